@@ -0,0 +1,105 @@
+#!/usr/bin/env python3
+"""二进制 IR 读入的健壮性测试
+
+把 bench/kernels 中的程序用 -koopa-bin 编译成二进制 IR, 随机改写其中 1-3 个字节或截断,
+再用 -riscv 编译改坏的文件: 编译器只能成功 (改动恰好无害) 或报错退出 (状态 1),
+被信号杀死、abort 或超时都算失败, 失败的输入保存到工作目录中以便重现
+指定 --server 时通过编译服务编译, 最后检查服务进程还活着
+
+用法: fuzz_binary_ir.py --compiler build/compiler [--cases 200] [--seed 0] [--server]
+"""
+
+import argparse
+import os
+import random
+import signal
+import subprocess
+import sys
+import time
+
+BENCH_DIR = os.path.dirname(os.path.abspath(__file__))
+
+
+def mutate(data, rng):
+    """返回改坏的副本: 多数改写 1-3 个字节, 少数截断"""
+    data = bytearray(data)
+    if rng.random() < 0.1:
+        return bytes(data[:rng.randrange(len(data))])
+    for _ in range(rng.randint(1, 3)):
+        # 跳过魔数, 否则只会得到 "not a binary IR file"
+        pos = rng.randrange(4, len(data))
+        data[pos] = rng.randrange(256) if rng.random() < 0.5 else data[pos] ^ (1 << rng.randrange(8))
+    return bytes(data)
+
+
+def main():
+    parser = argparse.ArgumentParser(description="二进制 IR 读入的健壮性测试")
+    parser.add_argument("--compiler", required=True)
+    parser.add_argument("--kernels", default=os.path.join(BENCH_DIR, "kernels"))
+    parser.add_argument("--work-dir", default="build/fuzz-bir")
+    parser.add_argument("--cases", type=int, default=200, help="每个程序生成的坏文件个数")
+    parser.add_argument("--seed", type=int, default=0)
+    parser.add_argument("--timeout", type=float, default=10)
+    parser.add_argument("--server", action="store_true", help="通过编译服务编译")
+    args = parser.parse_args()
+    args.compiler = os.path.abspath(args.compiler)
+    os.makedirs(args.work_dir, exist_ok=True)
+
+    env = dict(os.environ)
+    server = None
+    if args.server:
+        sock = os.path.join(os.path.abspath(args.work_dir), "server.sock")
+        if os.path.exists(sock):
+            os.unlink(sock)
+        server = subprocess.Popen([args.compiler, "--server", sock], stdout=subprocess.DEVNULL,
+                                  stderr=subprocess.DEVNULL)
+        for _ in range(100):
+            if os.path.exists(sock):
+                break
+            time.sleep(0.05)
+        env["SYSY_COMPILER_SERVER"] = sock
+
+    rng = random.Random(args.seed)
+    failures = total = rejected = 0
+    for name in sorted(f[:-3] for f in os.listdir(args.kernels) if f.endswith(".sy")):
+        good = os.path.join(args.work_dir, name + ".bir")
+        subprocess.check_call([args.compiler, "-koopa-bin", os.path.join(args.kernels, name + ".sy"), "-o", good],
+                              stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+        with open(good, "rb") as f:
+            data = f.read()
+        for case in range(args.cases):
+            bad = os.path.join(args.work_dir, "%s.%d.bir" % (name, case))
+            with open(bad, "wb") as f:
+                f.write(mutate(data, rng))
+            total += 1
+            try:
+                proc = subprocess.run([args.compiler, "-riscv", bad, "-o", bad + ".S"], env=env,
+                                      stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL, timeout=args.timeout)
+                status = proc.returncode
+            except subprocess.TimeoutExpired:
+                status = "timeout"
+            if status in (0, 1):
+                rejected += status == 1
+                os.unlink(bad)
+                if os.path.exists(bad + ".S"):
+                    os.unlink(bad + ".S")
+                continue
+            failures += 1
+            if isinstance(status, int) and status < 0:
+                status = signal.Signals(-status).name
+            print("FAIL %s: %s" % (bad, status))
+
+    if server:
+        if server.poll() is not None:
+            print("FAIL compile server exited with status %d" % server.returncode)
+            failures += 1
+        else:
+            server.terminate()
+            server.wait()
+    print("%d corrupt files: %d rejected, %d accepted, %d failures" % (total, rejected, total - rejected - failures,
+                                                                      failures))
+    sys.exit(1 if failures else 0)
+
+
+if __name__ == "__main__":
+    main()
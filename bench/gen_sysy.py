@@ -0,0 +1,184 @@
+#!/usr/bin/env python3
+"""生成用于测试编译器可扩展性的大规模 SysY 程序
+
+用法: gen_sysy.py 类型 规模 [-o 输出文件] [--seed 种子]
+
+类型:
+  lines   一个函数中有 规模 条语句
+  nest    if/while 交替嵌套 规模 层
+  expr    一个表达式中有 规模 个操作数
+  paren   括号和单目运算嵌套 规模 层的表达式
+  block   语句块嵌套 规模 层, 每层声明一个遮蔽外层的变量
+  cond    循环中一个 if 的条件由 规模 个比较用 || 和 && 连接, 每个比较短路求值时各成一个基本块
+  array   一个全局数组的初始化列表中有 规模 个元素
+  funcs   规模 个函数, 每个函数调用前一个函数
+
+生成的程序都能正常运行并输出一个结果, 变量的值来自 getint() 或函数参数,
+避免整个程序在编译期被常量折叠掉
+"""
+
+import argparse
+import random
+import sys
+
+
+def gen_lines(n, rng):
+    out = ["int main() {", "  int a = getint();", "  int b = a + 1;", "  int c = 0;"]
+    ops = ["+", "-", "*"]
+    names = ["a", "b", "c"]
+    for i in range(n):
+        dst = names[i % 3]
+        lhs, rhs = rng.choice(names), rng.choice(names)
+        op = rng.choice(ops)
+        # 取模防止数值无限增长
+        out.append("  %s = (%s %s %s + %d) %% 10007;" % (dst, lhs, op, rhs, rng.randint(0, 99)))
+    out += ["  putint(a + b + c);", "  putch(10);", "  return 0;", "}"]
+    return out
+
+
+def gen_nest(n, rng):
+    out = ["int main() {", "  int x = getint();", "  int s = 0;"]
+    indent = "  "
+    for i in range(n):
+        if i % 2 == 0:
+            out.append("%sif (x + %d > %d) {" % (indent, i, rng.randint(-5, 5)))
+        else:
+            out.append("%sint i%d = 0;" % (indent, i))
+            out.append("%swhile (i%d < 1) {" % (indent, i))
+            out.append("%s  i%d = i%d + 1;" % (indent, i, i))
+        indent += "  "
+    out.append("%ss = s + x;" % indent)
+    for i in reversed(range(n)):
+        indent = indent[:-2]
+        out.append("%s}" % indent)
+    out += ["  putint(s);", "  putch(10);", "  return 0;", "}"]
+    return out
+
+
+def gen_expr(n, rng):
+    out = ["int main() {", "  int a = getint();", "  int b = getint();", "  int r = 0"]
+    terms = []
+    for i in range(n):
+        term = rng.choice(["a", "b", str(rng.randint(1, 9)), "(a * %d)" % rng.randint(1, 9)])
+        terms.append(term)
+    ops = [rng.choice(["+", "-"]) for _ in range(n)]
+    line = ""
+    for op, term in zip(ops, terms):
+        line += " %s %s" % (op, term)
+        if len(line) > 100:
+            out.append("    " + line.strip())
+            line = ""
+    if line:
+        out.append("    " + line.strip())
+    out[-1] += ";"
+    out += ["  putint(r);", "  putch(10);", "  return 0;", "}"]
+    return out
+
+
+def gen_paren(n, rng):
+    # 不缩进, 否则文件大小是层数的平方
+    out = ["int main() {", "  int a = getint();", "  int r ="]
+    line = ""
+    for i in range(n):
+        line += rng.choice(["-(a + ", "(%d - " % rng.randint(1, 9), "!(a * ", "+(a % 7 - "])
+        if len(line) > 100:
+            out.append("    " + line)
+            line = ""
+    line += "a" + ")" * n
+    out += ["    " + line[k:k + 100] for k in range(0, len(line), 100)]
+    out[-1] += ";"
+    out += ["  putint(r);", "  putch(10);", "  return 0;", "}"]
+    return out
+
+
+def gen_block(n, rng):
+    out = ["int main() {", "  int x = getint();", "  int s = 0;"]
+    for i in range(n):
+        out.append("{ int x%d = x + %d; s = s + x%d %% 7;" % (i % 100, rng.randint(0, 9), i % 100))
+    out.append("s = s + x;")
+    out += ["}" * min(n - k, 100) for k in range(0, n, 100)]
+    out += ["  putint(s);", "  putch(10);", "  return 0;", "}"]
+    return out
+
+
+def gen_cond(n, rng):
+    out = ["int main() {", "  int a = getint();", "  int b = getint();", "  int s = 0;", "  int i = 0;",
+           "  while (i < 10) {", "    if ("]
+    line = ""
+    for i in range(n):
+        if i:
+            line += rng.choice([" || ", " && "])
+        line += "%s %s %d" % (rng.choice(["a", "b", "i"]), rng.choice(["<", ">", "==", "!="]), rng.randint(0, 9))
+        if len(line) > 100:
+            out.append("      " + line)
+            line = ""
+    if line:
+        out.append("      " + line)
+    out[-1] += ")"
+    out += ["      s = s + 1;", "    i = i + 1;", "  }", "  putint(s);", "  putch(10);", "  return 0;", "}"]
+    return out
+
+
+def gen_array(n, rng):
+    out = ["int data[%d] = {" % n]
+    row = []
+    for i in range(n):
+        row.append(str(rng.randint(0, 1000000)))
+        if len(row) == 16:
+            out.append("  " + ", ".join(row) + ",")
+            row = []
+    if row:
+        out.append("  " + ", ".join(row) + ",")
+    out[-1] = out[-1].rstrip(",")
+    out.append("};")
+    out += ["int main() {", "  int i = getint();", "  putint(data[i]);", "  putch(10);", "  return 0;", "}"]
+    return out
+
+
+def gen_funcs(n, rng):
+    out = ["int f0(int x) {", "  return x + 1;", "}"]
+    for i in range(1, n):
+        k = rng.randint(1, 9)
+        out += ["int f%d(int x) {" % i,
+                "  if (x > %d) return f%d(x - %d) %% 10007;" % (k, i - 1, k),
+                "  return f%d(x + %d) %% 10007;" % (i - 1, k),
+                "}"]
+    out += ["int main() {", "  putint(f%d(getint()));" % (n - 1), "  putch(10);", "  return 0;", "}"]
+    return out
+
+
+GENERATORS = {
+    "lines": gen_lines,
+    "nest": gen_nest,
+    "expr": gen_expr,
+    "paren": gen_paren,
+    "block": gen_block,
+    "cond": gen_cond,
+    "array": gen_array,
+    "funcs": gen_funcs,
+}
+
+
+def generate(kind, size, seed=0):
+    """返回生成的程序文本"""
+    lines = GENERATORS[kind](size, random.Random(seed))
+    return "\n".join(lines) + "\n"
+
+
+def main():
+    parser = argparse.ArgumentParser(description="生成大规模 SysY 程序")
+    parser.add_argument("kind", choices=sorted(GENERATORS))
+    parser.add_argument("size", type=int)
+    parser.add_argument("-o", "--output", help="输出文件, 默认为标准输出")
+    parser.add_argument("--seed", type=int, default=0)
+    args = parser.parse_args()
+    text = generate(args.kind, args.size, args.seed)
+    if args.output:
+        with open(args.output, "w") as f:
+            f.write(text)
+    else:
+        sys.stdout.write(text)
+
+
+if __name__ == "__main__":
+    main()
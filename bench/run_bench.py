@@ -0,0 +1,161 @@
+#!/usr/bin/env python3
+"""编译吞吐量基准测试
+
+用 gen_sysy.py 生成各个维度的大规模程序, 逐个用编译器编译,
+记录编译时间 (多次运行取最小值)、峰值内存 (RSS) 和输出大小,
+并与保存的基准结果比较, 任何一项比基准差超过阈值时以非零状态退出
+
+编译器运行时栈的大小限制为 --stack-kb (默认 1MB), 深层嵌套的用例因此也检查了编译器不随嵌套深度使用 C++ 栈;
+--check-linear 还以四分之一的规模运行每个用例, 按输入大小估计时间增长的指数, 超过 --linear-limit 时失败
+
+用法: run_bench.py --compiler build/compiler [--mode=-riscv] [--scale 1.0]
+                   [--baseline bench/baseline.json] [--update-baseline]
+                   [--stack-kb 1024] [--check-linear]
+"""
+
+import argparse
+import json
+import math
+import os
+import resource
+import sys
+import time
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+import gen_sysy
+
+# (名字, 生成器类型, scale 为 1 时的规模[, 编译模式])
+# expr/paren/block-100k 测试前端在病态输入上的线性时间和栈的使用, 固定只生成 IR:
+# 后端的寄存器分配对同时活跃的值很多的函数 (如 paren) 不是线性的, 不在这里测
+# cond-100k 固定生成汇编, 测试后端在有 10 万个基本块的函数上的线性时间 (支配树、循环层数和基本块排列)
+CASES = [
+    ("lines-100k", "lines", 100000),
+    ("nest-50", "nest", 50),
+    ("expr-5k", "expr", 5000),
+    ("array-1m", "array", 1000000),
+    ("funcs-5k", "funcs", 5000),
+    ("expr-100k", "expr", 100000, "-koopa"),
+    ("paren-100k", "paren", 100000, "-koopa"),
+    ("block-100k", "block", 100000, "-koopa"),
+    ("cond-100k", "cond", 100000, "-riscv"),
+]
+
+
+def run_once(compiler, mode, source, output, stack_kb=0):
+    """编译一次, 返回 (是否成功, 墙上时间, 峰值 RSS (KB)); stack_kb 不为 0 时限制栈的大小"""
+    start = time.perf_counter()
+    pid = os.fork()
+    if pid == 0:
+        devnull = os.open(os.devnull, os.O_WRONLY)
+        os.dup2(devnull, 1)
+        os.dup2(devnull, 2)
+        try:
+            if stack_kb:
+                resource.setrlimit(resource.RLIMIT_STACK, (stack_kb * 1024, stack_kb * 1024))
+            os.execv(compiler, [compiler, mode, source, "-o", output])
+        finally:
+            os._exit(127)
+    _, status, usage = os.wait4(pid, 0)
+    elapsed = time.perf_counter() - start
+    return os.WIFEXITED(status) and os.WEXITSTATUS(status) == 0, elapsed, usage.ru_maxrss
+
+
+def run_case(args, name, kind, size, mode):
+    source = os.path.join(args.work_dir, name + ".sy")
+    output = os.path.join(args.work_dir, name + ".out")
+    text = gen_sysy.generate(kind, size)
+    # 规模不变时不重新写文件, 省去重复生成的时间
+    if not os.path.exists(source) or open(source).read() != text:
+        with open(source, "w") as f:
+            f.write(text)
+    best, rss, ok = None, 0, True
+    for _ in range(args.repeat):
+        ok, elapsed, peak = run_once(args.compiler, mode, source, output, args.stack_kb)
+        if not ok:
+            break
+        best = elapsed if best is None else min(best, elapsed)
+        rss = max(rss, peak)
+    result = {"ok": ok, "input_bytes": len(text)}
+    if ok:
+        result.update({"time": best, "rss_kb": rss, "output_bytes": os.path.getsize(output)})
+    return result
+
+
+def compare(name, result, base, threshold):
+    """返回和基准相比变差的项"""
+    worse = []
+    if not base:
+        return worse
+    if base.get("ok") and not result["ok"]:
+        return ["now fails"]
+    if not result["ok"] or not base.get("ok"):
+        return worse
+    for key in ("time", "rss_kb", "output_bytes"):
+        if base[key] > 0 and result[key] > base[key] * (1 + threshold):
+            worse.append("%s %+.1f%%" % (key, (result[key] / base[key] - 1) * 100))
+    return worse
+
+
+def growth(args, name, kind, size, mode, result):
+    """以四分之一的规模再运行一次, 返回时间随输入大小增长的指数 (线性为 1); 时间太短无法估计时返回 None"""
+    small = run_case(args, name + "-quarter", kind, max(1, size // 4), mode)
+    if not result["ok"] or not small["ok"] or small["time"] < 0.01 or small["input_bytes"] >= result["input_bytes"]:
+        return None
+    return math.log(result["time"] / small["time"]) / math.log(result["input_bytes"] / small["input_bytes"])
+
+
+def main():
+    parser = argparse.ArgumentParser(description="编译吞吐量基准测试")
+    parser.add_argument("--compiler", required=True)
+    parser.add_argument("--mode", default="-riscv")
+    parser.add_argument("--scale", type=float, default=1.0, help="所有用例的规模乘以该系数")
+    parser.add_argument("--repeat", type=int, default=3, help="每个用例运行的次数, 时间取最小值")
+    parser.add_argument("--work-dir", default="build/bench")
+    parser.add_argument("--baseline", default=None, help="基准结果文件 (JSON)")
+    parser.add_argument("--update-baseline", action="store_true", help="把本次结果写为基准")
+    parser.add_argument("--threshold", type=float, default=0.10, help="允许比基准差的比例")
+    parser.add_argument("--only", default=None, help="只运行名字中含有该字符串的用例")
+    parser.add_argument("--stack-kb", type=int, default=1024, help="编译器的栈大小上限 (KB), 0 表示不限制")
+    parser.add_argument("--check-linear", action="store_true", help="检查编译时间随输入大小线性增长")
+    parser.add_argument("--linear-limit", type=float, default=1.3, help="--check-linear 允许的增长指数")
+    args = parser.parse_args()
+    args.compiler = os.path.abspath(args.compiler)
+    os.makedirs(args.work_dir, exist_ok=True)
+
+    baseline = {}
+    if args.baseline and os.path.exists(args.baseline) and not args.update_baseline:
+        with open(args.baseline) as f:
+            baseline = json.load(f)
+
+    results, regressed = {}, False
+    print("%-12s %10s %10s %12s %12s  %s" % ("case", "time(s)", "rss(MB)", "input", "output", "vs baseline"))
+    for name, kind, size, *case_mode in CASES:
+        if args.only and args.only not in name:
+            continue
+        size = max(1, int(size * args.scale))
+        mode = case_mode[0] if case_mode else args.mode
+        result = run_case(args, name, kind, size, mode)
+        results[name] = dict(result, kind=kind, size=size, mode=mode)
+        worse = compare(name, result, baseline.get(name), args.threshold)
+        if args.check_linear:
+            exponent = growth(args, name, kind, size, mode, result)
+            if exponent is not None and exponent > args.linear_limit:
+                worse.append("time grows as input^%.2f" % exponent)
+        regressed |= bool(worse)
+        note = ", ".join(worse) if worse else ("ok" if name in baseline else "-")
+        if result["ok"]:
+            print("%-12s %10.3f %10.1f %12d %12d  %s" % (name, result["time"], result["rss_kb"] / 1024,
+                                                         result["input_bytes"], result["output_bytes"], note))
+        else:
+            print("%-12s %10s %10s %12d %12s  %s" % (name, "FAILED", "-", result["input_bytes"], "-", note))
+
+    if args.update_baseline and args.baseline:
+        with open(args.baseline, "w") as f:
+            json.dump(results, f, indent=2, sort_keys=True)
+            f.write("\n")
+        print("baseline written to %s" % args.baseline)
+    sys.exit(1 if regressed else 0)
+
+
+if __name__ == "__main__":
+    main()
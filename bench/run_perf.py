@@ -0,0 +1,203 @@
+#!/usr/bin/env python3
+"""生成代码性能基准测试
+
+用编译器把 bench/kernels 中的 SysY 程序编译成 RISC-V 汇编, 在 rv32emu.py 中运行,
+检查输出是否与 .out 文件一致, 并统计执行的指令数、估计的周期数和指令组成
+结果是每个程序一行的文本表格, 可以保存下来与其他版本的编译器比较 (--compare 或直接 diff)
+
+用法: run_perf.py --compiler build/compiler [--mode -riscv] [-o results.txt] [--compare old.txt]
+      run_perf.py --update-expected   用宿主机的 C++ 编译器和 sylib.c 重新生成期望输出
+
+程序 NAME.sy 的标准输入是 NAME.in (没有时为空), 期望输出是 NAME.out,
+格式与 SysY 测试用例相同: 程序的输出, 最后一行是 main 的返回值
+"""
+
+import argparse
+import multiprocessing
+import os
+import subprocess
+import sys
+
+BENCH_DIR = os.path.dirname(os.path.abspath(__file__))
+sys.path.insert(0, BENCH_DIR)
+import rv32emu
+
+# timed 是 starttime 和 stoptime 之间执行的指令数, cycles 是 rv32emu 估计的周期数, code 是汇编中的指令条数
+COLUMNS = ["insts", "cycles", "timed", "loads", "stores", "branches", "branches_taken", "jumps", "calls", "muldiv", "code"]
+
+
+def kernel_names(args):
+    names = sorted(f[:-3] for f in os.listdir(args.kernels) if f.endswith(".sy"))
+    if args.only:
+        names = [n for n in names if args.only in n]
+    return names
+
+
+def read_optional(path):
+    if not os.path.exists(path):
+        return None
+    with open(path) as f:
+        return f.read()
+
+
+def run_kernel(job):
+    """编译并运行一个程序, 返回 (名字, 状态, 统计数据)"""
+    args, name = job
+    source = os.path.join(args.kernels, name + ".sy")
+    asm = os.path.join(args.work_dir, name + ".S")
+    stdin_data = read_optional(os.path.join(args.kernels, name + ".in")) or ""
+    expected = read_optional(os.path.join(args.kernels, name + ".out"))
+    proc = subprocess.run([args.compiler, args.mode, source, "-o", asm] + args.compiler_flag,
+                          stdout=subprocess.DEVNULL, stderr=subprocess.PIPE, universal_newlines=True)
+    if proc.returncode != 0:
+        return name, "compile-error", {"error": proc.stderr.strip().split("\n")[-1] if proc.stderr else ""}
+    with open(asm) as f:
+        text = f.read()
+    try:
+        program = rv32emu.Program(text)
+        result = rv32emu.run(program, stdin_data, args.max_insts)
+    except rv32emu.EmulatorError as e:
+        return name, "runtime-error", {"error": str(e)}
+    stats = dict(result.stats, insts=result.insts, cycles=result.cycles, timed=sum(result.timers), code=len(program.code))
+    actual = rv32emu.expected_text(result.output, result.exit_code)
+    if expected is None:
+        return name, "no-expected", stats
+    if actual != expected:
+        with open(os.path.join(args.work_dir, name + ".actual"), "w") as f:
+            f.write(actual)
+        return name, "wrong-output", stats
+    return name, "ok", stats
+
+
+def format_table(rows):
+    lines = ["%-14s %-14s" % ("kernel", "status") + "".join(" %12s" % c for c in COLUMNS)]
+    for name, status, stats in rows:
+        line = "%-14s %-14s" % (name, status)
+        line += "".join(" %12s" % stats.get(c, "-") for c in COLUMNS)
+        lines.append(line)
+    return "\n".join(lines) + "\n"
+
+
+def parse_table(text):
+    """读取 format_table 输出的表格, 返回 {名字: (状态, {列: 值})}"""
+    rows = {}
+    lines = text.strip().split("\n")
+    header = lines[0].split()
+    for line in lines[1:]:
+        fields = line.split()
+        stats = {}
+        for col, value in zip(header[2:], fields[2:]):
+            if value != "-":
+                stats[col] = int(value)
+        rows[fields[0]] = (fields[1], stats)
+    return rows
+
+
+def print_comparison(rows, old):
+    """逐个程序比较指令数, 返回是否有程序变差 (指令数增加或原来通过现在失败)
+    两边都有估计的周期数时也列出它的变化, 只作参考"""
+    worse = False
+    print("%-14s %14s %14s %9s %9s" % ("kernel", "old insts", "new insts", "change", "cycles"))
+    total_old = total_new = 0
+    cycles_old = cycles_new = 0
+    for name, status, stats in rows:
+        if name not in old:
+            print("%-14s %14s %14s %9s" % (name, "-", stats.get("insts", "-"), "new"))
+            continue
+        old_status, old_stats = old[name]
+        if status != "ok" or old_status != "ok":
+            note = "%s -> %s" % (old_status, status)
+            worse |= old_status == "ok" and status != "ok"
+            print("%-14s %14s %14s  %s" % (name, old_stats.get("insts", "-"), stats.get("insts", "-"), note))
+            continue
+        a, b = old_stats["insts"], stats["insts"]
+        total_old += a
+        total_new += b
+        worse |= b > a
+        cycles = "-"
+        if old_stats.get("cycles") and "cycles" in stats:
+            cycles_old += old_stats["cycles"]
+            cycles_new += stats["cycles"]
+            cycles = "%+8.2f%%" % ((stats["cycles"] / old_stats["cycles"] - 1) * 100)
+        print("%-14s %14d %14d %+8.2f%% %9s" % (name, a, b, (b / a - 1) * 100 if a else 0, cycles))
+    if total_old:
+        cycles = "%+8.2f%%" % ((cycles_new / cycles_old - 1) * 100) if cycles_old else "-"
+        print("%-14s %14d %14d %+8.2f%% %9s" % ("TOTAL", total_old, total_new, (total_new / total_old - 1) * 100,
+                                                cycles))
+    return worse
+
+
+def update_expected(args):
+    """用宿主机的 C++ 编译器编译每个程序并运行, 把结果写为期望输出"""
+    exe = os.path.join(args.work_dir, "host.exe")
+    for name in kernel_names(args):
+        source = os.path.join(args.kernels, name + ".sy")
+        # SysY 的整数运算溢出时回绕, 对应 -fwrapv
+        subprocess.check_call([args.host_cxx, "-O1", "-w", "-fwrapv", "-x", "c++", "-include",
+                               os.path.join(BENCH_DIR, "sylib.h"), source, "-x", "c",
+                               os.path.join(BENCH_DIR, "sylib.c"), "-o", exe])
+        stdin_path = os.path.join(args.kernels, name + ".in")
+        with open(stdin_path if os.path.exists(stdin_path) else os.devnull) as stdin:
+            proc = subprocess.run([exe], stdin=stdin, stdout=subprocess.PIPE, stderr=subprocess.DEVNULL,
+                                  universal_newlines=True)
+        with open(os.path.join(args.kernels, name + ".out"), "w") as f:
+            f.write(rv32emu.expected_text(proc.stdout, proc.returncode & 0xff))
+        print("%s: exit code %d" % (name, proc.returncode & 0xff))
+
+
+def main():
+    parser = argparse.ArgumentParser(description="生成代码性能基准测试")
+    parser.add_argument("--compiler", help="被测的编译器")
+    parser.add_argument("--mode", default="-riscv", help="-riscv 或 -perf")
+    parser.add_argument("--compiler-flag", action="append", default=[], help="传给编译器的额外参数")
+    parser.add_argument("--kernels", default=os.path.join(BENCH_DIR, "kernels"))
+    parser.add_argument("--work-dir", default="build/perf")
+    parser.add_argument("-o", "--output", help="把结果表格写到该文件")
+    parser.add_argument("--compare", help="与之前保存的结果表格比较指令数")
+    parser.add_argument("--only", default=None, help="只运行名字中含有该字符串的程序")
+    parser.add_argument("-j", "--jobs", type=int, default=os.cpu_count() or 1)
+    parser.add_argument("--max-insts", type=int, default=500000000, help="每个程序最多执行的指令数")
+    parser.add_argument("--update-expected", action="store_true", help="重新生成期望输出")
+    parser.add_argument("--host-cxx", default=os.environ.get("CXX", "c++"))
+    args = parser.parse_args()
+    os.makedirs(args.work_dir, exist_ok=True)
+
+    if args.update_expected:
+        update_expected(args)
+        return
+    if not args.compiler:
+        parser.error("--compiler is required")
+    args.compiler = os.path.abspath(args.compiler)
+
+    # 先读入旧的结果, 它可能与 --output 是同一个文件
+    old = None
+    if args.compare:
+        with open(args.compare) as f:
+            old = parse_table(f.read())
+
+    jobs = [(args, name) for name in kernel_names(args)]
+    if args.jobs > 1:
+        with multiprocessing.Pool(args.jobs) as pool:
+            rows = pool.map(run_kernel, jobs)
+    else:
+        rows = [run_kernel(job) for job in jobs]
+
+    table = format_table(rows)
+    sys.stdout.write(table)
+    for name, status, stats in rows:
+        if "error" in stats:
+            print("%s: %s" % (name, stats["error"]))
+    if args.output:
+        with open(args.output, "w") as f:
+            f.write(table)
+
+    worse = False
+    if old is not None:
+        print()
+        worse = print_comparison(rows, old)
+    failed = any(status != "ok" for _, status, _ in rows)
+    sys.exit(1 if failed or worse else 0)
+
+
+if __name__ == "__main__":
+    main()
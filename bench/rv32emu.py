@@ -0,0 +1,629 @@
+#!/usr/bin/env python3
+"""RV32IM 汇编解释器, 用于测量编译器生成代码的性能
+
+直接解释编译器输出的汇编文本, 不需要交叉工具链和 qemu
+运行时库 (sylib) 中的函数由解释器实现, 行为与 sylib.c 一致
+统计实际执行 (retired) 的指令数, 伪指令按展开后的真实指令条数计算,
+如超出 12 位立即数范围的 li 计为 lui + addi 两条
+
+另外按单发射顺序执行的流水线估计周期数: 每条指令要等它读的寄存器的结果可用,
+lw 和乘法的结果过 3 个周期、除法和取余过 20 个周期才能使用 (与编译器的 -mtune=generic 相同),
+只看同一段直线代码中前面的指令, 不计跳转的开销; 用来衡量指令调度 (-fschedule-insns) 的效果
+
+同时检查调用约定: 函数返回时 sp 和 s0-s11 必须恢复为调用前的值,
+调用运行时库函数后 t0-t6, a1-a7 会被写成无效值, 依赖这些寄存器的代码会算出错误结果
+
+用法: rv32emu.py 汇编文件 [-i 输入文件] [--profile] [--max-insts N]
+程序的输出写到标准输出, 返回值作为退出码, 统计信息写到标准错误
+"""
+
+import argparse
+import ast
+import os
+import re
+import sys
+
+MEM_SIZE = 64 << 20
+DATA_BASE = 0x10000
+STACK_TOP = MEM_SIZE - 16
+# 代码不放在内存中, 返回地址用 TEXT_BASE + 4 * 指令序号表示
+TEXT_BASE = 0x40000000
+EXIT_ADDR = 0x7ffffff0
+
+REGS = {"zero": 0, "ra": 1, "sp": 2, "gp": 3, "tp": 4, "t0": 5, "t1": 6, "t2": 7, "s0": 8, "fp": 8, "s1": 9}
+for _i in range(32):
+    REGS["x%d" % _i] = _i
+for _i in range(8):
+    REGS["a%d" % _i] = 10 + _i
+for _i in range(2, 12):
+    REGS["s%d" % _i] = 16 + _i
+for _i in range(3, 7):
+    REGS["t%d" % _i] = 25 + _i
+CALLEE_SAVED = [8, 9] + list(range(18, 28))
+CALLER_SAVED = [5, 6, 7, 11, 12, 13, 14, 15, 16, 17, 28, 29, 30, 31]
+POISON = 0x5eedbad
+
+# 解码后的操作, 执行时按出现频率排列判断顺序
+(LW, SW, ADDI, ADD, SUB, MUL, DIV, REM, BEQ, BNE, BLT, BGE, BLTU, BGEU, JAL, JALR,
+ SLT, SLTU, SLTI, SLTIU, AND, OR, XOR, ANDI, ORI, XORI, SLL, SRL, SRA, SLLI, SRLI, SRAI,
+ MULH, MULHU, MULHSU, DIVU, REMU, LUI, LB, LBU, LH, LHU, SB, SH, RUNTIME) = range(45)
+
+R_TYPE = {"add": ADD, "sub": SUB, "mul": MUL, "div": DIV, "rem": REM, "slt": SLT, "sltu": SLTU,
+          "and": AND, "or": OR, "xor": XOR, "sll": SLL, "srl": SRL, "sra": SRA, "mulh": MULH,
+          "mulhu": MULHU, "mulhsu": MULHSU, "divu": DIVU, "remu": REMU}
+I_TYPE = {"addi": ADDI, "slti": SLTI, "sltiu": SLTIU, "andi": ANDI, "ori": ORI, "xori": XORI,
+          "slli": SLLI, "srli": SRLI, "srai": SRAI}
+LOADS = {"lw": LW, "lb": LB, "lbu": LBU, "lh": LH, "lhu": LHU}
+STORES = {"sw": SW, "sb": SB, "sh": SH}
+BRANCHES = {"beq": BEQ, "bne": BNE, "blt": BLT, "bge": BGE, "bltu": BLTU, "bgeu": BGEU}
+# 交换操作数后等价的分支
+SWAPPED_BRANCHES = {"bgt": BLT, "ble": BGE, "bgtu": BLTU, "bleu": BGEU}
+# 与 0 比较的分支: (操作, 寄存器是否作为第二个操作数)
+ZERO_BRANCHES = {"beqz": (BEQ, False), "bnez": (BNE, False), "bltz": (BLT, False), "bgez": (BGE, False),
+                 "blez": (BGE, True), "bgtz": (BLT, True)}
+
+# 估计周期数时各操作的结果过几个周期可用, 其余为 1
+LATENCY = {LW: 3, LB: 3, LBU: 3, LH: 3, LHU: 3, MUL: 3, MULH: 3, MULHU: 3, MULHSU: 3,
+           DIV: 20, DIVU: 20, REM: 20, REMU: 20}
+
+RUNTIME_FUNCS = ["getint", "getch", "getarray", "putint", "putch", "putarray",
+                 "starttime", "stoptime", "_sysy_starttime", "_sysy_stoptime", "__sysy_profile_dump"]
+
+# 指令分类, 用于统计指令组成
+CLASS_OF = {LW: "loads", LB: "loads", LBU: "loads", LH: "loads", LHU: "loads",
+            SW: "stores", SB: "stores", SH: "stores",
+            MUL: "muldiv", MULH: "muldiv", MULHU: "muldiv", MULHSU: "muldiv",
+            DIV: "muldiv", DIVU: "muldiv", REM: "muldiv", REMU: "muldiv",
+            BEQ: "branches", BNE: "branches", BLT: "branches", BGE: "branches", BLTU: "branches",
+            BGEU: "branches", JAL: "jumps", JALR: "jumps", RUNTIME: "calls"}
+
+
+class EmulatorError(Exception):
+    pass
+
+
+def s32(v):
+    return ((v + 0x80000000) & 0xffffffff) - 0x80000000
+
+
+class Program:
+    """解析后的汇编程序"""
+
+    def __init__(self, text):
+        self.code = []      # (op, rd, rs1, rs2, imm)
+        self.weight = []    # 每条 (伪) 指令对应的真实指令条数
+        self.lines = []     # 源汇编, 用于报错
+        self.labels = {}    # 代码标号 -> 指令序号
+        self.symbols = {}   # 数据标号 -> 地址
+        self.data = bytearray()
+        self.funcs = []     # (起始指令序号, 函数名), 用于按函数统计
+        fixups = []         # 数据中引用标号的 .word, 所有标号都确定后再填
+        pending = []        # 引用标号的指令, 同上
+        section = "text"
+        for raw in text.split("\n"):
+            line = raw.split("#", 1)[0].strip()
+            while line:
+                m = re.match(r"([A-Za-z_.$][\w.$]*):\s*(.*)$", line)
+                if not m:
+                    break
+                if section == "text":
+                    self.labels[m.group(1)] = len(self.code)
+                    if not m.group(1).startswith("."):
+                        self.funcs.append((len(self.code), m.group(1)))
+                else:
+                    self.symbols[m.group(1)] = DATA_BASE + len(self.data)
+                line = m.group(2).strip()
+            if not line:
+                continue
+            if line.startswith("."):
+                section = self._directive(line, section, fixups)
+                continue
+            if section != "text":
+                raise EmulatorError("instruction outside .text: " + line)
+            pending.append((len(self.code), line))
+            self.code.append(None)
+            self.weight.append(1)
+            self.lines.append(line)
+        for index, line in pending:
+            self.code[index], self.weight[index] = self._decode(line)
+        self.stalls = self._stalls()
+        for offset, name in fixups:
+            self.data[offset:offset + 4] = (self._symbol(name) & 0xffffffff).to_bytes(4, "little")
+        if DATA_BASE + len(self.data) > STACK_TOP - (1 << 20):
+            raise EmulatorError("data section too large")
+
+    def _stalls(self):
+        """每条指令在顺序执行的流水线上等待操作数的周期数
+        在解析时按直线代码 (标号和跳转之间) 算好, 运行时乘以执行次数累加, 不减慢解释"""
+        starts = set(self.labels.values())
+        stalls = [0] * len(self.code)
+        ready = {}  # 寄存器 -> 结果可用的周期
+        cycle = 0
+        for index, (op, rd, rs1, rs2, _) in enumerate(self.code):
+            if index in starts:
+                ready, cycle = {}, 0
+            start = max(cycle, ready.get(rs1, 0), ready.get(rs2, 0))
+            stalls[index] = start - cycle
+            cycle = start + self.weight[index]
+            if rd:
+                ready[rd] = cycle - 1 + LATENCY.get(op, 1)
+            if BEQ <= op <= JALR or op == RUNTIME:
+                ready, cycle = {}, 0
+        return stalls
+
+    def _align(self, n):
+        while len(self.data) % n:
+            self.data.append(0)
+
+    def _directive(self, line, section, fixups):
+        parts = line.split(None, 1)
+        name, arg = parts[0], parts[1] if len(parts) > 1 else ""
+        if name == ".text":
+            return "text"
+        if name in (".data", ".bss", ".rodata", ".sdata", ".sbss"):
+            return "data"
+        if name == ".section":
+            return "text" if arg.split(",")[0].strip().startswith(".text") else "data"
+        if section == "text":
+            return section
+        if name == ".word":
+            for item in arg.split(","):
+                item = item.strip()
+                try:
+                    value = int(item, 0)
+                except ValueError:
+                    fixups.append((len(self.data), item))
+                    value = 0
+                self.data += (value & 0xffffffff).to_bytes(4, "little")
+        elif name in (".half", ".short"):
+            for item in arg.split(","):
+                self.data += (int(item, 0) & 0xffff).to_bytes(2, "little")
+        elif name == ".byte":
+            for item in arg.split(","):
+                self.data.append(int(item, 0) & 0xff)
+        elif name in (".asciz", ".string"):
+            self.data += ast.literal_eval(arg.strip()).encode() + b"\0"
+        elif name in (".zero", ".space"):
+            self.data += bytes(int(arg.split(",")[0], 0))
+        elif name in (".align", ".p2align"):
+            self._align(1 << int(arg.split(",")[0], 0))
+        elif name == ".balign":
+            self._align(int(arg.split(",")[0], 0))
+        return section
+
+    def _symbol(self, name):
+        if name in self.symbols:
+            return self.symbols[name]
+        raise EmulatorError("undefined symbol " + name)
+
+    def _target(self, name):
+        if name in self.labels:
+            return self.labels[name]
+        raise EmulatorError("undefined label " + name)
+
+    def _imm(self, s):
+        m = re.match(r"%(hi|lo)\(([\w.$]+)([+-]\d+)?\)$", s)
+        if m:
+            addr = self._symbol(m.group(2)) + int(m.group(3) or 0)
+            hi = (addr + 0x800) >> 12
+            return hi if m.group(1) == "hi" else addr - (hi << 12)
+        return int(s, 0)
+
+    def _mem(self, s):
+        m = re.match(r"(.*)\((\w+)\)$", s)
+        if not m:
+            raise EmulatorError("bad memory operand " + s)
+        return self._imm(m.group(1)) if m.group(1) else 0, REGS[m.group(2)]
+
+    def _decode(self, line):
+        parts = line.split(None, 1)
+        op = parts[0]
+        a = [x.strip() for x in parts[1].split(",")] if len(parts) > 1 else []
+        r = lambda i: REGS[a[i]]
+        if op in I_TYPE:
+            return (I_TYPE[op], r(0), r(1), 0, self._imm(a[2])), 1
+        if op in R_TYPE:
+            return (R_TYPE[op], r(0), r(1), r(2), 0), 1
+        if op in LOADS:
+            off, base = self._mem(a[1])
+            return (LOADS[op], r(0), base, 0, off), 1
+        if op in STORES:
+            off, base = self._mem(a[1])
+            return (STORES[op], 0, base, r(0), off), 1
+        if op in BRANCHES:
+            return (BRANCHES[op], 0, r(0), r(1), self._target(a[2])), 1
+        if op in SWAPPED_BRANCHES:
+            return (SWAPPED_BRANCHES[op], 0, r(1), r(0), self._target(a[2])), 1
+        if op in ZERO_BRANCHES:
+            kind, swap = ZERO_BRANCHES[op]
+            return (kind, 0, 0 if swap else r(0), r(0) if swap else 0, self._target(a[1])), 1
+        if op == "li":
+            value = s32(self._imm(a[1]))
+            return (ADDI, r(0), 0, 0, value), 1 if -2048 <= value < 2048 else 2
+        if op == "la":
+            return (ADDI, r(0), 0, 0, self._symbol(a[1])), 2
+        if op == "lui":
+            return (LUI, r(0), 0, 0, self._imm(a[1])), 1
+        if op == "mv":
+            return (ADDI, r(0), r(1), 0, 0), 1
+        if op == "nop":
+            return (ADDI, 0, 0, 0, 0), 1
+        if op == "neg":
+            return (SUB, r(0), 0, r(1), 0), 1
+        if op == "not":
+            return (XORI, r(0), r(1), 0, -1), 1
+        if op == "seqz":
+            return (SLTIU, r(0), r(1), 0, 1), 1
+        if op == "snez":
+            return (SLTU, r(0), 0, r(1), 0), 1
+        if op == "sltz":
+            return (SLT, r(0), r(1), 0, 0), 1
+        if op == "sgtz":
+            return (SLT, r(0), 0, r(1), 0), 1
+        if op == "sgt":
+            return (SLT, r(0), r(2), r(1), 0), 1
+        if op == "sgtu":
+            return (SLTU, r(0), r(2), r(1), 0), 1
+        if op == "j":
+            return (JAL, 0, 0, 0, self._target(a[0])), 1
+        if op == "jal":
+            if len(a) == 1:
+                return (JAL, 1, 0, 0, self._target(a[0])), 1
+            return (JAL, r(0), 0, 0, self._target(a[1])), 1
+        if op == "jr":
+            return (JALR, 0, r(0), 0, 0), 1
+        if op == "ret":
+            return (JALR, 0, 1, 0, 0), 1
+        if op == "jalr":
+            if len(a) == 1:
+                return (JALR, 1, r(0), 0, 0), 1
+            if len(a) == 2:
+                off, base = self._mem(a[1])
+                return (JALR, r(0), base, 0, off), 1
+            return (JALR, r(0), r(1), 0, self._imm(a[2])), 1
+        if op in ("call", "tail"):
+            link = 1 if op == "call" else 0
+            if a[0] in self.labels:
+                return (JAL, link, 0, 0, self.labels[a[0]]), 1
+            if a[0] in RUNTIME_FUNCS:
+                return (RUNTIME, link, 0, 0, RUNTIME_FUNCS.index(a[0])), 1
+            raise EmulatorError("call to undefined function " + a[0])
+        raise EmulatorError("unsupported instruction: " + line)
+
+    def function_of(self, index):
+        name = "?"
+        for start, func in self.funcs:
+            if start > index:
+                break
+            name = func
+        return name
+
+
+class Result:
+    def __init__(self):
+        self.output = ""
+        self.exit_code = 0
+        self.insts = 0
+        self.cycles = 0     # 指令数加上等待操作数的周期数
+        self.stats = {}
+        self.functions = {}
+        self.timers = []
+
+
+def run(program, stdin_data="", max_insts=2000000000, profile=False):
+    """运行 program, 返回 Result, 出错时抛出 EmulatorError"""
+    mem = bytearray(MEM_SIZE)
+    mem[DATA_BASE:DATA_BASE + len(program.data)] = program.data
+    words = memoryview(mem).cast("i")
+    R = [0] * 32
+    R[1] = EXIT_ADDR
+    R[2] = STACK_TOP
+    code = program.code
+    hits = [0] * len(code)
+    out = []
+    input_pos = [0]
+    # 影子栈: 每次调用时记下返回地址、sp 和 callee-saved 寄存器, 返回时检查
+    shadow = []
+    taken = 0
+    budget = max_insts
+    timers = []     # 未结束的 starttime 开始时已执行的指令数
+    timed = []      # 每对 starttime/stoptime 之间执行的指令数
+
+    def fail(pc, msg):
+        line = program.lines[pc] if 0 <= pc < len(code) else "?"
+        raise EmulatorError("%s (at '%s' in %s)" % (msg, line, program.function_of(pc)))
+
+    def getint():
+        # 与 scanf("%d") 相同: 跳过空白后读入一个十进制整数, 读不到时返回 -1
+        m = re.compile(r"\s*([-+]?\d+)").match(stdin_data, input_pos[0])
+        if not m:
+            return -1
+        input_pos[0] = m.end()
+        return s32(int(m.group(1)))
+
+    def runtime(pc, func):
+        name = RUNTIME_FUNCS[func]
+        if name == "getint":
+            R[10] = getint()
+        elif name == "getch":
+            pos = input_pos[0]
+            R[10] = ord(stdin_data[pos]) if pos < len(stdin_data) else -1
+            input_pos[0] = pos + 1
+        elif name == "getarray":
+            n, base = getint(), R[10]
+            for k in range(n):
+                store_word(pc, base + 4 * k, getint())
+            R[10] = n
+        elif name == "putint":
+            out.append(str(R[10]))
+        elif name == "putch":
+            out.append(chr(R[10] & 0xff))
+        elif name == "putarray":
+            n, base = R[10], R[11]
+            out.append("%d:" % n + "".join(" %d" % load_word(pc, base + 4 * k) for k in range(n)) + "\n")
+        elif name == "__sysy_profile_dump":
+            profile_dump(pc, R[10])
+        elif name.endswith("starttime"):
+            timers.append(sum(hits))
+        else:
+            if timers:
+                timed.append(sum(hits) - timers.pop())
+        for reg in CALLER_SAVED:
+            R[reg] = POISON
+
+    def profile_dump(pc, table):
+        # 与 sylib.c 中的 __sysy_profile_dump 相同, 每个计数器追加一行 "函数名 计数点 次数"
+        lines = []
+        for k in range(load_word(pc, table)):
+            counter = load_word(pc, table + 4 + 8 * k)
+            name = load_word(pc, table + 8 + 8 * k)
+            end = mem.index(b"\0", name)
+            lines.append("%s %d\n" % (mem[name:end].decode(), load_word(pc, counter) & 0xffffffff))
+        with open(os.environ.get("SYSY_PROFILE_FILE", "default.sysyprof"), "a") as f:
+            f.write("".join(lines))
+
+    def check_addr(pc, addr, size):
+        if addr < 0 or addr + size > MEM_SIZE or addr % size:
+            fail(pc, "bad memory access at 0x%x" % (addr & 0xffffffff))
+
+    def load_word(pc, addr):
+        check_addr(pc, addr, 4)
+        return words[addr >> 2]
+
+    def store_word(pc, addr, value):
+        check_addr(pc, addr, 4)
+        words[addr >> 2] = value
+
+    pc = program.labels.get("main")
+    if pc is None:
+        raise EmulatorError("no main function")
+    shadow.append((EXIT_ADDR, STACK_TOP, [R[r] for r in CALLEE_SAVED]))
+    while True:
+        op, rd, rs1, rs2, imm = code[pc]
+        hits[pc] += 1
+        next_pc = pc + 1
+        if op == LW:
+            addr = R[rs1] + imm
+            if addr & 3 or addr < 0 or addr >= MEM_SIZE:
+                fail(pc, "bad memory access at 0x%x" % (addr & 0xffffffff))
+            v = words[addr >> 2]
+        elif op == SW:
+            addr = R[rs1] + imm
+            if addr & 3 or addr < 0 or addr >= MEM_SIZE:
+                fail(pc, "bad memory access at 0x%x" % (addr & 0xffffffff))
+            words[addr >> 2] = R[rs2]
+            pc = next_pc
+            continue
+        elif op == ADDI:
+            v = s32(R[rs1] + imm)
+        elif op == ADD:
+            v = s32(R[rs1] + R[rs2])
+        elif op <= BGEU and op >= BEQ:
+            a, b = R[rs1], R[rs2]
+            if op == BEQ:
+                cond = a == b
+            elif op == BNE:
+                cond = a != b
+            elif op == BLT:
+                cond = a < b
+            elif op == BGE:
+                cond = a >= b
+            elif op == BLTU:
+                cond = (a & 0xffffffff) < (b & 0xffffffff)
+            else:
+                cond = (a & 0xffffffff) >= (b & 0xffffffff)
+            if cond:
+                taken += 1
+                budget -= 1
+                if budget < 0:
+                    fail(pc, "instruction limit exceeded")
+                pc = imm
+            else:
+                pc = next_pc
+            continue
+        elif op == JAL:
+            if rd:
+                R[rd] = TEXT_BASE + 4 * next_pc
+                shadow.append((R[rd], R[2], [R[r] for r in CALLEE_SAVED]))
+            budget -= 1
+            if budget < 0:
+                fail(pc, "instruction limit exceeded")
+            pc = imm
+            continue
+        elif op == JALR:
+            target = R[rs1] + imm
+            if rd:
+                R[rd] = TEXT_BASE + 4 * next_pc
+                shadow.append((R[rd], R[2], [R[r] for r in CALLEE_SAVED]))
+            elif rs1 == 1 and imm == 0:
+                # ret: 检查调用约定
+                if not shadow or shadow[-1][0] != target:
+                    fail(pc, "return to unexpected address 0x%x" % (target & 0xffffffff))
+                _, sp, saved = shadow.pop()
+                if sp != R[2]:
+                    fail(pc, "sp not restored on return")
+                if saved != [R[r] for r in CALLEE_SAVED]:
+                    fail(pc, "callee-saved register clobbered")
+            if target == EXIT_ADDR:
+                break
+            index = (target - TEXT_BASE) >> 2
+            if target & 3 or not 0 <= index < len(code):
+                fail(pc, "jump to bad address 0x%x" % (target & 0xffffffff))
+            pc = index
+            continue
+        elif op == SUB:
+            v = s32(R[rs1] - R[rs2])
+        elif op == MUL:
+            v = s32(R[rs1] * R[rs2])
+        elif op == DIV or op == REM:
+            a, b = R[rs1], R[rs2]
+            if b == 0:
+                q, r = -1, a
+            elif a == -0x80000000 and b == -1:
+                q, r = a, 0
+            else:
+                q = abs(a) // abs(b)
+                if (a < 0) != (b < 0):
+                    q = -q
+                r = a - q * b
+            v = q if op == DIV else r
+        elif op == SLT:
+            v = int(R[rs1] < R[rs2])
+        elif op == SLTU:
+            v = int((R[rs1] & 0xffffffff) < (R[rs2] & 0xffffffff))
+        elif op == SLTI:
+            v = int(R[rs1] < imm)
+        elif op == SLTIU:
+            v = int((R[rs1] & 0xffffffff) < (imm & 0xffffffff))
+        elif op == AND:
+            v = R[rs1] & R[rs2]
+        elif op == OR:
+            v = R[rs1] | R[rs2]
+        elif op == XOR:
+            v = R[rs1] ^ R[rs2]
+        elif op == ANDI:
+            v = R[rs1] & imm
+        elif op == ORI:
+            v = R[rs1] | imm
+        elif op == XORI:
+            v = R[rs1] ^ imm
+        elif op == SLL:
+            v = s32(R[rs1] << (R[rs2] & 31))
+        elif op == SRL:
+            v = s32((R[rs1] & 0xffffffff) >> (R[rs2] & 31))
+        elif op == SRA:
+            v = R[rs1] >> (R[rs2] & 31)
+        elif op == SLLI:
+            v = s32(R[rs1] << (imm & 31))
+        elif op == SRLI:
+            v = s32((R[rs1] & 0xffffffff) >> (imm & 31))
+        elif op == SRAI:
+            v = R[rs1] >> (imm & 31)
+        elif op == LUI:
+            v = s32(imm << 12)
+        elif op == MULH:
+            v = s32((R[rs1] * R[rs2]) >> 32)
+        elif op == MULHU:
+            v = s32(((R[rs1] & 0xffffffff) * (R[rs2] & 0xffffffff)) >> 32)
+        elif op == MULHSU:
+            v = s32((R[rs1] * (R[rs2] & 0xffffffff)) >> 32)
+        elif op == DIVU or op == REMU:
+            a, b = R[rs1] & 0xffffffff, R[rs2] & 0xffffffff
+            if b == 0:
+                v = -1 if op == DIVU else s32(a)
+            else:
+                v = s32(a // b if op == DIVU else a % b)
+        elif op in (LB, LBU, LH, LHU):
+            size = 1 if op in (LB, LBU) else 2
+            addr = R[rs1] + imm
+            check_addr(pc, addr, size)
+            v = int.from_bytes(mem[addr:addr + size], "little", signed=op in (LB, LH))
+        elif op in (SB, SH):
+            size = 1 if op == SB else 2
+            addr = R[rs1] + imm
+            check_addr(pc, addr, size)
+            mem[addr:addr + size] = (R[rs2] & ((1 << 8 * size) - 1)).to_bytes(size, "little")
+            pc = next_pc
+            continue
+        elif op == RUNTIME:
+            if rd:
+                R[1] = TEXT_BASE + 4 * next_pc
+            runtime(pc, imm)
+            if not rd:
+                # tail 调用运行时库函数, 相当于调用后立即 ret
+                pc = (R[1] - TEXT_BASE) >> 2
+                if R[1] == EXIT_ADDR:
+                    break
+                continue
+            pc = next_pc
+            continue
+        else:
+            fail(pc, "bad opcode")
+        if rd:
+            R[rd] = v
+        pc = next_pc
+
+    result = Result()
+    result.output = "".join(out)
+    result.exit_code = R[10] & 0xff
+    weight = program.weight
+    stalls = program.stalls
+    stats = {"branches_taken": taken}
+    for name in ("loads", "stores", "muldiv", "branches", "jumps", "calls"):
+        stats[name] = 0
+    for index, count in enumerate(hits):
+        if count:
+            result.insts += count * weight[index]
+            result.cycles += count * (weight[index] + stalls[index])
+            cls = CLASS_OF.get(code[index][0])
+            if cls:
+                stats[cls] += count
+    result.stats = stats
+    result.timers = timed
+    if profile:
+        for index, count in enumerate(hits):
+            if count:
+                func = program.function_of(index)
+                result.functions[func] = result.functions.get(func, 0) + count * weight[index]
+    return result
+
+
+def expected_text(output, exit_code):
+    """按 SysY 测试用例的格式拼接输出和返回值"""
+    if output and not output.endswith("\n"):
+        output += "\n"
+    return output + "%d\n" % exit_code
+
+
+def main():
+    parser = argparse.ArgumentParser(description="RV32IM 汇编解释器")
+    parser.add_argument("asm")
+    parser.add_argument("-i", "--input", help="程序的标准输入, 默认为空")
+    parser.add_argument("--profile", action="store_true", help="输出各函数执行的指令数")
+    parser.add_argument("--max-insts", type=int, default=2000000000)
+    args = parser.parse_args()
+    with open(args.asm) as f:
+        text = f.read()
+    stdin_data = ""
+    if args.input:
+        with open(args.input) as f:
+            stdin_data = f.read()
+    try:
+        result = run(Program(text), stdin_data, args.max_insts, args.profile)
+    except EmulatorError as e:
+        sys.stderr.write("error: %s\n" % e)
+        sys.exit(255)
+    sys.stdout.write(result.output)
+    for count in result.timers:
+        sys.stderr.write("Timer: %d instructions\n" % count)
+    sys.stderr.write("instructions: %d\n" % result.insts)
+    sys.stderr.write("cycles: %d\n" % result.cycles)
+    for name, value in sorted(result.stats.items()):
+        sys.stderr.write("%s: %d\n" % (name, value))
+    for func, count in sorted(result.functions.items(), key=lambda x: -x[1]):
+        sys.stderr.write("  %-24s %12d %6.2f%%\n" % (func, count, 100.0 * count / max(result.insts, 1)))
+    sys.exit(result.exit_code)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,56 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+#include "sylib.h"
+
+// 输入输出
+int getint(void) {
+  int t;
+  if(scanf("%d", &t) != 1) return -1;
+  return t;
+}
+int getch(void) {
+  return getchar();
+}
+int getarray(int a[]) {
+  int n = getint();
+  for(int i = 0; i < n; i++) a[i] = getint();
+  return n;
+}
+void putint(int a) {
+  printf("%d", a);
+}
+void putch(int a) {
+  putchar(a);
+}
+void putarray(int n, int a[]) {
+  printf("%d:", n);
+  for(int i = 0; i < n; i++) printf(" %d", a[i]);
+  printf("\n");
+}
+
+// 计时, 每对 starttime/stoptime 之间的时间输出到标准错误
+static struct timeval sysy_start;
+
+void starttime(void) {
+  gettimeofday(&sysy_start, NULL);
+}
+void stoptime(void) {
+  struct timeval end;
+  gettimeofday(&end, NULL);
+  long us = (end.tv_sec - sysy_start.tv_sec) * 1000000L + end.tv_usec - sysy_start.tv_usec;
+  fprintf(stderr, "Timer: %ldus\n", us);
+}
+
+// 把每个计数器追加一行 "函数名 计数点 次数" 到 $SYSY_PROFILE_FILE (默认 default.sysyprof)
+void __sysy_profile_dump(const struct sysy_profile_table *table) {
+  const char *path = getenv("SYSY_PROFILE_FILE");
+  FILE *fp = fopen(path ? path : "default.sysyprof", "a");
+  if(!fp) {
+    fprintf(stderr, "profile: cannot open %s\n", path ? path : "default.sysyprof");
+    return;
+  }
+  for(unsigned i = 0; i < table->count; i++)
+    fprintf(fp, "%s %u\n", table->entries[i].name, *table->entries[i].counter);
+  fclose(fp);
+}
@@ -0,0 +1,37 @@
+#ifndef __SYLIB_H_
+#define __SYLIB_H_
+
+// SysY 运行时库, 与 rv32emu.py 中实现的运行时函数行为一致
+// 用宿主机的编译器编译 SysY 程序 (生成期望输出) 时与程序链接在一起
+// SysY 允许用 const 变量作为数组长度, 这在 C 中不合法, 所以 SysY 程序按 C++ 编译
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int getint(void);
+int getch(void);
+int getarray(int a[]);
+void putint(int a);
+void putch(int a);
+void putarray(int n, int a[]);
+void starttime(void);
+void stoptime(void);
+
+// -fprofile-generate 生成的程序在 main 返回前调用, table 是编译器生成的计数器表:
+// 计数器个数 n, 然后是 n 对 (计数器的地址, 计数点的名字), 都是 32 位 (RV32)
+struct sysy_profile_entry {
+  unsigned *counter;
+  const char *name;
+};
+struct sysy_profile_table {
+  unsigned count;
+  struct sysy_profile_entry entries[];
+};
+void __sysy_profile_dump(const struct sysy_profile_table *table);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
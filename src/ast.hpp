@@ -8,28 +8,96 @@
 #include <unordered_map>
 #include <vector>
 #include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <set>
+#include <sstream>
+#include "remarks.hpp"
 
 using namespace std;
 
-static int current_id = 0;
-static int block_id = 0;
-static string  block_name = "";
-static int if_id = 0;
-static int or_id = 0;
-static int and_id = 0;
-static int while_id = 0;
-static int now_while = 0;
-static deque<string> nums;
-static deque<unordered_map<string, int>*> symbol_table_stack;
-static deque<unordered_map<string, string>*> symbol_type_stack;
-static deque<string> block_stack;
-
-static int fun_ret_flag=0;
+class BaseAST;
+
+// 一次编译（一个源文件）中前端用到的全部状态
+// 每次编译各自持有一个上下文，互不干扰，因此可以在多个线程中同时编译
+struct FrontendContext {
+  int current_id = 0;
+  int block_id = 0;
+  string block_name = "";
+  int if_id = 0;
+  int or_id = 0;
+  int and_id = 0;
+  int while_id = 0;
+  int now_while = 0;
+  deque<string> nums;
+  deque<unordered_map<string, int>*> symbol_table_stack;
+  deque<unordered_map<string, string>*> symbol_type_stack;
+  deque<string> block_stack;
+  // 每个名字在哪几层作用域中有定义 (由外到内), 最后一个就是名字当前指向的定义, 查找时不必逐层找
+  unordered_map<string, vector<int>> symbol_levels;
+
+  int fun_ret_flag = 0;
+
+  ostream &out; // Koopa IR 的输出位置
+
+  // 函数粒度的增量编译, 由调用者设置
+  // reuse_function 非空时, 先用函数的指纹 (见 function_fingerprint) 询问能否复用之前生成的 IR,
+  // 能复用就直接输出, 不再遍历这个函数的 AST
+  const string *source = nullptr; // 源代码, 用于计算函数的指纹
+  function<bool(const string &fingerprint, string &ir)> reuse_function;
+  // 每个函数的 IR 在输出中的位置 [begin, end), 按源代码中的顺序
+  struct FunctionIR {
+    string name;
+    string fingerprint;
+    long begin, end;
+    bool reused;
+  };
+  vector<FunctionIR> functions;
+
+  // 流式编译: 非空时 parser 每解析完一个 CompUnitItem 就交给它, 不再留在 AST 中, 由调用者设置
+  function<void(unique_ptr<BaseAST> item)> on_item;
+
+  Remarks *remarks = nullptr; // 非空时在其中记录优化报告
+  string func_name;           // 当前函数名, 用于优化报告
+
+  // 过程间优化 (-fipo, 见 CompUnitAST::IpoKoopaIR), 由调用者设置 ipo
+  bool ipo = false;
+  struct CallSite {
+    string callee;
+    vector<string> args; // 各个实参, 编译期常量是十进制整数
+    int loop_depth;      // 所在的 while 的层数
+  };
+  struct FunctionFacts {
+    vector<CallSite> calls; // 函数中的调用
+    set<string> assigned;   // 函数中被赋值的变量 (带作用域前缀)
+  };
+  FunctionFacts *facts = nullptr; // 非空时记下正在生成的函数中的调用和赋值
+  unordered_map<string, int> bound_params; // 正在生成的函数中当作常量的参数
+  string emit_name; // 非空时正在生成的函数改用这个名字 (特化出的副本)
+  struct Clone {
+    map<int, int> args; // 绑定为常量的参数的位置和值
+    string name;
+  };
+  unordered_map<string, vector<Clone>> clones; // 各函数特化出的副本, 实参相符的调用改为调用副本
+  int loop_depth = 0;  // 正在生成的语句所在的 while 的层数
+  int const_epoch = 0; // 改变 bound_params 时加一, 让节点上缓存的 IsConst 失效
+
+  explicit FrontendContext(ostream &out) : out(out) {}
+  ~FrontendContext() {
+    for(auto table : symbol_table_stack) delete table;
+    for(auto type : symbol_type_stack) delete type;
+  }
+};
+
+// 当前线程正在使用的前端上下文
+inline thread_local FrontendContext *ctx = nullptr;
 
 #define FUNCTYPE 22 // 函数类型
 
 // 用于计算的操作符到 Koopa IR 指令的映射
-static unordered_map<char, string> CalOp2Instruct={
+static const unordered_map<char, string> CalOp2Instruct={
   {'+', "add"},
   {'-', "sub"},
   {'*', "mul"},
@@ -37,7 +105,7 @@ static unordered_map<char, string> CalOp2Instruct={
   {'%', "mod"},
 };
 // 用于比较的操作符到 Koopa IR 指令的映射
-static unordered_map<string, string> ComOp2Instruct={
+static const unordered_map<string, string> ComOp2Instruct={
   {"<", "lt"},
   {">", "gt"},
   {"<=", "le"},
@@ -48,20 +116,20 @@ static unordered_map<string, string> ComOp2Instruct={
 
 inline void KoopaIR_one_operands(string instruct)
 {
-  cout << "  %"<< current_id << " = " << instruct <<" ";
-  cout << nums.back() << endl;
-  nums.pop_back();
-  nums.push_back("%"+to_string(current_id));
-  current_id++;
+  ctx->out << "  %"<< ctx->current_id << " = " << instruct <<" ";
+  ctx->out << ctx->nums.back() << endl;
+  ctx->nums.pop_back();
+  ctx->nums.push_back("%"+to_string(ctx->current_id));
+  ctx->current_id++;
 }
 inline void KoopaIR_two_operands(string instruct)
 {
-  cout << "  %"<< current_id << " = " << instruct <<" ";
-  cout << nums[nums.size()-2] << ", "<< nums.back() << endl;
-  nums.pop_back();
-  nums.pop_back();
-  nums.push_back("%"+to_string(current_id));
-  current_id++;
+  ctx->out << "  %"<< ctx->current_id << " = " << instruct <<" ";
+  ctx->out << ctx->nums[ctx->nums.size()-2] << ", "<< ctx->nums.back() << endl;
+  ctx->nums.pop_back();
+  ctx->nums.pop_back();
+  ctx->nums.push_back("%"+to_string(ctx->current_id));
+  ctx->current_id++;
 }
 inline void KoopaIR_logic_operands(string instruct)
 {
@@ -75,59 +143,311 @@ inline void KoopaIR_logic_operands(string instruct)
 }
 
 // 从符号表栈中找到符号的标识符，返回一个vector: {符号的标识符, 类型(const/var), 符号的值}
+// 最内层的定义所在的层由 symbol_levels 直接给出, 与嵌套的层数无关
 inline vector<string> get_target_ident(string ident)
 {
-  vector<string> ret;
-  for(int i=symbol_table_stack.size()-1; i>=0; i--){
-    string target_ident = block_stack[i] + ident ;
-    if(symbol_table_stack[i]->find(target_ident)!=symbol_table_stack[i]->end()){
-      ret.push_back(target_ident);
-      ret.push_back(symbol_type_stack[i]->at(target_ident));
-      ret.push_back(to_string(symbol_table_stack[i]->at(target_ident)));
-      break;
-    }
-  }
-  if(ret.size()==0)
-  {
-    ret.push_back("");
-    ret.push_back("");
-    ret.push_back("");
-  }
-  return ret;
+  auto it = ctx->symbol_levels.find(ident);
+  if(it == ctx->symbol_levels.end() || it->second.empty()) return {"", "", ""};
+  int i = it->second.back();
+  string target_ident = ctx->block_stack[i] + ident ;
+  return {target_ident, ctx->symbol_type_stack[i]->at(target_ident), to_string(ctx->symbol_table_stack[i]->at(target_ident))};
+}
+
+// 在当前作用域中登记符号 target_ident (作用域前缀加名字), 值为 value, 类型为 type
+inline void declare_symbol(const string &target_ident, int value, const string &type)
+{
+  if(!ctx->symbol_table_stack.back()->emplace(target_ident, value).second) return;
+  ctx->symbol_type_stack.back()->emplace(target_ident, type);
+  ctx->symbol_levels[target_ident.substr(ctx->block_stack.back().size())].push_back(ctx->symbol_table_stack.size()-1);
 }
 
 inline void enter_block()
 {
   unordered_map<string, int> *symbol_table=new unordered_map<string, int>;
   unordered_map<string, string> *symbol_type=new unordered_map<string, string>;
-  symbol_table_stack.push_back(symbol_table);
-  symbol_type_stack.push_back(symbol_type);
-  if(block_name!="") 
+  ctx->symbol_table_stack.push_back(symbol_table);
+  ctx->symbol_type_stack.push_back(symbol_type);
+  if(ctx->block_name!="") 
   {
-    block_stack.push_back(block_name);
-    block_name="";
+    ctx->block_stack.push_back(ctx->block_name);
+    ctx->block_name="";
   }
-  else block_stack.push_back("Block_"+to_string(block_id++)+"_");
+  else ctx->block_stack.push_back("Block_"+to_string(ctx->block_id++)+"_");
 }
 inline void exit_block()
 {
-  free(symbol_table_stack.back());
-  symbol_table_stack.pop_back();
-  free(symbol_type_stack.back());
-  symbol_type_stack.pop_back();
-  block_stack.pop_back();
+  // 本层定义的名字重新指向外层的定义
+  int level = ctx->symbol_table_stack.size()-1;
+  const string &prefix = ctx->block_stack.back();
+  for(auto &symbol : *ctx->symbol_table_stack.back()){
+    if(symbol.first.compare(0, prefix.size(), prefix) != 0) continue; // 全局作用域中的函数名没有前缀
+    auto it = ctx->symbol_levels.find(symbol.first.substr(prefix.size()));
+    if(it != ctx->symbol_levels.end() && !it->second.empty() && it->second.back() == level) it->second.pop_back();
+  }
+  delete ctx->symbol_table_stack.back();
+  ctx->symbol_table_stack.pop_back();
+  delete ctx->symbol_type_stack.back();
+  ctx->symbol_type_stack.pop_back();
+  ctx->block_stack.pop_back();
 }
 
+// 当前线程创建过的 AST 节点数, 用于 -ftime-report
+inline thread_local uint64_t ast_node_count = 0;
+
+// 在显式的工作栈上遍历 AST 时的一帧 (见 walk_koopa 等)
+struct WalkFrame {
+  const BaseAST *node;
+  int step = 0;  // 节点下一步的编号
+  int saved = 0; // 在各步之间保存的数据: 左侧的值、短路求值和 if 的编号等
+  string true_label, false_label; // CondIR 的跳转目标
+};
+
+inline void walk_koopa(const BaseAST *root);
+inline int walk_calculate(const BaseAST *root);
+inline bool walk_const(const BaseAST *root);
+inline void walk_cond(const BaseAST *root, const string &true_label, const string &false_label);
+
 // 所有 AST 的基类
 class BaseAST {
  public:
+  BaseAST() { ast_node_count++; }
   virtual ~BaseAST() = default;
 
+  int line = 0, column = 0; // 在源文件中的起始位置 (从 1 开始), 由 parser 设置
+
   virtual void Dump() const = 0;
   virtual void KoopaIR() const = 0;
   virtual int Calculate() const = 0;
+
+  // 生成作为条件 (if、while) 的表达式的 IR: 为真时跳到 true_label, 为假时跳到 false_label (如 "%If_0")
+  // 默认先求出值再 br; 逻辑运算和 ! 直接生成跳转链, 不求出 0/1
+  virtual void CondIR(const string &true_label, const string &false_label) const;
+
+  // 子树能否在编译期求值（只由字面量和 const 符号构成），结果缓存在节点上
+  bool IsConst() const {
+    if(const_state < 0 || const_epoch != ctx->const_epoch) return walk_const(this);
+    return const_state;
+  }
+
+  // 表达式和语句按步实现下面几个函数, 由 walk_koopa、walk_calculate、walk_const、walk_cond 在显式的工作栈上驱动,
+  // 表达式再长、语句和括号嵌套再深也不在 C++ 栈上递归。每次调用做 f.node 的第 f.step 步, 返回下一个要处理的子节点,
+  // 子节点处理完后再调用本节点的下一步; 返回 nullptr 表示本节点处理完毕。默认一步做完, 用于表达式以外的节点
+  virtual const BaseAST *KoopaIRStep(WalkFrame &f) const { KoopaIR(); return nullptr; }
+  // value 进入时是刚处理完的子节点的值, 本节点处理完毕时设为本节点的值
+  virtual const BaseAST *CalculateStep(WalkFrame &f, int &value) const { value = Calculate(); return nullptr; }
+  virtual const BaseAST *CheckConstStep(WalkFrame &f, bool &value) const { value = CheckConst(); return nullptr; }
+  // 返回子节点时在 child 中填好它的跳转目标
+  virtual const BaseAST *CondIRStep(WalkFrame &f, WalkFrame &child) const {
+    CondIR(f.true_label, f.false_label);
+    return nullptr;
+  }
+  // 把子节点移到 out 中, 由 release_children 逐个释放; 析构时调用 release_children 的节点要实现它
+  virtual void TakeChildren(vector<unique_ptr<BaseAST>> &out) {}
+
+ protected:
+  virtual bool CheckConst() const { return false; }
+
+ private:
+  friend bool walk_const(const BaseAST *root);
+  friend int walk_calculate(const BaseAST *root);
+  // 记下 IsConst 的结果, 常量的值在算出后也缓存起来
+  void SetConst(bool value) const {
+    const_state = value;
+    const_epoch = ctx->const_epoch;
+    value_cached = false;
+  }
+  bool CachedConst(bool &value) const {
+    if(const_state < 0 || const_epoch != ctx->const_epoch) return false;
+    value = const_state;
+    return true;
+  }
+  void SetValue(int value) const {
+    if(const_state != 1 || const_epoch != ctx->const_epoch) return;
+    const_value = value;
+    value_cached = true;
+  }
+  bool CachedValue(int &value) const {
+    if(!value_cached || const_epoch != ctx->const_epoch) return false;
+    value = const_value;
+    return true;
+  }
+
+  mutable int const_state = -1;
+  mutable int const_epoch = 0;
+  mutable bool value_cached = false;
+  mutable int const_value = 0;
 };
 
+inline void walk_koopa(const BaseAST *root)
+{
+  vector<WalkFrame> stack{{root}};
+  while(!stack.empty()) {
+    const BaseAST *child = stack.back().node->KoopaIRStep(stack.back());
+    if(child) stack.push_back({child});
+    else stack.pop_back();
+  }
+}
+
+// 已经求出过值的常量子树不再进入
+inline int walk_calculate(const BaseAST *root)
+{
+  int value = 0;
+  if(root->CachedValue(value)) return value;
+  vector<WalkFrame> stack{{root}};
+  while(!stack.empty()) {
+    const BaseAST *child = stack.back().node->CalculateStep(stack.back(), value);
+    if(!child) {
+      stack.back().node->SetValue(value);
+      stack.pop_back();
+    } else if(!child->CachedValue(value)) stack.push_back({child});
+  }
+  return value;
+}
+
+// 子树的结果缓存在各个节点上, 已经判断过的子树不再进入
+inline bool walk_const(const BaseAST *root)
+{
+  bool value = false;
+  vector<WalkFrame> stack{{root}};
+  while(!stack.empty()) {
+    const BaseAST *child = stack.back().node->CheckConstStep(stack.back(), value);
+    if(!child) {
+      stack.back().node->SetConst(value);
+      stack.pop_back();
+    } else if(!child->CachedConst(value)) stack.push_back({child});
+  }
+  return value;
+}
+
+inline void walk_cond(const BaseAST *root, const string &true_label, const string &false_label)
+{
+  vector<WalkFrame> stack{{root, 0, 0, true_label, false_label}};
+  while(!stack.empty()) {
+    WalkFrame child{nullptr};
+    child.node = stack.back().node->CondIRStep(stack.back(), child);
+    if(child.node) stack.push_back(std::move(child));
+    else stack.pop_back();
+  }
+}
+
+// 只有一个子节点、结果就是子节点的结果时的一步
+inline const BaseAST *only_child(WalkFrame &f, const unique_ptr<BaseAST> &child)
+{
+  return f.step++ ? nullptr : child.get();
+}
+
+// CondIR 中处理子节点 node, 它为真时跳到 true_label, 为假时跳到 false_label
+inline const BaseAST *branch(WalkFrame &child, const unique_ptr<BaseAST> &node, const string &true_label,
+                             const string &false_label)
+{
+  child.true_label = true_label;
+  child.false_label = false_label;
+  return node.get();
+}
+
+inline const BaseAST *only_child(WalkFrame &f, WalkFrame &child, const unique_ptr<BaseAST> &node)
+{
+  return f.step++ ? nullptr : branch(child, node, f.true_label, f.false_label);
+}
+
+// 二元运算的前两步: 依次处理左右两侧, 处理右侧之前把左侧的值 lhs_value 存到 f.saved; 两侧都处理完后返回 nullptr
+inline const BaseAST *operands(WalkFrame &f, const unique_ptr<BaseAST> &lhs, const unique_ptr<BaseAST> &rhs,
+                               int lhs_value = 0)
+{
+  switch(f.step++) {
+    case 0: return lhs.get();
+    case 1: f.saved = lhs_value; return rhs.get();
+  }
+  return nullptr;
+}
+
+// 两侧都是常量时才是常量, 左侧不是常量时不再看右侧
+inline const BaseAST *both_const(WalkFrame &f, bool value, const unique_ptr<BaseAST> &lhs,
+                                 const unique_ptr<BaseAST> &rhs)
+{
+  switch(f.step++) {
+    case 0: return lhs.get();
+    case 1: return value ? rhs.get() : nullptr;
+  }
+  return nullptr;
+}
+
+// 释放 node 的子树: 子节点先移到工作栈上再逐个析构, 析构时它们已经没有子节点, 不会层层递归
+inline void release_children(BaseAST *node)
+{
+  vector<unique_ptr<BaseAST>> pending;
+  node->TakeChildren(pending);
+  while(!pending.empty()) {
+    unique_ptr<BaseAST> child = std::move(pending.back());
+    pending.pop_back();
+    child->TakeChildren(pending);
+  }
+}
+
+inline void take_child(vector<unique_ptr<BaseAST>> &out, unique_ptr<BaseAST> &child)
+{
+  if(child) out.push_back(std::move(child));
+}
+
+inline void take_child(vector<unique_ptr<BaseAST>> &out, unique_ptr<vector<unique_ptr<BaseAST>>> &list)
+{
+  if(list) for(auto &child : *list) take_child(out, child);
+}
+
+// 记一条优化报告, 位置取 node 的起始位置
+inline void remark(Remark::Kind kind, const string &pass, const string &name, const BaseAST *node,
+                   const string &message)
+{
+  if(!ctx->remarks) return;
+  ctx->remarks->Emit(Remark{kind, pass, name, ctx->func_name, node->line, node->column, message});
+}
+
+// 记下当前函数中名为 block 的基本块对应 node 的位置
+inline void block_location(const string &block, const BaseAST *node)
+{
+  if(ctx->remarks) ctx->remarks->SetBlockLocation(ctx->func_name, block, node->line, node->column);
+}
+
+// 条件恒真或恒假时直接跳转, 否则求出值后按值跳转
+inline void BaseAST::CondIR(const string &true_label, const string &false_label) const
+{
+  if(IsConst()) {
+    bool value = Calculate();
+    remark(Remark::Passed, "branchfold", "ConstantCondition", this,
+           string("condition is always ") + (value ? "true" : "false") + ", replaced the branch with a jump");
+    ctx->out << "  jump " << (value ? true_label : false_label) << endl;
+    return;
+  }
+  KoopaIR();
+  ctx->out << "  br " << ctx->nums.back() << ", " << true_label << ", " << false_label << endl;
+  ctx->nums.pop_back();
+}
+
+// 折叠常量子树：能在编译期求值就直接压入结果，不再生成指令
+// 只在带运算符的节点上调用, 字面量和常量本身不算折叠
+inline bool fold_const(const BaseAST *ast)
+{
+  if(!ast->IsConst()) return false;
+  int value = ast->Calculate();
+  ctx->nums.push_back(to_string(value));
+  remark(Remark::Passed, "constfold", "ConstantFolded", ast, "folded constant expression to " + to_string(value));
+  return true;
+}
+
+// 实参为 args 的对 ident 的调用实际调用的函数: 绑定的参数都相符的副本中绑定最多的那个, 没有时就是 ident
+inline string call_target(const string &ident, const vector<string> &args)
+{
+  auto it = ctx->clones.find(ident);
+  if(it == ctx->clones.end()) return ident;
+  const FrontendContext::Clone *best = nullptr;
+  for(auto &clone : it->second) {
+    bool match = true;
+    for(auto &arg : clone.args) match = match && args[arg.first] == to_string(arg.second);
+    if(match && (!best || clone.args.size() > best->args.size())) best = &clone;
+  }
+  return best ? best->name : ident;
+}
+
 class CompUnitAST : public BaseAST {
  public:
   // 用智能指针管理对象
@@ -137,45 +457,62 @@ class CompUnitAST : public BaseAST {
     return;
   }
   void KoopaIR() const override {
+    BeginKoopaIR();
+    if(ctx->ipo) IpoKoopaIR();
+    else {
+      for(auto &i:*comp_unit_item_list) ItemKoopaIR(*i);
+    }
+    exit_block();
+  }
+  // 流式编译 (见 compiler.cpp 中的 compile_streaming) 不建立完整的 AST, 而是依次调用:
+  // BeginKoopaIR, parser 每解析完一项调用 ItemKoopaIR, 最后 exit_block
+  static void BeginKoopaIR() {
     enter_block();
 
     // 声明库函数
-    cout << "decl @getint(): i32\n" \
-                "decl @getch(): i32\n" \
-                "decl @getarray(*i32): i32\n" \
-                "decl @putint(i32)\n" \
-                "decl @putch(i32)\n" \
-                "decl @putarray(i32, *i32)\n" \
-                "decl @starttime()\n" \
-                "decl @stoptime()\n" << endl;
-    symbol_table_stack[0]->emplace("getint", FUNCTYPE);
-    symbol_type_stack[0]->emplace("getint", "Func_int");
-    symbol_table_stack[0]->emplace("getch", FUNCTYPE);
-    symbol_type_stack[0]->emplace("getch", "Func_int");
-    symbol_table_stack[0]->emplace("getarray", FUNCTYPE);
-    symbol_type_stack[0]->emplace("getarray", "Func_int");
-    symbol_table_stack[0]->emplace("putint", FUNCTYPE);
-    symbol_type_stack[0]->emplace("putint", "Func_void");
-    symbol_table_stack[0]->emplace("putch", FUNCTYPE);
-    symbol_type_stack[0]->emplace("putch", "Func_void");
-    symbol_table_stack[0]->emplace("putarray", FUNCTYPE);
-    symbol_type_stack[0]->emplace("putarray", "Func_void");
-    symbol_table_stack[0]->emplace("starttime", FUNCTYPE);
-    symbol_type_stack[0]->emplace("starttime", "Func_void");
-    symbol_table_stack[0]->emplace("stoptime", FUNCTYPE);
-    symbol_type_stack[0]->emplace("stoptime", "Func_void");
-
-    for(auto &i:*comp_unit_item_list){
-      i->KoopaIR();
-      cout<<endl;
-      current_id=0;
-      nums.clear();
-    }
-    exit_block();
+    ctx->symbol_table_stack[0]->emplace("getint", FUNCTYPE);
+    ctx->symbol_type_stack[0]->emplace("getint", "Func_int");
+    ctx->symbol_table_stack[0]->emplace("getch", FUNCTYPE);
+    ctx->symbol_type_stack[0]->emplace("getch", "Func_int");
+    ctx->symbol_table_stack[0]->emplace("getarray", FUNCTYPE);
+    ctx->symbol_type_stack[0]->emplace("getarray", "Func_int");
+    ctx->symbol_table_stack[0]->emplace("putint", FUNCTYPE);
+    ctx->symbol_type_stack[0]->emplace("putint", "Func_void");
+    ctx->symbol_table_stack[0]->emplace("putch", FUNCTYPE);
+    ctx->symbol_type_stack[0]->emplace("putch", "Func_void");
+    ctx->symbol_table_stack[0]->emplace("putarray", FUNCTYPE);
+    ctx->symbol_type_stack[0]->emplace("putarray", "Func_void");
+    ctx->symbol_table_stack[0]->emplace("starttime", FUNCTYPE);
+    ctx->symbol_type_stack[0]->emplace("starttime", "Func_void");
+    ctx->symbol_table_stack[0]->emplace("stoptime", FUNCTYPE);
+    ctx->symbol_type_stack[0]->emplace("stoptime", "Func_void");
+    if(ctx->ipo) return; // 过程间优化只声明用到了的库函数
+    for(auto &decl : runtime_decls) ctx->out << decl.second << "\n";
+    ctx->out << endl;
+  }
+  static void ItemKoopaIR(const BaseAST &item) {
+    item.KoopaIR();
+    ctx->out<<endl;
+    ctx->current_id=0;
+    ctx->nums.clear();
   }
   int Calculate() const override {
     return 0;
   }
+
+ private:
+  // 库函数的 (名字, 声明)
+  static constexpr pair<const char *, const char *> runtime_decls[] = {
+    {"getint", "decl @getint(): i32"},
+    {"getch", "decl @getch(): i32"},
+    {"getarray", "decl @getarray(*i32): i32"},
+    {"putint", "decl @putint(i32)"},
+    {"putch", "decl @putch(i32)"},
+    {"putarray", "decl @putarray(i32, *i32)"},
+    {"starttime", "decl @starttime()"},
+    {"stoptime", "decl @stoptime()"},
+  };
+  void IpoKoopaIR() const; // 需要用到 FuncDefAST, 定义在它后面
 };
 
 class CompUnitItemAST : public BaseAST {
@@ -186,14 +523,7 @@ class CompUnitItemAST : public BaseAST {
   void Dump() const override {
     return;
   }
-  void KoopaIR() const override {
-    if(func_def){
-      func_def->KoopaIR();
-    }
-    else if(decl){
-      decl->KoopaIR();
-    }
-  }
+  void KoopaIR() const override; // 需要用到 FuncDefAST, 定义在它后面
   int Calculate() const override {
     return 0;
   }
@@ -203,16 +533,29 @@ class ConstExpAST: public BaseAST{
   public:
     unique_ptr<BaseAST> exp;
 
+    ~ConstExpAST() override { release_children(this); }
     void Dump() const override {
       cout << "ConstExp { ";
       exp->Dump();
       cout << " }";
     }
     void KoopaIR() const override {
-      exp->KoopaIR();
+      walk_koopa(this);
     }
     int Calculate() const override {
-      return exp->Calculate();
+      return walk_calculate(this);
+    }
+    const BaseAST *KoopaIRStep(WalkFrame &f) const override {
+      return only_child(f, exp);
+    }
+    const BaseAST *CalculateStep(WalkFrame &f, int &value) const override {
+      return only_child(f, exp);
+    }
+    const BaseAST *CheckConstStep(WalkFrame &f, bool &value) const override {
+      return only_child(f, exp);
+    }
+    void TakeChildren(vector<unique_ptr<BaseAST>> &out) override {
+      take_child(out, exp);
     }
 };
 
@@ -227,45 +570,47 @@ class FuncFParamAST : public BaseAST {
   }
   void KoopaIR() const override {
     if(const_index_list){
-      cout << "@" << ident << ": *";
-      for (int i = 0; i < const_index_list->size(); i++) cout<<"[";
-      cout<<"i32";
-      if(const_index_list->size()) cout<<", ";
+      ctx->out << "@" << ident << ": *";
+      for (int i = 0; i < const_index_list->size(); i++) ctx->out<<"[";
+      ctx->out<<"i32";
+      if(const_index_list->size()) ctx->out<<", ";
       for (int i = const_index_list->size() - 1; i >= 0; i--) {
         const auto& const_exp = (*const_index_list)[i];
         int num = dynamic_cast<ConstExpAST*>(const_exp.get())->Calculate();
-        if(i) cout<<std::to_string(num) + "], ";
-        else cout<<std::to_string(num)+"]";
+        if(i) ctx->out<<std::to_string(num) + "], ";
+        else ctx->out<<std::to_string(num)+"]";
       }
-    } else cout << "@" << ident << ": i32";
+    } else ctx->out << "@" << ident << ": i32";
   }
   int Calculate() const override {
     return 0;
   }
   void Alloc() const {
-    string target_ident = block_stack.back() + ident ;
+    string target_ident = ctx->block_stack.back() + ident ;
     if(const_index_list){
-      cout<<"  @"<<target_ident<<" = alloc *";
-      for (int i = 0; i < const_index_list->size(); i++) cout<<"[";
-      cout<<"i32";
-      if(const_index_list->size()) cout<<", ";
+      ctx->out<<"  @"<<target_ident<<" = alloc *";
+      for (int i = 0; i < const_index_list->size(); i++) ctx->out<<"[";
+      ctx->out<<"i32";
+      if(const_index_list->size()) ctx->out<<", ";
       for (int i = const_index_list->size() - 1; i >= 0; i--) {
         const auto& const_exp = (*const_index_list)[i];
         int num = dynamic_cast<ConstExpAST*>(const_exp.get())->Calculate();
-        if(i) cout<<std::to_string(num) + "], ";
-        else cout<<std::to_string(num)+"]";
+        if(i) ctx->out<<std::to_string(num) + "], ";
+        else ctx->out<<std::to_string(num)+"]";
       }
-      cout<<endl;
+      ctx->out<<endl;
       // 这里符号表里存放的是数组有几个维度，如 arr*[2][3] -> 3，以在Stmt和Lval中部分解引用数组
       // 注意这里是*，即数组指针，所以要加1
-      symbol_table_stack.back()->emplace(target_ident, const_index_list->size()+1); 
-      symbol_type_stack.back()->emplace(target_ident, "ptr"); // 指针类型
+      declare_symbol(target_ident, const_index_list->size()+1, "ptr"); // 指针类型
+    } else if(ctx->bound_params.count(ident)){
+      // 每个调用处都传入同一个常量的参数当作常量, 不再分配变量
+      declare_symbol(target_ident, ctx->bound_params.at(ident), "const");
+      return;
     } else{
-      cout << "  @" << target_ident << " = alloc i32" << endl;
-      symbol_table_stack.back()->emplace(target_ident, 1); // 这里随便给的值，因为不会用到
-      symbol_type_stack.back()->emplace(target_ident, "var");
+      ctx->out << "  @" << target_ident << " = alloc i32" << endl;
+      declare_symbol(target_ident, 1, "var"); // 这里随便给的值，因为不会用到
     }
-    cout<<"  store @"<<ident<<", @"<<target_ident<<endl;
+    ctx->out<<"  store @"<<ident<<", @"<<target_ident<<endl;
   }
 };
 
@@ -277,8 +622,8 @@ class FuncTypeAST : public BaseAST {
     cout << "FuncDefAST { \"int\" }";
   }
   void KoopaIR() const override {
-    if(type=="int") cout<<": i32";
-    else cout<<" ";
+    if(type=="int") ctx->out<<": i32";
+    else ctx->out<<" ";
   }
   int Calculate() const override {
     return 0;
@@ -295,58 +640,348 @@ class FuncDefAST : public BaseAST {
   void Dump() const override {
     return ;
   }
+  int source_begin = 0, source_end = 0; // 函数在源代码中的字节范围
+
+  // 在全局作用域中登记这个函数
+  void Declare() const {
+    ctx->symbol_table_stack[0]->emplace(ident, FUNCTYPE);
+    ctx->symbol_type_stack[0]->emplace(ident, "Func_"+func_type);
+  }
   void KoopaIR() const override {
     const string& type = func_type;
-    symbol_table_stack[0]->emplace(ident, FUNCTYPE);
-    symbol_type_stack[0]->emplace(ident, "Func_"+type);
-    block_name="FUNC_"+ident+"_";
+    Declare();
+    // 临时变量、作用域和标签的编号都从头开始, 函数的 IR 只取决于它自己和它用到的全局符号
+    ctx->current_id=0;
+    ctx->block_id=1; // Block_0_ 是全局作用域
+    ctx->if_id=0;
+    ctx->or_id=0;
+    ctx->and_id=0;
+    ctx->while_id=0;
+    ctx->block_name="FUNC_"+ident+"_";
+    ctx->func_name=ident;
     enter_block();
     
-    cout<< "fun @"<<ident<<"(";
+    ctx->out<< "fun @"<<(ctx->emit_name.empty() ? ident : ctx->emit_name)<<"(";
     int i=0, sz=func_f_param_list->size();
     for(auto &param:*func_f_param_list){
       param->KoopaIR();
-      if(i!=sz-1) cout<<", ";
+      if(i!=sz-1) ctx->out<<", ";
       i++;
     }
-    cout<<")";
-    if(type=="int") cout<<": i32";
-    else cout<<" ";
-    cout << " {\n";
-    cout << "%entry:\n";
-    fun_ret_flag=0;
+    ctx->out<<")";
+    if(type=="int") ctx->out<<": i32";
+    else ctx->out<<" ";
+    ctx->out << " {\n";
+    ctx->out << "%entry:\n";
+    block_location("entry", this);
+    ctx->fun_ret_flag=0;
 
     for(auto& func_f_param: *func_f_param_list) 
       dynamic_cast<FuncFParamAST*>(func_f_param.get())->Alloc();
     
     block->KoopaIR();
-    if(fun_ret_flag==0)
+    if(ctx->fun_ret_flag==0)
     {
-      if(type=="void") cout<<"  ret"<<endl;
-      else cout<<"  ret 0"<<endl;
+      if(type=="void") ctx->out<<"  ret"<<endl;
+      else ctx->out<<"  ret 0"<<endl;
     }
-    cout << "}\n";
+    ctx->out << "}\n";
     exit_block();
+    ctx->func_name.clear();
   }
   int Calculate() const override {
     return 0;
   }
 };
 
+// 函数的指纹: 函数的源代码, 加上其中出现的标识符在全局作用域中对应的符号
+// (全局变量的名字、类型和常量值, 函数的返回类型), 指纹相同的函数生成的 Koopa IR 一定相同
+// 标识符按文本提取, 被局部变量遮住的全局符号也会算进去, 这只会让指纹更保守
+inline string function_fingerprint(const FuncDefAST *func)
+{
+  string text = ctx->source->substr(func->source_begin, func->source_end - func->source_begin);
+  set<string> idents;
+  for(size_t i = 0; i < text.size();){
+    if(isalpha((unsigned char)text[i]) || text[i] == '_'){
+      size_t j = i;
+      while(j < text.size() && (isalnum((unsigned char)text[j]) || text[j] == '_')) j++;
+      idents.insert(text.substr(i, j - i));
+      i = j;
+    }
+    else if(isdigit((unsigned char)text[i])){
+      while(i < text.size() && isalnum((unsigned char)text[i])) i++;
+    }
+    else i++;
+  }
+  string fingerprint = text;
+  auto &table = *ctx->symbol_table_stack[0];
+  auto &type = *ctx->symbol_type_stack[0];
+  for(auto &ident : idents){
+    // 全局变量和常量在符号表中带有全局作用域的前缀, 函数没有
+    for(auto &name : {ctx->block_stack[0] + ident, ident}){
+      if(table.find(name) == table.end()) continue;
+      fingerprint += "\n" + name + " " + type.at(name) + " " + to_string(table.at(name));
+    }
+  }
+  return fingerprint;
+}
+
+inline void CompUnitItemAST::KoopaIR() const {
+  if(decl){
+    decl->KoopaIR();
+    return;
+  }
+  auto func = dynamic_cast<FuncDefAST*>(func_def.get());
+  if(!ctx->reuse_function){
+    func->KoopaIR();
+    return;
+  }
+  FrontendContext::FunctionIR record{func->ident, function_fingerprint(func), (long)ctx->out.tellp(), 0, false};
+  string ir;
+  if(ctx->reuse_function(record.fingerprint, ir)){
+    func->Declare();
+    ctx->out << ir;
+    record.reused = true;
+  }
+  else func->KoopaIR();
+  record.end = ctx->out.tellp();
+  ctx->functions.push_back(record);
+}
+
+// 在作用域内把 out 的输出转到 buffer 中
+struct RedirectOutput {
+  ostream &out;
+  streambuf *saved;
+  RedirectOutput(ostream &out, ostream &buffer) : out(out), saved(out.rdbuf(buffer.rdbuf())) {}
+  ~RedirectOutput() { out.rdbuf(saved); }
+};
+
+// 过程间优化 (-fipo): 先逐项生成 IR, 同时记下每个函数中的调用和赋值, 然后
+// 1. 只保留从 main 可达的函数, 以及用到了的库函数声明
+// 2. 每个调用处都传入同一个常量、在函数中又没被赋值的 int 参数当作常量, 重新生成函数时折叠掉
+// 3. 同一组常量实参在调用处出现得多 (循环中的调用按 10 次算) 时, 为它特化出函数的副本, 这些调用改为调用副本
+// 副本和原函数的参数相同, 调用处照常传参; 只重新生成有参数当作常量、或者有调用改为调用副本的函数
+inline void CompUnitAST::IpoKoopaIR() const {
+  const size_t max_clones = 4;          // 每个函数最多特化出的副本数
+  const size_t max_clone_size = 16384;  // 只特化 IR 不超过这么多字节的函数
+  const int min_clone_weight = 2;       // 一组常量实参出现的加权次数至少为此才特化
+  struct Unit {
+    const FuncDefAST *func;
+    string name;
+    unordered_map<string, int> bound; // 当作常量的参数
+    map<int, int> clone_args;          // 副本绑定的参数 (位置 -> 值)
+    string ir;
+    FrontendContext::FunctionFacts facts;
+    bool regenerate = false;
+  };
+  vector<string> decl_ir(comp_unit_item_list->size()); // 全局变量和常量的 IR
+  vector<Unit> units;
+  unordered_map<string, size_t> unit_index;
+  vector<ptrdiff_t> item_unit(comp_unit_item_list->size(), -1);
+  auto finish_item = [] {
+    ctx->out << endl;
+    ctx->current_id = 0;
+    ctx->nums.clear();
+  };
+  for(size_t k = 0; k < comp_unit_item_list->size(); k++) {
+    auto item = dynamic_cast<CompUnitItemAST*>((*comp_unit_item_list)[k].get());
+    ostringstream buffer;
+    RedirectOutput redirect(ctx->out, buffer);
+    if(item->decl) {
+      item->decl->KoopaIR();
+      finish_item();
+      decl_ir[k] = buffer.str();
+      continue;
+    }
+    Unit unit;
+    unit.func = dynamic_cast<FuncDefAST*>(item->func_def.get());
+    unit.name = unit.func->ident;
+    ctx->facts = &unit.facts;
+    unit.func->KoopaIR();
+    ctx->facts = nullptr;
+    finish_item();
+    unit.ir = buffer.str();
+    item_unit[k] = units.size();
+    unit_index[unit.name] = units.size();
+    units.push_back(std::move(unit));
+  }
+
+  // 从 main 可达的函数 (没有 main 时保留所有函数) 和用到的库函数
+  auto reachable = [&units, &unit_index](set<string> &runtime) {
+    vector<bool> seen(units.size(), !unit_index.count("main"));
+    vector<size_t> stack;
+    if(unit_index.count("main")) stack.push_back(unit_index.at("main"));
+    else for(size_t i = 0; i < units.size(); i++) stack.push_back(i);
+    if(!stack.empty()) seen[stack.back()] = true;
+    while(!stack.empty()) {
+      size_t u = stack.back();
+      stack.pop_back();
+      for(auto &call : units[u].facts.calls) {
+        auto it = unit_index.find(call.callee);
+        if(it == unit_index.end()) runtime.insert(call.callee);
+        else if(!seen[it->second]) {
+          seen[it->second] = true;
+          stack.push_back(it->second);
+        }
+      }
+    }
+    return seen;
+  };
+  set<string> runtime;
+  auto live = reachable(runtime);
+
+  // 可达的函数中对每个函数的调用
+  unordered_map<string, vector<const FrontendContext::CallSite*>> sites;
+  for(size_t u = 0; u < units.size(); u++)
+    for(auto &call : units[u].facts.calls)
+      if(live[u]) sites[call.callee].push_back(&call);
+  auto is_integer = [](const string &arg) {
+    return !arg.empty() && (isdigit((unsigned char)arg[0]) || (arg[0] == '-' && arg.size() > 1));
+  };
+  size_t original_units = units.size();
+  for(size_t u = 0; u < original_units; u++) {
+    if(!live[u] || units[u].name == "main" || !sites.count(units[u].name)) continue;
+    auto &calls = sites[units[u].name];
+    auto func = units[u].func;
+    ctx->func_name = func->ident;
+    // 可以当作常量的参数: int 参数, 在函数中没被赋值
+    vector<int> candidates;
+    for(size_t j = 0; j < func->func_f_param_list->size(); j++) {
+      auto param = dynamic_cast<FuncFParamAST*>((*func->func_f_param_list)[j].get());
+      if(param->const_index_list || units[u].facts.assigned.count("FUNC_" + func->ident + "_" + param->ident)) continue;
+      bool same = true;
+      for(auto &call : calls) same = same && is_integer(call->args[j]) && call->args[j] == calls[0]->args[j];
+      if(!same) {
+        candidates.push_back(j);
+        continue;
+      }
+      units[u].bound[param->ident] = stoi(calls[0]->args[j]);
+      units[u].regenerate = true;
+      remark(Remark::Passed, "ipo", "ConstantArgument", param,
+             "parameter " + param->ident + " is " + calls[0]->args[j] + " at every call, propagated into " + func->ident);
+    }
+    if(candidates.empty() || units[u].ir.size() > max_clone_size) continue;
+    // 其余的参数按调用处的常量实参分组
+    map<map<int, int>, int> weights;
+    for(auto &call : calls) {
+      map<int, int> key;
+      for(int j : candidates)
+        if(is_integer(call->args[j])) key[j] = stoi(call->args[j]);
+      if(!key.empty()) weights[key] += call->loop_depth ? 10 : 1;
+    }
+    vector<pair<int, map<int, int>>> hot;
+    for(auto &w : weights)
+      if(w.second >= min_clone_weight) hot.emplace_back(-w.second, w.first);
+    sort(hot.begin(), hot.end());
+    if(hot.size() > max_clones) hot.resize(max_clones);
+    for(auto &h : hot) {
+      Unit clone;
+      clone.func = func;
+      for(int n = 0; clone.name.empty() || unit_index.count(clone.name) || ctx->symbol_table_stack[0]->count(clone.name); n++)
+        clone.name = func->ident + "_spec" + to_string(n);
+      clone.bound = units[u].bound;
+      clone.clone_args = h.second;
+      string args;
+      for(auto &arg : h.second) {
+        auto param = dynamic_cast<FuncFParamAST*>((*func->func_f_param_list)[arg.first].get());
+        clone.bound[param->ident] = arg.second;
+        args += (args.empty() ? "" : ", ") + param->ident + " = " + to_string(arg.second);
+      }
+      clone.regenerate = true;
+      remark(Remark::Passed, "ipo", "Specialized", func,
+             "specialized " + func->ident + " as " + clone.name + " for calls with " + args);
+      ctx->clones[func->ident].push_back({h.second, clone.name});
+      unit_index[clone.name] = units.size();
+      units.push_back(std::move(clone));
+    }
+  }
+  // 有调用改为调用副本的函数也要重新生成
+  for(size_t u = 0; u < original_units; u++)
+    for(auto &call : units[u].facts.calls)
+      if(live[u] && call_target(call.callee, call.args) != call.callee) units[u].regenerate = true;
+
+  // 重新生成时不再记优化报告, 以免与第一遍重复
+  Remarks *remarks = ctx->remarks;
+  ctx->remarks = nullptr;
+  for(auto &unit : units) {
+    if(!unit.regenerate) continue;
+    ostringstream buffer;
+    RedirectOutput redirect(ctx->out, buffer);
+    ctx->bound_params = unit.bound;
+    ctx->emit_name = unit.name == unit.func->ident ? "" : unit.name;
+    ctx->const_epoch++;
+    unit.facts = FrontendContext::FunctionFacts();
+    ctx->facts = &unit.facts;
+    unit.func->KoopaIR();
+    ctx->facts = nullptr;
+    finish_item();
+    unit.ir = buffer.str();
+  }
+  ctx->bound_params.clear();
+  ctx->emit_name.clear();
+  ctx->const_epoch++;
+  ctx->remarks = remarks;
+
+  runtime.clear();
+  live = reachable(runtime);
+  for(auto &decl : runtime_decls)
+    if(runtime.count(decl.first)) ctx->out << decl.second << "\n";
+  ctx->out << endl;
+  for(size_t k = 0; k < comp_unit_item_list->size(); k++) {
+    if(item_unit[k] < 0) {
+      ctx->out << decl_ir[k];
+      continue;
+    }
+    auto &unit = units[item_unit[k]];
+    ctx->func_name = unit.name;
+    if(!live[item_unit[k]]) {
+      remark(Remark::Passed, "ipo", "DeadFunction", unit.func,
+             "removed function " + unit.name + ", which is not reachable from main");
+      continue;
+    }
+    ctx->out << unit.ir;
+    // 副本紧跟在原函数之后
+    auto clones = ctx->clones.find(unit.name);
+    if(clones == ctx->clones.end()) continue;
+    for(auto &clone : clones->second)
+      if(live[unit_index[clone.name]]) ctx->out << units[unit_index[clone.name]].ir;
+  }
+  ctx->func_name.clear();
+}
+
 class ExpAST : public BaseAST {
  public:
   unique_ptr<BaseAST> lor_exp;
 
+  ~ExpAST() override { release_children(this); }
   void Dump() const override {
     cout << "EXPAST { ";
     lor_exp->Dump();
     cout << " }";
   }
   void KoopaIR() const override {
-    lor_exp->KoopaIR();
+    walk_koopa(this);
+  }
+  void CondIR(const string &true_label, const string &false_label) const override {
+    walk_cond(this, true_label, false_label);
   }
   int Calculate() const override {
-    return lor_exp->Calculate();
+    return walk_calculate(this);
+  }
+  const BaseAST *KoopaIRStep(WalkFrame &f) const override {
+    return only_child(f, lor_exp);
+  }
+  const BaseAST *CondIRStep(WalkFrame &f, WalkFrame &child) const override {
+    return only_child(f, child, lor_exp);
+  }
+  const BaseAST *CalculateStep(WalkFrame &f, int &value) const override {
+    return only_child(f, lor_exp);
+  }
+  const BaseAST *CheckConstStep(WalkFrame &f, bool &value) const override {
+    return only_child(f, lor_exp);
+  }
+  void TakeChildren(vector<unique_ptr<BaseAST>> &out) override {
+    take_child(out, lor_exp);
   }
 };
 
@@ -355,83 +990,98 @@ class LValAST: public BaseAST{
     string ident;
     unique_ptr<vector<unique_ptr<BaseAST>>> index_list;
 
+    ~LValAST() override { release_children(this); }
     void Dump() const override {
       cout << "LVal { ";
       cout << ident;
       cout << " }";
     }
     void KoopaIR() const override {
-      string target_ident = get_target_ident(ident)[0];
-      string target_type = get_target_ident(ident)[1];
-      string target_value = get_target_ident(ident)[2];
+      walk_koopa(this);
+    }
+    // 第 i 步 (i >= 1) 时第 i-1 个下标刚求出值, 下标都求完后取出元素
+    const BaseAST *KoopaIRStep(WalkFrame &f) const override {
+      vector<string> target = get_target_ident(ident);
+      string target_ident = target[0];
+      string target_type = target[1];
+      string target_value = target[2];
+      int i = f.step++ - 1;
       if(target_type=="array"||target_type=="const array"){
         // 数组
-        for (int i = 0; i < index_list->size(); i++) {
-          const auto& exp_index = (*index_list)[i];
-          dynamic_cast<ExpAST*>(exp_index.get())->KoopaIR();
-          cout << "  %" << current_id << " = getelemptr ";
-          if(i == 0) cout << "@" << get_target_ident(ident)[0];
-          else cout <<nums[nums.size()-2]; // 上一个 getelemptr 的结果
-          cout << ", " << nums.back() << endl;
-          nums.pop_back();
-          if(i!=0) nums.pop_back();
-          nums.push_back("%"+to_string(current_id));
-          current_id++;
+        if(i >= 0) {
+          ctx->out << "  %" << ctx->current_id << " = getelemptr ";
+          if(i == 0) ctx->out << "@" << target_ident;
+          else ctx->out <<ctx->nums[ctx->nums.size()-2]; // 上一个 getelemptr 的结果
+          ctx->out << ", " << ctx->nums.back() << endl;
+          ctx->nums.pop_back();
+          if(i!=0) ctx->nums.pop_back();
+          ctx->nums.push_back("%"+to_string(ctx->current_id));
+          ctx->current_id++;
         }
+        if(i + 1 < (int)index_list->size()) return (*index_list)[i + 1].get();
         if(index_list->size()==0)
         {
-          cout << "  %" << current_id << " = getelemptr @" << target_ident << ", 0" << endl;
-          nums.push_back("%"+to_string(current_id));
-          current_id++;
-          return ;
+          ctx->out << "  %" << ctx->current_id << " = getelemptr @" << target_ident << ", 0" << endl;
+          ctx->nums.push_back("%"+to_string(ctx->current_id));
+          ctx->current_id++;
+          return nullptr;
         }
         if(stoi(target_value)!=index_list->size())
-          cout << "  %" << current_id << " = getelemptr " << nums.back() << ", 0" << endl;
+          ctx->out << "  %" << ctx->current_id << " = getelemptr " << ctx->nums.back() << ", 0" << endl;
         else
-          cout << "  %" << current_id << " = load " << nums.back() << endl;
-        nums.pop_back();
-        nums.push_back("%"+to_string(current_id));
-        current_id++;
+          ctx->out << "  %" << ctx->current_id << " = load " << ctx->nums.back() << endl;
+        ctx->nums.pop_back();
+        ctx->nums.push_back("%"+to_string(ctx->current_id));
+        ctx->current_id++;
       } else if(target_type=="var"||target_type=="const"){
         // 变量
         if(target_ident=="") throw("undefined variable: " + ident);
-        if(target_type=="const") nums.push_back(target_value);
+        if(target_type=="const") ctx->nums.push_back(target_value);
         else{
-          cout << "  %"<< current_id << " = load @" << target_ident << endl;
-          nums.push_back("%"+to_string(current_id));
-          current_id++;
+          ctx->out << "  %"<< ctx->current_id << " = load @" << target_ident << endl;
+          ctx->nums.push_back("%"+to_string(ctx->current_id));
+          ctx->current_id++;
         }
       } else if(target_type=="ptr"){
-        // 指针
-        cout << "  %"<< current_id << " = load @" << target_ident << endl;
-        current_id++;
-        for (int i = 0; i<index_list->size(); i++) {
-          int lastptr_current_id = current_id-1;
-          const auto& exp_index = (*index_list)[i];
-          dynamic_cast<ExpAST*>(exp_index.get())->KoopaIR();
-          if(i==0) std::cout << "  %" << current_id << " = getptr %";
-          else std::cout << "  %" << current_id << " = getelemptr %";
-          std::cout << lastptr_current_id << ", " << nums.back() << std::endl;
-          nums.pop_back();
-          current_id++;
+        // 指针, f.saved 为上一个 getptr/getelemptr 的结果
+        if(i < 0) {
+          ctx->out << "  %"<< ctx->current_id << " = load @" << target_ident << endl;
+          ctx->current_id++;
+        } else {
+          if(i==0) ctx->out << "  %" << ctx->current_id << " = getptr %";
+          else ctx->out << "  %" << ctx->current_id << " = getelemptr %";
+          ctx->out << f.saved << ", " << ctx->nums.back() << std::endl;
+          ctx->nums.pop_back();
+          ctx->current_id++;
+        }
+        if(i + 1 < (int)index_list->size()) {
+          f.saved = ctx->current_id-1;
+          return (*index_list)[i + 1].get();
         }
         if(index_list->size()==0)
         {
-          cout << "  %" << current_id << " = getptr %" << current_id-1 << ", 0" << endl;
-          nums.push_back("%"+to_string(current_id));
-          current_id++;
-          return ;
+          ctx->out << "  %" << ctx->current_id << " = getptr %" << ctx->current_id-1 << ", 0" << endl;
+          ctx->nums.push_back("%"+to_string(ctx->current_id));
+          ctx->current_id++;
+          return nullptr;
         }
         if(stoi(target_value)!=index_list->size())
-          std::cout << "  %" << current_id << " = getelemptr %" << current_id-1 << ", 0" << std::endl;
+          ctx->out << "  %" << ctx->current_id << " = getelemptr %" << ctx->current_id-1 << ", 0" << std::endl;
         else
-          std::cout << "  %" << current_id << " = load %" << current_id-1 << std::endl;
-        nums.push_back("%"+to_string(current_id));
-        current_id++;
+          ctx->out << "  %" << ctx->current_id << " = load %" << ctx->current_id-1 << std::endl;
+        ctx->nums.push_back("%"+to_string(ctx->current_id));
+        ctx->current_id++;
       } else throw("In LVal undefined variable type: " + target_type);
+      return nullptr;
+    }
+    void TakeChildren(vector<unique_ptr<BaseAST>> &out) override {
+      take_child(out, index_list);
     }
     int Calculate() const override {
-      return symbol_table_stack.back()->at(get_target_ident(ident)[0]);
+      return stoi(get_target_ident(ident)[2]);
+    }
+    bool CheckConst() const override {
+      return get_target_ident(ident)[1]=="const";
     }
 };
 
@@ -439,6 +1089,7 @@ class BlockAST : public BaseAST {
  public:
   unique_ptr<vector<unique_ptr<BaseAST>>> block_item_list;
 
+  ~BlockAST() override { release_children(this); }
   void Dump() const override {
     if(!block_item_list) return;
     cout << "Block { ";
@@ -449,19 +1100,29 @@ class BlockAST : public BaseAST {
     cout << " }";
   }
   void KoopaIR() const override {
-    if(!block_item_list) return;
-    enter_block();
+    walk_koopa(this);
+  }
+  // 第 k 步生成第 k 项
+  const BaseAST *KoopaIRStep(WalkFrame &f) const override {
+    if(!block_item_list) return nullptr;
+    if(f.step == 0) enter_block();
     
-    for(auto &i:*block_item_list){
-      if(fun_ret_flag) break;
-      i->KoopaIR();
+    size_t k = f.step++;
+    if(k < block_item_list->size()){
+      if(!ctx->fun_ret_flag) return (*block_item_list)[k].get();
+      auto &first = (*block_item_list)[k];
+      remark(Remark::Passed, "unreachable", "UnreachableRemoved", first.get(),
+             "removed " + to_string(block_item_list->size() - k) + " unreachable statement(s) after return, break or continue");
     }
     exit_block();
-    
+    return nullptr;
   }
   int Calculate() const override {
     return 0;
   }
+  void TakeChildren(vector<unique_ptr<BaseAST>> &out) override {
+    take_child(out, block_item_list);
+  }
 };
 
 class BlockItemAST: public BaseAST{
@@ -469,6 +1130,7 @@ class BlockItemAST: public BaseAST{
     unique_ptr<BaseAST> stmt;
     unique_ptr<BaseAST> decl;
 
+    ~BlockItemAST() override { release_children(this); }
     void Dump() const override {
       cout << "BlockItem { ";
       if(stmt){
@@ -482,34 +1144,42 @@ class BlockItemAST: public BaseAST{
       cout << " }";
     }
     void KoopaIR() const override {
-      if(stmt){
-        stmt->KoopaIR();
-      }
-      if(decl){
-        decl->KoopaIR();
-      }
-      
+      walk_koopa(this);
+    }
+    const BaseAST *KoopaIRStep(WalkFrame &f) const override {
+      return only_child(f, stmt ? stmt : decl);
     }
     int Calculate() const override {
       return 0;
     }
+    void TakeChildren(vector<unique_ptr<BaseAST>> &out) override {
+      take_child(out, stmt);
+      take_child(out, decl);
+    }
 };
 
 class IfStmtAST: public BaseAST{
   public:
     unique_ptr<BaseAST> if_stmt;
 
+    ~IfStmtAST() override { release_children(this); }
     void Dump() const override {
       cout << "IfStmt { ";
       if_stmt->Dump();
       cout << " }";
     }
     void KoopaIR() const override {
-      if_stmt->KoopaIR();
+      walk_koopa(this);
+    }
+    const BaseAST *KoopaIRStep(WalkFrame &f) const override {
+      return only_child(f, if_stmt);
     }
     int Calculate() const override {
       return 0;
     }
+    void TakeChildren(vector<unique_ptr<BaseAST>> &out) override {
+      take_child(out, if_stmt);
+    }
 };
 
 class OnlyIfAST: public BaseAST{
@@ -517,6 +1187,7 @@ class OnlyIfAST: public BaseAST{
     unique_ptr<BaseAST> exp;
     unique_ptr<BaseAST> stmt;
 
+    ~OnlyIfAST() override { release_children(this); }
     void Dump() const override {
       cout << "OnlyIf { ";
       exp->Dump();
@@ -525,24 +1196,35 @@ class OnlyIfAST: public BaseAST{
       cout << " }";
     }
     void KoopaIR() const override {
-      if(fun_ret_flag) return;
-      int now_if = if_id++;
-      exp->KoopaIR();
-      cout << "  br " << nums.back() << ", %If_" << now_if << ", %IfEnd_" << now_if << endl; 
-      nums.pop_back();
-
-      cout << "%If_" << now_if << ":" << endl;
-      fun_ret_flag=0;
-      block_name="If_" + to_string(now_if) + "_";
-      stmt->KoopaIR();
-      if(!fun_ret_flag) cout << "  jump %IfEnd_" << now_if << endl;
+      walk_koopa(this);
+    }
+    const BaseAST *KoopaIRStep(WalkFrame &f) const override {
+      if(f.step++ == 0){
+        if(ctx->fun_ret_flag) return nullptr;
+        int now_if = f.saved = ctx->if_id++;
+        exp->CondIR("%If_" + to_string(now_if), "%IfEnd_" + to_string(now_if));
+
+        ctx->out << "%If_" << now_if << ":" << endl;
+        block_location("If_" + to_string(now_if), stmt.get());
+        ctx->fun_ret_flag=0;
+        ctx->block_name="If_" + to_string(now_if) + "_";
+        return stmt.get();
+      }
+      int now_if = f.saved;
+      if(!ctx->fun_ret_flag) ctx->out << "  jump %IfEnd_" << now_if << endl;
 
-      cout << "%IfEnd_" << now_if << ":" <<endl;
-      fun_ret_flag=0;
+      ctx->out << "%IfEnd_" << now_if << ":" <<endl;
+      block_location("IfEnd_" + to_string(now_if), this);
+      ctx->fun_ret_flag=0;
+      return nullptr;
     }
     int Calculate() const override {
       return 0;
     }
+    void TakeChildren(vector<unique_ptr<BaseAST>> &out) override {
+      take_child(out, exp);
+      take_child(out, stmt);
+    }
 };
 
 class IfElseAST: public BaseAST{
@@ -551,6 +1233,7 @@ class IfElseAST: public BaseAST{
     unique_ptr<BaseAST> if_stmt;
     unique_ptr<BaseAST> else_stmt;
 
+    ~IfElseAST() override { release_children(this); }
     void Dump() const override {
       cout << "IfElse { ";
       exp->Dump();
@@ -561,30 +1244,45 @@ class IfElseAST: public BaseAST{
       cout << " }";
     }
     void KoopaIR() const override {
-      if(fun_ret_flag) return;
-      int now_if=if_id++;
-      exp->KoopaIR();
-      cout << "  br " << nums.back() << ", %If_" << now_if << ", %Else_" << now_if << endl; 
-      nums.pop_back();
-
-      cout << "%If_" << now_if << ":" << endl;
-      fun_ret_flag=0;
-      block_name="If_" + to_string(now_if) + "_";
-      if_stmt->KoopaIR();
-      if(!fun_ret_flag) cout << "  jump %IfEnd_" << now_if << endl;
-
-      cout << "%Else_" << now_if << ":" <<endl;
-      fun_ret_flag=0;
-      block_name="Else_" + to_string(now_if) + "_";
-      else_stmt->KoopaIR();
-      if(!fun_ret_flag) cout << "  jump %IfEnd_" << now_if << endl;
+      walk_koopa(this);
+    }
+    const BaseAST *KoopaIRStep(WalkFrame &f) const override {
+      int now_if = f.saved;
+      switch(f.step++){
+        case 0:
+          if(ctx->fun_ret_flag) return nullptr;
+          now_if = f.saved = ctx->if_id++;
+          exp->CondIR("%If_" + to_string(now_if), "%Else_" + to_string(now_if));
+
+          ctx->out << "%If_" << now_if << ":" << endl;
+          block_location("If_" + to_string(now_if), if_stmt.get());
+          ctx->fun_ret_flag=0;
+          ctx->block_name="If_" + to_string(now_if) + "_";
+          return if_stmt.get();
+        case 1:
+          if(!ctx->fun_ret_flag) ctx->out << "  jump %IfEnd_" << now_if << endl;
+
+          ctx->out << "%Else_" << now_if << ":" <<endl;
+          block_location("Else_" + to_string(now_if), else_stmt.get());
+          ctx->fun_ret_flag=0;
+          ctx->block_name="Else_" + to_string(now_if) + "_";
+          return else_stmt.get();
+      }
+      if(!ctx->fun_ret_flag) ctx->out << "  jump %IfEnd_" << now_if << endl;
 
-      cout << "%IfEnd_" << now_if << ":" <<endl;
-      fun_ret_flag=0;
+      ctx->out << "%IfEnd_" << now_if << ":" <<endl;
+      block_location("IfEnd_" + to_string(now_if), this);
+      ctx->fun_ret_flag=0;
+      return nullptr;
     }
     int Calculate() const override {
       return 0;
     }
+    void TakeChildren(vector<unique_ptr<BaseAST>> &out) override {
+      take_child(out, exp);
+      take_child(out, if_stmt);
+      take_child(out, else_stmt);
+    }
 };
 
 class StmtAST : public BaseAST {
@@ -599,6 +1297,7 @@ class StmtAST : public BaseAST {
   bool continue_;
   bool return_;
 
+  ~StmtAST() override { release_children(this); }
   void Dump() const override {
     cout << "StmtAST { ";
     if(block){
@@ -618,14 +1317,18 @@ class StmtAST : public BaseAST {
     cout << " }";
   }
   void KoopaIR() const override {
+    walk_koopa(this);
+  }
+  // 赋值、return、break 和 continue 一步做完; 块、if 和 while 中的语句交给工作栈
+  const BaseAST *KoopaIRStep(WalkFrame &f) const override {
     if (block){
-      block->KoopaIR();
+      return only_child(f, block);
     } else if(exp_only){
-      exp_only->KoopaIR();
+      return only_child(f, exp_only);
     } else if (lval) {
       exp->KoopaIR();
-      string exp_save = nums.back();
-      nums.pop_back();
+      string exp_save = ctx->nums.back();
+      ctx->nums.pop_back();
       auto lval_ptr = dynamic_cast<LValAST*>(lval.get());
       string ident = lval_ptr->ident;
       string target_ident = get_target_ident(ident)[0];
@@ -635,89 +1338,101 @@ class StmtAST : public BaseAST {
         for (int i = 0; i < lval_ptr->index_list->size(); i++) {
           const auto& exp_index = (*(lval_ptr->index_list))[i];
           dynamic_cast<ExpAST*>(exp_index.get())->KoopaIR();
-          cout << "  %" << current_id << " = getelemptr ";
-          if(i == 0)cout << "@" << get_target_ident(lval_ptr->ident)[0];
-          else cout << nums[nums.size()-2]; // 上一个 getelemptr 的结果
-          cout << ", " << nums.back() << endl;
-          nums.pop_back();
-          if(i!=0) nums.pop_back();
-          nums.push_back("%"+to_string(current_id));
-          current_id++;
+          ctx->out << "  %" << ctx->current_id << " = getelemptr ";
+          if(i == 0)ctx->out << "@" << get_target_ident(lval_ptr->ident)[0];
+          else ctx->out << ctx->nums[ctx->nums.size()-2]; // 上一个 getelemptr 的结果
+          ctx->out << ", " << ctx->nums.back() << endl;
+          ctx->nums.pop_back();
+          if(i!=0) ctx->nums.pop_back();
+          ctx->nums.push_back("%"+to_string(ctx->current_id));
+          ctx->current_id++;
         }
-        cout << "  store " << exp_save << ", " << nums.back() << endl;
-        nums.pop_back();
+        ctx->out << "  store " << exp_save << ", " << ctx->nums.back() << endl;
+        ctx->nums.pop_back();
       } else if(target_type=="var" || target_type=="const"){
         // LVal为变量
-        cout << "  store " << exp_save << ", @";
+        ctx->out << "  store " << exp_save << ", @";
         if(target_ident=="") throw("undefined variable: " + ident);
-        cout << target_ident << endl;
+        if(ctx->facts) ctx->facts->assigned.insert(target_ident);
+        ctx->out << target_ident << endl;
       } else if (target_type=="ptr"){
-        std::cout << "  %" << current_id << " = load @" << target_ident << std::endl;
-        current_id++;
+        ctx->out << "  %" << ctx->current_id << " = load @" << target_ident << std::endl;
+        ctx->current_id++;
         for (int i = 0; i<lval_ptr->index_list->size(); i++) {
-          int lastptr_current_id = current_id-1;
+          int lastptr_current_id = ctx->current_id-1;
           const auto& exp_index = (*(lval_ptr->index_list))[i];
           dynamic_cast<ExpAST*>(exp_index.get())->KoopaIR();
           if(i==0)
-            std::cout << "  %" << current_id << " = getptr %";
+            ctx->out << "  %" << ctx->current_id << " = getptr %";
           else
-            std::cout << "  %" << current_id << " = getelemptr %";
-          std::cout << lastptr_current_id << ", " << nums.back() << std::endl;
-          nums.pop_back();
-          current_id++;
+            ctx->out << "  %" << ctx->current_id << " = getelemptr %";
+          ctx->out << lastptr_current_id << ", " << ctx->nums.back() << std::endl;
+          ctx->nums.pop_back();
+          ctx->current_id++;
         }
-        std::cout << "  store " << exp_save << ", %" << current_id-1 << std::endl;
+        ctx->out << "  store " << exp_save << ", %" << ctx->current_id-1 << std::endl;
       } else throw("In Stmt undefined variable type: " + target_type);
     } else if(return_){
-      if(fun_ret_flag) return;
+      if(ctx->fun_ret_flag) return nullptr;
       if(!exp)
       {
-        cout<<"  ret"<<endl;
-        fun_ret_flag=1;
-        return ;
+        ctx->out<<"  ret"<<endl;
+        ctx->fun_ret_flag=1;
+        return nullptr;
       }
       exp->KoopaIR();
-      cout<<"  ret "<<nums.back()<<endl;
-      fun_ret_flag=1;
-      nums.pop_back();
+      ctx->out<<"  ret "<<ctx->nums.back()<<endl;
+      ctx->fun_ret_flag=1;
+      ctx->nums.pop_back();
     } else if(if_stmt){
-      if_stmt->KoopaIR();
+      return only_child(f, if_stmt);
+    } else if(while_stmt && f.step++ == 0){
+      if(ctx->fun_ret_flag) return nullptr;
+      f.saved=ctx->now_while; // 外层循环的编号, 循环体生成完后恢复
+      ctx->now_while=ctx->while_id++;
+      ctx->loop_depth++;
+      ctx->out<<"  jump %While_"<<ctx->now_while<<endl;
+      ctx->out<<"%While_"<<ctx->now_while<<":"<<endl;
+      block_location("While_" + to_string(ctx->now_while), this);
+      ctx->fun_ret_flag=0;
+      ctx->block_name="While_" + to_string(ctx->now_while) + "_";
+      exp->CondIR("%WhileBody_" + to_string(ctx->now_while), "%WhileEnd_" + to_string(ctx->now_while));
+
+      ctx->out << "%WhileBody_" << ctx->now_while << ":" << endl;
+      block_location("WhileBody_" + to_string(ctx->now_while), while_stmt.get());
+      ctx->fun_ret_flag=0;
+      ctx->block_name="WhileBody_" + to_string(ctx->now_while) + "_";
+      return while_stmt.get();
     } else if(while_stmt){
-      if(fun_ret_flag) return;
-      int save_while=now_while;
-      now_while=while_id++;
-      cout<<"  jump %While_"<<now_while<<endl;
-      cout<<"%While_"<<now_while<<":"<<endl;
-      fun_ret_flag=0;
-      block_name="While_" + to_string(now_while) + "_";
-      exp->KoopaIR();
-      cout << "  br " << nums.back() << ", %WhileBody_" << now_while << ", %WhileEnd_" << now_while << endl; 
-      nums.pop_back();
-
-      cout << "%WhileBody_" << now_while << ":" << endl;
-      fun_ret_flag=0;
-      block_name="WhileBody_" + to_string(now_while) + "_";
-      while_stmt->KoopaIR();
-      if(!fun_ret_flag) cout << "  jump %While_" << now_while << endl;
-
-      cout << "%WhileEnd_" << now_while << ":" <<endl;
-      now_while=save_while;
-      fun_ret_flag=0;
+      if(!ctx->fun_ret_flag) ctx->out << "  jump %While_" << ctx->now_while << endl;
+      ctx->loop_depth--;
+
+      ctx->out << "%WhileEnd_" << ctx->now_while << ":" <<endl;
+      block_location("WhileEnd_" + to_string(ctx->now_while), this);
+      ctx->now_while=f.saved;
+      ctx->fun_ret_flag=0;
     } else if(break_){
-      // if(fun_ret_flag) return;
-      cout << "  jump %WhileEnd_" << now_while << endl;
-      fun_ret_flag=1;
+      // if(ctx->fun_ret_flag) return;
+      ctx->out << "  jump %WhileEnd_" << ctx->now_while << endl;
+      ctx->fun_ret_flag=1;
     } else if(continue_){
-      // if(fun_ret_flag) return;
-      cout << "  jump %While_" << now_while << endl;
-      fun_ret_flag=1;
+      // if(ctx->fun_ret_flag) return;
+      ctx->out << "  jump %While_" << ctx->now_while << endl;
+      ctx->fun_ret_flag=1;
     }
-    
-    
+    return nullptr;
   }
   int Calculate() const override {
     return 0;
   }
+  void TakeChildren(vector<unique_ptr<BaseAST>> &out) override {
+    take_child(out, exp);
+    take_child(out, lval);
+    take_child(out, block);
+    take_child(out, exp_only);
+    take_child(out, if_stmt);
+    take_child(out, while_stmt);
+  }
 };
 
 class PrimaryExpAST : public BaseAST {
@@ -726,6 +1441,7 @@ class PrimaryExpAST : public BaseAST {
   unique_ptr<BaseAST> number;
   unique_ptr<BaseAST> lval;
 
+  ~PrimaryExpAST() override { release_children(this); }
   void Dump() const override {
     cout << "PrimaryExpAST { ";
     if (exp) {
@@ -738,22 +1454,37 @@ class PrimaryExpAST : public BaseAST {
     cout << " }";
   }
   void KoopaIR() const override {
-    if (exp) {
-      exp->KoopaIR();
-    } else if (number) {
-      number->KoopaIR();
-    } else {
-      lval->KoopaIR();
-    }
+    walk_koopa(this);
+  }
+  void CondIR(const string &true_label, const string &false_label) const override {
+    walk_cond(this, true_label, false_label);
   }
   int Calculate() const override {
-    if (exp) {
-      return exp->Calculate();
-    } else if (number) {
-      return number->Calculate();
-    } else {
-      return lval->Calculate();
-    }
+    return walk_calculate(this);
+  }
+  const BaseAST *KoopaIRStep(WalkFrame &f) const override {
+    return only_child(f, child());
+  }
+  const BaseAST *CondIRStep(WalkFrame &f, WalkFrame &child) const override {
+    if (exp) return only_child(f, child, exp);
+    BaseAST::CondIR(f.true_label, f.false_label);
+    return nullptr;
+  }
+  const BaseAST *CalculateStep(WalkFrame &f, int &value) const override {
+    return only_child(f, child());
+  }
+  const BaseAST *CheckConstStep(WalkFrame &f, bool &value) const override {
+    return only_child(f, child());
+  }
+  void TakeChildren(vector<unique_ptr<BaseAST>> &out) override {
+    take_child(out, exp);
+    take_child(out, number);
+    take_child(out, lval);
+  }
+
+ private:
+  const unique_ptr<BaseAST> &child() const {
+    return exp ? exp : number ? number : lval;
   }
 };
 
@@ -765,14 +1496,17 @@ class UnaryExpAST : public BaseAST {
   string ident;
   unique_ptr<vector<unique_ptr<BaseAST>>> func_r_param_list;
 
+  ~UnaryExpAST() override { release_children(this); }
   void Dump() const override {
     return;
   }
   void KoopaIR() const override {
-    if (primary_exp) {
-      primary_exp->KoopaIR();
-    } else if(unary_exp) {
-      unary_exp->KoopaIR();
+    walk_koopa(this);
+  }
+  const BaseAST *KoopaIRStep(WalkFrame &f) const override {
+    if (primary_exp) return only_child(f, primary_exp);
+    if (unary_exp) {
+      if (f.step++ == 0) return fold_const(this) ? nullptr : unary_exp.get();
       switch(unary_op)
       {
         case '-':
@@ -783,48 +1517,84 @@ class UnaryExpAST : public BaseAST {
           break;
       }
     } else if(ident!=""){
-      int cnt=0, sz=func_r_param_list->size();
-      for(auto &param:*func_r_param_list){
-        param->KoopaIR();
-        cnt++;
-      }
-
-      if(symbol_type_stack[0]->at(ident)=="Func_int")
-        cout << "  %"<< current_id << " = call @" << ident << "(";
+      // 依次求出各个实参, 都求出后生成调用
+      int sz=func_r_param_list->size();
+      if (f.step < sz) return (*func_r_param_list)[f.step++].get();
+
+      // 实参与某个特化出的副本相符时改为调用副本
+      vector<string> args(ctx->nums.end() - sz, ctx->nums.end());
+      string callee = call_target(ident, args);
+      if(ctx->facts) ctx->facts->calls.push_back({callee, args, ctx->loop_depth});
+      if(ctx->symbol_type_stack[0]->at(ident)=="Func_int")
+        ctx->out << "  %"<< ctx->current_id << " = call @" << callee << "(";
       else
-        cout << "  call @" << ident << "(";
+        ctx->out << "  call @" << callee << "(";
       
       for(int i=sz-1;i>=0;i--)
       {
-        cout << nums[nums.size()-1-i];
-        if(i!=0) cout<<", ";
+        ctx->out << ctx->nums[ctx->nums.size()-1-i];
+        if(i!=0) ctx->out<<", ";
       }
-      for(int i=sz-1;i>=0;i--) nums.pop_back();
-      cout<<")"<<endl;
+      for(int i=sz-1;i>=0;i--) ctx->nums.pop_back();
+      ctx->out<<")"<<endl;
 
-      if(symbol_type_stack[0]->at(ident)=="Func_int")
+      if(ctx->symbol_type_stack[0]->at(ident)=="Func_int")
       {
-        nums.push_back("%"+to_string(current_id));
-        current_id++;
+        ctx->nums.push_back("%"+to_string(ctx->current_id));
+        ctx->current_id++;
       }
     }
+    return nullptr;
+  }
+  void CondIR(const string &true_label, const string &false_label) const override {
+    walk_cond(this, true_label, false_label);
+  }
+  const BaseAST *CondIRStep(WalkFrame &f, WalkFrame &child) const override {
+    if (f.step++) return nullptr;
+    if (IsConst() || (!primary_exp && !unary_exp)) {
+      BaseAST::CondIR(f.true_label, f.false_label);
+      return nullptr;
+    }
+    if (primary_exp) return branch(child, primary_exp, f.true_label, f.false_label);
+    // !x 为真当且仅当 x 为假; -x 和 +x 与 x 同真假
+    if (unary_op == '!') return branch(child, unary_exp, f.false_label, f.true_label);
+    return branch(child, unary_exp, f.true_label, f.false_label);
   }
   int Calculate() const override {
-    if(primary_exp){
-      return primary_exp->Calculate();
-    }
-    else{
-      switch(unary_op)
-      {
-        case '-':
-          return -unary_exp->Calculate();
-        case '!':
-          return !unary_exp->Calculate();
-        case '+':
-          return unary_exp->Calculate();
-      }
-    }
-    return 0;
+    return walk_calculate(this);
+  }
+  const BaseAST *CalculateStep(WalkFrame &f, int &value) const override {
+    if(primary_exp) return only_child(f, primary_exp);
+    if(!unary_exp) {
+      value = 0; // 函数调用
+      return nullptr;
+    }
+    if(f.step++ == 0) return unary_exp.get();
+    switch(unary_op)
+    {
+      case '-':
+        value = int(0u - unsigned(value));
+        break;
+      case '!':
+        value = !value;
+        break;
+      case '+':
+        break;
+      default:
+        value = 0;
+    }
+    return nullptr;
+  }
+  const BaseAST *CheckConstStep(WalkFrame &f, bool &value) const override {
+    if(primary_exp) return only_child(f, primary_exp);
+    if(unary_exp) return only_child(f, unary_exp);
+    value = false; // 函数调用
+    return nullptr;
+  }
+  void TakeChildren(vector<unique_ptr<BaseAST>> &out) override {
+    take_child(out, primary_exp);
+    take_child(out, unary_exp);
+    take_child(out, func_r_param_list);
   }
 };
 
@@ -838,11 +1608,14 @@ class NumberAST : public BaseAST {
     cout << " }";
   }
   void KoopaIR() const override {
-    nums.push_back(to_string(n));
+    ctx->nums.push_back(to_string(n));
   }
   int Calculate() const override {
     return n;
   }
+  bool CheckConst() const override {
+    return true;
+  }
 };
 
 class AddExpAST : public BaseAST {
@@ -851,6 +1624,7 @@ class AddExpAST : public BaseAST {
   unique_ptr<BaseAST> mul_exp;
   char add_op;
 
+  ~AddExpAST() override { release_children(this); }
   void Dump() const override {
     cout << "AddExpAST { ";
     if (add_exp) {
@@ -863,26 +1637,46 @@ class AddExpAST : public BaseAST {
     cout << " }";
   }
   void KoopaIR() const override {
-    if (add_exp) {
-      add_exp->KoopaIR();
-      mul_exp->KoopaIR();
-      KoopaIR_two_operands(CalOp2Instruct[add_op]);
-    } else {
-      mul_exp->KoopaIR();
-    }
+    walk_koopa(this);
+  }
+  const BaseAST *KoopaIRStep(WalkFrame &f) const override {
+    if (!add_exp) return only_child(f, mul_exp);
+    if (f.step == 0 && fold_const(this)) return nullptr;
+    if (auto next = operands(f, add_exp, mul_exp)) return next;
+    KoopaIR_two_operands(CalOp2Instruct.at(add_op));
+    return nullptr;
+  }
+  void CondIR(const string &true_label, const string &false_label) const override {
+    walk_cond(this, true_label, false_label);
+  }
+  const BaseAST *CondIRStep(WalkFrame &f, WalkFrame &child) const override {
+    if (!add_exp) return only_child(f, child, mul_exp);
+    BaseAST::CondIR(f.true_label, f.false_label);
+    return nullptr;
   }
   int Calculate() const override {
-    if(add_exp){
-      if(add_op=='+'){
-        return add_exp->Calculate() + mul_exp->Calculate();
-      }
-      else{
-        return add_exp->Calculate() - mul_exp->Calculate();
-      }
+    return walk_calculate(this);
+  }
+  const BaseAST *CalculateStep(WalkFrame &f, int &value) const override {
+    if(!add_exp) return only_child(f, mul_exp);
+    if(auto next = operands(f, add_exp, mul_exp, value)) return next;
+    // 按 32 位补码回绕，与 Koopa IR 的运算语义一致
+    unsigned lhs = f.saved, rhs = value;
+    if(add_op=='+'){
+      value = int(lhs + rhs);
     }
     else{
-      return mul_exp->Calculate();
+      value = int(lhs - rhs);
     }
+    return nullptr;
+  }
+  const BaseAST *CheckConstStep(WalkFrame &f, bool &value) const override {
+    if(add_exp) return both_const(f, value, add_exp, mul_exp);
+    return only_child(f, mul_exp);
+  }
+  void TakeChildren(vector<unique_ptr<BaseAST>> &out) override {
+    take_child(out, add_exp);
+    take_child(out, mul_exp);
   }
 };
 
@@ -892,6 +1686,7 @@ class MulExpAST: public BaseAST{
     unique_ptr<BaseAST> unary_exp;
     char mul_op;
   
+    ~MulExpAST() override { release_children(this); }
     void Dump() const override {
       cout << "MulExpAST { ";
       if (mul_exp) {
@@ -904,29 +1699,57 @@ class MulExpAST: public BaseAST{
       cout << " }";
     }
     void KoopaIR() const override {
-      if (mul_exp) {
-        mul_exp->KoopaIR();
-        unary_exp->KoopaIR();
-        KoopaIR_two_operands(CalOp2Instruct[mul_op]);
-      } else {
-        unary_exp->KoopaIR();
+      walk_koopa(this);
+    }
+    const BaseAST *KoopaIRStep(WalkFrame &f) const override {
+      if (!mul_exp) return only_child(f, unary_exp);
+      if (f.step == 0) {
+        if (fold_const(this)) return nullptr;
+        if (mul_exp->IsConst() && unary_exp->IsConst())
+          remark(Remark::Missed, "constfold", "DivisionNotFolded", this,
+                 "division of constants not folded: the result is undefined and is left to run time");
       }
+      if (auto next = operands(f, mul_exp, unary_exp)) return next;
+      KoopaIR_two_operands(CalOp2Instruct.at(mul_op));
+      return nullptr;
+    }
+    void CondIR(const string &true_label, const string &false_label) const override {
+      walk_cond(this, true_label, false_label);
+    }
+    const BaseAST *CondIRStep(WalkFrame &f, WalkFrame &child) const override {
+      if (!mul_exp) return only_child(f, child, unary_exp);
+      BaseAST::CondIR(f.true_label, f.false_label);
+      return nullptr;
     }
     int Calculate() const override {
-      if(mul_exp){
-        if(mul_op=='*'){
-          return mul_exp->Calculate() * unary_exp->Calculate();
-        }
-        else if(mul_op=='/'){
-          return mul_exp->Calculate() / unary_exp->Calculate();
-        }
-        else{
-          return mul_exp->Calculate() % unary_exp->Calculate();
-        }
+      return walk_calculate(this);
+    }
+    const BaseAST *CalculateStep(WalkFrame &f, int &value) const override {
+      if(!mul_exp) return only_child(f, unary_exp);
+      if(auto next = operands(f, mul_exp, unary_exp, value)) return next;
+      if(mul_op=='*'){
+        value = int(unsigned(f.saved) * unsigned(value));
+      }
+      else if(mul_op=='/'){
+        value = f.saved / value;
       }
       else{
-        return unary_exp->Calculate();
+        value = f.saved % value;
       }
+      return nullptr;
+    }
+    const BaseAST *CheckConstStep(WalkFrame &f, bool &value) const override {
+      if(!mul_exp) return only_child(f, unary_exp);
+      if(auto next = both_const(f, value, mul_exp, unary_exp)) return next;
+      if(!value || mul_op=='*') return nullptr;
+      // 除零和 INT_MIN / -1 留到运行时处理，不在编译期折叠
+      int rhs = unary_exp->Calculate();
+      value = rhs != 0 && !(rhs == -1 && mul_exp->Calculate() == INT32_MIN);
+      return nullptr;
+    }
+    void TakeChildren(vector<unique_ptr<BaseAST>> &out) override {
+      take_child(out, mul_exp);
+      take_child(out, unary_exp);
     }
 };
 
@@ -935,6 +1758,7 @@ class LOrExpAST: public BaseAST{
     unique_ptr<BaseAST> lor_exp;
     unique_ptr<BaseAST> land_exp;
 
+    ~LOrExpAST() override { release_children(this); }
     void Dump() const override {
       cout << "LOrExp { ";
       if (lor_exp) {
@@ -947,44 +1771,124 @@ class LOrExpAST: public BaseAST{
       cout << " }";
     }
     void KoopaIR() const override {
-      if (lor_exp) {
-        int now_or=or_id++;
-        cout << "  @" << "Or_" << now_or << " = alloc i32" << endl;
-        lor_exp->KoopaIR();
+      walk_koopa(this);
+    }
+    const BaseAST *KoopaIRStep(WalkFrame &f) const override {
+      if (!lor_exp) return only_child(f, land_exp);
+      if (f.step == 0) {
+        if (fold_const(this)) return nullptr;
+        if (lor_exp->IsConst() || land_exp->IsConst())
+          remark(Remark::Passed, "constfold", "ShortCircuitRemoved", this,
+                 "one operand of || is constant, no short-circuit branch needed");
+      }
+      if (lor_exp->IsConst()) {
+        // 左侧为常量 0（为真时整个表达式已被折叠），结果只取决于右侧
+        if (f.step++ == 0) return land_exp.get();
+        KoopaIR_one_operands("ne 0,");
+      } else if (land_exp->IsConst()) {
+        // 右侧为常量，左侧仍需求值，但无需短路跳转
+        if (f.step++ == 0) return lor_exp.get();
+        if(land_exp->Calculate()){
+          ctx->nums.pop_back();
+          ctx->nums.push_back("1");
+        }
+        else KoopaIR_one_operands("ne 0,");
+      } else if (f.step == 0) {
+        f.step++;
+        f.saved = ctx->or_id++;
+        ctx->out << "  @" << "Or_" << f.saved << " = alloc i32" << endl;
+        return lor_exp.get();
+      } else if (f.step == 1) {
+        f.step++;
+        int now_or = f.saved;
         // 如果lor_exp为真，那么land_exp就不用计算了，设置标签跳过land_exp
-        cout << "  br " << nums.back() << ", %OrSkip_" << now_or << ", %OrBody_" << now_or << endl;
+        ctx->out << "  br " << ctx->nums.back() << ", %OrSkip_" << now_or << ", %OrBody_" << now_or << endl;
         
-        cout << "%OrBody_" << now_or << ":" << endl;
-        fun_ret_flag=0;
-        block_name="Or_Body" + to_string(now_or) + "_";
-        land_exp->KoopaIR();
-        KoopaIR_logic_operands("or");
-        cout << "  store " << nums.back() << ", @Or_" << now_or << endl;
-        nums.pop_back();
-        if(!fun_ret_flag) cout << "  jump %OrEnd_" << now_or << endl;
-
-        cout << "%OrSkip_" << now_or << ":" << endl;
-        fun_ret_flag=0;
-        cout << "  store 1, @Or_" << now_or << endl;
-        if(!fun_ret_flag) cout << "  jump %OrEnd_" << now_or << endl;
-
-        cout << "%OrEnd_" << now_or << ":" << endl;
-        fun_ret_flag=0;
-        cout << "  %"<< current_id++ << " = load @Or_" << now_or << endl;
-        nums.push_back("%"+to_string(current_id-1));
+        ctx->out << "%OrBody_" << now_or << ":" << endl;
+        ctx->fun_ret_flag=0;
+        ctx->block_name="Or_Body" + to_string(now_or) + "_";
+        return land_exp.get();
       } else {
-        land_exp->KoopaIR();
+        int now_or = f.saved;
+        KoopaIR_logic_operands("or");
+        ctx->out << "  store " << ctx->nums.back() << ", @Or_" << now_or << endl;
+        ctx->nums.pop_back();
+        if(!ctx->fun_ret_flag) ctx->out << "  jump %OrEnd_" << now_or << endl;
+
+        ctx->out << "%OrSkip_" << now_or << ":" << endl;
+        ctx->fun_ret_flag=0;
+        ctx->out << "  store 1, @Or_" << now_or << endl;
+        if(!ctx->fun_ret_flag) ctx->out << "  jump %OrEnd_" << now_or << endl;
+
+        ctx->out << "%OrEnd_" << now_or << ":" << endl;
+        ctx->fun_ret_flag=0;
+        ctx->out << "  %"<< ctx->current_id++ << " = load @Or_" << now_or << endl;
+        ctx->nums.push_back("%"+to_string(ctx->current_id-1));
       }
+      return nullptr;
+    }
+    void CondIR(const string &true_label, const string &false_label) const override {
+      walk_cond(this, true_label, false_label);
+    }
+    // 短路求值直接生成跳转链: 左侧为真时跳到 true_label, 否则在 OrBody 中判断右侧
+    const BaseAST *CondIRStep(WalkFrame &f, WalkFrame &child) const override {
+      if (!lor_exp) return only_child(f, child, land_exp);
+      if (f.step++ == 0) {
+        if (IsConst()) {
+          BaseAST::CondIR(f.true_label, f.false_label);
+          return nullptr;
+        }
+        if (lor_exp->IsConst() || land_exp->IsConst())
+          remark(Remark::Passed, "constfold", "ShortCircuitRemoved", this,
+                 "one operand of || is constant, no short-circuit branch needed");
+        // 左侧为常量 0, 结果只取决于右侧
+        if (lor_exp->IsConst()) return branch(child, land_exp, f.true_label, f.false_label);
+        // 右侧为常量, 左侧仍需求值 (可能有副作用), 左侧为假时结果就是右侧
+        if (land_exp->IsConst())
+          return branch(child, lor_exp, f.true_label, land_exp->Calculate() ? f.true_label : f.false_label);
+        f.saved = ctx->or_id++;
+        return branch(child, lor_exp, f.true_label, "%OrBody_" + to_string(f.saved));
+      }
+      // 有一侧为常量时只处理了一侧
+      if (f.step > 2 || lor_exp->IsConst() || land_exp->IsConst()) return nullptr;
+      ctx->out << "%OrBody_" << f.saved << ":" << endl;
+      ctx->fun_ret_flag=0;
+      ctx->block_name="Or_Body" + to_string(f.saved) + "_";
+      return branch(child, land_exp, f.true_label, f.false_label);
     }
     int Calculate() const override {
-      if(lor_exp){
-        int lor_exp_value = lor_exp->Calculate();
-        if(lor_exp_value) return 1;
-        else return !!land_exp->Calculate();
+      return walk_calculate(this);
+    }
+    const BaseAST *CalculateStep(WalkFrame &f, int &value) const override {
+      if(!lor_exp) return only_child(f, land_exp);
+      switch(f.step++) {
+        case 0:
+          return lor_exp.get();
+        case 1:
+          if(value) {
+            value = 1;
+            return nullptr;
+          }
+          return land_exp.get();
       }
-      else{
-        return land_exp->Calculate();
+      value = !!value;
+      return nullptr;
+    }
+    const BaseAST *CheckConstStep(WalkFrame &f, bool &value) const override {
+      if(!lor_exp) return only_child(f, land_exp);
+      switch(f.step++) {
+        case 0:
+          return lor_exp.get();
+        case 1:
+          // 左侧为非零常量时右侧被短路，不必是常量
+          if(!value || lor_exp->Calculate()) return nullptr;
+          return land_exp.get();
       }
+      return nullptr;
+    }
+    void TakeChildren(vector<unique_ptr<BaseAST>> &out) override {
+      take_child(out, lor_exp);
+      take_child(out, land_exp);
     }
 };
 
@@ -993,6 +1897,7 @@ class LAndExpAST: public BaseAST{
     unique_ptr<BaseAST> land_exp;
     unique_ptr<BaseAST> eq_exp;
 
+    ~LAndExpAST() override { release_children(this); }
     void Dump() const override {
       cout << "LAndExp { ";
       if (land_exp) {
@@ -1005,50 +1910,127 @@ class LAndExpAST: public BaseAST{
       cout << " }";
     }
     void KoopaIR() const override {
-      if (land_exp) {
-        int now_and = and_id++;
-        cout << "  @" << "And_" << now_and << " = alloc i32" << endl;
-        land_exp->KoopaIR();
-        cout << "  %"<< current_id++ << " = ne 0, " << nums.back() << endl;
-        nums.pop_back();
-        nums.push_back("%"+to_string(current_id-1));
+      walk_koopa(this);
+    }
+    const BaseAST *KoopaIRStep(WalkFrame &f) const override {
+      if (!land_exp) return only_child(f, eq_exp);
+      if (f.step == 0) {
+        if (fold_const(this)) return nullptr;
+        if (land_exp->IsConst() || eq_exp->IsConst())
+          remark(Remark::Passed, "constfold", "ShortCircuitRemoved", this,
+                 "one operand of && is constant, no short-circuit branch needed");
+      }
+      if (land_exp->IsConst()) {
+        // 左侧为非零常量（为 0 时整个表达式已被折叠），结果只取决于右侧
+        if (f.step++ == 0) return eq_exp.get();
+        KoopaIR_one_operands("ne 0,");
+      } else if (eq_exp->IsConst()) {
+        // 右侧为常量，左侧仍需求值，但无需短路跳转
+        if (f.step++ == 0) return land_exp.get();
+        if(!eq_exp->Calculate()){
+          ctx->nums.pop_back();
+          ctx->nums.push_back("0");
+        }
+        else KoopaIR_one_operands("ne 0,");
+      } else if (f.step == 0) {
+        f.step++;
+        f.saved = ctx->and_id++;
+        ctx->out << "  @" << "And_" << f.saved << " = alloc i32" << endl;
+        return land_exp.get();
+      } else if (f.step == 1) {
+        f.step++;
+        int now_and = f.saved;
+        ctx->out << "  %"<< ctx->current_id++ << " = ne 0, " << ctx->nums.back() << endl;
+        ctx->nums.pop_back();
+        ctx->nums.push_back("%"+to_string(ctx->current_id-1));
         // 如果land_exp为假，那么eq_exp就不用计算了，设置标签跳过eq_exp
-        cout << "  br " << nums.back() << ", %AndBody_" << now_and << ", %AndSkip_" << now_and << endl;
-
-        cout << "%AndBody_" << now_and << ":" << endl;
-        fun_ret_flag=0;
-        block_name="And_Body" + to_string(now_and) + "_";
-        eq_exp->KoopaIR();
-        cout << "  %"<< current_id++ << " = ne 0, " << nums.back() << endl;
-        nums.pop_back();
-        nums.push_back("%"+to_string(current_id-1));
-        KoopaIR_logic_operands("and");
-        cout << "  store " << nums.back() << ", @And_" << now_and << endl;
-        nums.pop_back();
-        if(!fun_ret_flag) cout << "  jump %AndEnd_" << now_and << endl;
-
-        cout << "%AndSkip_" << now_and << ":" << endl;
-        fun_ret_flag=0;
-        cout << "  store 0, @And_" << now_and << endl;
-        if(!fun_ret_flag) cout << "  jump %AndEnd_" << now_and << endl;
-
-        cout << "%AndEnd_" << now_and << ":" << endl;
-        fun_ret_flag=0;
-        cout << "  %"<< current_id++ << " = load @And_" << now_and << endl;
-        nums.push_back("%"+to_string(current_id-1));
+        ctx->out << "  br " << ctx->nums.back() << ", %AndBody_" << now_and << ", %AndSkip_" << now_and << endl;
+
+        ctx->out << "%AndBody_" << now_and << ":" << endl;
+        ctx->fun_ret_flag=0;
+        ctx->block_name="And_Body" + to_string(now_and) + "_";
+        return eq_exp.get();
       } else {
-        eq_exp->KoopaIR();
+        int now_and = f.saved;
+        ctx->out << "  %"<< ctx->current_id++ << " = ne 0, " << ctx->nums.back() << endl;
+        ctx->nums.pop_back();
+        ctx->nums.push_back("%"+to_string(ctx->current_id-1));
+        KoopaIR_logic_operands("and");
+        ctx->out << "  store " << ctx->nums.back() << ", @And_" << now_and << endl;
+        ctx->nums.pop_back();
+        if(!ctx->fun_ret_flag) ctx->out << "  jump %AndEnd_" << now_and << endl;
+
+        ctx->out << "%AndSkip_" << now_and << ":" << endl;
+        ctx->fun_ret_flag=0;
+        ctx->out << "  store 0, @And_" << now_and << endl;
+        if(!ctx->fun_ret_flag) ctx->out << "  jump %AndEnd_" << now_and << endl;
+
+        ctx->out << "%AndEnd_" << now_and << ":" << endl;
+        ctx->fun_ret_flag=0;
+        ctx->out << "  %"<< ctx->current_id++ << " = load @And_" << now_and << endl;
+        ctx->nums.push_back("%"+to_string(ctx->current_id-1));
+      }
+      return nullptr;
+    }
+    void CondIR(const string &true_label, const string &false_label) const override {
+      walk_cond(this, true_label, false_label);
+    }
+    // 短路求值直接生成跳转链: 左侧为假时跳到 false_label, 否则在 AndBody 中判断右侧
+    const BaseAST *CondIRStep(WalkFrame &f, WalkFrame &child) const override {
+      if (!land_exp) return only_child(f, child, eq_exp);
+      if (f.step++ == 0) {
+        if (IsConst()) {
+          BaseAST::CondIR(f.true_label, f.false_label);
+          return nullptr;
+        }
+        if (land_exp->IsConst() || eq_exp->IsConst())
+          remark(Remark::Passed, "constfold", "ShortCircuitRemoved", this,
+                 "one operand of && is constant, no short-circuit branch needed");
+        // 左侧为非零常量, 结果只取决于右侧
+        if (land_exp->IsConst()) return branch(child, eq_exp, f.true_label, f.false_label);
+        // 右侧为常量, 左侧仍需求值 (可能有副作用), 左侧为真时结果就是右侧
+        if (eq_exp->IsConst())
+          return branch(child, land_exp, eq_exp->Calculate() ? f.true_label : f.false_label, f.false_label);
+        f.saved = ctx->and_id++;
+        return branch(child, land_exp, "%AndBody_" + to_string(f.saved), f.false_label);
       }
+      // 有一侧为常量时只处理了一侧
+      if (f.step > 2 || land_exp->IsConst() || eq_exp->IsConst()) return nullptr;
+      ctx->out << "%AndBody_" << f.saved << ":" << endl;
+      ctx->fun_ret_flag=0;
+      ctx->block_name="And_Body" + to_string(f.saved) + "_";
+      return branch(child, eq_exp, f.true_label, f.false_label);
     }
     int Calculate() const override {
-      if(land_exp){
-        int land_exp_value = land_exp->Calculate();
-        if(!land_exp_value) return 0;
-        else return !!eq_exp->Calculate();
+      return walk_calculate(this);
+    }
+    const BaseAST *CalculateStep(WalkFrame &f, int &value) const override {
+      if(!land_exp) return only_child(f, eq_exp);
+      switch(f.step++) {
+        case 0:
+          return land_exp.get();
+        case 1:
+          if(!value) return nullptr;
+          return eq_exp.get();
       }
-      else{
-        return eq_exp->Calculate();
+      value = !!value;
+      return nullptr;
+    }
+    const BaseAST *CheckConstStep(WalkFrame &f, bool &value) const override {
+      if(!land_exp) return only_child(f, eq_exp);
+      switch(f.step++) {
+        case 0:
+          return land_exp.get();
+        case 1:
+          // 左侧为常量 0 时右侧被短路，不必是常量
+          if(!value || !land_exp->Calculate()) return nullptr;
+          return eq_exp.get();
       }
+      return nullptr;
+    }
+    void TakeChildren(vector<unique_ptr<BaseAST>> &out) override {
+      take_child(out, land_exp);
+      take_child(out, eq_exp);
     }
 };
 
@@ -1058,6 +2040,7 @@ class EqExpAST: public BaseAST{
     unique_ptr<BaseAST> rel_exp;
     string eq_op;
 
+    ~EqExpAST() override { release_children(this); }
     void Dump() const override {
       cout << "EqExp { ";
       if (eq_exp) {
@@ -1070,26 +2053,45 @@ class EqExpAST: public BaseAST{
       cout << " }";
     }
     void KoopaIR() const override {
-      if (eq_exp) {
-        eq_exp->KoopaIR();
-        rel_exp->KoopaIR();
-        KoopaIR_two_operands(ComOp2Instruct[eq_op]);
-      } else {
-        rel_exp->KoopaIR();
-      }
+      walk_koopa(this);
+    }
+    const BaseAST *KoopaIRStep(WalkFrame &f) const override {
+      if (!eq_exp) return only_child(f, rel_exp);
+      if (f.step == 0 && fold_const(this)) return nullptr;
+      if (auto next = operands(f, eq_exp, rel_exp)) return next;
+      KoopaIR_two_operands(ComOp2Instruct.at(eq_op));
+      return nullptr;
+    }
+    void CondIR(const string &true_label, const string &false_label) const override {
+      walk_cond(this, true_label, false_label);
+    }
+    // 比较的结果由后端与条件跳转合并 (beq、bne)
+    const BaseAST *CondIRStep(WalkFrame &f, WalkFrame &child) const override {
+      if (!eq_exp) return only_child(f, child, rel_exp);
+      BaseAST::CondIR(f.true_label, f.false_label);
+      return nullptr;
     }
     int Calculate() const override {
-      if(eq_exp){
-        if(eq_op=="=="){
-          return eq_exp->Calculate() == rel_exp->Calculate();
-        }
-        else{
-          return eq_exp->Calculate() != rel_exp->Calculate();
-        }
+      return walk_calculate(this);
+    }
+    const BaseAST *CalculateStep(WalkFrame &f, int &value) const override {
+      if(!eq_exp) return only_child(f, rel_exp);
+      if(auto next = operands(f, eq_exp, rel_exp, value)) return next;
+      if(eq_op=="=="){
+        value = f.saved == value;
       }
       else{
-        return rel_exp->Calculate();
+        value = f.saved != value;
       }
+      return nullptr;
+    }
+    const BaseAST *CheckConstStep(WalkFrame &f, bool &value) const override {
+      if(eq_exp) return both_const(f, value, eq_exp, rel_exp);
+      return only_child(f, rel_exp);
+    }
+    void TakeChildren(vector<unique_ptr<BaseAST>> &out) override {
+      take_child(out, eq_exp);
+      take_child(out, rel_exp);
     }
 };
 
@@ -1099,6 +2101,7 @@ class RelExpAST: public BaseAST{
     unique_ptr<BaseAST> add_exp;
     string rel_op;
 
+    ~RelExpAST() override { release_children(this); }
     void Dump() const override {
       cout << "RelExp { ";
       if (rel_exp) {
@@ -1111,32 +2114,51 @@ class RelExpAST: public BaseAST{
       cout << " }";
     }
     void KoopaIR() const override {
-      if (rel_exp) {
-        rel_exp->KoopaIR();
-        add_exp->KoopaIR();
-        KoopaIR_two_operands(ComOp2Instruct[rel_op]);
-      } else {
-        add_exp->KoopaIR();
-      }
+      walk_koopa(this);
+    }
+    const BaseAST *KoopaIRStep(WalkFrame &f) const override {
+      if (!rel_exp) return only_child(f, add_exp);
+      if (f.step == 0 && fold_const(this)) return nullptr;
+      if (auto next = operands(f, rel_exp, add_exp)) return next;
+      KoopaIR_two_operands(ComOp2Instruct.at(rel_op));
+      return nullptr;
+    }
+    void CondIR(const string &true_label, const string &false_label) const override {
+      walk_cond(this, true_label, false_label);
+    }
+    // 比较的结果由后端与条件跳转合并 (blt、bge 等)
+    const BaseAST *CondIRStep(WalkFrame &f, WalkFrame &child) const override {
+      if (!rel_exp) return only_child(f, child, add_exp);
+      BaseAST::CondIR(f.true_label, f.false_label);
+      return nullptr;
     }
     int Calculate() const override {
-      if(rel_exp){
-        if(rel_op=="<"){
-          return rel_exp->Calculate() < add_exp->Calculate();
-        }
-        else if(rel_op==">"){
-          return rel_exp->Calculate() > add_exp->Calculate();
-        }
-        else if(rel_op=="<="){
-          return rel_exp->Calculate() <= add_exp->Calculate();
-        }
-        else{
-          return rel_exp->Calculate() >= add_exp->Calculate();
-        }
+      return walk_calculate(this);
+    }
+    const BaseAST *CalculateStep(WalkFrame &f, int &value) const override {
+      if(!rel_exp) return only_child(f, add_exp);
+      if(auto next = operands(f, rel_exp, add_exp, value)) return next;
+      if(rel_op=="<"){
+        value = f.saved < value;
+      }
+      else if(rel_op==">"){
+        value = f.saved > value;
+      }
+      else if(rel_op=="<="){
+        value = f.saved <= value;
       }
       else{
-        return add_exp->Calculate();
+        value = f.saved >= value;
       }
+      return nullptr;
+    }
+    const BaseAST *CheckConstStep(WalkFrame &f, bool &value) const override {
+      if(rel_exp) return both_const(f, value, rel_exp, add_exp);
+      return only_child(f, add_exp);
+    }
+    void TakeChildren(vector<unique_ptr<BaseAST>> &out) override {
+      take_child(out, rel_exp);
+      take_child(out, add_exp);
     }
 };
 
@@ -1181,7 +2203,6 @@ class BTypeAST: public BaseAST{
       cout << " }";
     }
     void KoopaIR() const override {
-      // cout << type;
     }
     int Calculate() const override {
       return 0;
@@ -1215,49 +2236,58 @@ class ConstDeclAST: public BaseAST{
 // depth: 当前所在的维度
 // idx: 当前所在的维度的起始下标，相当于把多维数组展开成一维数组，idx就是这个一维数组的下标
 // format: 打印的格式，A(aggregate): 打印{x1,x2,x3,...}，S(store): 获取数组元素的指针，然后用store指令把值存进去
+// 输出数组 ident 的初始值 array_init_agg (已展开成一维): format 为 'A' 时输出全局变量的 aggregate, 为 'S' 时输出局部变量逐个元素的 store
+// 按维度逐层展开, 用显式的栈代替递归, 栈中每项是正在输出的一个子数组
 static void print_array_init(const string& ident, 
                             vector<int>* array_init_agg, 
                             deque<int>* len, 
                             deque<int>* mul_len, 
-                            int depth, 
-                            int idx, 
                             char format) {
-  if (format == 'A') {
-    if(depth == len->size())
-      cout << (*array_init_agg)[idx];
-    else {
-      cout << "{";
-      int size = (*mul_len)[depth] / (*len)[depth];
-      for (int i=0; i < (*len)[depth] ;i++) {
-        print_array_init(ident, array_init_agg, len, mul_len, depth+1, idx + i*size, format);
-        if(i != (*len)[depth]-1)
-          cout << ", ";
-      }
-      cout << "}";
-    }
-  } else if (format == 'S'){
-    if(depth == len->size()) {
-      // 一维数组，不需要递归
-      cout << "  store " << (*array_init_agg)[idx] << ", %" << current_id-1 << endl;
-    } else {
-      // 多维数组，需要递归，且其中其实有“跳维”的操作，具体看下面注释
-      // 举例: a=int[2][3][4]
-      // 则mul_len = {4*3*2, 4*3, 4}, len = {2, 3, 4}
-      // step = 4*3*2/2 = 12，步长，即打印一个元素需要跳过多少个下标
-      // 我们会先从最低维开始打印，即从a[0][0][0]开始打印，打印完一维后，再打印下一维
-      // 所以会有“跳维”的操作，即打印第一轮打印的其实是a中的第0，12，24，36个元素，所以需要计算步长step
-      int step = (*mul_len)[depth] / (*len)[depth];
-      int parent_id = current_id-1;
-      // 这里不使用nums，nums的push和pop的逻辑在这里有些复杂，且nums在此处可以不用
-      for (int i=0; i < (*len)[depth] ;i++) {
-        cout << "  %" << current_id << " = getelemptr ";
-        if(depth == 0) cout << "@" << get_target_ident(ident)[0];
-        else cout <<"%"<<parent_id;
-        cout << ", " << i << endl;
-        current_id++;
-        print_array_init(ident, array_init_agg, len, mul_len, depth+1, idx + i*step, format);
-      }
-    }
+  struct Frame {
+    int depth;         // 子数组所在的维度, 等于维数时是一个元素
+    int idx;           // 子数组的第一个元素在 array_init_agg 中的下标
+    int i = -1;        // 下一个要输出的下标, -1 表示还没开始
+    int parent_id = 0; // 'S': 子数组的指针
+  };
+  vector<Frame> stack{{0, 0}};
+  while (!stack.empty()) {
+    Frame &frame = stack.back();
+    int depth = frame.depth;
+    if (depth == len->size()) {
+      if (format == 'A') ctx->out << (*array_init_agg)[frame.idx];
+      // 一维数组，不需要再展开
+      else ctx->out << "  store " << (*array_init_agg)[frame.idx] << ", %" << ctx->current_id-1 << endl;
+      stack.pop_back();
+      continue;
+    }
+    if (frame.i == (*len)[depth]) {
+      if (format == 'A') ctx->out << "}";
+      stack.pop_back();
+      continue;
+    }
+    // 多维数组，需要展开，且其中其实有“跳维”的操作，具体看下面注释
+    // 举例: a=int[2][3][4]
+    // 则mul_len = {4*3*2, 4*3, 4}, len = {2, 3, 4}
+    // step = 4*3*2/2 = 12，步长，即打印一个元素需要跳过多少个下标
+    // 我们会先从最低维开始打印，即从a[0][0][0]开始打印，打印完一维后，再打印下一维
+    // 所以会有“跳维”的操作，即打印第一轮打印的其实是a中的第0，12，24，36个元素，所以需要计算步长step
+    int step = (*mul_len)[depth] / (*len)[depth];
+    if (frame.i < 0) {
+      frame.i = 0;
+      if (format == 'A') ctx->out << "{";
+      frame.parent_id = ctx->current_id-1;
+      if (frame.i == (*len)[depth]) continue;
+    } else if (format == 'A') ctx->out << ", ";
+    int i = frame.i++;
+    if (format == 'S') {
+      // 这里不使用ctx->nums，ctx->nums的push和pop的逻辑在这里有些复杂，且ctx->nums在此处可以不用
+      ctx->out << "  %" << ctx->current_id << " = getelemptr ";
+      if(depth == 0) ctx->out << "@" << get_target_ident(ident)[0];
+      else ctx->out <<"%"<<frame.parent_id;
+      ctx->out << ", " << i << endl;
+      ctx->current_id++;
+    }
+    stack.push_back({depth + 1, frame.idx + i*step});
   }
 }
 
@@ -1267,6 +2297,11 @@ class ConstInitValAST: public BaseAST{
     unique_ptr<BaseAST> const_exp;
     unique_ptr<vector<unique_ptr<BaseAST>>> const_array_init_val;
 
+    ~ConstInitValAST() override { release_children(this); }
+    void TakeChildren(vector<unique_ptr<BaseAST>> &out) override {
+      take_child(out, const_exp);
+      take_child(out, const_array_init_val);
+    }
     void Dump() const override {
       cout << "ConstInitVal { ";
       const_exp->Dump();
@@ -1316,18 +2351,17 @@ class ConstDefAST: public BaseAST{
       cout << " }";
     }
     void KoopaIR() const override {
-      string target_ident = block_stack.back() + ident ;
+      string target_ident = ctx->block_stack.back() + ident ;
       if(const_index_list->size())
       {
         // 数组
         // 这里符号表里存放的是数组有几个维度，如 arr[2][3][4] -> 3，以在Stmt和Lval中部分解引用数组
-        symbol_table_stack.back()->emplace(target_ident, const_index_list->size());
-        symbol_type_stack.back()->emplace(target_ident, "const array");
-        if(symbol_table_stack.size()==1) cout<<"global "<<"@"<<target_ident<<" = alloc ";
-        else cout << "  @" << target_ident << " = alloc ";
-        for (int i = 0; i < const_index_list->size(); i++) cout << "[";
-        cout << "i32";
-        if(const_index_list->size()) cout << ", ";
+        declare_symbol(target_ident, const_index_list->size(), "const array");
+        if(ctx->symbol_table_stack.size()==1) ctx->out<<"global "<<"@"<<target_ident<<" = alloc ";
+        else ctx->out << "  @" << target_ident << " = alloc ";
+        for (int i = 0; i < const_index_list->size(); i++) ctx->out << "[";
+        ctx->out << "i32";
+        if(const_index_list->size()) ctx->out << ", ";
 
         // arr[2][3][4] -> len = {2, 3, 4}, mul_len = {4*3*2, 4*3, 4}
         auto mul_len = new deque<int>();
@@ -1338,29 +2372,28 @@ class ConstDefAST: public BaseAST{
           len->push_front(tmp);
           if(mul_len->empty()) mul_len->push_front(tmp);
           else mul_len->push_front(mul_len->front() * tmp);
-          if(i!=0) cout << tmp << "], ";
-          else cout << tmp << "]";
+          if(i!=0) ctx->out << tmp << "], ";
+          else ctx->out << tmp << "]";
         }
 
         vector<int> array_init_agg = dynamic_cast<ConstInitValAST*>
           (const_init_val.get())->Aggregate(mul_len->begin(), mul_len->end());
-        if (symbol_table_stack.size() == 1) {
+        if (ctx->symbol_table_stack.size() == 1) {
           // 全局用aggregate初始化
-          cout << ", ";
-          print_array_init(ident, &array_init_agg, len, mul_len, 0, 0, 'A');
-          cout << endl;
+          ctx->out << ", ";
+          print_array_init(ident, &array_init_agg, len, mul_len, 'A');
+          ctx->out << endl;
         } else{
           // 局部用store指令初始化，方便目标代码生成
-          cout << endl;
-          print_array_init(ident, &array_init_agg, len, mul_len, 0, 0, 'S');
+          ctx->out << endl;
+          print_array_init(ident, &array_init_agg, len, mul_len, 'S');
         }
         delete mul_len;
         delete len;
       }
       else{
         // 常量
-        symbol_table_stack.back()->emplace(target_ident, const_init_val->Calculate());
-        symbol_type_stack.back()->emplace(target_ident, "const");
+        declare_symbol(target_ident, const_init_val->Calculate(), "const");
       }
     }
     int Calculate() const override {
@@ -1391,6 +2424,11 @@ class InitValAST: public BaseAST{
     unique_ptr<BaseAST> exp;
     unique_ptr<vector<unique_ptr<BaseAST>>> array_init_val;
 
+    ~InitValAST() override { release_children(this); }
+    void TakeChildren(vector<unique_ptr<BaseAST>> &out) override {
+      take_child(out, exp);
+      take_child(out, array_init_val);
+    }
     void Dump() const override {
       cout << "InitVal { ";
       exp->Dump();
@@ -1403,7 +2441,7 @@ class InitValAST: public BaseAST{
       return exp->Calculate();
     }
     vector<int> Aggregate(deque<int>::iterator mul_len_begin,deque<int>::iterator mul_len_end) const {
-      if(symbol_table_stack.size()==1) {
+      if(ctx->symbol_table_stack.size()==1) {
         // 全局数组变量的初始化列表中只能出现常量表达式, 返回的 array_init_agg 即为各项的值
         vector<int> array_init_agg;
         for(auto& init_val : *array_init_val) {
@@ -1433,8 +2471,8 @@ class InitValAST: public BaseAST{
           auto child = dynamic_cast<InitValAST*>(init_val.get());
           if (!child->array_init_val) {
             child->KoopaIR();
-            array_init_agg.push_back(stoi(nums.back()));
-            nums.pop_back();
+            array_init_agg.push_back(stoi(ctx->nums.back()));
+            ctx->nums.pop_back();
           } else{
             auto it = mul_len_begin;
             ++it;
@@ -1447,7 +2485,6 @@ class InitValAST: public BaseAST{
             }
           }
         }
-        // cout<<"array_init_agg.size()="<<array_init_agg.size()<<endl;
         array_init_agg.insert(array_init_agg.end(), (*mul_len_begin) - array_init_agg.size(), 0);
         return array_init_agg;
     }
@@ -1472,15 +2509,14 @@ class VarDefAST: public BaseAST{
     void KoopaIR() const override {
       if(const_index_list->size()){
         // 数组
-        string target_ident = block_stack.back() + ident ;
+        string target_ident = ctx->block_stack.back() + ident ;
         // 这里符号表里存放的是数组有几个维度，如 arr[2][3][4] -> 3，以在Stmt和Lval中部分解引用数组
-        symbol_table_stack.back()->emplace(target_ident, const_index_list->size());
-        symbol_type_stack.back()->emplace(target_ident, "array");
-        if(symbol_table_stack.size()==1) cout<<"global "<<"@"<<target_ident<<" = alloc ";
-        else cout << "  @" << target_ident << " = alloc ";
-        for (int i = 0; i < const_index_list->size(); i++) cout << "[";
-        cout << "i32";
-        if(const_index_list->size()) cout << ", ";
+        declare_symbol(target_ident, const_index_list->size(), "array");
+        if(ctx->symbol_table_stack.size()==1) ctx->out<<"global "<<"@"<<target_ident<<" = alloc ";
+        else ctx->out << "  @" << target_ident << " = alloc ";
+        for (int i = 0; i < const_index_list->size(); i++) ctx->out << "[";
+        ctx->out << "i32";
+        if(const_index_list->size()) ctx->out << ", ";
 
         auto mul_len = new deque<int>();
         auto len = new deque<int>();
@@ -1490,27 +2526,27 @@ class VarDefAST: public BaseAST{
           len->push_front(tmp);
           if(mul_len->empty()) mul_len->push_front(tmp);
           else mul_len->push_front(mul_len->front() * tmp);
-          if(i!=0) cout << tmp << "], ";
-          else cout << tmp << "]";
+          if(i!=0) ctx->out << tmp << "], ";
+          else ctx->out << tmp << "]";
         }
 
-        if(symbol_table_stack.size()==1){
+        if(ctx->symbol_table_stack.size()==1){
           // 全局
           if(init_val){
             vector<int> array_init_agg = 
               dynamic_cast<InitValAST*>(init_val.get())->Aggregate(mul_len->begin(), mul_len->end());
-            cout << ", ";
-            print_array_init(ident, &array_init_agg, len, mul_len, 0, 0, 'A');
-            cout << endl;
+            ctx->out << ", ";
+            print_array_init(ident, &array_init_agg, len, mul_len, 'A');
+            ctx->out << endl;
           }
-          else cout<<", zeroinit"<<endl;
+          else ctx->out<<", zeroinit"<<endl;
         } else{
           // 局部
-          cout<<endl;
+          ctx->out<<endl;
           if(init_val) {
             vector<int> array_init_agg = 
               dynamic_cast<InitValAST*>(init_val.get())->Aggregate(mul_len->begin(), mul_len->end());
-            print_array_init(ident, &array_init_agg, len, mul_len, 0, 0, 'S');
+            print_array_init(ident, &array_init_agg, len, mul_len, 'S');
           };
           // 如果没有init_val，局部数组先不进行处理，不打印zeroinit，这是为了之后方便生成目标代码
         }
@@ -1518,21 +2554,20 @@ class VarDefAST: public BaseAST{
         delete len;
       } else{
         // 变量
-        string target_ident = block_stack.back() + ident ;
-        if(symbol_table_stack.size()==1) cout<<"global "<<"@"<<target_ident<<" = alloc i32, ";
-        else cout << "  @" << target_ident << " = alloc i32";
-        symbol_table_stack.back()->emplace(target_ident, 1); // 这里随便给的值，因为不会用到
-        symbol_type_stack.back()->emplace(target_ident, "var");
-        if(symbol_table_stack.size()==1){
-          if(init_val) cout << init_val->Calculate() << endl;
-          else cout<<"zeroinit"<<endl;
+        string target_ident = ctx->block_stack.back() + ident ;
+        if(ctx->symbol_table_stack.size()==1) ctx->out<<"global "<<"@"<<target_ident<<" = alloc i32, ";
+        else ctx->out << "  @" << target_ident << " = alloc i32";
+        declare_symbol(target_ident, 1, "var"); // 这里随便给的值，因为不会用到
+        if(ctx->symbol_table_stack.size()==1){
+          if(init_val) ctx->out << init_val->Calculate() << endl;
+          else ctx->out<<"zeroinit"<<endl;
         }
         else{
           if(init_val) {
           init_val->KoopaIR();
-          cout << "  store " << nums.back() << ", @" << target_ident << endl;
-          nums.pop_back();
-          } else cout<<endl;
+          ctx->out << "  store " << ctx->nums.back() << ", @" << target_ident << endl;
+          ctx->nums.pop_back();
+          } else ctx->out<<endl;
         }
       }
     }
@@ -0,0 +1,840 @@
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+#include "binary_ir.hpp"
+#include "dominators.hpp"
+
+using namespace std;
+
+static const char binary_ir_magic[4] = {'S', 'Y', 'I', 'R'};
+static const uint64_t binary_ir_version = 1;
+
+// 操作数的种类, 在操作数的最低两位
+enum OperandKind { OPERAND_LOCAL, OPERAND_GLOBAL, OPERAND_INTEGER, OPERAND_CONST };
+// OPERAND_CONST 的种类
+enum ConstKind { CONST_ZERO_INIT, CONST_UNDEF, CONST_AGGREGATE };
+
+static void put(string &out, uint64_t x) {
+  for(; x >= 0x80; x >>= 7) out += char((x & 0x7f) | 0x80);
+  out += char(x);
+}
+
+static uint64_t zigzag(int64_t x) { return (uint64_t(x) << 1) ^ uint64_t(x >> 63); }
+static int64_t unzigzag(uint64_t x) { return int64_t(x >> 1) ^ -int64_t(x & 1); }
+
+bool IsBinaryIR(const char *data, size_t size) {
+  return size >= sizeof(binary_ir_magic) && !memcmp(data, binary_ir_magic, sizeof(binary_ir_magic));
+}
+
+/**********************************写出************************************/
+
+namespace {
+
+struct Writer {
+  vector<const char *> strings;
+  unordered_map<string, uint64_t> string_index;
+  string types; // 类型表的内容
+  uint64_t type_count = 0;
+  unordered_map<string, uint64_t> type_index; // 按结构去重, 键是类型在类型表中的编码
+  unordered_map<koopa_raw_value_t, uint64_t> globals;
+  unordered_map<koopa_raw_function_t, uint64_t> funcs;
+  unordered_map<koopa_raw_value_t, uint64_t> locals;
+  unordered_map<koopa_raw_basic_block_t, uint64_t> bbs;
+
+  uint64_t name(const char *name) {
+    if(!name) return 0;
+    auto it = string_index.find(name);
+    if(it != string_index.end()) return it->second;
+    strings.push_back(name);
+    return string_index[name] = strings.size();
+  }
+
+  uint64_t type(koopa_raw_type_t ty) {
+    string key;
+    put(key, ty->tag);
+    switch(ty->tag) {
+      case KOOPA_RTT_ARRAY:
+        put(key, type(ty->data.array.base));
+        put(key, ty->data.array.len);
+        break;
+      case KOOPA_RTT_POINTER:
+        put(key, type(ty->data.pointer.base));
+        break;
+      case KOOPA_RTT_FUNCTION:
+        put(key, ty->data.function.params.len);
+        for(uint32_t i = 0; i < ty->data.function.params.len; i++)
+          put(key, type(reinterpret_cast<koopa_raw_type_t>(ty->data.function.params.buffer[i])));
+        put(key, type(ty->data.function.ret));
+        break;
+      default:
+        break;
+    }
+    auto it = type_index.find(key);
+    if(it != type_index.end()) return it->second;
+    types += key;
+    return type_index[key] = type_count++;
+  }
+
+  void operand(string &out, koopa_raw_value_t value) {
+    switch(value->kind.tag) {
+      case KOOPA_RVT_INTEGER:
+        put(out, zigzag(value->kind.data.integer.value) << 2 | OPERAND_INTEGER);
+        return;
+      case KOOPA_RVT_ZERO_INIT:
+      case KOOPA_RVT_UNDEF:
+        put(out, uint64_t(value->kind.tag == KOOPA_RVT_ZERO_INIT ? CONST_ZERO_INIT : CONST_UNDEF) << 2 | OPERAND_CONST);
+        put(out, type(value->ty));
+        return;
+      case KOOPA_RVT_AGGREGATE: {
+        put(out, uint64_t(CONST_AGGREGATE) << 2 | OPERAND_CONST);
+        put(out, type(value->ty));
+        auto &elems = value->kind.data.aggregate.elems;
+        put(out, elems.len);
+        for(uint32_t i = 0; i < elems.len; i++) operand(out, reinterpret_cast<koopa_raw_value_t>(elems.buffer[i]));
+        return;
+      }
+      case KOOPA_RVT_GLOBAL_ALLOC:
+        put(out, globals.at(value) << 2 | OPERAND_GLOBAL);
+        return;
+      default:
+        auto it = locals.find(value);
+        if(it == locals.end()) throw string("binary IR: operand defined outside its function");
+        put(out, it->second << 2 | OPERAND_LOCAL);
+    }
+  }
+
+  void operands(string &out, const koopa_raw_slice_t &values) {
+    put(out, values.len);
+    for(uint32_t i = 0; i < values.len; i++) operand(out, reinterpret_cast<koopa_raw_value_t>(values.buffer[i]));
+  }
+
+  void instruction(string &out, koopa_raw_value_t inst) {
+    auto &kind = inst->kind;
+    put(out, kind.tag);
+    put(out, name(inst->name));
+    put(out, type(inst->ty));
+    switch(kind.tag) {
+      case KOOPA_RVT_ALLOC:
+        break;
+      case KOOPA_RVT_LOAD:
+        operand(out, kind.data.load.src);
+        break;
+      case KOOPA_RVT_STORE:
+        operand(out, kind.data.store.value);
+        operand(out, kind.data.store.dest);
+        break;
+      case KOOPA_RVT_GET_PTR:
+        operand(out, kind.data.get_ptr.src);
+        operand(out, kind.data.get_ptr.index);
+        break;
+      case KOOPA_RVT_GET_ELEM_PTR:
+        operand(out, kind.data.get_elem_ptr.src);
+        operand(out, kind.data.get_elem_ptr.index);
+        break;
+      case KOOPA_RVT_BINARY:
+        put(out, kind.data.binary.op);
+        operand(out, kind.data.binary.lhs);
+        operand(out, kind.data.binary.rhs);
+        break;
+      case KOOPA_RVT_BRANCH:
+        operand(out, kind.data.branch.cond);
+        put(out, bbs.at(kind.data.branch.true_bb));
+        put(out, bbs.at(kind.data.branch.false_bb));
+        operands(out, kind.data.branch.true_args);
+        operands(out, kind.data.branch.false_args);
+        break;
+      case KOOPA_RVT_JUMP:
+        put(out, bbs.at(kind.data.jump.target));
+        operands(out, kind.data.jump.args);
+        break;
+      case KOOPA_RVT_CALL:
+        put(out, funcs.at(kind.data.call.callee));
+        operands(out, kind.data.call.args);
+        break;
+      case KOOPA_RVT_RETURN:
+        put(out, kind.data.ret.value != nullptr);
+        if(kind.data.ret.value) operand(out, kind.data.ret.value);
+        break;
+      default:
+        throw string("binary IR: unexpected value kind in a basic block");
+    }
+  }
+
+  // 一个有函数体的函数的一节 (不含开头的字节数)
+  string function(koopa_raw_function_t func) {
+    locals.clear();
+    bbs.clear();
+    uint64_t next = 0;
+    for(uint32_t i = 0; i < func->params.len; i++) locals[reinterpret_cast<koopa_raw_value_t>(func->params.buffer[i])] = next++;
+    for(uint32_t i = 0; i < func->bbs.len; i++) {
+      auto bb = reinterpret_cast<koopa_raw_basic_block_t>(func->bbs.buffer[i]);
+      bbs[bb] = i;
+      for(uint32_t j = 0; j < bb->params.len; j++) locals[reinterpret_cast<koopa_raw_value_t>(bb->params.buffer[j])] = next++;
+      for(uint32_t j = 0; j < bb->insts.len; j++) locals[reinterpret_cast<koopa_raw_value_t>(bb->insts.buffer[j])] = next++;
+    }
+    string out;
+    put(out, func->bbs.len);
+    for(uint32_t i = 0; i < func->bbs.len; i++) {
+      auto bb = reinterpret_cast<koopa_raw_basic_block_t>(func->bbs.buffer[i]);
+      put(out, name(bb->name));
+      put(out, bb->params.len);
+      for(uint32_t j = 0; j < bb->params.len; j++) {
+        auto param = reinterpret_cast<koopa_raw_value_t>(bb->params.buffer[j]);
+        put(out, name(param->name));
+        put(out, type(param->ty));
+      }
+      put(out, bb->insts.len);
+    }
+    for(uint32_t i = 0; i < func->bbs.len; i++) {
+      auto bb = reinterpret_cast<koopa_raw_basic_block_t>(func->bbs.buffer[i]);
+      for(uint32_t j = 0; j < bb->insts.len; j++) instruction(out, reinterpret_cast<koopa_raw_value_t>(bb->insts.buffer[j]));
+    }
+    return out;
+  }
+};
+
+} // namespace
+
+void WriteBinaryIR(const koopa_raw_program_t &program, string &out) {
+  Writer writer;
+  // 字符串表和类型表要放在最前面, 所以先把其余部分写到 body 中
+  string body;
+  put(body, program.values.len);
+  for(uint32_t i = 0; i < program.values.len; i++) {
+    auto value = reinterpret_cast<koopa_raw_value_t>(program.values.buffer[i]);
+    writer.globals[value] = i;
+    put(body, writer.name(value->name));
+    put(body, writer.type(value->ty));
+    writer.operand(body, value->kind.data.global_alloc.init);
+  }
+  put(body, program.funcs.len);
+  for(uint32_t i = 0; i < program.funcs.len; i++) {
+    auto func = reinterpret_cast<koopa_raw_function_t>(program.funcs.buffer[i]);
+    writer.funcs[func] = i;
+    put(body, writer.name(func->name));
+    put(body, writer.type(func->ty));
+    for(uint32_t j = 0; j < func->params.len; j++)
+      put(body, writer.name(reinterpret_cast<koopa_raw_value_t>(func->params.buffer[j])->name));
+    put(body, func->bbs.len != 0);
+  }
+  for(uint32_t i = 0; i < program.funcs.len; i++) {
+    auto func = reinterpret_cast<koopa_raw_function_t>(program.funcs.buffer[i]);
+    if(!func->bbs.len) continue;
+    string section = writer.function(func);
+    put(body, section.size());
+    body += section;
+  }
+
+  out.append(binary_ir_magic, sizeof(binary_ir_magic));
+  put(out, binary_ir_version);
+  put(out, writer.strings.size());
+  for(auto str : writer.strings) {
+    size_t len = strlen(str);
+    put(out, len);
+    out.append(str, len + 1);
+  }
+  put(out, writer.type_count);
+  out += writer.types;
+  out += body;
+}
+
+/**********************************读入************************************/
+
+// 能作为值的类型: i32、数组和指针; 参数和基本块参数只能是 i32 或指针
+static bool is_value_type(koopa_raw_type_t ty) {
+  return ty->tag == KOOPA_RTT_INT32 || ty->tag == KOOPA_RTT_ARRAY || ty->tag == KOOPA_RTT_POINTER;
+}
+
+static bool is_scalar_type(koopa_raw_type_t ty) { return ty->tag == KOOPA_RTT_INT32 || ty->tag == KOOPA_RTT_POINTER; }
+
+// 值类型占用的字节数, 读类型时已经保证不超过 max_object_size
+static uint64_t type_size(koopa_raw_type_t ty) {
+  if(ty->tag == KOOPA_RTT_ARRAY) return ty->data.array.len * type_size(ty->data.array.base);
+  return ty->tag == KOOPA_RTT_UNIT ? 0 : 4;
+}
+
+// 两个类型结构相同; 文件中的类型已经去重, 多数情况下指针相等
+static bool same_type(koopa_raw_type_t a, koopa_raw_type_t b) {
+  if(a == b) return true;
+  if(a->tag != b->tag) return false;
+  switch(a->tag) {
+    case KOOPA_RTT_ARRAY:
+      return a->data.array.len == b->data.array.len && same_type(a->data.array.base, b->data.array.base);
+    case KOOPA_RTT_POINTER:
+      return same_type(a->data.pointer.base, b->data.pointer.base);
+    case KOOPA_RTT_FUNCTION: {
+      auto &pa = a->data.function.params, &pb = b->data.function.params;
+      if(pa.len != pb.len || !same_type(a->data.function.ret, b->data.function.ret)) return false;
+      for(uint32_t i = 0; i < pa.len; i++)
+        if(!same_type(reinterpret_cast<koopa_raw_type_t>(pa.buffer[i]), reinterpret_cast<koopa_raw_type_t>(pb.buffer[i])))
+          return false;
+      return true;
+    }
+    default:
+      return true;
+  }
+}
+
+static koopa_raw_value_t slice_value(const koopa_raw_slice_t &s, uint32_t i) {
+  return reinterpret_cast<koopa_raw_value_t>(s.buffer[i]);
+}
+
+// 常量: 全局变量的初始值和 aggregate 的元素只能是常量, 且类型为 ty
+static bool is_constant(koopa_raw_value_t v, koopa_raw_type_t ty) {
+  if(!same_type(v->ty, ty)) return false;
+  switch(v->kind.tag) {
+    case KOOPA_RVT_INTEGER:
+    case KOOPA_RVT_ZERO_INIT:
+    case KOOPA_RVT_UNDEF:
+      return true;
+    case KOOPA_RVT_AGGREGATE: {
+      // 元素的类型比 ty 少一层, 递归的层数不超过类型嵌套的层数
+      auto &elems = v->kind.data.aggregate.elems;
+      if(ty->tag != KOOPA_RTT_ARRAY || elems.len != ty->data.array.len) return false;
+      for(uint32_t i = 0; i < elems.len; i++)
+        if(!is_constant(slice_value(elems, i), ty->data.array.base)) return false;
+      return true;
+    }
+    default:
+      return false;
+  }
+}
+
+// 有结果、能作为操作数的值
+static bool is_operand(koopa_raw_value_t v) {
+  switch(v->kind.tag) {
+    case KOOPA_RVT_STORE:
+    case KOOPA_RVT_BRANCH:
+    case KOOPA_RVT_JUMP:
+    case KOOPA_RVT_RETURN:
+      return false;
+    default:
+      return is_value_type(v->ty);
+  }
+}
+
+static bool is_terminator(koopa_raw_value_t v) {
+  return v->kind.tag == KOOPA_RVT_BRANCH || v->kind.tag == KOOPA_RVT_JUMP || v->kind.tag == KOOPA_RVT_RETURN;
+}
+
+// 实参与形参的个数和类型一致; params 中是类型 (函数的参数) 或值 (基本块的参数)
+static bool args_match(const koopa_raw_slice_t &params, const koopa_raw_slice_t &args) {
+  if(params.len != args.len) return false;
+  for(uint32_t i = 0; i < params.len; i++) {
+    auto ty = params.kind == KOOPA_RSIK_TYPE ? reinterpret_cast<koopa_raw_type_t>(params.buffer[i])
+                                             : slice_value(params, i)->ty;
+    if(!same_type(ty, slice_value(args, i)->ty)) return false;
+  }
+  return true;
+}
+
+// 指令的操作数和结果的类型符合指令的要求, 后端据此访问 pointer.base、array.base 等, 不再检查
+static bool valid_instruction(koopa_raw_value_t v, koopa_raw_type_t ret) {
+  auto &data = v->kind.data;
+  auto is_int = [](koopa_raw_value_t x) { return x->ty->tag == KOOPA_RTT_INT32; };
+  bool is_unit = v->ty->tag == KOOPA_RTT_UNIT;
+  // 指针所指的类型, 不是指针时为 nullptr
+  auto pointee = [](koopa_raw_value_t x) {
+    return x->ty->tag == KOOPA_RTT_POINTER ? x->ty->data.pointer.base : nullptr;
+  };
+  switch(v->kind.tag) {
+    case KOOPA_RVT_ALLOC:
+      return v->ty->tag == KOOPA_RTT_POINTER;
+    case KOOPA_RVT_LOAD: {
+      auto base = pointee(data.load.src);
+      return base && same_type(v->ty, base);
+    }
+    case KOOPA_RVT_STORE: {
+      auto base = pointee(data.store.dest);
+      return is_unit && base && same_type(data.store.value->ty, base);
+    }
+    case KOOPA_RVT_GET_PTR:
+      return pointee(data.get_ptr.src) && is_int(data.get_ptr.index) && same_type(v->ty, data.get_ptr.src->ty);
+    case KOOPA_RVT_GET_ELEM_PTR: {
+      auto base = pointee(data.get_elem_ptr.src);
+      return base && base->tag == KOOPA_RTT_ARRAY && is_int(data.get_elem_ptr.index) && pointee(v) &&
+             same_type(pointee(v), base->data.array.base);
+    }
+    case KOOPA_RVT_BINARY:
+      return is_int(v) && is_int(data.binary.lhs) && is_int(data.binary.rhs);
+    case KOOPA_RVT_BRANCH:
+      return is_unit && is_int(data.branch.cond) && args_match(data.branch.true_bb->params, data.branch.true_args) &&
+             args_match(data.branch.false_bb->params, data.branch.false_args);
+    case KOOPA_RVT_JUMP:
+      return is_unit && args_match(data.jump.target->params, data.jump.args);
+    case KOOPA_RVT_CALL: {
+      auto &callee = data.call.callee->ty->data.function;
+      return same_type(v->ty, callee.ret) && args_match(callee.params, data.call.args);
+    }
+    case KOOPA_RVT_RETURN:
+      if(ret->tag == KOOPA_RTT_UNIT) return is_unit && !data.ret.value;
+      return is_unit && data.ret.value && same_type(data.ret.value->ty, ret);
+    default:
+      return false;
+  }
+}
+
+struct BinaryIR::Reader {
+  BinaryIR &ir;
+  const unsigned char *pos, *end;
+  vector<const char *> strings;
+  vector<koopa_raw_type_kind_t *> types;
+  koopa_raw_type_kind_t *int32 = nullptr; // 整数操作数的类型
+  int aggregate_depth = 0;                // 正在读的 aggregate 的层数
+  vector<koopa_raw_value_data_t *> globals;
+  vector<koopa_raw_function_data_t *> funcs;
+  // 每个值和基本块被哪些指令用到; 读的时候先在 used_by.len 中计数, 最后一次分配
+  vector<pair<koopa_raw_slice_t *, const void *>> uses;
+  // 读到的 (操作数, 使用者), 读完之后检查操作数都是有结果的值
+  vector<pair<koopa_raw_value_t, const void *>> operand_uses;
+  // 每个函数的指令的操作数在 operand_uses 中的范围
+  vector<pair<size_t, size_t>> function_uses;
+  // 从 block 中分配小对象, 不必每个对象单独 new
+  char *block = nullptr;
+  size_t block_left = 0;
+
+  Reader(BinaryIR &ir, const char *data, size_t size)
+      : ir(ir), pos(reinterpret_cast<const unsigned char *>(data)), end(pos + size) {}
+
+  // 类型嵌套的层数和一个对象 (数组、栈帧) 的字节数的上限
+  // 后端递归地处理类型, 并用 int 计算大小, 坏的文件不能让它栈溢出或溢出
+  static const int max_type_depth = 256;
+  static const uint64_t max_object_size = uint64_t(1) << 30;
+
+  [[noreturn]] static void fail(const string &msg) { throw string(msg); }
+
+  template<class T>
+  T *alloc(size_t n = 1) {
+    size_t bytes = (sizeof(T) * n + 7) & ~size_t(7);
+    if(bytes > block_left) {
+      size_t size = max<size_t>(bytes, 64 << 10);
+      ir.arena.emplace_back(new char[size]);
+      block = ir.arena.back().get();
+      block_left = size;
+    }
+    T *p = reinterpret_cast<T *>(block);
+    memset(static_cast<void *>(p), 0, sizeof(T) * n);
+    block += bytes;
+    block_left -= bytes;
+    return p;
+  }
+
+  koopa_raw_slice_t slice(uint64_t len, koopa_raw_slice_item_kind_t kind) {
+    koopa_raw_slice_t s;
+    s.buffer = len ? alloc<const void *>(len) : nullptr;
+    s.len = len;
+    s.kind = kind;
+    return s;
+  }
+
+  uint64_t num() {
+    uint64_t x = 0;
+    for(int shift = 0; shift < 64; shift += 7) {
+      if(pos == end) fail("unexpected end of data");
+      unsigned char byte = *pos++;
+      x |= uint64_t(byte & 0x7f) << shift;
+      if(!(byte & 0x80)) return x;
+    }
+    fail("malformed integer");
+  }
+
+  // 不超过 limit 的下标
+  uint64_t index(uint64_t limit, const char *what) {
+    uint64_t x = num();
+    if(x >= limit) fail(string("bad ") + what + " index");
+    return x;
+  }
+
+  const char *name() {
+    uint64_t x = index(strings.size() + 1, "string");
+    return x ? strings[x - 1] : nullptr;
+  }
+
+  koopa_raw_type_t type() { return types[index(types.size(), "type")]; }
+
+  koopa_raw_value_data_t *value(koopa_raw_type_t ty, koopa_raw_value_tag_t tag) {
+    auto v = alloc<koopa_raw_value_data_t>();
+    v->ty = ty;
+    v->used_by.kind = KOOPA_RSIK_VALUE;
+    v->kind.tag = tag;
+    return v;
+  }
+
+  void use(koopa_raw_slice_t &used_by, const void *user) {
+    used_by.len++;
+    uses.emplace_back(&used_by, user);
+  }
+
+  koopa_raw_value_t operand(const vector<koopa_raw_value_data_t *> &locals, const void *user) {
+    uint64_t x = num();
+    koopa_raw_value_data_t *v;
+    switch(x & 3) {
+      case OPERAND_LOCAL:
+        if((x >> 2) >= locals.size()) fail("bad value index");
+        v = locals[x >> 2];
+        break;
+      case OPERAND_GLOBAL:
+        if((x >> 2) >= globals.size()) fail("bad global index");
+        v = globals[x >> 2];
+        break;
+      case OPERAND_INTEGER:
+        v = value(int32, KOOPA_RVT_INTEGER);
+        v->kind.data.integer.value = int32_t(unzigzag(x >> 2));
+        break;
+      default: {
+        uint64_t kind = x >> 2;
+        if(kind > CONST_AGGREGATE) fail("bad constant kind");
+        auto ty = type();
+        if(kind == CONST_AGGREGATE) {
+          // 合法的 aggregate 每深一层类型少一层, 先限制层数, 元素的类型等读完再检查
+          if(++aggregate_depth > max_type_depth) fail("aggregate nested too deeply");
+          v = value(ty, KOOPA_RVT_AGGREGATE);
+          auto &elems = v->kind.data.aggregate.elems;
+          elems = slice(count(), KOOPA_RSIK_VALUE);
+          for(uint32_t i = 0; i < elems.len; i++) elems.buffer[i] = operand(locals, v);
+          aggregate_depth--;
+        }
+        else v = value(ty, kind == CONST_ZERO_INIT ? KOOPA_RVT_ZERO_INIT : KOOPA_RVT_UNDEF);
+      }
+    }
+    if(user) {
+      use(v->used_by, user);
+      operand_uses.emplace_back(v, user);
+    }
+    return v;
+  }
+
+  // 后面的元素个数, 每个元素至少占一个字节, 所以不会超过剩下的字节数
+  uint64_t count() {
+    uint64_t n = num();
+    if(n > uint64_t(end - pos)) fail("bad count");
+    return n;
+  }
+
+  koopa_raw_slice_t operands(const vector<koopa_raw_value_data_t *> &locals, const void *user) {
+    auto s = slice(count(), KOOPA_RSIK_VALUE);
+    for(uint32_t i = 0; i < s.len; i++) s.buffer[i] = operand(locals, user);
+    return s;
+  }
+
+  void header() {
+    if(!IsBinaryIR(reinterpret_cast<const char *>(pos), end - pos)) fail("not a binary IR file");
+    pos += sizeof(binary_ir_magic);
+    uint64_t version = num();
+    if(version != binary_ir_version)
+      fail("unsupported binary IR version " + to_string(version) + " (expected " + to_string(binary_ir_version) + ")");
+
+    strings.resize(count());
+    for(auto &str : strings) {
+      uint64_t len = num();
+      if(len >= uint64_t(end - pos) || pos[len] != '\0') fail("bad string");
+      str = reinterpret_cast<const char *>(pos);
+      pos += len + 1;
+    }
+
+    int32 = alloc<koopa_raw_type_kind_t>();
+    int32->tag = KOOPA_RTT_INT32;
+    types.resize(count());
+    vector<int> depth(types.size(), 1);
+    for(size_t i = 0; i < types.size(); i++) {
+      // 引用的类型都在前面, 所以只能引用前 i 个
+      auto ty = types[i] = alloc<koopa_raw_type_kind_t>();
+      uint64_t tag = num();
+      if(tag > KOOPA_RTT_FUNCTION) fail("bad type tag");
+      ty->tag = koopa_raw_type_tag_t(tag);
+      if(tag == KOOPA_RTT_ARRAY || tag == KOOPA_RTT_POINTER) {
+        uint64_t base = index(i, "type");
+        if(!is_value_type(types[base])) fail("bad type");
+        if((depth[i] = depth[base] + 1) > max_type_depth) fail("type nested too deeply");
+        if(tag == KOOPA_RTT_POINTER) ty->data.pointer.base = types[base];
+        else {
+          uint64_t len = num();
+          if(!len || len > max_object_size / type_size(types[base])) fail("array too large");
+          ty->data.array.base = types[base];
+          ty->data.array.len = len;
+        }
+      }
+      else if(tag == KOOPA_RTT_FUNCTION) {
+        // 参数只能是 i32 或指针, 返回值只能是 i32 或 unit
+        auto &params = ty->data.function.params;
+        params = slice(count(), KOOPA_RSIK_TYPE);
+        for(uint32_t j = 0; j < params.len; j++) {
+          params.buffer[j] = types[index(i, "type")];
+          if(!is_scalar_type(reinterpret_cast<koopa_raw_type_t>(params.buffer[j]))) fail("bad parameter type");
+        }
+        auto ret = ty->data.function.ret = types[index(i, "type")];
+        if(ret->tag != KOOPA_RTT_INT32 && ret->tag != KOOPA_RTT_UNIT) fail("bad return type");
+      }
+    }
+  }
+
+  void instruction(koopa_raw_value_data_t *v, const vector<koopa_raw_value_data_t *> &locals,
+                   const vector<koopa_raw_basic_block_data_t *> &bbs) {
+    uint64_t tag = num();
+    v->kind.tag = koopa_raw_value_tag_t(tag);
+    v->name = name();
+    v->ty = type();
+    v->used_by.kind = KOOPA_RSIK_VALUE;
+    auto &data = v->kind.data;
+    auto bb = [&]() {
+      auto target = bbs[index(bbs.size(), "basic block")];
+      use(target->used_by, v);
+      return target;
+    };
+    switch(tag) {
+      case KOOPA_RVT_ALLOC:
+        break;
+      case KOOPA_RVT_LOAD:
+        data.load.src = operand(locals, v);
+        break;
+      case KOOPA_RVT_STORE:
+        data.store.value = operand(locals, v);
+        data.store.dest = operand(locals, v);
+        break;
+      case KOOPA_RVT_GET_PTR:
+        data.get_ptr.src = operand(locals, v);
+        data.get_ptr.index = operand(locals, v);
+        break;
+      case KOOPA_RVT_GET_ELEM_PTR:
+        data.get_elem_ptr.src = operand(locals, v);
+        data.get_elem_ptr.index = operand(locals, v);
+        break;
+      case KOOPA_RVT_BINARY: {
+        uint64_t op = num();
+        if(op > KOOPA_RBO_SAR) fail("bad binary operator");
+        data.binary.op = koopa_raw_binary_op_t(op);
+        data.binary.lhs = operand(locals, v);
+        data.binary.rhs = operand(locals, v);
+        break;
+      }
+      case KOOPA_RVT_BRANCH:
+        data.branch.cond = operand(locals, v);
+        data.branch.true_bb = bb();
+        data.branch.false_bb = bb();
+        data.branch.true_args = operands(locals, v);
+        data.branch.false_args = operands(locals, v);
+        break;
+      case KOOPA_RVT_JUMP:
+        data.jump.target = bb();
+        data.jump.args = operands(locals, v);
+        break;
+      case KOOPA_RVT_CALL:
+        data.call.callee = funcs[index(funcs.size(), "function")];
+        data.call.args = operands(locals, v);
+        break;
+      case KOOPA_RVT_RETURN:
+        data.ret.value = num() ? operand(locals, v) : nullptr;
+        break;
+      default:
+        fail("bad instruction tag");
+    }
+  }
+
+  void function(koopa_raw_function_data_t *func) {
+    uint64_t size = num();
+    if(size > uint64_t(end - pos)) fail("truncated function " + string(func->name ? func->name : ""));
+    const unsigned char *section_end = pos + size;
+
+    vector<koopa_raw_value_data_t *> locals;
+    for(uint32_t i = 0; i < func->params.len; i++)
+      locals.push_back(const_cast<koopa_raw_value_data_t *>(reinterpret_cast<koopa_raw_value_t>(func->params.buffer[i])));
+    vector<koopa_raw_basic_block_data_t *> bbs(count());
+    func->bbs = slice(bbs.size(), KOOPA_RSIK_BASIC_BLOCK);
+    for(size_t i = 0; i < bbs.size(); i++) {
+      auto bb = bbs[i] = alloc<koopa_raw_basic_block_data_t>();
+      func->bbs.buffer[i] = bb;
+      bb->name = name();
+      bb->used_by.kind = KOOPA_RSIK_VALUE;
+      bb->params = slice(count(), KOOPA_RSIK_VALUE);
+      for(uint32_t j = 0; j < bb->params.len; j++) {
+        auto param = value(nullptr, KOOPA_RVT_BLOCK_ARG_REF);
+        param->name = name();
+        param->ty = type();
+        if(!is_scalar_type(param->ty)) fail("bad basic block parameter type");
+        param->kind.data.block_arg_ref.index = j;
+        bb->params.buffer[j] = param;
+        locals.push_back(param);
+      }
+      bb->insts = slice(count(), KOOPA_RSIK_VALUE);
+      // 指令可以用到后面的基本块中定义的值, 所以先分配好所有指令
+      auto insts = alloc<koopa_raw_value_data_t>(bb->insts.len);
+      for(uint32_t j = 0; j < bb->insts.len; j++) {
+        bb->insts.buffer[j] = &insts[j];
+        locals.push_back(&insts[j]);
+      }
+    }
+    for(auto bb : bbs) {
+      for(uint32_t j = 0; j < bb->insts.len; j++)
+        instruction(const_cast<koopa_raw_value_data_t *>(reinterpret_cast<koopa_raw_value_t>(bb->insts.buffer[j])), locals, bbs);
+    }
+    if(pos != section_end) fail("bad size of function " + string(func->name ? func->name : ""));
+  }
+
+  // 读完之后检查各个值的类型和基本块的结构; 指令可以用到后面定义的值, 所以不能边读边检查
+  void check() {
+    for(auto &use : operand_uses)
+      if(!is_operand(use.first)) fail("operand without a value");
+    for(auto v : globals) {
+      if(!v->name || !*v->name) fail("global variable without a name");
+      if(!is_constant(v->kind.data.global_alloc.init, v->ty->data.pointer.base))
+        fail(string("bad initializer of ") + v->name);
+    }
+    for(size_t f = 0; f < funcs.size(); f++) {
+      auto func = funcs[f];
+      if(!func->name || !*func->name) fail("function without a name");
+      auto ret = func->ty->data.function.ret;
+      uint64_t frame = 0; // 局部变量的总字节数
+      for(uint32_t i = 0; i < func->bbs.len; i++) {
+        auto bb = reinterpret_cast<koopa_raw_basic_block_t>(func->bbs.buffer[i]);
+        if(!bb->name || !*bb->name) fail(string("basic block without a name in ") + func->name);
+        if(!bb->insts.len) fail(string("empty basic block ") + bb->name + " in " + func->name);
+        for(uint32_t j = 0; j < bb->insts.len; j++) {
+          auto inst = slice_value(bb->insts, j);
+          if(!valid_instruction(inst, ret))
+            fail("bad instruction (kind.tag=" + to_string(inst->kind.tag) + ") in " + func->name);
+          if(is_terminator(inst) != (j + 1 == bb->insts.len))
+            fail(string("basic block ") + bb->name + " in " + func->name + " does not end with exactly one terminator");
+          if(inst->kind.tag == KOOPA_RVT_ALLOC) frame += type_size(inst->ty->data.pointer.base);
+        }
+      }
+      if(frame > max_object_size) fail(string("stack frame too large in ") + func->name);
+      check_dominance(func, function_uses[f].first, function_uses[f].second);
+    }
+  }
+
+  // 指令的结果只能用在它支配的位置: 同一基本块中的后面, 或者它所在的基本块支配的基本块中
+  // 这样值之间的引用没有环, 后端沿着操作数和地址计算递归时一定会结束
+  // 从入口到不了的基本块也要生成代码, 把它们当作入口的后继, 同样要求支配关系,
+  // 所以入口支配所有基本块, 其余的支配关系按支配树判断
+  void check_dominance(koopa_raw_function_t func, size_t first_use, size_t last_use) {
+    uint32_t n = func->bbs.len;
+    if(!n) return;
+    unordered_map<const void *, uint32_t> bb_index;
+    unordered_map<const void *, pair<uint32_t, uint32_t>> where; // 指令 -> (基本块, 第几条)
+    for(uint32_t i = 0; i < n; i++) bb_index[func->bbs.buffer[i]] = i;
+    vector<vector<uint32_t>> succs(n);
+    for(uint32_t i = 0; i < n; i++) {
+      auto bb = reinterpret_cast<koopa_raw_basic_block_t>(func->bbs.buffer[i]);
+      for(uint32_t j = 0; j < bb->insts.len; j++) where[bb->insts.buffer[j]] = {i, j};
+      auto last = slice_value(bb->insts, bb->insts.len - 1);
+      if(last->kind.tag == KOOPA_RVT_BRANCH) {
+        succs[i].push_back(bb_index[last->kind.data.branch.true_bb]);
+        succs[i].push_back(bb_index[last->kind.data.branch.false_bb]);
+      }
+      else if(last->kind.tag == KOOPA_RVT_JUMP) succs[i].push_back(bb_index[last->kind.data.jump.target]);
+    }
+    DominatorTree tree(succs, {0});
+
+    for(size_t k = first_use; k < last_use; k++) {
+      auto def = where.find(operand_uses[k].first), at = where.find(operand_uses[k].second);
+      // 常量、参数和全局变量不是指令; aggregate 的元素的使用者不是指令
+      if(def == where.end() || at == where.end()) continue;
+      uint32_t d = def->second.first, u = at->second.first;
+      bool dominates = d == u ? def->second.second < at->second.second : !d || tree.Dominates(d, u);
+      if(!dominates) fail(string("value used before it is defined in ") + func->name);
+    }
+  }
+
+  void read() {
+    header();
+
+    vector<koopa_raw_value_data_t *> no_locals;
+    globals.resize(count());
+    ir.program.values = slice(globals.size(), KOOPA_RSIK_VALUE);
+    for(size_t i = 0; i < globals.size(); i++) {
+      auto v = globals[i] = value(nullptr, KOOPA_RVT_GLOBAL_ALLOC);
+      v->name = name();
+      v->ty = type();
+      if(v->ty->tag != KOOPA_RTT_POINTER) fail("global variable with a non-pointer type");
+      v->kind.data.global_alloc.init = operand(no_locals, v);
+      ir.program.values.buffer[i] = v;
+    }
+
+    funcs.resize(count());
+    ir.program.funcs = slice(funcs.size(), KOOPA_RSIK_FUNCTION);
+    vector<bool> has_body(funcs.size());
+    for(size_t i = 0; i < funcs.size(); i++) {
+      auto func = funcs[i] = alloc<koopa_raw_function_data_t>();
+      func->name = name();
+      func->ty = type();
+      if(func->ty->tag != KOOPA_RTT_FUNCTION) fail("function with a non-function type");
+      auto &param_types = func->ty->data.function.params;
+      func->params = slice(param_types.len, KOOPA_RSIK_VALUE);
+      for(uint32_t j = 0; j < param_types.len; j++) {
+        auto param = value(reinterpret_cast<koopa_raw_type_t>(param_types.buffer[j]), KOOPA_RVT_FUNC_ARG_REF);
+        param->name = name();
+        param->kind.data.func_arg_ref.index = j;
+        func->params.buffer[j] = param;
+      }
+      func->bbs = slice(0, KOOPA_RSIK_BASIC_BLOCK);
+      has_body[i] = num();
+      ir.program.funcs.buffer[i] = func;
+    }
+    function_uses.resize(funcs.size());
+    for(size_t i = 0; i < funcs.size(); i++) {
+      if(!has_body[i]) continue;
+      function_uses[i].first = operand_uses.size();
+      function(funcs[i]);
+      function_uses[i].second = operand_uses.size();
+    }
+    if(pos != end) fail("trailing data");
+    check();
+
+    // 按计数分配 used_by, 再按读到的顺序填入
+    for(auto &use : uses) {
+      auto &used_by = *use.first;
+      if(!used_by.buffer) {
+        used_by.buffer = alloc<const void *>(used_by.len);
+        used_by.len = 0;
+      }
+      used_by.buffer[used_by.len++] = use.second;
+    }
+  }
+};
+
+BinaryIR::BinaryIR() = default;
+
+BinaryIR::~BinaryIR() {
+  if(mapped) munmap(mapped, mapped_size);
+}
+
+bool BinaryIR::Load(const char *data, size_t size, string &error) {
+  Reader reader(*this, data, size);
+  try {
+    reader.read();
+  } catch(const string &msg) {
+    error = "invalid binary IR: " + msg;
+    program = koopa_raw_program_t{};
+    return false;
+  }
+  return true;
+}
+
+bool BinaryIR::Map(const string &path, string &error) {
+  int fd = open(path.c_str(), O_RDONLY);
+  if(fd < 0) {
+    error = "cannot open " + path;
+    return false;
+  }
+  struct stat st;
+  if(fstat(fd, &st) != 0 || st.st_size == 0) {
+    close(fd);
+    error = "invalid binary IR: empty file " + path;
+    return false;
+  }
+  void *data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if(data == MAP_FAILED) {
+    error = "cannot map " + path;
+    return false;
+  }
+  mapped = data;
+  mapped_size = st.st_size;
+  return Load(static_cast<const char *>(data), st.st_size, error);
+}
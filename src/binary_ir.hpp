@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+#include "koopa.h"
+
+// 二进制 IR: raw program 的紧凑、带版本号的序列化格式, 读入时不解析文本, 直接重建 raw program 交给后端
+// 用于缓存 Koopa 解析的结果、在编译器进程之间传递 IR (-koopa-bin 的输出可以作为输入)
+//
+// 格式 (除魔数外都是 LEB128 变长整数, 有符号数先做 zigzag):
+//   "SYIR" 版本号
+//   字符串表: 个数, 每个是 长度 字节 '\0' (读入后名字直接指向其中, 不再复制)
+//   类型表: 个数, 每个是 tag 和参数 (数组: 元素类型 长度; 指针: 基类型; 函数: 参数个数 各参数类型 返回类型),
+//           引用的类型都在前面
+//   全局变量: 个数, 每个是 名字 类型 初值
+//   函数表: 个数, 每个是 名字 类型 各参数的名字 有无函数体 (参数个数由函数类型给出)
+//   每个有函数体的函数一节: 字节数, 基本块个数, 每个基本块的 名字 参数个数 各参数的名字和类型 指令条数,
+//           然后是所有指令, 每条是 tag 名字 类型 和该类指令的操作数
+// 名字是字符串表的下标加一 (0 表示没有名字), 类型是类型表的下标
+// 操作数是 (x << 2) | kind: kind 0 为函数中的第 x 个值 (参数、基本块参数、指令依次编号), 1 为第 x 个全局变量,
+// 2 为整数 x, 3 为常量 (x 为 0 zeroinit、1 undef、2 aggregate, 后面是类型, aggregate 还有元素个数和各元素)
+
+// 把 program 写成二进制 IR, 追加到 out
+void WriteBinaryIR(const koopa_raw_program_t &program, std::string &out);
+
+// data 是否以二进制 IR 的魔数开头
+bool IsBinaryIR(const char *data, size_t size);
+
+// 读入的二进制 IR, raw program 中的所有指针都指向它持有的内存
+class BinaryIR {
+ public:
+  BinaryIR();
+  ~BinaryIR();
+  BinaryIR(const BinaryIR &) = delete;
+  BinaryIR &operator=(const BinaryIR &) = delete;
+
+  // 读入内存中的二进制 IR, 时间与大小成正比; 失败时返回 false 并在 error 中给出原因
+  // 名字指向 data 中的字符串, data 要在本对象析构之前一直有效
+  bool Load(const char *data, size_t size, std::string &error);
+  // 映射文件 path 后读入, 映射在本对象析构时解除
+  bool Map(const std::string &path, std::string &error);
+
+  const koopa_raw_program_t &Program() const { return program; }
+
+ private:
+  struct Reader;
+  koopa_raw_program_t program{};
+  std::vector<std::unique_ptr<char[]>> arena; // 重建的 raw program 占用的内存
+  void *mapped = nullptr;
+  size_t mapped_size = 0;
+};
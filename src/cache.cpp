@@ -0,0 +1,194 @@
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <dirent.h>
+#include <fcntl.h>
+#include <string>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+#include "cache.hpp"
+
+using namespace std;
+
+/*********************************sha256***********************************/
+static const uint32_t sha256_k[64] = {
+  0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+  0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+  0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+  0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+  0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+  0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+  0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+  0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+static inline uint32_t rotr(uint32_t x, int n) { return (x >> n) | (x << (32 - n)); }
+
+static void sha256_block(uint32_t h[8], const unsigned char *p) {
+  uint32_t w[64];
+  for(int i = 0; i < 16; i++)
+    w[i] = (uint32_t)p[4*i] << 24 | (uint32_t)p[4*i+1] << 16 | (uint32_t)p[4*i+2] << 8 | p[4*i+3];
+  for(int i = 16; i < 64; i++) {
+    uint32_t s0 = rotr(w[i-15], 7) ^ rotr(w[i-15], 18) ^ (w[i-15] >> 3);
+    uint32_t s1 = rotr(w[i-2], 17) ^ rotr(w[i-2], 19) ^ (w[i-2] >> 10);
+    w[i] = w[i-16] + s0 + w[i-7] + s1;
+  }
+  uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4], f = h[5], g = h[6], k = h[7];
+  for(int i = 0; i < 64; i++) {
+    uint32_t t1 = k + (rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25)) + ((e & f) ^ (~e & g)) + sha256_k[i] + w[i];
+    uint32_t t2 = (rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+    k = g; g = f; f = e; e = d + t1;
+    d = c; c = b; b = a; a = t1 + t2;
+  }
+  h[0] += a; h[1] += b; h[2] += c; h[3] += d; h[4] += e; h[5] += f; h[6] += g; h[7] += k;
+}
+
+string sha256_hex(const string &data) {
+  uint32_t h[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+                   0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+  size_t n = data.size();
+  const unsigned char *p = reinterpret_cast<const unsigned char *>(data.data());
+  size_t full = n / 64 * 64;
+  for(size_t i = 0; i < full; i += 64) sha256_block(h, p + i);
+  // 最后不足一块的部分, 加上 0x80 和以位计的长度, 补齐到一块或两块
+  unsigned char tail[128] = {0};
+  size_t rest = n - full;
+  memcpy(tail, p + full, rest);
+  tail[rest] = 0x80;
+  size_t tail_len = rest + 9 <= 64 ? 64 : 128;
+  uint64_t bits = (uint64_t)n * 8;
+  for(int i = 0; i < 8; i++) tail[tail_len - 1 - i] = bits >> (8 * i);
+  for(size_t i = 0; i < tail_len; i += 64) sha256_block(h, tail + i);
+
+  static const char digits[] = "0123456789abcdef";
+  string hex;
+  for(int i = 0; i < 8; i++)
+    for(int j = 28; j >= 0; j -= 4) hex += digits[(h[i] >> j) & 0xf];
+  return hex;
+}
+/*******************************sha256 end*********************************/
+
+const string &compiler_build_id() {
+  // 用可执行文件的 inode、大小和修改时间标识编译器, 每次重新链接都会改变,
+  // 比对整个可执行文件求哈希快得多
+  static const string id = [] {
+    struct stat st;
+    if(stat("/proc/self/exe", &st)) return string("sysy " __DATE__ " " __TIME__);
+    return to_string(st.st_ino) + ":" + to_string(st.st_size) + ":"
+         + to_string(st.st_mtim.tv_sec) + "." + to_string(st.st_mtim.tv_nsec);
+  }();
+  return id;
+}
+
+// 条目文件开头的标记, 后面跟内容的长度, 用来发现被截断的条目
+static const char entry_magic[] = "sysy-cache 1\n";
+
+static string entry_path(const string &dir, const string &key) {
+  return dir + "/" + key.substr(0, 2) + "/" + key.substr(2);
+}
+
+bool cache_lookup(const string &dir, const string &key, string &output) {
+  string path = entry_path(dir, key);
+  FILE *fp = fopen(path.c_str(), "rb");
+  if(!fp) return false;
+  string data;
+  char buf[65536];
+  for(size_t n; (n = fread(buf, 1, sizeof(buf), fp)) > 0;) data.append(buf, n);
+  fclose(fp);
+
+  size_t magic_len = strlen(entry_magic);
+  size_t newline = data.find('\n', magic_len);
+  if(data.compare(0, magic_len, entry_magic) || newline == string::npos) return false;
+  if(data.size() - newline - 1 != strtoull(data.c_str() + magic_len, nullptr, 10)) return false;
+  output = data.substr(newline + 1);
+  // 更新修改时间, 标记为最近用过
+  utimensat(AT_FDCWD, path.c_str(), nullptr, 0);
+  return true;
+}
+
+// 扫描缓存目录, 总大小超过 max_bytes 时从最旧的条目开始删除, 删到上限的 3/4,
+// 避免之后每次写入都要淘汰
+// 用目录下 lock 文件上的 flock 保证同一时刻只有一个进程在淘汰, 拿不到锁就跳过
+// 扫描整个目录代价较高, lock 文件的修改时间记录上次扫描的时间, 10 秒内只扫描一次,
+// 所以缓存大小可能暂时略超过上限
+static void cache_evict(const string &dir, uint64_t max_bytes) {
+  string lock_path = dir + "/lock";
+  struct stat lock_st;
+  if(!stat(lock_path.c_str(), &lock_st) && time(nullptr) - lock_st.st_mtime < 10) return;
+  int lock = open(lock_path.c_str(), O_RDWR | O_CREAT, 0644);
+  if(lock < 0) return;
+  if(flock(lock, LOCK_EX | LOCK_NB)) {
+    close(lock);
+    return;
+  }
+  futimens(lock, nullptr);
+
+  struct Entry {
+    timespec mtime;
+    uint64_t size;
+    string path;
+  };
+  vector<Entry> entries;
+  uint64_t total = 0;
+  time_t now = time(nullptr);
+  DIR *top = opendir(dir.c_str());
+  for(dirent *sub; top && (sub = readdir(top));) {
+    if(strlen(sub->d_name) != 2) continue;
+    string sub_dir = dir + "/" + sub->d_name;
+    DIR *d = opendir(sub_dir.c_str());
+    for(dirent *e; d && (e = readdir(d));) {
+      if(e->d_name[0] == '.') continue;
+      string path = sub_dir + "/" + e->d_name;
+      struct stat st;
+      if(stat(path.c_str(), &st) || !S_ISREG(st.st_mode)) continue;
+      // 写到一半就退出的进程留下的临时文件
+      if(!strncmp(e->d_name, "tmp.", 4)) {
+        if(now - st.st_mtime > 3600) unlink(path.c_str());
+        continue;
+      }
+      entries.push_back({st.st_mtim, (uint64_t)st.st_size, path});
+      total += st.st_size;
+    }
+    if(d) closedir(d);
+  }
+  if(top) closedir(top);
+
+  if(total > max_bytes) {
+    sort(entries.begin(), entries.end(), [](const Entry &a, const Entry &b) {
+      return a.mtime.tv_sec != b.mtime.tv_sec ? a.mtime.tv_sec < b.mtime.tv_sec
+                                              : a.mtime.tv_nsec < b.mtime.tv_nsec;
+    });
+    for(auto &entry : entries) {
+      if(total <= max_bytes / 4 * 3) break;
+      if(!unlink(entry.path.c_str())) total -= entry.size;
+    }
+  }
+  flock(lock, LOCK_UN);
+  close(lock);
+}
+
+void cache_store(const string &dir, const string &key, const string &output, uint64_t max_bytes) {
+  string sub_dir = dir + "/" + key.substr(0, 2);
+  mkdir(dir.c_str(), 0755);
+  if(mkdir(sub_dir.c_str(), 0755) && errno != EEXIST) return;
+
+  // 临时文件名包含进程号和进程内的序号, 不同进程、线程之间不会冲突
+  static atomic<unsigned> counter{0};
+  string tmp = sub_dir + "/tmp." + to_string(getpid()) + "." + to_string(counter++);
+  FILE *fp = fopen(tmp.c_str(), "wb");
+  if(!fp) return;
+  string header = entry_magic + to_string(output.size()) + "\n";
+  bool ok = fwrite(header.data(), 1, header.size(), fp) == header.size()
+            && fwrite(output.data(), 1, output.size(), fp) == output.size();
+  ok = fclose(fp) == 0 && ok;
+  if(!ok || rename(tmp.c_str(), entry_path(dir, key).c_str())) {
+    unlink(tmp.c_str());
+    return;
+  }
+  cache_evict(dir, max_bytes);
+}
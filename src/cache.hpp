@@ -0,0 +1,24 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+// 内容寻址的编译结果缓存
+// 每个条目是 dir/前两位/其余位 的一个文件, 文件名是键 (SHA-256) 的十六进制表示,
+// 内容是一次编译的完整输出。写入时先写临时文件再 rename, 所以多个编译器进程
+// 同时读写同一个缓存目录时, 读到的条目要么完整要么不存在
+
+// data 的 SHA-256, 64 位十六进制
+std::string sha256_hex(const std::string &data);
+
+// 标识编译器本身的字符串, 重新编译、链接编译器后会改变, 要加入缓存的键中
+const std::string &compiler_build_id();
+
+// 查找 key 对应的条目, 命中时把内容放到 output 并返回 true
+// 命中会更新条目的修改时间, 淘汰时按修改时间从旧到新删除, 即 LRU
+bool cache_lookup(const std::string &dir, const std::string &key, std::string &output);
+
+// 写入条目, 之后若缓存总大小超过 max_bytes 就淘汰最久没有用到的条目
+// 写入失败 (例如目录不可写) 只会让之后的查找不命中, 不影响编译
+void cache_store(const std::string &dir, const std::string &key, const std::string &output,
+                 uint64_t max_bytes);
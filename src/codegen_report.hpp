@@ -0,0 +1,159 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <iomanip>
+#include <mutex>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+// 静态代价模型和各函数的代码质量报告 (--report=codegen)
+// 不运行程序, 只根据生成的汇编估计每个基本块的代价, 用来发现代码质量的退化
+
+// 一个基本块的统计, 块中包括该 Koopa 基本块生成的全部汇编 (含跳板标签和函数序言)
+struct BlockCost {
+  std::string label;
+  int loop_depth = 0;  // 所在循环的嵌套层数
+  int insts = 0;       // 指令条数, 伪指令按展开后的条数计算
+  long long count = -1; // 按 -fprofile-use 的计数执行的次数, 没有计数时为 -1
+  double cost = 0;     // 按延迟估计的代价
+  double weighted = 0; // cost * count, 没有计数时用 cost * 10^loop_depth 估计
+};
+
+struct FunctionCost {
+  std::string name;
+  int frame_size = 0; // 栈帧长度 (stack_frame_length)
+  int spills = 0;     // 把中间结果存到栈上的次数
+  int reloads = 0;    // 从栈上取回中间结果的次数
+  int insts = 0, loads = 0, stores = 0, muldiv = 0, branches = 0, jumps = 0, calls = 0;
+  double cost = 0;    // 各基本块 weighted 之和
+  std::vector<BlockCost> blocks;
+};
+
+// 一条指令的代价, 大致对应单发射顺序执行的 RV32IM 核心:
+// 访存 3 (load-use 延迟), 乘法 3, 除法和取余 20, 分支和跳转 2 (平均的跳转开销), 调用和返回 3,
+// 其余 1; 伪指令 li (超出 12 位立即数) 和 la 展开为两条
+// 返回值是展开后的指令条数, 同时把统计累加到 func 中
+inline int account_instruction(const std::string &line, FunctionCost &func, double &cost) {
+  std::istringstream in(line);
+  std::string op, dst, src;
+  in >> op;
+  if(op.empty() || op[0] == '.' || op.back() == ':') return 0;
+  int count = 1;
+  if(op == "li") {
+    in >> dst >> src;
+    long long value = std::strtoll(src.c_str(), nullptr, 0);
+    if(value < -2048 || value >= 2048) count = 2;
+    cost += count;
+  }
+  else if(op == "la") {
+    count = 2;
+    cost += 2;
+  }
+  else if(op[0] == 'l' && (op == "lw" || op == "lh" || op == "lhu" || op == "lb" || op == "lbu")) {
+    func.loads++;
+    cost += 3;
+  }
+  else if(op == "sw" || op == "sh" || op == "sb") {
+    func.stores++;
+    cost += 1;
+  }
+  else if(op.compare(0, 3, "mul") == 0) {
+    func.muldiv++;
+    cost += 3;
+  }
+  else if(op.compare(0, 3, "div") == 0 || op.compare(0, 3, "rem") == 0) {
+    func.muldiv++;
+    cost += 20;
+  }
+  else if(op[0] == 'b') {
+    func.branches++;
+    cost += 2;
+  }
+  else if(op == "j" || op == "jr" || op == "jal" || op == "jalr") {
+    func.jumps++;
+    cost += 2;
+  }
+  else if(op == "call" || op == "tail" || op == "ret") {
+    if(op != "ret") func.calls++;
+    cost += 3;
+  }
+  else cost += 1;
+  return count;
+}
+
+// 统计一个基本块的汇编 text, 结果记到 block 和 func 中
+inline void account_block(const std::string &text, BlockCost &block, FunctionCost &func) {
+  std::istringstream in(text);
+  for(std::string line; std::getline(in, line);) block.insts += account_instruction(line, func, block.cost);
+  block.weighted = block.cost * (block.count >= 0 ? double(block.count) : std::pow(10.0, block.loop_depth));
+  func.insts += block.insts;
+  func.cost += block.weighted;
+}
+
+// 汇总各个文件中各个函数的统计
+// 批量编译时所有文件共用一个 CodegenReport, 可以在多个线程中同时记录
+class CodegenReport {
+ public:
+  void Add(const std::string &input, std::vector<FunctionCost> funcs) {
+    std::lock_guard<std::mutex> lock(mutex);
+    files.emplace_back(input, std::move(funcs));
+  }
+
+  // 按文件名排序输出, 使批量编译的结果与线程的调度无关
+  void Print(std::ostream &out, bool json) {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::stable_sort(files.begin(), files.end(),
+                     [](const File &a, const File &b) { return a.first < b.first; });
+    if(json) {
+      out << "{\"files\": [";
+      for(size_t i = 0; i < files.size(); i++) {
+        out << (i ? ", " : "") << "{\"input\": \"" << files[i].first << "\", \"functions\": [";
+        for(size_t j = 0; j < files[i].second.size(); j++) {
+          auto &f = files[i].second[j];
+          out << (j ? ", " : "") << "{\"name\": \"" << f.name << "\", \"frame_size\": " << f.frame_size
+              << ", \"spills\": " << f.spills << ", \"reloads\": " << f.reloads << ", \"insts\": " << f.insts
+              << ", \"loads\": " << f.loads << ", \"stores\": " << f.stores << ", \"muldiv\": " << f.muldiv
+              << ", \"branches\": " << f.branches << ", \"jumps\": " << f.jumps << ", \"calls\": " << f.calls
+              << ", \"cost\": " << f.cost << ", \"blocks\": [";
+          for(size_t k = 0; k < f.blocks.size(); k++) {
+            auto &b = f.blocks[k];
+            out << (k ? ", " : "") << "{\"label\": \"" << b.label << "\", \"loop_depth\": " << b.loop_depth
+                << ", \"count\": " << b.count << ", \"insts\": " << b.insts << ", \"cost\": " << b.cost << ", \"weighted\": " << b.weighted << "}";
+          }
+          out << "]}";
+        }
+        out << "]}";
+      }
+      out << "]}" << std::endl;
+      return;
+    }
+    for(auto &file : files) {
+      out << file.first << ":" << std::endl;
+      for(auto &f : file.second) {
+        out << "function " << f.name << ": frame " << f.frame_size << " bytes, " << f.spills << " spills, "
+            << f.reloads << " reloads, " << f.insts << " instructions (" << f.loads << " loads, " << f.stores
+            << " stores, " << f.muldiv << " mul/div, " << f.branches << " branches, " << f.jumps << " jumps, "
+            << f.calls << " calls), cost " << std::fixed << std::setprecision(1) << f.cost << std::endl;
+        out << "  " << std::left << std::setw(28) << "block" << std::right << std::setw(6) << "depth"
+            << std::setw(12) << "count" << std::setw(7) << "insts" << std::setw(10) << "cost" << std::setw(14)
+            << "weighted" << std::endl;
+        for(auto &b : f.blocks)
+          out << "  " << std::left << std::setw(28) << b.label << std::right << std::setw(6) << b.loop_depth
+              << std::setw(12) << (b.count >= 0 ? std::to_string(b.count) : "-") << std::setw(7) << b.insts
+              << std::setw(10) << b.cost << std::setw(14) << b.weighted << std::endl;
+        out << std::defaultfloat;
+      }
+    }
+  }
+
+ private:
+  typedef std::pair<std::string, std::vector<FunctionCost>> File;
+  std::mutex mutex;
+  std::vector<File> files;
+};
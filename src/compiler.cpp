@@ -0,0 +1,768 @@
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <fcntl.h>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <set>
+#include <unordered_map>
+#include <sstream>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+#include "ast.hpp"
+#include "binary_ir.hpp"
+#include "cache.hpp"
+#include "codegen_report.hpp"
+#include "compiler.hpp"
+#include "koopa.h"
+#include "profile.hpp"
+#include "schedule.hpp"
+#include "thread_pool.hpp"
+#include "time_report.hpp"
+#include "visit_koopa_raw.hpp"
+
+using namespace std;
+
+// Flex/Bison 生成的可重入 lexer 和 parser 的接口
+typedef void *yyscan_t;
+extern int yylex_init_extra(long *token_count, yyscan_t *scanner);
+#ifdef SYSY_SIMD_LEXER
+// simd_lexer.cpp 直接扫描内存中的源代码
+extern void yyset_buffer(const char *data, size_t size, yyscan_t scanner);
+#else
+extern void yyset_in(FILE *in, yyscan_t scanner);
+#endif
+extern int yylex_destroy(yyscan_t scanner);
+extern int yyparse(yyscan_t scanner, unique_ptr<BaseAST> &ast, ostream &diag);
+
+// 缓存的键: 输入内容和所有影响输出的东西, 以后新增影响输出的选项也要加进来
+static string cache_key(const CompileOptions &opts, const string &source) {
+  string key_data = compiler_build_id();
+  key_data += '\0';
+  key_data += opts.mode;
+  key_data += '\0';
+  if(opts.profile_generate) key_data += "profile-generate";
+  key_data += '\0';
+  if(opts.profile) key_data += opts.profile->Digest();
+  key_data += '\0';
+  if(opts.auto_memoize) key_data += "memoize=" + to_string(opts.auto_memoize);
+  key_data += '\0';
+  if(opts.ipo) key_data += "ipo";
+  key_data += '\0';
+  if(opts.schedule) key_data += string("schedule=") + opts.schedule->name;
+  key_data += '\0';
+  key_data += source;
+  return sha256_hex(key_data);
+}
+
+// 函数粒度的缓存的键, kind 为 "ir" 或 "asm", 汇编还取决于输出模式
+static string fragment_key(const CompileOptions &opts, const string &kind, const string &fingerprint) {
+  string key_data = compiler_build_id();
+  key_data += '\0';
+  key_data += kind;
+  key_data += '\0';
+  if(kind == "asm") key_data += opts.mode;
+  key_data += '\0';
+  if(kind == "asm" && opts.schedule) key_data += string("schedule=") + opts.schedule->name;
+  key_data += '\0';
+  key_data += fingerprint;
+  return sha256_hex(key_data);
+}
+
+// 由函数定义的 IR 得到对应的声明
+// 例如 "fun @f(@x: i32, @a: *[i32, 3]): i32 {" -> "decl @f(i32, *[i32, 3]): i32"
+static string function_decl(const string &ir) {
+  size_t open = ir.find('('), pos = open + 1, param = pos;
+  string decl = "decl " + ir.substr(4, open - 4) + "(";
+  bool first = true;
+  for(int depth = 0; ; pos++) {
+    if(ir[pos] == '[') depth++;
+    else if(ir[pos] == ']') depth--;
+    else if(depth == 0 && (ir[pos] == ',' || ir[pos] == ')')) {
+      // 参数形如 "@x: i32", 只保留类型
+      size_t colon = ir.find(':', param);
+      if(colon < pos) {
+        decl += (first ? "" : ", ") + ir.substr(colon + 2, pos - colon - 2);
+        first = false;
+      }
+      param = pos + 1;
+      if(ir[pos] == ')') break;
+    }
+  }
+  // ')' 和 '{' 之间是返回类型, 如 ": i32 ", 没有返回值时只有空格
+  string ret = ir.substr(pos + 1, ir.find('{', pos) - pos - 1);
+  ret.erase(ret.find_last_not_of(' ') + 1);
+  return decl + ")" + ret + "\n";
+}
+
+// 统计以两个空格缩进、且不是以 . 开头的伪指令的行数, 即 Koopa IR 或汇编中的指令条数
+static uint64_t count_instructions(const string &text) {
+  uint64_t count = 0;
+  for(size_t pos = 0; (pos = text.find("\n  ", pos)) != string::npos; pos += 3)
+    if(pos + 3 < text.size() && text[pos + 3] != '.') count++;
+  return count;
+}
+
+// 把 Koopa IR 文本解析成 raw program, 交给 generate 生成汇编
+// 启用缓存时按 IR 文本缓存解析结果的二进制 IR, IR 没变 (如只改了注释和格式) 时不再解析文本
+static int with_raw_program(const CompileOptions &opts, const string &input, const string &ir,
+                            const function<void(const koopa_raw_program_t &)> &generate) {
+  string binary_key;
+  if(!opts.cache_dir.empty()) {
+    binary_key = fragment_key(opts, "bir", ir);
+    string binary, error;
+    BinaryIR cached;
+    bool hit;
+    {
+      PhaseTimer timer(opts.time_report, "binary IR load");
+      hit = cache_lookup(opts.cache_dir, binary_key, binary) && cached.Load(binary.data(), binary.size(), error);
+      if(timer.Enabled()) timer.Count(hit, "hits");
+    }
+    if(hit) {
+      generate(cached.Program());
+      return 0;
+    }
+  }
+  koopa_program_t program;
+  {
+    PhaseTimer timer(opts.time_report, "Koopa parse");
+    if(timer.Enabled()) timer.Count(count_instructions(ir), "IR instructions");
+    koopa_error_code_t ret = koopa_parse_from_string(ir.c_str(), &program);
+    if(ret != KOOPA_EC_SUCCESS) {
+      *opts.diag << "error: " << input << ": invalid Koopa IR generated" << endl;
+      return 1;
+    }
+  }
+  // 创建一个 raw program builder, 用来构建 raw program
+  koopa_raw_program_builder_t builder = koopa_new_raw_program_builder();
+  koopa_raw_program_t raw;
+  {
+    PhaseTimer timer(opts.time_report, "raw program build");
+    // 将 Koopa IR 程序转换为 raw program
+    raw = koopa_build_raw_program(builder, program);
+    // 释放 Koopa IR 程序占用的内存
+    koopa_delete_program(program);
+    if(timer.Enabled()) timer.Count(raw.funcs.len, "functions");
+  }
+  if(!binary_key.empty()) {
+    string binary;
+    WriteBinaryIR(raw, binary);
+    cache_store(opts.cache_dir, binary_key, binary, opts.cache_size);
+  }
+
+  // 处理 raw program
+  generate(raw);
+
+  // 处理完成, 释放 raw program builder 占用的内存
+  // 注意, raw program 中所有的指针指向的内存均为 raw program builder 的内存
+  // 所以不要在 raw program 处理完毕之前释放 builder
+  koopa_delete_raw_program_builder(builder);
+  return 0;
+}
+
+// 增量生成汇编: 汇编已在缓存中的函数在 IR 中只保留声明, 只为其余函数生成汇编,
+// 再和缓存中的汇编按原来的顺序拼接
+static int generate_incremental(const CompileOptions &opts, const string &input, const string &ir,
+                                const vector<FrontendContext::FunctionIR> &functions, ostream &out) {
+  vector<string> cached(functions.size());
+  vector<bool> hit(functions.size());
+  string partial;
+  long pos = 0;
+  for(size_t i = 0; i < functions.size(); i++) {
+    auto &func = functions[i];
+    string func_ir = ir.substr(func.begin, func.end - func.begin);
+    partial += ir.substr(pos, func.begin - pos);
+    hit[i] = cache_lookup(opts.cache_dir, fragment_key(opts, "asm", func.fingerprint), cached[i]);
+    partial += hit[i] ? function_decl(func_ir) : func_ir;
+    pos = func.end;
+  }
+  partial += ir.substr(pos);
+
+  string globals;
+  vector<pair<string, string>> generated;
+  if(with_raw_program(opts, input, partial, [&](const koopa_raw_program_t &raw) {
+       PhaseTimer timer(opts.time_report, "code generation");
+       BackendOptions backend;
+       backend.pool = opts.pool;
+       backend.schedule = opts.schedule;
+       GenerateRiscvFragments(raw, globals, generated, backend);
+       if(!timer.Enabled()) return;
+       uint64_t count = 0;
+       for(auto &func : generated) count += count_instructions(func.second);
+       timer.Count(count, "instructions");
+       timer.Count(generated.size(), "functions");
+     })) return 1;
+
+  // 生成的应当恰好是缓存中没有的函数, 按原来的顺序; 对不上时报错, 不输出拼错的汇编
+  bool match = generated.size() == size_t(count(hit.begin(), hit.end(), false));
+  for(size_t i = 0, next = 0; match && i < functions.size(); i++)
+    if(!hit[i]) match = generated[next++].first == functions[i].name;
+  if(!match) {
+    *opts.diag << "error: " << input << ": functions generated by the backend do not match the IR" << endl;
+    return 1;
+  }
+
+  out << globals;
+  size_t next = 0;
+  for(size_t i = 0; i < functions.size(); i++) {
+    if(hit[i]) {
+      out << cached[i];
+      continue;
+    }
+    out << generated[next].second;
+    cache_store(opts.cache_dir, fragment_key(opts, "asm", functions[i].fingerprint),
+                generated[next].second, opts.cache_size);
+    next++;
+  }
+  return 0;
+}
+
+// 把整个文件读到 content 中
+static bool read_file(const string &path, string &content) {
+#ifdef SYSY_SIMD_LEXER
+  // 映射整个文件后一次复制出来, 不经过 stdio 的缓冲区; 空文件和不能映射的文件 (如管道) 仍用 fread
+  int fd = open(path.c_str(), O_RDONLY);
+  if(fd < 0) return false;
+  struct stat st;
+  if(fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+    void *data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if(data != MAP_FAILED) {
+      madvise(data, st.st_size, MADV_SEQUENTIAL);
+      content.assign(static_cast<const char *>(data), st.st_size);
+      munmap(data, st.st_size);
+      close(fd);
+      return true;
+    }
+  }
+  close(fd);
+#endif
+  FILE *fp = fopen(path.c_str(), "rb");
+  if(!fp) return false;
+  char buf[65536];
+  for(size_t n; (n = fread(buf, 1, sizeof(buf), fp)) > 0;) content.append(buf, n);
+  bool ok = !ferror(fp);
+  fclose(fp);
+  return ok;
+}
+
+// 编译已经读入内存的源代码 source, input 只用于报错
+static int compile_source(const CompileOptions &opts, const string &input, const string &source, ostream &out) {
+  // parse input file
+#ifndef SYSY_SIMD_LEXER
+  FILE *fp = fmemopen(const_cast<char *>(source.data()), source.size(), "r");
+  if(!fp) {
+    *opts.diag << "error: cannot open " << input << endl;
+    return 1;
+  }
+#endif
+  unique_ptr<BaseAST> ast;
+  int ret;
+  {
+    PhaseTimer timer(opts.time_report, "parse");
+    long tokens = 0;
+    uint64_t nodes = ast_node_count;
+    yyscan_t scanner;
+    yylex_init_extra(timer.Enabled() ? &tokens : nullptr, &scanner);
+#ifdef SYSY_SIMD_LEXER
+    yyset_buffer(source.data(), source.size(), scanner);
+#else
+    yyset_in(fp, scanner);
+#endif
+    ret = yyparse(scanner, ast, *opts.diag);
+    yylex_destroy(scanner);
+#ifndef SYSY_SIMD_LEXER
+    fclose(fp);
+#endif
+    if(timer.Enabled()) {
+      timer.Count(tokens, "tokens");
+      timer.Count(ast_node_count - nodes, "AST nodes");
+    }
+  }
+  if(ret) {
+    *opts.diag << "error: failed to parse " << input << endl;
+    return 1;
+  }
+
+  if(opts.verbose) {
+    PhaseTimer timer(opts.time_report, "AST dump");
+    cout<<"parse done"<<endl;
+    // dump AST
+    cout<<"Dump start"<<endl;
+    ast->Dump();
+    cout <<"Dump done"<< endl;
+  }
+
+  // generate Koopa IR
+  stringstream ss;
+  FrontendContext frontend(ss);
+  Remarks remarks(opts.remarks);
+  if(opts.remarks.Enabled()) frontend.remarks = &remarks;
+  frontend.ipo = opts.ipo;
+  // 启用缓存时按函数复用之前生成的 IR, 需要优化报告时每个函数都要重新生成;
+  // 过程间优化后函数的 IR 取决于其他函数中的调用, 也不按函数复用
+  if(!opts.cache_dir.empty() && !opts.remarks.Enabled() && !opts.ipo) {
+    frontend.source = &source;
+    frontend.reuse_function = [&opts](const string &fingerprint, string &ir) {
+      return cache_lookup(opts.cache_dir, fragment_key(opts, "ir", fingerprint), ir);
+    };
+  }
+  // 前端和后端遇到不支持的程序时抛出异常, 只让这一次编译失败
+  string str;
+  try {
+    {
+      PhaseTimer timer(opts.time_report, "IR generation");
+      ctx = &frontend;
+      ast->KoopaIR();
+      ctx = nullptr;
+      str = ss.str();
+      if(timer.Enabled()) {
+        timer.Count(count_instructions(str), "IR instructions");
+        timer.Count(count_if(frontend.functions.begin(), frontend.functions.end(),
+                             [](const FrontendContext::FunctionIR &func) { return func.reused; }),
+                    "functions reused");
+      }
+    }
+    for(auto &func : frontend.functions) {
+      if(!func.reused)
+        cache_store(opts.cache_dir, fragment_key(opts, "ir", func.fingerprint),
+                    str.substr(func.begin, func.end - func.begin), opts.cache_size);
+    }
+
+    if(opts.mode == "-koopa")
+    {
+      out << str;
+    }
+    else if(opts.mode == "-koopa-bin")
+    {
+      if(with_raw_program(opts, input, str, [&](const koopa_raw_program_t &raw) {
+           PhaseTimer timer(opts.time_report, "binary IR write");
+           string binary;
+           WriteBinaryIR(raw, binary);
+           out << binary;
+           if(timer.Enabled()) timer.Count(binary.size(), "bytes");
+         })) return 1;
+    }
+    // 代码质量报告需要统计每个函数, 不能复用缓存中的汇编;
+    // 插桩的计数器表跨越所有函数, 按计数生成的汇编取决于计数, 记忆表取决于整个程序, 也都不按函数复用
+    else if(!frontend.functions.empty() && !opts.codegen_report && !opts.profile_generate && !opts.profile &&
+            !opts.auto_memoize)
+    {
+      if(generate_incremental(opts, input, str, frontend.functions, out)) return 1;
+    }
+    else
+    {
+      // 统计时先生成到缓冲区, 以便数出指令条数
+      ostringstream code;
+      vector<FunctionCost> costs;
+      BackendOptions backend;
+      backend.pool = opts.pool;
+      backend.costs = opts.codegen_report ? &costs : nullptr;
+      backend.instrument = opts.profile_generate;
+      backend.profile = opts.profile;
+      backend.memoize = opts.auto_memoize;
+      backend.schedule = opts.schedule;
+      backend.remarks = frontend.remarks;
+      if(with_raw_program(opts, input, str, [&](const koopa_raw_program_t &raw) {
+           PhaseTimer timer(opts.time_report, "code generation");
+           GenerateRiscv(raw, timer.Enabled() ? code : out, backend);
+           if(timer.Enabled()) timer.Count(count_instructions(code.str()), "instructions");
+         })) return 1;
+      out << code.str();
+      if(opts.codegen_report) opts.codegen_report->Add(input, std::move(costs));
+    }
+  } catch(const string &msg) {
+    ctx = nullptr;
+    *opts.diag << "error: " << input << ": " << msg << endl;
+    return 1;
+  } catch(const exception &e) {
+    ctx = nullptr;
+    *opts.diag << "error: " << input << ": " << e.what() << endl;
+    return 1;
+  }
+
+  if(opts.remarks.Enabled()) {
+    // 先输出到缓冲区, 批量编译时各文件的报告不会交错
+    ostringstream text;
+    remarks.Print(text, input);
+    *opts.diag << text.str();
+    if(opts.remarks.save_record) {
+      ofstream record(opts.remarks.record_file);
+      remarks.Save(record, input);
+      if(!record) {
+        *opts.diag << "error: cannot write " << opts.remarks.record_file << endl;
+        return 1;
+      }
+    }
+  }
+
+  if(opts.verbose) cout<<str<<endl;
+  return 0;
+}
+
+// 流式编译中 IR 里出现的全局符号的名字, 即 "@name" 中的 name
+static set<string> referenced_symbols(const string &ir) {
+  set<string> names;
+  for(size_t pos = 0; (pos = ir.find('@', pos)) != string::npos;) {
+    size_t end = ++pos;
+    while(end < ir.size() && (isalnum((unsigned char)ir[end]) || ir[end] == '_')) end++;
+    names.insert(ir.substr(pos, end - pos));
+    pos = end;
+  }
+  return names;
+}
+
+// 全局变量的定义在单独编译其他项时的替身, 初值不影响使用它的函数的汇编
+// 例如 "global @a = alloc [i32, 3], {1, 2, 3}" -> "global @a = alloc [i32, 3], zeroinit"
+static string global_decl(const string &line) {
+  size_t pos = line.find("alloc ") + 6;
+  for(int depth = 0; pos < line.size() && !(depth == 0 && line[pos] == ','); pos++) {
+    if(line[pos] == '[') depth++;
+    else if(line[pos] == ']') depth--;
+  }
+  return line.substr(0, pos) + ", zeroinit\n";
+}
+
+// 流式编译: parser 每解析完一个全局声明或函数, 就生成它的 IR 和汇编并输出, 然后释放它的 AST,
+// 内存占用取决于最大的函数而不是整个文件。输入不读到内存中 (Flex 按块读文件, 手写的 lexer 扫描映射的文件),
+// 所以不使用缓存; 每项单独编译, 调用者不知道被调函数会不会改写全局变量, 汇编与增量编译时相同
+static int compile_streaming(const CompileOptions &opts, const string &input, ostream &out) {
+#ifdef SYSY_SIMD_LEXER
+  string source;
+  const char *data = nullptr;
+  size_t size = 0;
+  int fd = open(input.c_str(), O_RDONLY);
+  struct stat st;
+  if(fd >= 0 && fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+    void *map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if(map != MAP_FAILED) {
+      madvise(map, st.st_size, MADV_SEQUENTIAL);
+      data = static_cast<const char *>(map);
+      size = st.st_size;
+    }
+  }
+  if(fd >= 0) close(fd);
+  // 空文件和不能映射的文件 (如管道) 仍读到内存中
+  if(!data) {
+    if(!read_file(input, source)) {
+      *opts.diag << "error: cannot open " << input << endl;
+      return 1;
+    }
+    data = source.data();
+    size = source.size();
+  }
+#else
+  FILE *fp = fopen(input.c_str(), "rb");
+  if(!fp) {
+    *opts.diag << "error: cannot open " << input << endl;
+    return 1;
+  }
+#endif
+
+  stringstream item_ir;
+  FrontendContext frontend(item_ir);
+  Remarks remarks(opts.remarks);
+  if(opts.remarks.Enabled()) frontend.remarks = &remarks;
+  vector<FunctionCost> costs;
+  BackendOptions backend;
+  backend.pool = opts.pool;
+  backend.costs = opts.codegen_report ? &costs : nullptr;
+  backend.profile = opts.profile;
+  backend.schedule = opts.schedule;
+  backend.remarks = frontend.remarks;
+  // 每项各自的 Koopa 解析和汇编生成都算在流式编译的耗时中
+  CompileOptions item_opts = opts;
+  item_opts.time_report = nullptr;
+
+  string runtime_decls; // 库函数的声明, 每项单独编译时都要加上
+  unordered_map<string, string> decls; // 已经输出的全局变量和函数在单独编译其他项时的声明
+  string error;
+  bool failed = false;
+  long items = 0;
+  // 生成一项的汇编: 函数加上它用到的全局符号的声明后单独编译, 全局变量只输出数据段
+  auto generate = [&](const string &ir) {
+    bool is_func = ir.compare(0, 4, "fun ") == 0;
+    string name = is_func ? ir.substr(5, ir.find('(') - 5) : "";
+    string program = runtime_decls;
+    if(is_func) {
+      for(auto &symbol : referenced_symbols(ir)) {
+        auto decl = decls.find(symbol);
+        if(symbol != name && decl != decls.end()) program += decl->second;
+      }
+    }
+    program += ir;
+    string globals;
+    vector<pair<string, string>> funcs;
+    if(with_raw_program(item_opts, input, program, [&](const koopa_raw_program_t &raw) {
+         GenerateRiscvFragments(raw, globals, funcs, backend);
+       })) return false;
+    // 函数的程序中的全局变量只是替身, 不输出它们的数据段
+    if(!is_func) out << globals;
+    for(auto &func : funcs) out << func.second;
+    if(is_func) decls[name] = function_decl(ir);
+    else {
+      istringstream lines(ir);
+      for(string line; getline(lines, line);) {
+        if(line.compare(0, 8, "global @") == 0) decls[line.substr(8, line.find(' ', 8) - 8)] = global_decl(line);
+      }
+    }
+    return true;
+  };
+  frontend.on_item = [&](unique_ptr<BaseAST> item) {
+    if(failed || !error.empty()) return;
+    items++;
+    try {
+      CompUnitAST::ItemKoopaIR(*item);
+      item.reset();
+      string ir = item_ir.str();
+      item_ir.str("");
+      if(opts.mode == "-koopa") out << ir;
+      else if(ir.find_first_not_of('\n') != string::npos) failed = !generate(ir);
+    } catch(const string &msg) {
+      error = msg;
+    } catch(const exception &e) {
+      error = e.what();
+    }
+  };
+
+  int ret;
+  {
+    PhaseTimer timer(opts.time_report, "streaming compile");
+    long tokens = 0;
+    uint64_t nodes = ast_node_count;
+    ctx = &frontend;
+    CompUnitAST::BeginKoopaIR();
+    runtime_decls = item_ir.str();
+    item_ir.str("");
+    if(opts.mode == "-koopa") out << runtime_decls;
+    yyscan_t scanner;
+    yylex_init_extra(timer.Enabled() ? &tokens : nullptr, &scanner);
+#ifdef SYSY_SIMD_LEXER
+    yyset_buffer(data, size, scanner);
+#else
+    yyset_in(fp, scanner);
+#endif
+    unique_ptr<BaseAST> ast;
+    ret = yyparse(scanner, ast, *opts.diag);
+    yylex_destroy(scanner);
+    exit_block();
+    ctx = nullptr;
+#ifdef SYSY_SIMD_LEXER
+    if(source.empty()) munmap(const_cast<char *>(data), size);
+#else
+    fclose(fp);
+#endif
+    if(timer.Enabled()) {
+      timer.Count(tokens, "tokens");
+      timer.Count(ast_node_count - nodes, "AST nodes");
+      timer.Count(items, "items");
+    }
+  }
+  if(ret) {
+    *opts.diag << "error: failed to parse " << input << endl;
+    return 1;
+  }
+  if(!error.empty()) {
+    *opts.diag << "error: " << input << ": " << error << endl;
+    return 1;
+  }
+  if(failed) return 1;
+
+  if(opts.codegen_report) opts.codegen_report->Add(input, std::move(costs));
+  if(opts.remarks.Enabled()) {
+    ostringstream text;
+    remarks.Print(text, input);
+    *opts.diag << text.str();
+    if(opts.remarks.save_record) {
+      ofstream record(opts.remarks.record_file);
+      remarks.Save(record, input);
+      if(!record) {
+        *opts.diag << "error: cannot write " << opts.remarks.record_file << endl;
+        return 1;
+      }
+    }
+  }
+  return 0;
+}
+
+// 输入是二进制 IR (见 binary_ir.hpp) 时跳过前端和 Koopa 解析, 直接生成汇编
+// -koopa-bin 时重新写出, 没有把 raw program 输出为 Koopa IR 文本的功能, 所以不支持 -koopa
+static int compile_binary_ir(const CompileOptions &opts, const string &input, const BinaryIR &ir, ostream &out) {
+  if(opts.mode == "-koopa") {
+    *opts.diag << "error: " << input << ": cannot print binary IR as Koopa IR" << endl;
+    return 1;
+  }
+  if(opts.mode == "-koopa-bin") {
+    string binary;
+    WriteBinaryIR(ir.Program(), binary);
+    out << binary;
+    return 0;
+  }
+  if(opts.profile_generate || opts.auto_memoize) {
+    *opts.diag << "error: " << input << ": -fprofile-generate and -fauto-memoize need the source program" << endl;
+    return 1;
+  }
+  Remarks remarks(opts.remarks);
+  vector<FunctionCost> costs;
+  BackendOptions backend;
+  backend.pool = opts.pool;
+  backend.costs = opts.codegen_report ? &costs : nullptr;
+  backend.profile = opts.profile;
+  backend.schedule = opts.schedule;
+  backend.remarks = opts.remarks.Enabled() ? &remarks : nullptr;
+  try {
+    PhaseTimer timer(opts.time_report, "code generation");
+    GenerateRiscv(ir.Program(), out, backend);
+  } catch(const string &msg) {
+    *opts.diag << "error: " << input << ": " << msg << endl;
+    return 1;
+  } catch(const exception &e) {
+    *opts.diag << "error: " << input << ": " << e.what() << endl;
+    return 1;
+  }
+  if(opts.codegen_report) opts.codegen_report->Add(input, std::move(costs));
+  if(opts.remarks.Enabled()) {
+    ostringstream text;
+    remarks.Print(text, input);
+    *opts.diag << text.str();
+  }
+  return 0;
+}
+
+// 文件是否以二进制 IR 的魔数开头
+static bool binary_ir_file(const string &path) {
+  char magic[4];
+  FILE *fp = fopen(path.c_str(), "rb");
+  if(!fp) return false;
+  size_t n = fread(magic, 1, sizeof(magic), fp);
+  fclose(fp);
+  return IsBinaryIR(magic, n);
+}
+
+int compile_file(const CompileOptions &opts, const string &input, ostream &out) {
+  if(binary_ir_file(input)) {
+    BinaryIR ir;
+    string error;
+    {
+      PhaseTimer timer(opts.time_report, "binary IR load");
+      if(!ir.Map(input, error)) {
+        *opts.diag << "error: " << input << ": " << error << endl;
+        return 1;
+      }
+      if(timer.Enabled()) timer.Count(ir.Program().funcs.len, "functions");
+    }
+    return compile_binary_ir(opts, input, ir, out);
+  }
+  if(opts.stream) return compile_streaming(opts, input, out);
+  string source;
+  {
+    PhaseTimer timer(opts.time_report, "read input");
+    if(!read_file(input, source)) {
+      *opts.diag << "error: cannot open " << input << endl;
+      return 1;
+    }
+    if(timer.Enabled()) timer.Count(source.size(), "bytes");
+  }
+  return compile_buffer(opts, input, source, out);
+}
+
+int compile_buffer(const CompileOptions &opts, const string &input, const string &source, ostream &out) {
+  if(IsBinaryIR(source.data(), source.size())) {
+    BinaryIR ir;
+    string error;
+    if(!ir.Load(source.data(), source.size(), error)) {
+      *opts.diag << "error: " << input << ": " << error << endl;
+      return 1;
+    }
+    return compile_binary_ir(opts, input, ir, out);
+  }
+  // 代码质量报告和优化报告要在编译时统计, 所以不使用缓存的结果
+  if(opts.cache_dir.empty() || opts.codegen_report || opts.remarks.Enabled())
+    return compile_source(opts, input, source, out);
+
+  string key, output;
+  bool hit;
+  {
+    PhaseTimer timer(opts.time_report, "cache lookup");
+    key = cache_key(opts, source);
+    hit = cache_lookup(opts.cache_dir, key, output);
+    if(timer.Enabled()) timer.Count(hit, "hits");
+  }
+  if(hit) {
+    out << output;
+    return 0;
+  }
+  stringstream result;
+  if(compile_source(opts, input, source, result)) return 1;
+  output = result.str();
+  {
+    PhaseTimer timer(opts.time_report, "cache store");
+    cache_store(opts.cache_dir, key, output, opts.cache_size);
+  }
+  out << output;
+  return 0;
+}
+
+// input 对应的输出文件: output_dir/文件名去掉扩展名 + .koopa 或 .S
+static string output_path(const CompileOptions &opts, const string &input, const string &output_dir) {
+  string name = input.substr(input.find_last_of('/') + 1);
+  name = name.substr(0, name.find_last_of('.'));
+  return output_dir + "/" + name + (opts.mode == "-koopa" ? ".koopa" : opts.mode == "-koopa-bin" ? ".bir" : ".S");
+}
+
+int compile_batch(const CompileOptions &opts, const vector<string> &inputs,
+                  const string &output_dir, unsigned jobs) {
+  set<string> outputs;
+  for(auto &input : inputs) {
+    if(!outputs.insert(output_path(opts, input, output_dir)).second) {
+      cerr << "error: more than one input would be written to " << output_path(opts, input, output_dir) << endl;
+      return 1;
+    }
+  }
+
+  // 大文件先提交, 避免最后只剩一个大文件在单个线程上编译
+  vector<pair<off_t, string>> order;
+  for(auto &input : inputs) {
+    struct stat st;
+    order.emplace_back(stat(input.c_str(), &st) ? 0 : st.st_size, input);
+  }
+  stable_sort(order.begin(), order.end(), [](auto &a, auto &b) { return a.first > b.first; });
+
+  atomic<int> failed{0};
+  ThreadPool pool(jobs);
+  CompileOptions file_opts = opts;
+  file_opts.pool = &pool;
+  for(auto &item : order) {
+    const string input = item.second;
+    pool.Submit([&file_opts, &output_dir, &failed, input] {
+      const CompileOptions &opts = file_opts;
+      // 每个文件的优化记录写到输出文件旁边
+      CompileOptions record_opts;
+      if(opts.remarks.save_record) {
+        record_opts = opts;
+        record_opts.remarks.record_file =
+            output_path(opts, input, output_dir) + (opts.remarks.record_json ? ".opt.json" : ".opt.yaml");
+      }
+      // 先在内存中生成完整结果, 失败时不留下不完整的输出文件
+      stringstream result;
+      if(compile_file(opts.remarks.save_record ? record_opts : opts, input, result)) {
+        failed++;
+        return;
+      }
+      ofstream ofs(output_path(opts, input, output_dir));
+      ofs << result.str();
+      if(!ofs) {
+        cerr << "error: cannot write " << output_path(opts, input, output_dir) << endl;
+        failed++;
+      }
+    });
+  }
+  pool.Wait();
+
+  if(failed) cerr << failed << " of " << inputs.size() << " files failed to compile" << endl;
+  return failed ? 1 : 0;
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstdint>
+#include <iostream>
+#include <ostream>
+#include <string>
+#include <vector>
+#include "remarks.hpp"
+
+class ThreadPool;
+class TimeReport;
+class CodegenReport;
+class Profile;
+struct MachineModel;
+
+// 一次编译的选项
+struct CompileOptions {
+  std::string mode;     // -koopa 输出 Koopa IR, -riscv / -perf 输出 RISC-V 汇编
+  bool verbose = false; // 是否在标准输出打印解析进度、AST 和 Koopa IR 等调试信息
+  ThreadPool *pool = nullptr; // 非空时在其中并行生成各个函数的目标代码
+  std::string cache_dir;      // 非空时把编译结果缓存到该目录, 输入和选项都没变时直接取出
+  uint64_t cache_size = 256 << 20; // 缓存目录的大小上限 (字节)
+  std::ostream *diag = &std::cerr;  // 错误信息的输出位置
+  TimeReport *time_report = nullptr; // 非空时把各阶段的耗时记到其中 (-ftime-report)
+  CodegenReport *codegen_report = nullptr; // 非空时把各函数的代码质量统计记到其中 (--report=codegen)
+  RemarkOptions remarks; // 优化报告 (-Rpass=..., -fsave-optimization-record)
+  bool profile_generate = false;    // 插入基本块计数器 (-fprofile-generate)
+  const Profile *profile = nullptr; // 非空时按其中的计数生成代码 (-fprofile-use)
+  bool ipo = false;     // 过程间优化: 删除不可达的函数, 传播和特化常量参数 (-fipo)
+  int auto_memoize = 0; // 非 0 时给纯的递归函数加上这么多项 (2 的幂) 的记忆表 (-fauto-memoize)
+  bool stream = false;  // 流式编译: 每解析完一项就生成并输出, 随即释放它的 AST, 不使用缓存 (-fstream)
+  const MachineModel *schedule = nullptr; // 非空时按该机器模型在每个基本块内调度指令 (-fschedule-insns, -mtune=)
+};
+
+// 编译源文件 input, 目标代码写到 out, 成功返回 0
+// 启用缓存时先按输入内容和影响输出的选项查找缓存, 命中则不再解析和生成代码
+// 所有状态都在本次调用各自的上下文中, 可以在多个线程中同时调用
+int compile_file(const CompileOptions &opts, const std::string &input, std::ostream &out);
+
+// 与 compile_file 相同, 但源代码 source 已经在内存中, input 只用于报错
+int compile_buffer(const CompileOptions &opts, const std::string &input, const std::string &source,
+                   std::ostream &out);
+
+// 用 jobs 个线程批量编译 inputs, 每个文件的结果写到 output_dir 下的同名文件
+// (扩展名换成 .koopa 或 .S), 全部成功返回 0
+// 文件之间和同一文件的函数之间共用这 jobs 个线程
+int compile_batch(const CompileOptions &opts, const std::vector<std::string> &inputs,
+                  const std::string &output_dir, unsigned jobs);
@@ -0,0 +1,94 @@
+#include <utility>
+#include "dominators.hpp"
+
+using namespace std;
+
+DominatorTree::DominatorTree(const vector<vector<uint32_t>> &succs, const vector<uint32_t> &roots) {
+  const uint32_t none = UINT32_MAX;
+  uint32_t n = succs.size(), root = n;
+  vector<vector<uint32_t>> preds(n + 1);
+  for(uint32_t i = 0; i < n; i++)
+    for(uint32_t s : succs[i]) preds[s].push_back(i);
+
+  // 从虚拟的根深度优先遍历, 得到后序; 节点很多时递归会栈溢出, 所以用显式的栈
+  vector<uint32_t> order, post(n + 1, none);
+  vector<bool> visited(n + 1);
+  size_t next_root = 0;
+  uint32_t next_start = 0;
+  visited[root] = true;
+  vector<pair<uint32_t, size_t>> stack = {{root, 0}};
+  while(!stack.empty()) {
+    auto &top = stack.back();
+    uint32_t s = none;
+    if(top.first != root) {
+      if(top.second < succs[top.first].size()) s = succs[top.first][top.second++];
+    }
+    else if(next_root < roots.size()) s = roots[next_root++];
+    else {
+      while(next_start < n && visited[next_start]) next_start++;
+      if(next_start < n) s = next_start;
+    }
+    if(s != none) {
+      if(top.first == root) preds[s].push_back(root);
+      if(!visited[s]) {
+        visited[s] = true;
+        stack.emplace_back(s, 0);
+      }
+      continue;
+    }
+    post[top.first] = order.size();
+    order.push_back(top.first);
+    stack.pop_back();
+  }
+
+  // 迭代到不动点; 求前驱们的最近公共祖先时, 走过的节点都以当前的结果为祖先, 记上 stamp,
+  // 之后的前驱走到记过的节点就可以停下, 所以前驱很多、又在一条长链上时 (如很长的 || 的出口) 不必每次都走到底
+  vector<uint32_t> idom(n + 1, none);
+  vector<size_t> mark(n + 1, 0);
+  size_t stamp = 0;
+  idom[root] = root;
+  for(bool changed = true; changed;) {
+    changed = false;
+    // 逆后序, 最后一个是根
+    for(size_t k = n; k-- > 0;) {
+      uint32_t b = order[k], dom = none;
+      stamp++;
+      for(uint32_t p : preds[b]) {
+        if(idom[p] == none) continue;
+        if(dom == none) dom = p;
+        uint32_t a = p;
+        while(a != dom && mark[a] != stamp) {
+          if(post[a] < post[dom]) {
+            mark[a] = stamp;
+            a = idom[a];
+          }
+          else dom = idom[dom];
+        }
+        mark[dom] = stamp;
+      }
+      if(idom[b] != dom) {
+        idom[b] = dom;
+        changed = true;
+      }
+    }
+  }
+
+  vector<vector<uint32_t>> children(n + 1);
+  for(uint32_t b = 0; b < n; b++) children[idom[b]].push_back(b);
+  enter.resize(n + 1);
+  leave.resize(n + 1);
+  uint32_t clock = 0;
+  stack = {{root, 0}};
+  enter[root] = clock++;
+  while(!stack.empty()) {
+    auto &top = stack.back();
+    if(top.second < children[top.first].size()) {
+      uint32_t c = children[top.first][top.second++];
+      enter[c] = clock++;
+      stack.emplace_back(c, 0);
+      continue;
+    }
+    leave[top.first] = clock;
+    stack.pop_back();
+  }
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+// 控制流图的支配树, 用于找回边 (循环) 和检查值的定义支配使用
+// 在逆后序上按 Cooper-Harvey-Kennedy 的迭代算法求直接支配者, 再按支配树的先序区间回答支配关系,
+// 时间和空间都与边数成正比, 不用 n*n 的支配矩阵
+class DominatorTree {
+ public:
+  // succs[i] 是节点 i 的后继; 从一个虚拟的根出发, 根的后继依次是 roots 中的节点和其余还没访问到的节点,
+  // 所以从 roots 到不了的节点 (如 return 之后的代码) 也有支配关系
+  DominatorTree(const std::vector<std::vector<uint32_t>> &succs, const std::vector<uint32_t> &roots);
+
+  // a 支配 b, 包括 a == b
+  bool Dominates(uint32_t a, uint32_t b) const { return enter[a] <= enter[b] && leave[b] <= leave[a]; }
+
+ private:
+  std::vector<uint32_t> enter, leave; // 支配树的先序编号, 以及子树中最大的编号加一
+};
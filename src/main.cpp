@@ -1,18 +1,22 @@
-#include <cassert>
+#include <cstdlib>
+#include <cstring>
 #include <fstream>
+#include <iostream>
+#include <regex>
 #include <unordered_map>
-#include "ast.hpp"
-#include <memory>
-#include "koopa.h"
 #include <string>
-#include <sstream>
-#include "visit_koopa_raw.hpp"
+#include <thread>
+#include <vector>
+#include "codegen_report.hpp"
+#include "compiler.hpp"
+#include "profile.hpp"
+#include "schedule.hpp"
+#include "server.hpp"
+#include "thread_pool.hpp"
+#include "time_report.hpp"
 
 using namespace std;
 
-extern FILE *yyin;
-extern int yyparse(unique_ptr<BaseAST> &ast);
-
 std::unordered_map<char, const char *> generator = {
     {'k', R"(fun @main(): i32 {
 %entry:
@@ -33,64 +37,201 @@ main:
 )"},
 };
 
-int main(int argc, const char *argv[]) {
-  assert(argc == 5);
-  ofstream ofs(argv[4]);
-  // ofs << generator[argv[1][1]];
-
-  // parse input file
-  yyin = fopen(argv[2], "r");
-  assert(yyin);
-
-  unique_ptr<BaseAST> ast;
-  auto ret = yyparse(ast);
-  assert(!ret);
+static void usage() {
+  cerr << "usage: compiler -koopa|-koopa-bin|-riscv|-perf INPUT -o OUTPUT [-j N]" << endl
+       << "       compiler -koopa|-koopa-bin|-riscv|-perf --batch [-j N] -o OUTPUT_DIR INPUT..." << endl
+       << "         (-koopa-bin writes binary IR; a binary IR INPUT is compiled without reparsing)" << endl
+       << "         (an argument @FILE reads more inputs from FILE, one per line)" << endl
+       << "       compiler --server SOCKET [-j N]" << endl
+       << "options: --cache DIR       cache outputs in DIR (default: $SYSY_CACHE_DIR)" << endl
+       << "         --cache-size MB   evict least recently used entries beyond MB (default: 256)" << endl
+       << "         -ftime-report[=json]  print time spent in each phase to stderr" << endl
+       << "         --report=codegen[-json]  print frame size, spills, instruction mix and static cost" << endl
+       << "                                  of each function and basic block to stderr" << endl
+       << "         -Rpass=REGEX, -Rpass-missed=REGEX, -Rpass-analysis=REGEX" << endl
+       << "                           print remarks of the passes matching REGEX (e.g. constfold) to stderr" << endl
+       << "         -fsave-optimization-record[=yaml|json]  save all remarks to OUTPUT.opt.yaml or .opt.json" << endl
+       << "         -foptimization-record-file=FILE  save the remarks of a single-file compile to FILE" << endl
+       << "         -fprofile-generate  count executions of each basic block and branch; the program appends" << endl
+       << "                             the counts to $SYSY_PROFILE_FILE (default: default.sysyprof) on exit" << endl
+       << "         -fprofile-use=FILE  use the counts in FILE for code layout and cost estimates" << endl
+       << "         -fipo               remove functions unreachable from main, propagate constant arguments" << endl
+       << "                             and specialize functions for frequent constant arguments" << endl
+       << "         -fauto-memoize[=N]  cache the results of pure recursive functions in a table of N entries" << endl
+       << "                             (rounded up to a power of two, default: 1024)" << endl
+       << "         -fstream            compile and emit each global declaration and function as soon as it is" << endl
+       << "                             parsed, then free its AST (bypasses the cache)" << endl
+       << "         -fschedule-insns    reorder the instructions of each basic block to hide load and" << endl
+       << "                             multiply latency" << endl
+       << "         -mtune=MODEL        machine model for -fschedule-insns: " << MachineModelNames() << endl
+       << "                             (default: generic)" << endl
+       << "with $SYSY_COMPILER_SERVER set to a server's SOCKET, single-file compiles are sent to it" << endl
+       << "(unless -j, --cache or --cache-size is given; the server uses its own settings)" << endl;
+}
 
-  cout<<"parse done"<<endl;
-  stringstream ss;
-  
+int main(int argc, const char *argv[]) {
+  CompileOptions opts;
+  // 没有用 --cache 指定时, 用环境变量 SYSY_CACHE_DIR 指定的缓存目录
+  if(const char *dir = getenv("SYSY_CACHE_DIR")) opts.cache_dir = dir;
+  bool batch = false, time_report_json = false, codegen_report_json = false;
+  TimeReport time_report;
+  CodegenReport codegen_report;
+  Profile profile;
+  unsigned jobs = 0;
+  // 命令行指定了 -j、--cache 或 --cache-size: 编译服务用自己启动时的设置, 所以不交给服务
+  bool local_settings = false;
+  bool schedule = false;
+  const MachineModel *tune = FindMachineModel("generic");
+  string output, server, profile_file;
+  vector<string> inputs;
+  for(int i = 1; i < argc; i++) {
+    if(!strcmp(argv[i], "-koopa") || !strcmp(argv[i], "-koopa-bin") || !strcmp(argv[i], "-riscv") ||
+       !strcmp(argv[i], "-perf"))
+      opts.mode = argv[i];
+    else if(!strcmp(argv[i], "--batch")) batch = true;
+    else if(!strcmp(argv[i], "-ftime-report")) opts.time_report = &time_report;
+    else if(!strcmp(argv[i], "-ftime-report=json")) {
+      opts.time_report = &time_report;
+      time_report_json = true;
+    }
+    else if(!strcmp(argv[i], "--report=codegen")) opts.codegen_report = &codegen_report;
+    else if(!strcmp(argv[i], "--report=codegen-json")) {
+      opts.codegen_report = &codegen_report;
+      codegen_report_json = true;
+    }
+    else if(!strncmp(argv[i], "-Rpass=", 7)) opts.remarks.passed = argv[i] + 7;
+    else if(!strncmp(argv[i], "-Rpass-missed=", 14)) opts.remarks.missed = argv[i] + 14;
+    else if(!strncmp(argv[i], "-Rpass-analysis=", 16)) opts.remarks.analysis = argv[i] + 16;
+    else if(!strcmp(argv[i], "-fsave-optimization-record") || !strcmp(argv[i], "-fsave-optimization-record=yaml"))
+      opts.remarks.save_record = true;
+    else if(!strcmp(argv[i], "-fsave-optimization-record=json")) {
+      opts.remarks.save_record = true;
+      opts.remarks.record_json = true;
+    }
+    else if(!strncmp(argv[i], "-foptimization-record-file=", 27)) {
+      opts.remarks.save_record = true;
+      opts.remarks.record_file = argv[i] + 27;
+    }
+    else if(!strcmp(argv[i], "-fprofile-generate")) opts.profile_generate = true;
+    else if(!strncmp(argv[i], "-fprofile-use=", 14)) profile_file = argv[i] + 14;
+    else if(!strcmp(argv[i], "-fipo")) opts.ipo = true;
+    else if(!strcmp(argv[i], "-fauto-memoize")) opts.auto_memoize = 1024;
+    else if(!strncmp(argv[i], "-fauto-memoize=", 15)) {
+      long entries = atol(argv[i] + 15);
+      if(entries < 1 || entries > (1 << 20)) {
+        cerr << "error: -fauto-memoize= expects 1 to " << (1 << 20) << " entries" << endl;
+        return 1;
+      }
+      for(opts.auto_memoize = 1; opts.auto_memoize < entries;) opts.auto_memoize <<= 1;
+    }
+    else if(!strcmp(argv[i], "-fstream")) opts.stream = true;
+    else if(!strcmp(argv[i], "-fschedule-insns")) schedule = true;
+    else if(!strncmp(argv[i], "-mtune=", 7)) {
+      tune = FindMachineModel(argv[i] + 7);
+      if(!tune) {
+        cerr << "error: unknown machine model " << argv[i] + 7 << " (expected one of " << MachineModelNames() << ")"
+             << endl;
+        return 1;
+      }
+    }
+    else if(!strcmp(argv[i], "--server") && i + 1 < argc) server = argv[++i];
+    else if(!strcmp(argv[i], "-j") && i + 1 < argc) {
+      jobs = atoi(argv[++i]);
+      local_settings = true;
+    }
+    else if(!strcmp(argv[i], "-o") && i + 1 < argc) output = argv[++i];
+    else if(!strcmp(argv[i], "--cache") && i + 1 < argc) {
+      opts.cache_dir = argv[++i];
+      local_settings = true;
+    }
+    else if(!strcmp(argv[i], "--cache-size") && i + 1 < argc) {
+      opts.cache_size = strtoull(argv[++i], nullptr, 10) << 20;
+      local_settings = true;
+    }
+    else if(argv[i][0] == '@') {
+      ifstream list(argv[i] + 1);
+      if(!list) {
+        cerr << "error: cannot open " << argv[i] + 1 << endl;
+        return 1;
+      }
+      for(string line; getline(list, line);)
+        if(!line.empty()) inputs.push_back(line);
+    }
+    else inputs.push_back(argv[i]);
+  }
 
-  // dump AST
-  cout<<"Dump start"<<endl;
-  ast->Dump();
-  cout <<"Dump done"<< endl;
+  if(!profile_file.empty()) {
+    string error;
+    if(!profile.Load(profile_file, error)) {
+      cerr << "error: " << error << endl;
+      return 1;
+    }
+    opts.profile = &profile;
+  }
+  if(schedule) opts.schedule = tune;
 
-  // 将标准输出重定向到ofs
-  streambuf *cout_backup = cout.rdbuf(ss.rdbuf());;
+  // 常驻的编译服务: 模式和输入输出由每个请求各自给出
+  if(!server.empty()) {
+    opts.time_report = nullptr;
+    opts.codegen_report = nullptr;
+    opts.remarks = RemarkOptions();
+    if(jobs > 1) {
+      ThreadPool pool(jobs);
+      opts.pool = &pool;
+      return run_server(opts, server);
+    }
+    return run_server(opts, server);
+  }
 
-  
-  // generate Koopa IR
-  ast->KoopaIR();
-  string str = ss.str();
-  cout.rdbuf(ofs.rdbuf());
-  if(string(argv[1])=="-koopa")
-  {
-    cout << str;
+  if(opts.mode.empty() || output.empty() || inputs.empty() || (!batch && inputs.size() != 1)) {
+    usage();
+    return 1;
+  }
+  for(const string *re : {&opts.remarks.passed, &opts.remarks.missed, &opts.remarks.analysis}) {
+    try {
+      regex check(*re);
+    } catch(const regex_error &) {
+      cerr << "error: invalid regular expression in remark option: " << *re << endl;
+      return 1;
+    }
+  }
+  // 流式编译时每项单独编译, 不能做需要看整个程序的变换
+  if(opts.stream && (opts.ipo || opts.auto_memoize || opts.profile_generate || opts.mode == "-koopa-bin")) {
+    cerr << "error: -fstream cannot be combined with -koopa-bin, -fipo, -fauto-memoize or -fprofile-generate" << endl;
+    return 1;
   }
-  else if(string(argv[1])=="-riscv")
-  {
-    koopa_program_t program;
-    koopa_error_code_t ret = koopa_parse_from_string(str.c_str(), &program);
-    assert(ret == KOOPA_EC_SUCCESS);  // 确保解析时没有出错
-    // 创建一个 raw program builder, 用来构建 raw program
-    koopa_raw_program_builder_t builder = koopa_new_raw_program_builder();
-    // 将 Koopa IR 程序转换为 raw program
-    koopa_raw_program_t raw = koopa_build_raw_program(builder, program);
-    // 释放 Koopa IR 程序占用的内存
-    koopa_delete_program(program);
+  if(opts.remarks.save_record && opts.remarks.record_file.empty())
+    opts.remarks.record_file = output + (opts.remarks.record_json ? ".opt.json" : ".opt.yaml");
 
-    // 处理 raw program
-    Visit(raw);
-    // ...
+  // 批量编译: 默认用满所有 CPU 核, 各阶段耗时是所有文件的合计
+  if(batch) {
+    int ret = compile_batch(opts, inputs, output, jobs ? jobs : thread::hardware_concurrency());
+    if(opts.time_report) time_report.Print(cerr, time_report_json);
+    if(opts.codegen_report) codegen_report.Print(cerr, codegen_report_json);
+    return ret;
+  }
 
-    // 处理完成, 释放 raw program builder 占用的内存
-    // 注意, raw program 中所有的指针指向的内存均为 raw program builder 的内存
-    // 所以不要在 raw program 处理完毕之前释放 builder
-    koopa_delete_raw_program_builder(builder);
+  // 设置了 SYSY_COMPILER_SERVER 时交给常驻的编译服务, 连不上时仍在本进程中编译
+  const char *socket_path = getenv("SYSY_COMPILER_SERVER");
+  if(socket_path && !opts.time_report && !opts.codegen_report && !opts.remarks.Enabled() && !opts.profile_generate &&
+     !opts.profile && !opts.auto_memoize && !opts.ipo &&
+     !opts.stream && !opts.schedule && !local_settings) {
+    int ret = request_compile(socket_path, opts.mode, inputs[0], output);
+    if(ret >= 0) return ret;
   }
 
-  // 恢复标准输出
-  cout.rdbuf(cout_backup);
-  cout<<ss.str()<<endl;
-  return 0;
+  ofstream ofs(output);
+  // ofs << generator[argv[1][1]];
+  opts.verbose = true;
+  // 单个文件: 指定 -j 时在多个线程中并行生成各个函数
+  int ret;
+  if(jobs > 1) {
+    ThreadPool pool(jobs);
+    opts.pool = &pool;
+    ret = compile_file(opts, inputs[0], ofs);
+  }
+  else ret = compile_file(opts, inputs[0], ofs);
+  if(opts.time_report) time_report.Print(cerr, time_report_json);
+  if(opts.codegen_report) codegen_report.Print(cerr, codegen_report_json);
+  return ret;
 }
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// 基本块计数 (-fprofile-generate / -fprofile-use)
+// 插桩后的程序在 main 返回前调用运行时库的 __sysy_profile_dump, 把每个计数器追加一行
+// "函数名 计数点 次数" 到 $SYSY_PROFILE_FILE (默认 default.sysyprof)
+// 计数点是 Koopa IR 中基本块的名字 (如 While_0), 或者条件跳转的真分支 "源块->目标块";
+// 假分支的次数等于源块的次数减去真分支的次数, 所以每条边的次数都可以得到
+// 多次运行的结果追加在同一个文件中, 读入时把同一个计数点的次数相加
+
+// 一个函数的计数
+struct FunctionProfile {
+  std::map<std::string, long long> counts;
+};
+
+class Profile {
+ public:
+  // 读入计数文件, 失败时返回 false 并在 error 中给出原因
+  bool Load(const std::string &file, std::string &error) {
+    std::ifstream in(file);
+    if(!in) {
+      error = "cannot open " + file;
+      return false;
+    }
+    std::string line;
+    for(int number = 1; std::getline(in, line); number++) {
+      std::istringstream fields(line);
+      std::string func, point;
+      long long count;
+      if(!(fields >> func >> point >> count) || count < 0) {
+        error = file + ":" + std::to_string(number) + ": malformed profile record";
+        return false;
+      }
+      funcs[func].counts[point] += count;
+    }
+    text = std::to_string(funcs.size());
+    for(auto &func : funcs)
+      for(auto &count : func.second.counts)
+        text += "\n" + func.first + " " + count.first + " " + std::to_string(count.second);
+    return true;
+  }
+
+  // 函数 func 的计数, 没有记录时返回 nullptr
+  const FunctionProfile *Function(const std::string &func) const {
+    auto it = funcs.find(func);
+    return it == funcs.end() ? nullptr : &it->second;
+  }
+
+  // 归一化后的全部计数, 用作缓存的键
+  const std::string &Digest() const { return text; }
+
+ private:
+  std::map<std::string, FunctionProfile> funcs;
+  std::string text;
+};
+
+// 函数 profile 中计数点 point 的次数, 没有记录时返回 -1
+inline long long profile_count(const FunctionProfile *profile, const std::string &point) {
+  if(!profile) return -1;
+  auto it = profile->counts.find(point);
+  return it == profile->counts.end() ? -1 : it->second;
+}
+
+// 真分支计数点的名字
+inline std::string profile_edge(const std::string &from, const std::string &to) {
+  return from + "->" + to;
+}
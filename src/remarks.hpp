@@ -0,0 +1,111 @@
+#pragma once
+
+#include <map>
+#include <ostream>
+#include <regex>
+#include <string>
+#include <utility>
+#include <vector>
+
+// 优化报告 (optimization remarks)
+// 每个优化在做了变换 (Passed)、放弃了变换 (Missed) 或得到分析结论 (Analysis) 时记一条报告,
+// 带上源代码中的位置和所在的函数, 用来回答 "这个循环为什么没有被优化"
+
+// 选择要输出哪些报告
+struct RemarkOptions {
+  // 按优化的名字过滤, 对应 -Rpass=、-Rpass-missed=、-Rpass-analysis=, 为空时不输出该类报告
+  std::string passed, missed, analysis;
+  bool save_record = false;  // -fsave-optimization-record: 把所有报告写到文件中
+  bool record_json = false;  // 记录文件用 JSON 格式, 否则用 YAML 格式
+  std::string record_file;   // 记录文件, 默认为输出文件名加上 .opt.yaml 或 .opt.json
+
+  bool Enabled() const { return !passed.empty() || !missed.empty() || !analysis.empty() || save_record; }
+};
+
+struct Remark {
+  enum Kind { Passed, Missed, Analysis } kind;
+  std::string pass;     // 优化的名字, 如 constfold
+  std::string name;     // 报告的种类, 如 ConstantFolded
+  std::string function; // 所在的函数, 全局作用域中为空
+  int line = 0, column = 0;
+  std::string message;
+};
+
+// 一次编译中的全部报告
+class Remarks {
+ public:
+  explicit Remarks(const RemarkOptions &opts) : opts(opts) {
+    if(!opts.passed.empty()) filters[Remark::Passed] = std::regex(opts.passed);
+    if(!opts.missed.empty()) filters[Remark::Missed] = std::regex(opts.missed);
+    if(!opts.analysis.empty()) filters[Remark::Analysis] = std::regex(opts.analysis);
+  }
+
+  void Emit(Remark remark) { remarks.push_back(std::move(remark)); }
+
+  // 记下 Koopa IR 中基本块对应的源代码位置, 让后端的优化也能给出行号
+  void SetBlockLocation(const std::string &function, const std::string &block, int line, int column) {
+    blocks[function + "/" + block] = std::make_pair(line, column);
+  }
+  std::pair<int, int> BlockLocation(const std::string &function, const std::string &block) const {
+    auto it = blocks.find(function + "/" + block);
+    return it == blocks.end() ? std::make_pair(0, 0) : it->second;
+  }
+
+  // 按 -Rpass 等选项以诊断信息的格式输出, 如 "a.sy:3:9: remark: ... [-Rpass=constfold]"
+  void Print(std::ostream &out, const std::string &input) const {
+    static const char *const flags[] = {"-Rpass", "-Rpass-missed", "-Rpass-analysis"};
+    for(auto &r : remarks) {
+      auto it = filters.find(r.kind);
+      if(it == filters.end() || !std::regex_search(r.pass, it->second)) continue;
+      out << input << ":" << r.line << ":" << r.column << ": remark: " << r.message
+          << " [" << flags[r.kind] << "=" << r.pass << "]" << std::endl;
+    }
+  }
+
+  // 按与 LLVM 相同的 YAML 格式或 JSON 格式输出全部报告, 不受 -Rpass 等选项的过滤
+  void Save(std::ostream &out, const std::string &input) const {
+    static const char *const kinds[] = {"Passed", "Missed", "Analysis"};
+    if(opts.record_json) {
+      out << "[";
+      for(size_t i = 0; i < remarks.size(); i++) {
+        auto &r = remarks[i];
+        out << (i ? ",\n " : "") << "{\"kind\": \"" << kinds[r.kind] << "\", \"pass\": \"" << r.pass
+            << "\", \"name\": \"" << r.name << "\", \"file\": " << Quote(input, '"') << ", \"line\": " << r.line
+            << ", \"column\": " << r.column << ", \"function\": \"" << r.function
+            << "\", \"message\": " << Quote(r.message, '"') << "}";
+      }
+      out << "]" << std::endl;
+      return;
+    }
+    for(auto &r : remarks) {
+      out << "--- !" << kinds[r.kind] << "\n"
+          << "Pass:            " << r.pass << "\n"
+          << "Name:            " << r.name << "\n"
+          << "DebugLoc:        { File: " << Quote(input, '\'') << ", Line: " << r.line
+          << ", Column: " << r.column << " }\n"
+          << "Function:        " << (r.function.empty() ? "''" : r.function) << "\n"
+          << "Args:\n"
+          << "  - String:          " << Quote(r.message, '\'') << "\n"
+          << "...\n";
+    }
+  }
+
+  const std::vector<Remark> &All() const { return remarks; }
+
+ private:
+  // YAML 的单引号字符串中单引号写两遍, JSON 的双引号字符串中用反斜杠转义
+  static std::string Quote(const std::string &s, char quote) {
+    std::string result(1, quote);
+    for(char c : s) {
+      if(c == quote) result += quote == '\'' ? "''" : "\\\"";
+      else if(c == '\\' && quote == '"') result += "\\\\";
+      else result += c;
+    }
+    return result + quote;
+  }
+
+  const RemarkOptions &opts;
+  std::map<Remark::Kind, std::regex> filters;
+  std::vector<Remark> remarks;
+  std::map<std::string, std::pair<int, int>> blocks;
+};
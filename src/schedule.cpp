@@ -0,0 +1,254 @@
+#include <algorithm>
+#include <cstdlib>
+#include <queue>
+#include <string>
+#include <utility>
+#include <vector>
+#include "schedule.hpp"
+
+using namespace std;
+
+// 机器模型表, 延迟是近似值, 换了目标核心时按实测调整或加一行
+static const MachineModel machine_models[] = {
+  //  名字              发射  alu  load  store  mul  div
+  {"generic",            1,    1,   3,    1,     3,   20}, // 与 --report=codegen 的代价模型一致
+  {"rocket",             1,    1,   2,    1,     4,   33}, // 单发射 5 级流水线, 迭代式乘除法器
+  {"sifive-7-series",    2,    1,   3,    1,     3,   35}, // 双发射顺序执行, 如 U74
+};
+
+const MachineModel *FindMachineModel(const string &name) {
+  for(auto &model : machine_models)
+    if(name == model.name) return &model;
+  return nullptr;
+}
+
+string MachineModelNames() {
+  string names;
+  for(auto &model : machine_models) names += string(names.empty() ? "" : ", ") + model.name;
+  return names;
+}
+
+// 一个区域最多的指令条数; 再长的直线代码分成几段各自调度, 使调度的时间与代码长度成正比
+static const size_t max_region = 256;
+
+// 寄存器名 -> 编号 (x0-x31), 不是寄存器时返回 -1
+static int reg_index(const string &name) {
+  static const char *const names[32] = {
+    "zero", "ra", "sp", "gp", "tp", "t0", "t1", "t2", "s0", "s1", "a0", "a1", "a2", "a3", "a4", "a5",
+    "a6", "a7", "s2", "s3", "s4", "s5", "s6", "s7", "s8", "s9", "s10", "s11", "t3", "t4", "t5", "t6",
+  };
+  for(int i = 0; i < 32; i++)
+    if(name == names[i]) return i;
+  if(name == "fp") return 8;
+  if(name.size() >= 2 && name[0] == 'x') {
+    char *end;
+    long i = strtol(name.c_str() + 1, &end, 10);
+    if(!*end && i >= 0 && i < 32) return int(i);
+  }
+  return -1;
+}
+
+static const int sp_reg = 2;
+
+// 一条可以移动的指令
+struct SchedInst {
+  size_t begin, end;   // 在 code 中的范围, 含换行符
+  int def = -1;        // 写的寄存器
+  vector<int> uses;    // 读的寄存器
+  int latency = 1;     // 结果过几个周期可用
+  int slots = 1;       // 占用的发射槽, 展开为两条的伪指令占两个
+  bool load = false, store = false;
+  int size = 0;        // 访存的字节数
+  enum { Stack, Global, Other } space = Other; // 访存的地址: sp 加常数、全局符号加常数、其他
+  string symbol;       // Global 时的符号
+  long offset = 0;     // Stack 和 Global 时的常数偏移量
+};
+
+// 分析一行汇编, 能移动时填好 inst 并返回 true
+// 标签、伪操作、跳转、调用、修改 sp 的指令和认不出的指令都不移动
+static bool parse_inst(const string &line, const MachineModel &model, SchedInst &inst) {
+  size_t pos = line.find_first_not_of(" \t");
+  if(pos == string::npos || pos == 0 || line[pos] == '.' || line.back() == ':') return false;
+  size_t op_end = line.find_first_of(" \t", pos);
+  string op = line.substr(pos, op_end == string::npos ? string::npos : op_end - pos);
+  vector<string> args;
+  for(size_t p = op_end; p != string::npos && p < line.size();) {
+    size_t comma = line.find(',', p);
+    string arg = line.substr(p, comma == string::npos ? string::npos : comma - p);
+    size_t b = arg.find_first_not_of(" \t"), e = arg.find_last_not_of(" \t");
+    if(b != string::npos) args.push_back(arg.substr(b, e - b + 1));
+    p = comma == string::npos ? comma : comma + 1;
+  }
+  if(op[0] == 'b' || op == "j" || op == "jal" || op == "jr" || op == "jalr" || op == "call" || op == "tail" ||
+     op == "ret" || args.empty())
+    return false;
+
+  bool load = op == "lw" || op == "lh" || op == "lhu" || op == "lb" || op == "lbu";
+  bool store = op == "sw" || op == "sh" || op == "sb";
+  if(load || store) {
+    // 访存操作数 "偏移量(基址)", 如 8(sp)、%lo(x+8)(t1)
+    if(args.size() != 2 || args[1].back() != ')') return false;
+    size_t open = args[1].rfind('(');
+    if(open == string::npos) return false;
+    int base = reg_index(args[1].substr(open + 1, args[1].size() - open - 2));
+    int value = reg_index(args[0]);
+    if(base < 0 || value < 0) return false;
+    string disp = args[1].substr(0, open);
+    inst.load = load;
+    inst.store = store;
+    inst.size = op[1] == 'w' ? 4 : op[1] == 'h' ? 2 : 1;
+    if(base == sp_reg && !disp.empty() && disp.find_first_not_of("-0123456789") == string::npos) {
+      inst.space = SchedInst::Stack;
+      inst.offset = strtol(disp.c_str(), nullptr, 10);
+    }
+    else if(disp.compare(0, 4, "%lo(") == 0 && disp.back() == ')') {
+      // 符号加上常数, 如 x、x+8、x-4
+      string sym = disp.substr(4, disp.size() - 5);
+      size_t sign = sym.find_first_of("+-", 1);
+      inst.space = SchedInst::Global;
+      inst.symbol = sym.substr(0, sign);
+      inst.offset = sign == string::npos ? 0 : strtol(sym.c_str() + sign, nullptr, 10);
+    }
+    inst.uses.push_back(base);
+    if(store) inst.uses.push_back(value);
+    else inst.def = value;
+    inst.latency = store ? model.store : model.load;
+    return inst.def != sp_reg;
+  }
+
+  // 其余的指令都是 "op 目的寄存器, 源操作数..."
+  inst.def = reg_index(args[0]);
+  if(inst.def < 0 || inst.def == sp_reg) return false;
+  for(size_t i = 1; i < args.size(); i++) {
+    int reg = reg_index(args[i]);
+    if(reg >= 0) inst.uses.push_back(reg);
+  }
+  if(op.compare(0, 3, "mul") == 0) inst.latency = model.mul;
+  else if(op.compare(0, 3, "div") == 0 || op.compare(0, 3, "rem") == 0) inst.latency = model.div;
+  else inst.latency = model.alu;
+  // 超出 12 位立即数的 li 和 la 展开为先后依赖的两条
+  if(op == "la") inst.slots = 2;
+  else if(op == "li" && args.size() == 2) {
+    long long value = strtoll(args[1].c_str(), nullptr, 0);
+    if(value < -2048 || value >= 2048) inst.slots = 2;
+  }
+  inst.latency += inst.slots - 1;
+  return true;
+}
+
+// 两次访存可能访问同一个地址
+// 栈上的地址和全局变量不重叠, 不同的全局变量也不重叠; 区域内 sp 不变, 基址都是 sp 时按偏移量判断
+static bool may_alias(const SchedInst &a, const SchedInst &b) {
+  if(a.space == SchedInst::Other || b.space == SchedInst::Other) return true;
+  if(a.space != b.space) return false;
+  if(a.space == SchedInst::Global && a.symbol != b.symbol) return false;
+  return a.offset < b.offset + b.size && b.offset < a.offset + a.size;
+}
+
+// 对区域 insts (原来的顺序) 做表调度, 返回新的顺序 (下标)
+// 依赖: 写后读的延迟为前者的延迟, 写后写为 1, 读后写为 0 (顺序发射, 可以在同一周期);
+// 访存之间按 may_alias 判断, 两次读不相关
+// 优先级是到区域末尾的关键路径长度, 相同时保持原来的顺序
+static vector<size_t> schedule_region(const vector<SchedInst> &insts, const MachineModel &model) {
+  size_t n = insts.size();
+  vector<vector<pair<size_t, int>>> succs(n);
+  vector<int> npred(n, 0);
+  auto edge = [&](size_t from, size_t to, int latency) {
+    succs[from].emplace_back(to, latency);
+    npred[to]++;
+  };
+  vector<int> last_def(32, -1);
+  vector<vector<size_t>> readers(32); // 上次写之后读了该寄存器的指令
+  for(size_t i = 0; i < n; i++) {
+    auto &inst = insts[i];
+    for(int reg : inst.uses)
+      if(reg && last_def[reg] >= 0) edge(last_def[reg], i, insts[last_def[reg]].latency);
+    if(inst.def > 0) {
+      if(last_def[inst.def] >= 0) edge(last_def[inst.def], i, 1);
+      for(size_t r : readers[inst.def])
+        if(r != i) edge(r, i, 0);
+      readers[inst.def].clear();
+    }
+    for(int reg : inst.uses)
+      if(reg && reg != inst.def) readers[reg].push_back(i);
+    if(inst.def > 0) last_def[inst.def] = int(i);
+    if(inst.load || inst.store)
+      for(size_t j = 0; j < i; j++) {
+        auto &prev = insts[j];
+        if(!(prev.load || prev.store) || (prev.load && inst.load) || !may_alias(prev, inst)) continue;
+        edge(j, i, prev.store && inst.load ? prev.latency : prev.load ? 0 : 1);
+      }
+  }
+  // 关键路径长度, 边都从前往后, 倒着算一遍即可
+  vector<int> height(n);
+  for(size_t i = n; i-- > 0;) {
+    height[i] = insts[i].latency;
+    for(auto &s : succs[i]) height[i] = max(height[i], s.second + height[s.first]);
+  }
+
+  auto later = [&](size_t a, size_t b) { return height[a] != height[b] ? height[a] < height[b] : a > b; };
+  priority_queue<size_t, vector<size_t>, decltype(later)> ready(later);
+  // 前驱都已发射、但结果还没好的指令, 按可以发射的周期排列
+  priority_queue<pair<long, size_t>, vector<pair<long, size_t>>, greater<pair<long, size_t>>> waiting;
+  vector<long> earliest(n, 0);
+  for(size_t i = 0; i < n; i++)
+    if(!npred[i]) ready.push(i);
+  vector<size_t> order;
+  order.reserve(n);
+  for(long cycle = 0; order.size() < n;) {
+    while(!waiting.empty() && waiting.top().first <= cycle) {
+      ready.push(waiting.top().second);
+      waiting.pop();
+    }
+    if(ready.empty()) {
+      cycle = waiting.top().first;
+      continue;
+    }
+    int used = 0;
+    while(!ready.empty() && used < model.issue_width) {
+      size_t i = ready.top();
+      ready.pop();
+      order.push_back(i);
+      used += insts[i].slots;
+      for(auto &s : succs[i]) {
+        earliest[s.first] = max(earliest[s.first], cycle + s.second);
+        if(--npred[s.first]) continue;
+        if(earliest[s.first] <= cycle) ready.push(s.first);
+        else waiting.emplace(earliest[s.first], s.first);
+      }
+    }
+    cycle += (used + model.issue_width - 1) / model.issue_width;
+  }
+  return order;
+}
+
+void ScheduleFunction(string &code, const MachineModel &model) {
+  string result;
+  result.reserve(code.size());
+  vector<SchedInst> region;
+  auto flush = [&]() {
+    if(region.size() > 1) {
+      for(size_t i : schedule_region(region, model)) result.append(code, region[i].begin, region[i].end - region[i].begin);
+    }
+    else if(!region.empty()) result.append(code, region[0].begin, region[0].end - region[0].begin);
+    region.clear();
+  };
+  for(size_t pos = 0; pos < code.size();) {
+    size_t end = code.find('\n', pos);
+    end = end == string::npos ? code.size() : end + 1;
+    SchedInst inst;
+    if(code[end - 1] == '\n' && parse_inst(code.substr(pos, end - pos - 1), model, inst)) {
+      inst.begin = pos;
+      inst.end = end;
+      region.push_back(std::move(inst));
+      if(region.size() == max_region) flush();
+    }
+    else {
+      flush();
+      result.append(code, pos, end - pos);
+    }
+    pos = end;
+  }
+  flush();
+  code.swap(result);
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <string>
+
+// 分配寄存器之后的指令调度 (-fschedule-insns): 在每个基本块内按机器模型做表调度 (list scheduling),
+// 把与前面的 lw、mul、div 无关的指令提到它们和使用者之间, 顺序执行的流水线就不必等待结果
+
+// 机器模型: 每个周期能发射的指令数和各类指令的结果要过几个周期才能使用
+// 新的目标核心在 schedule.cpp 的 machine_models 表中加一行, 用 -mtune=名字 选择
+struct MachineModel {
+  const char *name;
+  int issue_width; // 每个周期发射的指令数
+  int alu;         // 算术、逻辑、比较、li、mv 等
+  int load;        // lw/lh/lb 到使用者的延迟 (load-use)
+  int store;       // sw 到读同一地址的 lw
+  int mul;
+  int div;         // 除法和取余
+};
+
+// 按名字找机器模型, 没有时返回 nullptr
+const MachineModel *FindMachineModel(const std::string &name);
+
+// 所有机器模型的名字, 以逗号分隔, 用于报错
+std::string MachineModelNames();
+
+// 调度一个函数的汇编 code, 结果写回 code
+// 标签、伪操作、跳转、调用和修改 sp 的指令不移动, 它们之间的指令只在原来的范围内重排,
+// 所以这些不移动的行在 code 中的位置和地址都不变, 之前记下的条件跳转和基本块的位置仍然有效
+void ScheduleFunction(std::string &code, const MachineModel &model);
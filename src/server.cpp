@@ -0,0 +1,211 @@
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <thread>
+#include <unistd.h>
+#include "server.hpp"
+
+using namespace std;
+
+// 协议: 请求和回复都是一条消息, 消息由若干字段组成,
+// 每个字段是一行 "名字 长度" 加上长度个字节的内容, 以一个空行结束
+// 请求的字段: mode (-koopa/-koopa-bin/-riscv/-perf), input (源文件路径),
+//             source (可选, 源代码内容, 有它时不再读 input), output (可选, 输出文件路径)
+// 回复的字段: status (0 为成功), diag (错误信息), output (请求中没有 output 时为编译结果)
+typedef map<string, string> Message;
+
+// 带缓冲地从套接字中读取, 避免逐字节地调用 read
+class Connection {
+ public:
+  explicit Connection(int fd) : fd(fd) {}
+
+  bool Receive(Message &message) {
+    message.clear();
+    string line;
+    while(ReadLine(line)) {
+      if(line.empty()) return true;
+      size_t space = line.find(' ');
+      if(space == string::npos) return false;
+      string &value = message[line.substr(0, space)];
+      if(!Read(strtoull(line.c_str() + space + 1, nullptr, 10), value)) return false;
+    }
+    return false;
+  }
+
+  bool Send(const Message &message) {
+    string data;
+    for(auto &field : message) {
+      data += field.first + " " + to_string(field.second.size()) + "\n";
+      data += field.second;
+    }
+    data += "\n";
+    for(size_t sent = 0; sent < data.size();) {
+      ssize_t n = send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+      if(n < 0 && errno == EINTR) continue;
+      if(n <= 0) return false;
+      sent += n;
+    }
+    return true;
+  }
+
+ private:
+  bool Fill() {
+    char buf[65536];
+    ssize_t n;
+    do n = read(fd, buf, sizeof(buf)); while(n < 0 && errno == EINTR);
+    if(n <= 0) return false;
+    buffer.erase(0, pos);
+    pos = 0;
+    buffer.append(buf, n);
+    return true;
+  }
+  bool ReadLine(string &line) {
+    size_t newline;
+    while((newline = buffer.find('\n', pos)) == string::npos)
+      if(!Fill()) return false;
+    line = buffer.substr(pos, newline - pos);
+    pos = newline + 1;
+    return true;
+  }
+  bool Read(size_t len, string &data) {
+    while(buffer.size() - pos < len)
+      if(!Fill()) return false;
+    data = buffer.substr(pos, len);
+    pos += len;
+    return true;
+  }
+
+  int fd;
+  string buffer;
+  size_t pos = 0;
+};
+
+static bool make_address(const string &socket_path, sockaddr_un &addr) {
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if(socket_path.size() >= sizeof(addr.sun_path)) return false;
+  strcpy(addr.sun_path, socket_path.c_str());
+  return true;
+}
+
+// 处理一个编译请求
+static Message handle_request(const CompileOptions &server_opts, const Message &request) {
+  CompileOptions opts = server_opts;
+  ostringstream diag, result;
+  opts.diag = &diag;
+  auto field = [&request](const string &name) {
+    auto it = request.find(name);
+    return it == request.end() ? string() : it->second;
+  };
+  opts.mode = field("mode");
+  string input = field("input"), output = field("output");
+
+  int status = 1;
+  if(opts.mode != "-koopa" && opts.mode != "-koopa-bin" && opts.mode != "-riscv" && opts.mode != "-perf")
+    diag << "error: unknown mode " << opts.mode << endl;
+  else if(request.count("source")) status = compile_buffer(opts, input, field("source"), result);
+  else status = compile_file(opts, input, result);
+
+  Message reply;
+  if(status == 0 && !output.empty()) {
+    ofstream ofs(output);
+    ofs << result.str();
+    if(!ofs) {
+      diag << "error: cannot write " << output << endl;
+      status = 1;
+    }
+  }
+  else if(status == 0) reply["output"] = result.str();
+  reply["status"] = to_string(status);
+  reply["diag"] = diag.str();
+  return reply;
+}
+
+static void serve_connection(const CompileOptions &opts, int fd) {
+  Connection connection(fd);
+  Message request;
+  while(connection.Receive(request))
+    if(!connection.Send(handle_request(opts, request))) break;
+  close(fd);
+}
+
+// 退出时删除套接字文件, 信号处理函数中只能使用固定的缓冲区
+static char server_socket_path[sizeof(sockaddr_un::sun_path)];
+
+static void stop_server(int) {
+  unlink(server_socket_path);
+  _exit(0);
+}
+
+int run_server(const CompileOptions &opts, const string &socket_path) {
+  sockaddr_un addr;
+  if(!make_address(socket_path, addr)) {
+    cerr << "error: socket path too long: " << socket_path << endl;
+    return 1;
+  }
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  // 套接字文件已经存在时, 连得上说明已有服务在运行, 否则是上次没有清理掉的
+  if(connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) == 0) {
+    cerr << "error: a server is already listening on " << socket_path << endl;
+    close(fd);
+    return 1;
+  }
+  close(fd);
+  unlink(socket_path.c_str());
+
+  fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if(fd < 0 || bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) || listen(fd, SOMAXCONN)) {
+    cerr << "error: cannot listen on " << socket_path << ": " << strerror(errno) << endl;
+    return 1;
+  }
+  strcpy(server_socket_path, socket_path.c_str());
+  signal(SIGINT, stop_server);
+  signal(SIGTERM, stop_server);
+  signal(SIGPIPE, SIG_IGN);
+
+  while(true) {
+    int client = accept(fd, nullptr, nullptr);
+    if(client < 0) {
+      if(errno == EINTR || errno == ECONNABORTED) continue;
+      cerr << "error: accept: " << strerror(errno) << endl;
+      return 1;
+    }
+    thread(serve_connection, ref(opts), client).detach();
+  }
+}
+
+// 服务进程的工作目录可能不同, 相对路径要先转换成绝对路径
+static string absolute_path(const string &path) {
+  if(path.empty() || path[0] == '/') return path;
+  char cwd[4096];
+  if(!getcwd(cwd, sizeof(cwd))) return path;
+  return string(cwd) + "/" + path;
+}
+
+int request_compile(const string &socket_path, const string &mode, const string &input, const string &output) {
+  sockaddr_un addr;
+  if(!make_address(socket_path, addr)) return -1;
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if(fd < 0) return -1;
+  if(connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr))) {
+    close(fd);
+    return -1;
+  }
+
+  Connection connection(fd);
+  Message reply;
+  bool ok = connection.Send({{"mode", mode}, {"input", absolute_path(input)}, {"output", absolute_path(output)}})
+            && connection.Receive(reply);
+  close(fd);
+  // 请求已经发出后服务断开了, 不知道输出是否已经写出, 让调用者重新编译
+  if(!ok) return -1;
+  cerr << reply["diag"];
+  return atoi(reply["status"].c_str());
+}
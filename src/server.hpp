@@ -0,0 +1,17 @@
+#pragma once
+
+#include <string>
+#include "compiler.hpp"
+
+// 常驻的编译服务
+// 在 Unix 域套接字上接受编译请求, 省去每次编译都要启动进程的开销
+// 每个请求使用各自的前端和后端上下文, 编译完即销毁, 请求之间不共享任何编译状态
+// 客户端可以在一个连接上依次发送多个请求, 每个连接由单独的线程处理
+
+// 在 socket_path 上运行编译服务, opts 中的缓存等设置对所有请求生效, 收到 SIGINT/SIGTERM 时退出
+int run_server(const CompileOptions &opts, const std::string &socket_path);
+
+// 把一次编译请求发给 socket_path 上的编译服务, 由服务把结果写到 output
+// 返回编译结果 (0 为成功), 连不上服务时返回 -1, 调用者应改为在本进程中编译
+int request_compile(const std::string &socket_path, const std::string &mode,
+                    const std::string &input, const std::string &output);
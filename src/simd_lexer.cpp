@@ -0,0 +1,237 @@
+// 手写的 lexer, 用 make LEXER=simd (SSE2) 或 LEXER=simd-avx2 代替 sysy.l 中 Flex 生成的 lexer, 便于对比
+// 给 parser 的 token、token 的值和位置与 Flex 生成的 lexer 完全相同
+// 输入是内存中的整个源文件, 不经过 FILE*; 跳过空白和注释、扫描标识符和数字时按块 (SSE2 16 字节, AVX2 32 字节)
+// 同时判断每个字节的类别, 找到第一个不属于该类别的字节
+#ifdef SYSY_SIMD_LEXER
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#include "sysy.tab.hpp"
+
+using namespace std;
+
+namespace {
+
+// lexer 的状态: 还没读的输入 [cur, end)
+struct Scanner {
+  const char *cur = nullptr, *end = nullptr;
+  long *token_count = nullptr; // 非空时在其中统计 token 的个数 (不算空白和注释), 用于 -ftime-report
+};
+
+/********************************字节类别**********************************/
+
+#if defined(__AVX2__)
+typedef __m256i Vec;
+const int vec_bytes = 32;
+const uint32_t all_bytes = 0xffffffffu;
+inline Vec load(const char *p) { return _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p)); }
+inline Vec splat(char c) { return _mm256_set1_epi8(c); }
+inline Vec eq(Vec a, Vec b) { return _mm256_cmpeq_epi8(a, b); }
+inline Vec either(Vec a, Vec b) { return _mm256_or_si256(a, b); }
+inline Vec sub(Vec a, Vec b) { return _mm256_sub_epi8(a, b); }
+inline Vec min_u8(Vec a, Vec b) { return _mm256_min_epu8(a, b); }
+inline uint32_t bits(Vec v) { return _mm256_movemask_epi8(v); }
+#define SIMD_LEXER_VECTOR 1
+#elif defined(__SSE2__)
+typedef __m128i Vec;
+const int vec_bytes = 16;
+const uint32_t all_bytes = 0xffffu;
+inline Vec load(const char *p) { return _mm_loadu_si128(reinterpret_cast<const __m128i *>(p)); }
+inline Vec splat(char c) { return _mm_set1_epi8(c); }
+inline Vec eq(Vec a, Vec b) { return _mm_cmpeq_epi8(a, b); }
+inline Vec either(Vec a, Vec b) { return _mm_or_si128(a, b); }
+inline Vec sub(Vec a, Vec b) { return _mm_sub_epi8(a, b); }
+inline Vec min_u8(Vec a, Vec b) { return _mm_min_epu8(a, b); }
+inline uint32_t bits(Vec v) { return _mm_movemask_epi8(v); }
+#define SIMD_LEXER_VECTOR 1
+#endif
+
+#ifdef SIMD_LEXER_VECTOR
+// 每个字节是否在 [lo, hi] 中: c - lo 按无符号数不超过 hi - lo
+inline Vec in_range(Vec v, char lo, char hi) {
+  Vec d = sub(v, splat(lo));
+  return eq(min_u8(d, splat(hi - lo)), d);
+}
+#endif
+
+// 每个类别既能判断单个字节, 也能判断一块字节 (结果中属于该类别的字节为全 1)
+struct Space { // [ \t\n\r], 与 sysy.l 中的 WhiteSpace 相同
+  bool operator()(char c) const { return c == ' ' || c == '\t' || c == '\n' || c == '\r'; }
+#ifdef SIMD_LEXER_VECTOR
+  Vec operator()(Vec v) const {
+    return either(either(eq(v, splat(' ')), eq(v, splat('\t'))), either(eq(v, splat('\n')), eq(v, splat('\r'))));
+  }
+#endif
+};
+
+struct IdentChar { // [a-zA-Z0-9_]
+  bool operator()(char c) const { return isalnum((unsigned char)c) || c == '_'; }
+#ifdef SIMD_LEXER_VECTOR
+  Vec operator()(Vec v) const {
+    return either(either(in_range(v, 'a', 'z'), in_range(v, 'A', 'Z')), either(in_range(v, '0', '9'), eq(v, splat('_'))));
+  }
+#endif
+};
+
+struct Digit { // [lo-hi], 十进制为 [0-9], 八进制为 [0-7]
+  char hi;
+  bool operator()(char c) const { return c >= '0' && c <= hi; }
+#ifdef SIMD_LEXER_VECTOR
+  Vec operator()(Vec v) const { return in_range(v, '0', hi); }
+#endif
+};
+
+struct HexDigit { // [0-9a-fA-F]
+  bool operator()(char c) const { return isxdigit((unsigned char)c); }
+#ifdef SIMD_LEXER_VECTOR
+  Vec operator()(Vec v) const {
+    return either(in_range(v, '0', '9'), either(in_range(v, 'a', 'f'), in_range(v, 'A', 'F')));
+  }
+#endif
+};
+
+struct NotByte { // 除了 c 以外的字节, 用来找 c
+  char c;
+  bool operator()(char x) const { return x != c; }
+#ifdef SIMD_LEXER_VECTOR
+  Vec operator()(Vec v) const { return eq(eq(v, splat(c)), splat(0)); }
+#endif
+};
+
+// 从 p 开始跳过属于类别 cls 的字节, 返回第一个不属于它的位置 (或 end)
+template<class Class>
+inline const char *skip(const char *p, const char *end, const Class &cls) {
+#ifdef SIMD_LEXER_VECTOR
+  for(; end - p >= vec_bytes; p += vec_bytes) {
+    uint32_t outside = bits(cls(load(p))) ^ all_bytes;
+    if(outside) return p + __builtin_ctz(outside);
+  }
+#endif
+  while(p < end && cls(*p)) p++;
+  return p;
+}
+
+/**********************************位置************************************/
+
+// 与 sysy.l 中的 update_location 相同: 每段文本 (包括空白和注释) 都把位置向后推进
+void update_location(YYLTYPE *loc, const char *text, size_t len) {
+  loc->first_line = loc->last_line;
+  loc->first_column = loc->last_column;
+  loc->begin = loc->end;
+  const char *end = text + len;
+  int lines = 0;
+  const char *last_newline = nullptr;
+  for(const char *p = text; (p = skip(p, end, NotByte{'\n'})) < end; p++) {
+    lines++;
+    last_newline = p;
+  }
+  if(last_newline) {
+    loc->last_line += lines;
+    loc->last_column = 1 + (end - last_newline - 1);
+  } else loc->last_column += len;
+  loc->end += len;
+}
+
+// 从 p ("/*") 开始的块注释的结尾 ("*/" 之后), 没有结尾时返回 nullptr
+const char *block_comment_end(const char *p, const char *end) {
+  for(p += 2; (p = skip(p, end, NotByte{'*'})) < end; p++)
+    if(p + 1 < end && p[1] == '/') return p + 2;
+  return nullptr;
+}
+
+// 关键字对应的 token, 不是关键字时返回 0
+int keyword(const char *p, size_t len) {
+  static const pair<const char *, int> keywords[] = {
+    {"return", RETURN}, {"const", CONST}, {"if", IF}, {"else", ELSE}, {"while", WHILE},
+    {"break", BREAK}, {"continue", CONTINUE},
+  };
+  for(auto &k : keywords)
+    if(strlen(k.first) == len && !memcmp(k.first, p, len)) return k.second;
+  return 0;
+}
+
+} // namespace
+
+/*********************************接口*************************************/
+
+// 与 Flex 生成的同名函数相同
+int yylex_init_extra(long *token_count, yyscan_t *scanner) {
+  auto s = new Scanner;
+  s->token_count = token_count;
+  *scanner = s;
+  return 0;
+}
+
+int yylex_destroy(yyscan_t scanner) {
+  delete static_cast<Scanner *>(scanner);
+  return 0;
+}
+
+// 代替 Flex 的 yyset_in: 直接扫描内存中的 [data, data + size), 扫描期间 data 要一直有效
+void yyset_buffer(const char *data, size_t size, yyscan_t scanner) {
+  auto s = static_cast<Scanner *>(scanner);
+  s->cur = data;
+  s->end = data + size;
+}
+
+int yylex(YYSTYPE *yylval, YYLTYPE *yylloc, yyscan_t scanner) {
+  auto s = static_cast<Scanner *>(scanner);
+  const char *end = s->end;
+  // 空白、行注释和块注释各算一段文本, 与 Flex 一样分别推进位置
+  for(;;) {
+    const char *p = s->cur, *q = nullptr;
+    if(p == end) return 0;
+    if(Space()(*p)) q = skip(p + 1, end, Space());
+    else if(p[0] == '/' && p + 1 < end && p[1] == '/') q = skip(p + 2, end, NotByte{'\n'});
+    else if(p[0] == '/' && p + 1 < end && p[1] == '*') q = block_comment_end(p, end);
+    if(!q) break;
+    update_location(yylloc, p, q - p);
+    s->cur = q;
+  }
+
+  const char *p = s->cur, *q = p + 1;
+  int token;
+  if(isalpha((unsigned char)*p) || *p == '_') {
+    q = skip(q, end, IdentChar());
+    token = keyword(p, q - p);
+    if(!token) {
+      yylval->str_val = new string(p, q);
+      token = (q - p == 3 && !memcmp(p, "int", 3)) || (q - p == 4 && !memcmp(p, "void", 4)) ? TYPE : IDENT;
+    }
+  }
+  else if(isdigit((unsigned char)*p)) {
+    // 与 sysy.l 相同: [1-9][0-9]*, 0[0-7]*, 0[xX][0-9a-fA-F]+
+    if(*p != '0') q = skip(q, end, Digit{'9'});
+    else if(q + 1 < end && (*q == 'x' || *q == 'X') && isxdigit((unsigned char)q[1])) q = skip(q + 1, end, HexDigit());
+    else q = skip(q, end, Digit{'7'});
+    yylval->int_val = strtol(string(p, q).c_str(), nullptr, 0);
+    token = INT_CONST;
+  }
+  else if((*p == '&' || *p == '|') && q < end && *q == *p) {
+    token = *p == '&' ? AND : OR;
+    q++;
+  }
+  else if(*p == '<' || *p == '>') {
+    if(q < end && *q == '=') q++;
+    yylval->str_val = new string(p, q);
+    token = RELOP;
+  }
+  else if((*p == '!' || *p == '=') && q < end && *q == '=') {
+    q++;
+    yylval->str_val = new string(p, q);
+    token = EQOP;
+  }
+  else token = *p;
+  update_location(yylloc, p, q - p);
+  s->cur = q;
+  if(s->token_count) ++*s->token_count;
+  return token;
+}
+
+#endif
@@ -1,7 +1,28 @@
 %code requires {
   #include <memory>
+  #include <ostream>
   #include <string>
   #include "ast.hpp"
+
+  // 可重入的 lexer 的状态, 与 Flex 生成的定义保持一致
+  #ifndef YY_TYPEDEF_YY_SCANNER_T
+  #define YY_TYPEDEF_YY_SCANNER_T
+  typedef void *yyscan_t;
+  #endif
+
+  // 符号在源文件中的位置: 行号列号用于报错, 字节偏移 [begin, end) 用于截取对应的源代码
+  struct YYLTYPE {
+    int first_line, first_column;
+    int last_line, last_column;
+    int begin, end;
+  };
+  #define YYLTYPE_IS_DECLARED 1
+  #define YYLTYPE_IS_TRIVIAL 1
+}
+
+%code provides {
+  // 声明 lexer 函数, 由 Flex 以 reentrant + bison-bridge + bison-locations 方式生成
+  int yylex(YYSTYPE *yylval, YYLTYPE *yylloc, yyscan_t scanner);
 }
 
 %{
@@ -12,18 +33,62 @@
 #include "ast.hpp"
 #include <vector>
 
-// 声明 lexer 函数和错误处理函数
-int yylex();
-void yyerror(std::unique_ptr<BaseAST> &ast, const char *s);
-
 using namespace std;
 
 %}
 
+%code {
+  // 声明错误处理函数
+  void yyerror(YYLTYPE *loc, yyscan_t scanner, std::unique_ptr<BaseAST> &ast, std::ostream &diag, const char *s);
+
+  // 记下节点在源文件中的起始位置, 用于优化报告
+  static BaseAST *located(BaseAST *ast, const YYLTYPE &loc) {
+    ast->line = loc.first_line;
+    ast->column = loc.first_column;
+    return ast;
+  }
+
+  // 把解析完的一项加到 items 中; 流式编译时直接交给前端处理, 处理完就释放
+  static void add_item(std::vector<std::unique_ptr<BaseAST>> *items, BaseAST *item) {
+    if(ctx && ctx->on_item) ctx->on_item(std::unique_ptr<BaseAST>(item));
+    else items->push_back(std::unique_ptr<BaseAST>(item));
+  }
+
+  // parser 的栈 (在堆上) 最多的层数, 即括号、语句和初始化列表能嵌套的深度; 之后的各遍都在显式的工作栈上遍历 AST,
+  // 嵌套再深也不会用尽 C++ 栈
+  #define YYMAXDEPTH 1000000
+
+  // 非终结符的位置从第一个符号的开头到最后一个符号的结尾, 空产生式取前一个符号的结尾
+  #define YYLLOC_DEFAULT(Cur, Rhs, N)                                   \
+    do {                                                                \
+      if(N) {                                                           \
+        (Cur).first_line = YYRHSLOC(Rhs, 1).first_line;                 \
+        (Cur).first_column = YYRHSLOC(Rhs, 1).first_column;             \
+        (Cur).begin = YYRHSLOC(Rhs, 1).begin;                           \
+        (Cur).last_line = YYRHSLOC(Rhs, N).last_line;                   \
+        (Cur).last_column = YYRHSLOC(Rhs, N).last_column;               \
+        (Cur).end = YYRHSLOC(Rhs, N).end;                               \
+      } else {                                                          \
+        (Cur).first_line = (Cur).last_line = YYRHSLOC(Rhs, 0).last_line; \
+        (Cur).first_column = (Cur).last_column = YYRHSLOC(Rhs, 0).last_column; \
+        (Cur).begin = (Cur).end = YYRHSLOC(Rhs, 0).end;                 \
+      }                                                                 \
+    } while(0)
+}
+
+// 生成可重入的 parser: 不使用全局的 yylval/yyin, 所有状态都在调用者持有的 scanner 中
+// 这样一个进程就可以多次、甚至在多个线程中同时解析不同的文件
+%define api.pure full
+%lex-param { yyscan_t scanner }
+
+// 记录每个符号在源文件中的位置
+%locations
+
 // 定义 parser 函数和错误处理函数的附加参数
 // 我们需要返回一个字符串作为 AST, 所以我们把附加参数定义成字符串的智能指针
 // 解析完成后, 我们要手动修改这个参数, 把它设置成解析得到的字符串
-%parse-param { std::unique_ptr<BaseAST> &ast }
+// diag 是错误信息的输出位置
+%parse-param { yyscan_t scanner } { std::unique_ptr<BaseAST> &ast } { std::ostream &diag }
 
 // yylval 的定义, 我们把它定义成了一个联合体 (union)
 // 因为 token 的值有的是字符串指针, 有的是整数
@@ -80,12 +145,12 @@ CompUnit
 CompUnitItemList
   : CompUnitItem {
     auto vec = new vector<unique_ptr<BaseAST>>();
-    vec->push_back(unique_ptr<BaseAST>($1));
+    add_item(vec, $1);
     $$ = vec;
   }
   | CompUnitItemList CompUnitItem {
     auto vec = $1;
-    vec->push_back(unique_ptr<BaseAST>($2));
+    add_item(vec, $2);
     $$ = vec;
   }
   ;
@@ -94,12 +159,12 @@ CompUnitItem
   : FuncDef {
     auto ast = new CompUnitItemAST();
     ast->func_def = unique_ptr<BaseAST>($1);
-    $$ = ast;
+    $$ = located(ast, @$);
   }
   | Decl {
     auto ast = new CompUnitItemAST();
     ast->decl = unique_ptr<BaseAST>($1);
-    $$ = ast;
+    $$ = located(ast, @$);
   }
   ;
 
@@ -120,7 +185,9 @@ FuncDef
     ast->ident = *unique_ptr<string>($2);
     ast->func_f_param_list = unique_ptr<vector<unique_ptr<BaseAST> > >($4);
     ast->block = unique_ptr<BaseAST>($6);
-    $$ = ast;
+    ast->source_begin = @$.begin;
+    ast->source_end = @$.end;
+    $$ = located(ast, @$);
   }
   ;
 
@@ -146,14 +213,14 @@ FuncFParam
     auto ast = new FuncFParamAST();
     ast->b_type = *unique_ptr<string>($1);
     ast->ident = *unique_ptr<string>($2);
-    $$ = ast;
+    $$ = located(ast, @$);
   }
   | TYPE IDENT '[' ']' ConstIndexList {
     auto ast = new FuncFParamAST();
     ast->b_type = *unique_ptr<string>($1);
     ast->ident = *unique_ptr<string>($2);
     ast->const_index_list = unique_ptr<vector<unique_ptr<BaseAST>>>($5);
-    $$ = ast;
+    $$ = located(ast, @$);
   }
   ;
 
@@ -161,7 +228,7 @@ Block
   : '{' BlockItemList '}' {
     auto ast = new BlockAST();
     ast->block_item_list = unique_ptr<vector<unique_ptr<BaseAST>>>($2);
-    $$ = ast;
+    $$ = located(ast, @$);
   }
   ;
 
@@ -186,12 +253,12 @@ BlockItem
   : Stmt {
     auto ast = new BlockItemAST();
     ast->stmt = unique_ptr<BaseAST>($1);
-    $$ = ast;
+    $$ = located(ast, @$);
   }
   | Decl {
     auto ast = new BlockItemAST();
     ast->decl = unique_ptr<BaseAST>($1);
-    $$ = ast;
+    $$ = located(ast, @$);
   }
   ;
 
@@ -200,53 +267,53 @@ Stmt
     auto ast = new StmtAST();
     ast->exp = unique_ptr<BaseAST>($2);
     ast->return_ = true;
-    $$ = ast;
+    $$ = located(ast, @$);
   }
   | RETURN ';' {
     auto ast = new StmtAST();
     ast->return_ = true;
-    $$ = ast;
+    $$ = located(ast, @$);
   }
   | LVal '=' Exp ';' {
     auto ast = new StmtAST();
     ast->lval = unique_ptr<BaseAST>($1);
     ast->exp = unique_ptr<BaseAST>($3);
-    $$ = ast;
+    $$ = located(ast, @$);
   }
   | Block {
     auto ast = new StmtAST();
     ast->block = unique_ptr<BaseAST>($1);
-    $$ = ast;
+    $$ = located(ast, @$);
   }
   | Exp ';' {
     auto ast = new StmtAST();
     ast->exp_only = unique_ptr<BaseAST>($1);
-    $$ = ast;
+    $$ = located(ast, @$);
   }
   | ';' {
     auto ast = new StmtAST();
-    $$ = ast;
+    $$ = located(ast, @$);
   }
   | IfStmt {
     auto ast = new StmtAST();
     ast->if_stmt = unique_ptr<BaseAST>($1);
-    $$ = ast;
+    $$ = located(ast, @$);
   }
   | WHILE '(' Exp ')' Stmt {
     auto ast = new StmtAST();
     ast->exp = unique_ptr<BaseAST>($3);
     ast->while_stmt = unique_ptr<BaseAST>($5);
-    $$ = ast;
+    $$ = located(ast, @$);
   }
   | BREAK ';' {
     auto ast = new StmtAST();
     ast->break_ = true;
-    $$ = ast;
+    $$ = located(ast, @$);
   }
   | CONTINUE ';' {
     auto ast = new StmtAST();
     ast->continue_ = true;
-    $$ = ast;
+    $$ = located(ast, @$);
   }
   ;
 
@@ -254,12 +321,12 @@ IfStmt
   : OnlyIf {
     auto ast=new IfStmtAST();
     ast->if_stmt=unique_ptr<BaseAST>($1);
-    $$=ast;
+    $$ = located(ast, @$);
   }
   | IfElse {
     auto ast=new IfStmtAST();
     ast->if_stmt=unique_ptr<BaseAST>($1);
-    $$=ast;
+    $$ = located(ast, @$);
   }
   ;
 
@@ -268,7 +335,7 @@ OnlyIf
     auto ast = new OnlyIfAST();
     ast->exp = unique_ptr<BaseAST>($3);
     ast->stmt = unique_ptr<BaseAST>($5);
-    $$ = ast;
+    $$ = located(ast, @$);
   }
   ;
 
@@ -278,7 +345,7 @@ IfElse
     ast->exp = unique_ptr<BaseAST>($3);
     ast->if_stmt = unique_ptr<BaseAST>($5);
     ast->else_stmt = unique_ptr<BaseAST>($7);
-    $$ = ast;
+    $$ = located(ast, @$);
   }
   ;
 
@@ -286,7 +353,7 @@ Exp
   : LOrExp {
     auto ast = new ExpAST();
     ast->lor_exp = unique_ptr<BaseAST>($1);
-    $$ = ast;
+    $$ = located(ast, @$);
   }
   ;
 
@@ -295,7 +362,7 @@ LVal
     auto ast = new LValAST();
     ast->ident = *unique_ptr<string>($1);
     ast->index_list = unique_ptr<vector<unique_ptr<BaseAST>>>($2);
-    $$ = ast;
+    $$ = located(ast, @$);
   }
   ;
 
@@ -315,17 +382,17 @@ PrimaryExp
   : '(' Exp ')'{
     auto ast = new PrimaryExpAST();
     ast->exp = unique_ptr<BaseAST>($2);
-    $$ = ast;
+    $$ = located(ast, @$);
   }
   | Number {
     auto ast = new PrimaryExpAST();
     ast->number = unique_ptr<BaseAST>($1);
-    $$ = ast;
+    $$ = located(ast, @$);
   }
   | LVal{
     auto ast = new PrimaryExpAST();
     ast->lval = unique_ptr<BaseAST>($1);
-    $$ = ast;
+    $$ = located(ast, @$);
   }
   ;
 
@@ -333,7 +400,7 @@ Number
   : INT_CONST {
     auto ast = new NumberAST();
     ast->n = $1;
-    $$ = ast;
+    $$ = located(ast, @$);
   }
   ;
 
@@ -342,19 +409,19 @@ UnaryExp
   : PrimaryExp {
     auto ast = new UnaryExpAST();
     ast->primary_exp = unique_ptr<BaseAST>($1);
-    $$ = ast;
+    $$ = located(ast, @$);
   }
   | UnaryOp UnaryExp{
     auto ast = new UnaryExpAST();
     ast->unary_op = $1;
     ast->unary_exp = unique_ptr<BaseAST>($2);
-    $$ = ast;
+    $$ = located(ast, @$);
   }
   | IDENT '(' FuncRParams ')'{
     auto ast = new UnaryExpAST();
     ast->ident = *unique_ptr<string>($1);
     ast->func_r_param_list = unique_ptr<vector<unique_ptr<BaseAST>>>($3);
-    $$ = ast;
+    $$ = located(ast, @$);
   }
   ;
 
@@ -390,14 +457,14 @@ AddExp
   : MulExp {
     auto ast = new AddExpAST();
     ast->mul_exp = unique_ptr<BaseAST>($1);
-    $$ = ast;
+    $$ = located(ast, @$);
   }
   | AddExp AddOp MulExp {
     auto ast = new AddExpAST();
     ast->add_exp = unique_ptr<BaseAST>($1);
     ast->add_op = $2;
     ast->mul_exp = unique_ptr<BaseAST>($3);
-    $$ = ast;
+    $$ = located(ast, @$);
   }
   ;
 
@@ -414,14 +481,14 @@ MulExp
   : UnaryExp {
     auto ast = new MulExpAST();
     ast->unary_exp = unique_ptr<BaseAST>($1);
-    $$ = ast;
+    $$ = located(ast, @$);
   }
   | MulExp MulOp UnaryExp {
     auto ast = new MulExpAST();
     ast->mul_exp = unique_ptr<BaseAST>($1);
     ast->mul_op = $2;
     ast->unary_exp = unique_ptr<BaseAST>($3);
-    $$ = ast;
+    $$ = located(ast, @$);
   }
   ;
 
@@ -441,13 +508,13 @@ LOrExp
   : LAndExp {
     auto ast = new LOrExpAST();
     ast->land_exp = unique_ptr<BaseAST>($1);
-    $$ = ast;
+    $$ = located(ast, @$);
   }
   | LOrExp OR LAndExp {
     auto ast = new LOrExpAST();
     ast->lor_exp = unique_ptr<BaseAST>($1);
     ast->land_exp = unique_ptr<BaseAST>($3);
-    $$ = ast;
+    $$ = located(ast, @$);
   }
   ;
 
@@ -455,13 +522,13 @@ LAndExp
   : EqExp {
     auto ast = new LAndExpAST();
     ast->eq_exp = unique_ptr<BaseAST>($1);
-    $$ = ast;
+    $$ = located(ast, @$);
   }
   | LAndExp AND EqExp {
     auto ast = new LAndExpAST();
     ast->land_exp = unique_ptr<BaseAST>($1);
     ast->eq_exp = unique_ptr<BaseAST>($3);
-    $$ = ast;
+    $$ = located(ast, @$);
   }
   ;
 
@@ -469,14 +536,14 @@ EqExp
   : RelExp {
     auto ast = new EqExpAST();
     ast->rel_exp = unique_ptr<BaseAST>($1);
-    $$ = ast;
+    $$ = located(ast, @$);
   }
   | EqExp EQOP RelExp {
     auto ast = new EqExpAST();
     ast->eq_exp = unique_ptr<BaseAST>($1);
     ast->eq_op = *unique_ptr<string>($2);
     ast->rel_exp = unique_ptr<BaseAST>($3);
-    $$ = ast;
+    $$ = located(ast, @$);
   }
   ;
 
@@ -484,14 +551,14 @@ RelExp
   : AddExp {
     auto ast = new RelExpAST();
     ast->add_exp = unique_ptr<BaseAST>($1);
-    $$ = ast;
+    $$ = located(ast, @$);
   }
   | RelExp RELOP AddExp {
     auto ast = new RelExpAST();
     ast->rel_exp = unique_ptr<BaseAST>($1);
     ast->rel_op = *unique_ptr<string>($2);
     ast->add_exp = unique_ptr<BaseAST>($3);
-    $$ = ast;
+    $$ = located(ast, @$);
   }
   ;
 
@@ -500,12 +567,12 @@ Decl
   : ConstDecl{
     auto ast = new DeclAST();
     ast->const_decl = unique_ptr<BaseAST>($1);
-    $$ = ast;
+    $$ = located(ast, @$);
   }
   | VarDecl{
     auto ast = new DeclAST();
     ast->var_decl = unique_ptr<BaseAST>($1);
-    $$ = ast;
+    $$ = located(ast, @$);
   }
   ;
 
@@ -514,7 +581,7 @@ ConstDecl
     auto ast = new ConstDeclAST();
     ast->b_type = *unique_ptr<string>($2);
     ast->const_def_list = unique_ptr<vector<unique_ptr<BaseAST>>>($3);
-    $$ = ast;
+    $$ = located(ast, @$);
   }
   ;
 
@@ -537,7 +604,7 @@ ConstDef
     ast->ident = *unique_ptr<string>($1);
     ast->const_index_list = unique_ptr<vector<unique_ptr<BaseAST>>>($2);
     ast->const_init_val = unique_ptr<BaseAST>($4);
-    $$ = ast;
+    $$ = located(ast, @$);
   }
   ;
 
@@ -557,12 +624,12 @@ ConstInitVal
   : ConstExp{
     auto ast = new ConstInitValAST();
     ast->const_exp = unique_ptr<BaseAST>($1);
-    $$ = ast;
+    $$ = located(ast, @$);
   }
   | ConstArrayInitVal{
     auto ast = new ConstInitValAST();
     ast->const_array_init_val = unique_ptr<vector<unique_ptr<BaseAST>>>($1);
-    $$ = ast;
+    $$ = located(ast, @$);
   }
   ;
 
@@ -594,7 +661,7 @@ ConstExp
   : Exp{
     auto ast = new ConstExpAST();
     ast->exp = unique_ptr<BaseAST>($1);
-    $$ = ast;
+    $$ = located(ast, @$);
   }
   ;
 
@@ -603,7 +670,7 @@ VarDecl
     auto ast = new VarDeclAST();
     ast->b_type = *unique_ptr<string>($1);
     ast->var_def_list = unique_ptr<vector<unique_ptr<BaseAST>>>($2);
-    $$ = ast;
+    $$ = located(ast, @$);
   }
   ;
 
@@ -625,14 +692,14 @@ VarDef
     auto ast = new VarDefAST();
     ast->ident = *unique_ptr<string>($1);
     ast->const_index_list = unique_ptr<vector<unique_ptr<BaseAST>>>($2);
-    $$ = ast;
+    $$ = located(ast, @$);
   }
   | IDENT ConstIndexList '=' InitVal{
     auto ast = new VarDefAST();
     ast->ident = *unique_ptr<string>($1);
     ast->const_index_list = unique_ptr<vector<unique_ptr<BaseAST>>>($2);
     ast->init_val = unique_ptr<BaseAST>($4);
-    $$ = ast;
+    $$ = located(ast, @$);
   }
   ;
 
@@ -640,12 +707,12 @@ InitVal
   : Exp{
     auto ast = new InitValAST();
     ast->exp = unique_ptr<BaseAST>($1);
-    $$ = ast;
+    $$ = located(ast, @$);
   }
   | ArrayInitVal{
     auto ast = new InitValAST();
     ast->array_init_val = unique_ptr<vector<unique_ptr<BaseAST>>>($1);
-    $$ = ast;
+    $$ = located(ast, @$);
   }
   ;
 
@@ -677,6 +744,6 @@ InitValList
 
 // 定义错误处理函数, 其中第二个参数是错误信息
 // parser 如果发生错误 (例如输入的程序出现了语法错误), 就会调用这个函数
-void yyerror(unique_ptr<BaseAST> &ast, const char *s) {
-  cerr << "error: " << s << endl;
+void yyerror(YYLTYPE *loc, yyscan_t scanner, unique_ptr<BaseAST> &ast, ostream &diag, const char *s) {
+  diag << "error: " << loc->first_line << ":" << loc->first_column << ": " << s << endl;
 }
@@ -0,0 +1,153 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// 工作窃取线程池
+// 每个工作线程有自己的任务队列，优先从自己队列的尾部取任务，
+// 自己的队列空了就从其他线程队列的头部窃取，避免任务大小不均时个别线程空等
+class ThreadPool {
+ public:
+  explicit ThreadPool(unsigned num_threads) {
+    if(num_threads == 0) num_threads = 1;
+    for(unsigned i = 0; i < num_threads; i++) queues.emplace_back(new TaskQueue);
+    for(unsigned i = 0; i < num_threads; i++) threads.emplace_back([this, i] { Run(i); });
+  }
+  ~ThreadPool() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stop = true;
+    }
+    wake.notify_all();
+    for(auto &thread : threads) thread.join();
+  }
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+
+  // 提交任务；在工作线程中提交的任务放进该线程自己的队列
+  void Submit(std::function<void()> task) {
+    unsigned target = current_pool == this ? current_worker : next_queue++ % queues.size();
+    {
+      std::lock_guard<std::mutex> lock(queues[target]->mutex);
+      queues[target]->tasks.push_back(std::move(task));
+    }
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      pending++;
+      queued++;
+    }
+    wake.notify_one();
+  }
+
+  // 等待所有已提交的任务执行完毕，不能在任务内部调用
+  void Wait() {
+    std::unique_lock<std::mutex> lock(mutex);
+    done.wait(lock, [this] { return pending == 0; });
+  }
+
+  // 并行执行 body(0), body(1), ..., body(n-1) 并等待全部完成
+  // 调用者自己也领取下标执行, 不依赖有空闲的工作线程, 因此也可以在线程池的任务中调用
+  // body 抛出的第一个异常在全部完成后由调用者重新抛出
+  void ParallelFor(size_t n, const std::function<void(size_t)> &body) {
+    struct Loop {
+      std::atomic<size_t> next{0};
+      size_t finished = 0;
+      std::exception_ptr error;
+      std::mutex mutex;
+      std::condition_variable done;
+    };
+    if(n == 0) return;
+    // 迟到的帮手任务可能在调用者返回后才开始执行, 它们只会领到越界的下标而不会访问 body,
+    // 但仍会访问 loop, 所以 loop 要用 shared_ptr 保活
+    auto loop = std::make_shared<Loop>();
+    auto work = [loop, n, &body] {
+      size_t count = 0;
+      std::exception_ptr error;
+      for(size_t i; (i = loop->next++) < n; count++) {
+        try {
+          body(i);
+        } catch(...) {
+          if(!error) error = std::current_exception();
+        }
+      }
+      if(count == 0) return;
+      std::lock_guard<std::mutex> lock(loop->mutex);
+      if(error && !loop->error) loop->error = error;
+      loop->finished += count;
+      if(loop->finished == n) loop->done.notify_all();
+    };
+    for(size_t i = 1; i < std::min<size_t>(n, Size()); i++) Submit(work);
+    work();
+    std::unique_lock<std::mutex> lock(loop->mutex);
+    loop->done.wait(lock, [&] { return loop->finished == n; });
+    if(loop->error) std::rethrow_exception(loop->error);
+  }
+
+  unsigned Size() const { return threads.size(); }
+
+ private:
+  struct TaskQueue {
+    std::mutex mutex;
+    std::deque<std::function<void()>> tasks;
+  };
+
+  // 先取自己队列尾部的任务，再依次从其他队列头部窃取
+  bool Take(unsigned self, std::function<void()> &task) {
+    for(unsigned i = 0; i < queues.size(); i++) {
+      TaskQueue &queue = *queues[(self + i) % queues.size()];
+      std::lock_guard<std::mutex> lock(queue.mutex);
+      if(queue.tasks.empty()) continue;
+      if(i == 0) {
+        task = std::move(queue.tasks.back());
+        queue.tasks.pop_back();
+      } else {
+        task = std::move(queue.tasks.front());
+        queue.tasks.pop_front();
+      }
+      return true;
+    }
+    return false;
+  }
+
+  void Run(unsigned self) {
+    current_pool = this;
+    current_worker = self;
+    std::function<void()> task;
+    while(true) {
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        wake.wait(lock, [this] { return stop || queued > 0; });
+        if(queued == 0) return;
+        // 先占下一个任务的名额，队列中的任务数不会少于已占的名额，所以一定能取到
+        queued--;
+      }
+      while(!Take(self, task)) std::this_thread::yield();
+      task();
+      task = nullptr;
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        if(--pending == 0) done.notify_all();
+      }
+    }
+  }
+
+  std::vector<std::unique_ptr<TaskQueue>> queues;
+  std::vector<std::thread> threads;
+  std::mutex mutex;
+  std::condition_variable wake, done;
+  size_t pending = 0; // 已提交但还没执行完的任务数
+  size_t queued = 0;  // 还在队列中、没有被工作线程占下的任务数
+  std::atomic<unsigned> next_queue{0};
+  bool stop = false;
+
+  inline static thread_local ThreadPool *current_pool = nullptr;
+  inline static thread_local unsigned current_worker = 0;
+};
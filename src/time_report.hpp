@@ -0,0 +1,122 @@
+#pragma once
+
+#include <cstdint>
+#include <ctime>
+#include <iomanip>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+// 各编译阶段的耗时统计 (-ftime-report)
+// 同名阶段的数据会累加, 批量编译时所有文件共用一个 TimeReport, 可以在多个线程中同时记录
+class TimeReport {
+ public:
+  // 处理的各类对象的个数, 如 (tokens, 1234)
+  typedef std::vector<std::pair<std::string, uint64_t>> Items;
+  struct Phase {
+    std::string name;
+    double wall = 0;    // 墙上时间 (秒)
+    double cpu = 0;     // 执行该阶段的线程占用的 CPU 时间 (秒)
+    uint64_t runs = 0;  // 执行次数
+    Items items;
+  };
+
+  void Add(const std::string &name, double wall, double cpu, const Items &items) {
+    std::lock_guard<std::mutex> lock(mutex);
+    Phase *phase = nullptr;
+    for(auto &p : phases)
+      if(p.name == name) phase = &p;
+    if(!phase) {
+      phases.push_back(Phase{name});
+      phase = &phases.back();
+    }
+    phase->wall += wall;
+    phase->cpu += cpu;
+    phase->runs++;
+    for(auto &item : items) {
+      auto it = phase->items.begin();
+      while(it != phase->items.end() && it->first != item.first) it++;
+      if(it == phase->items.end()) phase->items.push_back(item);
+      else it->second += item.second;
+    }
+  }
+
+  // 按阶段第一次出现的顺序输出, 最后一行是合计
+  void Print(std::ostream &out, bool json) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    double wall = 0, cpu = 0;
+    for(auto &p : phases) {
+      wall += p.wall;
+      cpu += p.cpu;
+    }
+    if(json) {
+      out << "{\"phases\": [";
+      for(size_t i = 0; i < phases.size(); i++) {
+        auto &p = phases[i];
+        out << (i ? ", " : "") << "{\"name\": \"" << p.name << "\", \"wall\": " << p.wall
+            << ", \"cpu\": " << p.cpu << ", \"runs\": " << p.runs << ", \"items\": {";
+        for(size_t j = 0; j < p.items.size(); j++)
+          out << (j ? ", " : "") << "\"" << p.items[j].first << "\": " << p.items[j].second;
+        out << "}}";
+      }
+      out << "], \"total\": {\"wall\": " << wall << ", \"cpu\": " << cpu << "}}" << std::endl;
+      return;
+    }
+    out << "Execution times (seconds)" << std::endl;
+    out << std::left << std::setw(18) << " phase" << std::right << std::setw(11) << "wall"
+        << std::setw(11) << "cpu" << std::setw(7) << "%" << "  items" << std::endl;
+    out << std::fixed << std::setprecision(6);
+    for(auto &p : phases) {
+      out << " " << std::left << std::setw(17) << p.name << std::right << std::setw(11) << p.wall
+          << std::setw(11) << p.cpu << std::setw(6) << std::setprecision(1)
+          << (wall > 0 ? p.wall / wall * 100 : 0) << "%" << std::setprecision(6) << " ";
+      for(size_t j = 0; j < p.items.size(); j++)
+        out << (j ? ", " : " ") << p.items[j].second << " " << p.items[j].first;
+      out << std::endl;
+    }
+    out << " " << std::left << std::setw(17) << "TOTAL" << std::right << std::setw(11) << wall
+        << std::setw(11) << cpu << std::endl;
+    out << std::defaultfloat;
+  }
+
+ private:
+  mutable std::mutex mutex;
+  std::vector<Phase> phases;
+};
+
+// 统计一个阶段的 RAII 计时器, 析构时把结果记到 report 中
+// report 为空时什么都不做, 所以不需要统计时也可以留在代码中
+class PhaseTimer {
+ public:
+  PhaseTimer(TimeReport *report, const char *name) : report(report), name(name) {
+    if(!report) return;
+    clock_gettime(CLOCK_MONOTONIC, &wall_start);
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu_start);
+  }
+  ~PhaseTimer() {
+    if(!report) return;
+    timespec wall_end, cpu_end;
+    clock_gettime(CLOCK_MONOTONIC, &wall_end);
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu_end);
+    report->Add(name, Seconds(wall_start, wall_end), Seconds(cpu_start, cpu_end), items);
+  }
+  PhaseTimer(const PhaseTimer &) = delete;
+  PhaseTimer &operator=(const PhaseTimer &) = delete;
+
+  bool Enabled() const { return report != nullptr; }
+  // 记录本阶段处理了 n 个 unit, 如 Count(1234, "tokens")
+  // 统计个数本身可能要花时间, 调用前先检查 Enabled()
+  void Count(uint64_t n, const char *unit) { items.emplace_back(unit, n); }
+
+ private:
+  static double Seconds(const timespec &start, const timespec &end) {
+    return (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) * 1e-9;
+  }
+
+  TimeReport *report;
+  const char *name;
+  TimeReport::Items items;
+  timespec wall_start, cpu_start;
+};
@@ -3,15 +3,27 @@
 #include <cstring>
 #include <sstream>
 #include <cassert>
+#include "codegen_report.hpp"
+#include "dominators.hpp"
+#include "profile.hpp"
+#include "remarks.hpp"
+#include "schedule.hpp"
+#include "thread_pool.hpp"
 #include "visit_koopa_raw.hpp"
 #include <unordered_map>
+#include <unordered_set>
 #include <deque>
+#include <numeric>
+#include <tuple>
 #include <algorithm>
+#include <iomanip>
+#include <string>
+#include <vector>
 
 using namespace std;
 
 // binary op: koopa --> riscv , 注意这里的LE, GE都是“反”的，比如: LE --> sgt
-unordered_map<int, string> binary_op_map={
+const unordered_map<int, string> binary_op_map={
   {KOOPA_RBO_NOT_EQ, "snez"},
   {KOOPA_RBO_EQ, "seqz"},
   {KOOPA_RBO_LT, "slt"},
@@ -27,31 +39,90 @@ unordered_map<int, string> binary_op_map={
   {KOOPA_RBO_OR, "or"},
 };
 
-static deque <string> nums; 
+// 比较与条件跳转合并: koopa 的比较 --> (条件成立时跳转的指令, 条件不成立时跳转的指令)
+const unordered_map<int, pair<string, string>> branch_op_map={
+  {KOOPA_RBO_EQ, {"beq", "bne"}},
+  {KOOPA_RBO_NOT_EQ, {"bne", "beq"}},
+  {KOOPA_RBO_LT, {"blt", "bge"}},
+  {KOOPA_RBO_GE, {"bge", "blt"}},
+  {KOOPA_RBO_GT, {"bgt", "ble"}},
+  {KOOPA_RBO_LE, {"ble", "bgt"}},
+};
+
 const deque<string> tmp_regs=\
 {"t0", "t1", "t2", "t3", "t4", "t5", "t6", };
 const deque<string> param_regs=\
 {"a0", "a1", "a2", "a3", "a4", "a5", "a6", "a7",};
+const deque<string> saved_regs=\
+{"s0", "s1", "s2", "s3", "s4", "s5", "s6", "s7", "s8", "s9", "s10", "s11",};
 const int num_regs=tmp_regs.size();
-unordered_map<string, int> reg_used; // 记录临时寄存器是否被使用过，1表示被使用过，0表示没被使用过
+
+// SysY 运行时库中的函数, 只通过参数读写数组, 不读写程序中的全局变量
+const unordered_set<string> runtime_funcs={
+  "getint", "getch", "getarray", "putint", "putch", "putarray", "starttime", "stoptime",
+};
+
+// 一个函数 (包括它直接或间接调用的函数) 读写的全局变量; unknown 表示不知道, 要当作读写了所有全局变量
+struct GlobalEffects {
+  unordered_set<koopa_raw_value_t> ref, mod;
+  bool unknown = false;
+};
+
+// 一次目标代码生成中用到的全部状态，每次生成各自持有一个，可以在多个线程中同时生成
+struct BackendContext {
+  deque <string> nums;
+  unordered_map<string, int> reg_used; // 记录临时寄存器是否被使用过，1表示被使用过，0表示没被使用过
 
 /********************************lv4 start**********************************/
 
-static unordered_map<koopa_raw_value_t, int> loc; // 有返回值的语句在栈中的位置
-static int stack_frame_length = 0; // 栈帧长度
-static int stack_frame_used = 0; // 已经使用的栈帧长度
+  unordered_map<koopa_raw_value_t, int> loc; // 有返回值的语句在栈中的位置
+  unordered_map<koopa_raw_value_t, string> home; // 放在寄存器中、不占栈空间的值及其所在的寄存器
+  unordered_set<string> home_regs; // 被 home 占用的寄存器, 不再作为临时寄存器分配
+  unordered_map<koopa_raw_value_t, vector<string>> call_saves; // 调用前后要保存的调用者保存的寄存器
+  unordered_map<string, int> save_slot; // 保存寄存器的栈上位置
+  vector<string> callee_saved; // 用到的被调用者保存的寄存器, 在序言中保存, 返回前恢复
+  vector<koopa_raw_value_t> promoted; // 提升到寄存器中的全局变量, 在入口处读入
+  unordered_set<koopa_raw_value_t> promoted_dirty; // 其中函数会写的, 返回前和被调用者用到之前写回
+  unordered_map<koopa_raw_basic_block_t, int> loop_depth; // 当前函数各基本块的循环层数, 每个函数求一次
+  int stack_frame_length = 0; // 栈帧长度
+  int stack_frame_used = 0; // 已经使用的栈帧长度
 
-static int saved_ra = 0; // 当前正在访问的函数有没有保存ra
+  int saved_ra = 0; // 当前正在访问的函数有没有保存ra
 
 /*********************************lv4 end***********************************/
 
+  ostream &out; // 汇编代码的输出位置
+  BackendOptions opts; // 生成代码的选项
+  string func_name; // 当前函数名, 用作基本块标签的前缀
+  koopa_raw_basic_block_t bb = nullptr; // 当前基本块
+  koopa_raw_value_t inst = nullptr; // 正在生成的指令, 其余有返回值的指令在用到时从栈上取出
+  koopa_raw_basic_block_t next_bb = nullptr; // 排在当前基本块之后的基本块, 跳到它时不用跳转指令
+
+  // 条件跳转只能跳到 ±4KiB 以内, 超出范围时改用跳板
+  unordered_set<koopa_raw_basic_block_t> far_branches; // 末尾的条件跳转要用跳板的基本块
+  vector<tuple<koopa_raw_basic_block_t, long, string>> cond_branches; // (所在基本块, 在输出中的位置, 目标标签)
+
+  FunctionCost *cost = nullptr; // 当前函数的统计
+  vector<pair<koopa_raw_basic_block_t, long>> block_starts; // 各基本块的汇编在输出中的起始位置
+
+  const FunctionProfile *profile = nullptr; // 当前函数的计数 (-fprofile-use)
+  const unordered_map<koopa_raw_function_t, GlobalEffects> *effects = nullptr; // 各函数读写的全局变量
+  const unordered_map<koopa_raw_function_t, string> *memoizable = nullptr; // 递归函数不能加记忆表的原因 (-fauto-memoize)
+  vector<Remark> remarks; // 当前函数的优化报告, 生成完所有函数后按顺序汇总
+
+  explicit BackendContext(ostream &out) : out(out) {}
+};
+
+// 当前线程正在使用的后端上下文
+static thread_local BackendContext *ctx = nullptr;
+
 // 返回没被使用过的第一个寄存器
 inline string get_reg()
 {
   for(int i=0; i<num_regs; i++)
-    if(reg_used[tmp_regs[i]] == 0)
+    if(ctx->reg_used[tmp_regs[i]] == 0)
     {
-      reg_used[tmp_regs[i]] = 1;
+      ctx->reg_used[tmp_regs[i]] = 1;
       return tmp_regs[i];
     }
   assert(false);
@@ -59,59 +130,78 @@ inline string get_reg()
 
 inline void free_reg()
 {
-  string reg = nums.back();
-  nums.pop_back();
-  reg_used[reg] = 0;
+  string reg = ctx->nums.back();
+  ctx->nums.pop_back();
+  if(!ctx->home_regs.count(reg)) ctx->reg_used[reg] = 0;
+}
+
+// 以 sp 为基址读写栈上 offset 处的字, 偏移量放得进 12 位立即数时直接写在指令中
+inline void stack_access(const string &op, const string &reg, int offset) {
+  if(offset < 2048) {
+    ctx->out<<"  "<<op<<" "<<reg<<", "<<offset<<"(sp)"<<endl;
+    return;
+  }
+  string tmp_reg=get_reg();
+  ctx->out<<"  li "<<tmp_reg<<", "<<offset<<endl;
+  ctx->out<<"  add "<<tmp_reg<<", "<<tmp_reg<<", sp"<<endl;
+  ctx->out<<"  "<<op<<" "<<reg<<", 0("<<tmp_reg<<")"<<endl;
+  ctx->reg_used[tmp_reg] = 0;
+}
+
+// 读写全局变量 global: lui 取高 20 位, 低 12 位放在 lw/sw 的立即数中
+inline void global_access(const string &op, const string &reg, const koopa_raw_value_t &global) {
+  string tmp_reg=get_reg();
+  ctx->out<<"  lui "<<tmp_reg<<", %hi("<<global->name+1<<")"<<endl;
+  ctx->out<<"  "<<op<<" "<<reg<<", %lo("<<global->name+1<<")("<<tmp_reg<<")"<<endl;
+  ctx->reg_used[tmp_reg] = 0;
 }
 
 // 将reg中的值存到value所在的位置
 inline void save_reg(const koopa_raw_value_t &value, const std::string &reg) {
+  auto it = ctx->home.find(value);
+  if(it != ctx->home.end()) {
+    if(it->second != reg) ctx->out<<"  mv "<<it->second<<", "<<reg<<endl;
+    return;
+  }
   if(value->kind.tag == KOOPA_RVT_GLOBAL_ALLOC)
   {
-    string tmp_reg=get_reg();
-    cout<<"  lui "<<tmp_reg<<", %hi("<<value->name+1<<")"<<endl;
-    cout<<"  sw "<<reg<<", %lo("<<value->name+1<<")("<<tmp_reg<<")"<<endl;
-    reg_used[tmp_reg] = 0;
+    global_access("sw", reg, value);
     return;
   }
-  string tmp_reg=get_reg();
-  cout<<"  li "<<tmp_reg<<", "<<loc[value]<<endl;
-  cout<<"  add "<<tmp_reg<<", "<<tmp_reg<<", sp"<<endl;
-  cout<<"  sw "<<reg<<", 0("<<tmp_reg<<")"<<endl;
-  reg_used[tmp_reg] = 0;
+  // 存到 alloc 分配的局部变量是程序本身的写操作, 其余都是把中间结果存到栈上
+  if(ctx->cost && value->kind.tag != KOOPA_RVT_ALLOC) ctx->cost->spills++;
+  stack_access("sw", reg, ctx->loc[value]);
 }
 
 inline void load_reg(const koopa_raw_value_t &value, const std::string &reg) {
-  // cout<<"value->kind.tag="<<value->kind.tag<<endl;
   if (value->kind.tag == KOOPA_RVT_FUNC_ARG_REF) {
     const auto& index = value->kind.data.func_arg_ref.index;
-    cout<<"index="<<index<<endl;
     if (index < param_regs.size()) {
-      std::cout << "  mv " << reg << ", a" << index << std::endl;
-    }
-    else {
-      string tmp_reg=get_reg();
-      std::cout << "  li " << tmp_reg << ", " << stack_frame_length + (index - 8) * 4 << std::endl;
-      std::cout << "  add " << tmp_reg << ", " << tmp_reg << ", sp" << std::endl;
-      std::cout << "  lw " << reg << ", 0(" << tmp_reg << ")" << std::endl;
-      reg_used[tmp_reg] = 0;
+      ctx->out << "  mv " << reg << ", a" << index << std::endl;
     }
+    else stack_access("lw", reg, ctx->stack_frame_length + (index - 8) * 4);
+  } else if(ctx->home.count(value)) {
+    // 包括提升到寄存器中的全局变量
+    if(ctx->home[value] != reg) ctx->out<<"  mv "<<reg<<", "<<ctx->home[value]<<endl;
   } else if(value->kind.tag == KOOPA_RVT_GLOBAL_ALLOC) {
-    // lui     a1, %hi(x)
-    // lw      a0, %lo(x)(a1)
-    string tmp_reg=get_reg();
-    cout<<"  lui "<<tmp_reg<<", %hi("<<value->name+1<<")"<<endl;
-    cout<<"  lw "<<reg<<", %lo("<<value->name+1<<")("<<tmp_reg<<")"<<endl;
-    reg_used[tmp_reg] = 0;
-    // std::cout << "  la " << reg << ", " << value->name+1 << std::endl;
-    // cout<<"  lw "<<reg<<", 0("<<reg<<")"<<endl;
+    global_access("lw", reg, value);
   } else{
-    string tmp_reg=get_reg();
-    cout<<"  li "<<tmp_reg<<", "<<loc[value]<<endl;
-    cout<<"  add "<<tmp_reg<<", "<<tmp_reg<<", sp"<<endl;
-    cout<<"  lw "<<reg<<", 0("<<tmp_reg<<")"<<endl;
-    reg_used[tmp_reg] = 0;
+    if(ctx->cost && value->kind.tag != KOOPA_RVT_ALLOC) ctx->cost->reloads++;
+    stack_access("lw", reg, ctx->loc[value]);
+  }
+}
+
+// 把已经存到栈上的 value 取到一个新的寄存器中; 放在寄存器中的值直接用它所在的寄存器
+inline void load_value(const koopa_raw_value_t &value)
+{
+  auto it = ctx->home.find(value);
+  if(it != ctx->home.end()) {
+    ctx->nums.push_back(it->second);
+    return;
   }
+  string target_reg = get_reg();
+  load_reg(value, target_reg); // 把变量的值放到寄存器里
+  ctx->nums.push_back(target_reg);
 }
 
 // 给定riscv的运算符（op），以及koopaIR的两个操作数（lhs, rhs），生成对应的汇编代码
@@ -120,30 +210,885 @@ inline void binary_two_operands(koopa_raw_value_t lhs, koopa_raw_value_t rhs, st
   
   Visit(lhs);
   Visit(rhs);
-  string target_reg = get_reg();
-  cout<<"  "<<op<<" "<<target_reg<<", "<<nums[nums.size()-2]<<", "<<nums.back()<<endl;
+  // 结果放在寄存器中时直接算到那个寄存器里
+  string target_reg = ctx->home.count(value) ? ctx->home[value] : get_reg();
+  ctx->out<<"  "<<op<<" "<<target_reg<<", "<<ctx->nums[ctx->nums.size()-2]<<", "<<ctx->nums.back()<<endl;
   free_reg();
   free_reg();
-  nums.push_back(target_reg);
+  ctx->nums.push_back(target_reg);
 
-  loc[value] = stack_frame_used;
-  stack_frame_used += 4;
   save_reg(value, target_reg);
   free_reg();
 }
 
 
 
+// value 是否是只用作基本块 bb 末尾条件跳转的条件的比较
+// 这样的比较不单独生成, 由条件跳转直接比较两个操作数; 操作数都是不会再变的值, 推迟到跳转时再取也一样
+static bool fused_compare(const koopa_raw_value_t &value, const koopa_raw_basic_block_t &bb) {
+  if(value->kind.tag != KOOPA_RVT_BINARY || !branch_op_map.count(value->kind.data.binary.op)) return false;
+  if(value->used_by.len != 1 || bb->insts.len == 0) return false;
+  auto last = reinterpret_cast<koopa_raw_value_t>(bb->insts.buffer[bb->insts.len - 1]);
+  return last == value->used_by.buffer[0] && last->kind.tag == KOOPA_RVT_BRANCH;
+}
+
+// 类型占用的字节数
+static int type_size(const koopa_raw_type_t &ty) {
+  if(ty->tag == KOOPA_RTT_ARRAY) return ty->data.array.len * type_size(ty->data.array.base);
+  return ty->tag == KOOPA_RTT_UNIT ? 0 : 4;
+}
+
+// 能放在寄存器中的局部变量: i32 和指针
+static bool scalar_alloc(const koopa_raw_value_t &value) {
+  auto base = value->ty->data.pointer.base;
+  return base->tag == KOOPA_RTT_INT32 || base->tag == KOOPA_RTT_POINTER;
+}
+
+// getelemptr 和 getptr 都是 "基址 + 下标 * 步长", 只是步长不同
+static bool is_address(const koopa_raw_value_t &value) {
+  return value->kind.tag == KOOPA_RVT_GET_ELEM_PTR || value->kind.tag == KOOPA_RVT_GET_PTR;
+}
+
+// 地址计算的 (基址, 下标)
+static pair<koopa_raw_value_t, koopa_raw_value_t> address_operands(const koopa_raw_value_t &value) {
+  if(value->kind.tag == KOOPA_RVT_GET_PTR) return {value->kind.data.get_ptr.src, value->kind.data.get_ptr.index};
+  return {value->kind.data.get_elem_ptr.src, value->kind.data.get_elem_ptr.index};
+}
+
+// 下标每加一, 地址增加的字节数: getptr 跨过整个所指的对象, getelemptr 跨过数组的一个元素
+static int index_stride(const koopa_raw_value_t &value) {
+  auto base = address_operands(value).first->ty->data.pointer.base;
+  return type_size(value->kind.tag == KOOPA_RVT_GET_PTR ? base : base->data.array.base);
+}
+
+// 下标是常数、只用来读写内存或者计算别的这样的地址的 getelemptr/getptr 不单独生成,
+// 常数偏移量合并到读写内存的指令的 12 位立即数中
+static bool folded_address(const koopa_raw_value_t &value) {
+  if(!is_address(value) || address_operands(value).second->kind.tag != KOOPA_RVT_INTEGER) return false;
+  if(value->used_by.len == 0) return false;
+  for(size_t i = 0; i < value->used_by.len; i++) {
+    auto user = reinterpret_cast<koopa_raw_value_t>(value->used_by.buffer[i]);
+    if(user->kind.tag == KOOPA_RVT_LOAD) continue;
+    if(user->kind.tag == KOOPA_RVT_STORE && user->kind.data.store.value != value) continue;
+    if(is_address(user) && address_operands(user).first == value && folded_address(user)) continue;
+    return false;
+  }
+  return true;
+}
+
+// 把 base 加上常数 offset 放到 target 中
+static void add_offset(const string &target, const string &base, int offset) {
+  if(offset >= -2048 && offset < 2048) {
+    if(offset) ctx->out<<"  addi "<<target<<", "<<base<<", "<<offset<<endl;
+    else if(target != base) ctx->out<<"  mv "<<target<<", "<<base<<endl;
+    return;
+  }
+  string tmp_reg = get_reg();
+  ctx->out<<"  li "<<tmp_reg<<", "<<offset<<endl;
+  ctx->out<<"  add "<<target<<", "<<base<<", "<<tmp_reg<<endl;
+  ctx->reg_used[tmp_reg] = 0;
+}
+
+// 沿着合并掉的地址计算找到基址, 累加常数偏移量
+static koopa_raw_value_t address_base(koopa_raw_value_t ptr, int &offset) {
+  offset = 0;
+  while(folded_address(ptr)) {
+    auto ops = address_operands(ptr);
+    offset += ops.second->kind.data.integer.value * index_stride(ptr);
+    ptr = ops.first;
+  }
+  return ptr;
+}
+
+// 全局变量的符号加上偏移量, 如 x+8
+static string symbol_offset(const koopa_raw_value_t &global, int offset) {
+  string symbol = global->name+1;
+  if(offset > 0) return symbol + "+" + to_string(offset);
+  return offset ? symbol + to_string(offset) : symbol;
+}
+
+// 地址 ptr 对应的访存操作数, 如 "8(sp)"、"%lo(x+8)(t1)"; 占用的临时寄存器放在 tmp 中, 访存之后由调用者释放
+static string memory_operand(const koopa_raw_value_t &ptr, string &tmp) {
+  int offset;
+  auto base = address_base(ptr, offset);
+  tmp.clear();
+  if(base->kind.tag == KOOPA_RVT_GLOBAL_ALLOC) {
+    tmp = get_reg();
+    ctx->out<<"  lui "<<tmp<<", %hi("<<symbol_offset(base, offset)<<")"<<endl;
+    return "%lo(" + symbol_offset(base, offset) + ")(" + tmp + ")";
+  }
+  string base_reg = "sp";
+  if(base->kind.tag == KOOPA_RVT_ALLOC) offset += ctx->loc[base];
+  else {
+    // 基址是算出来的指针
+    load_value(base);
+    base_reg = ctx->nums.back();
+    ctx->nums.pop_back();
+    if(!ctx->home_regs.count(base_reg)) tmp = base_reg;
+  }
+  if(offset >= -2048 && offset < 2048) return to_string(offset) + "(" + base_reg + ")";
+  string reg = tmp.empty() ? get_reg() : tmp;
+  add_offset(reg, base_reg, offset);
+  tmp = reg;
+  return "0(" + reg + ")";
+}
+
+// 基本块的汇编标签: 各个函数的基本块编号都从头开始, 所以要加上函数名区分
+// 以 .L 开头的标签不会和源程序中的符号重名, 也不会出现在目标文件的符号表中
+static string bb_label(const koopa_raw_basic_block_t &bb, const string &prefix = "") {
+  return ".L" + ctx->func_name + "." + prefix + (bb->name+1);
+}
+
+// 基本块的后继
+static vector<koopa_raw_basic_block_t> successors(const koopa_raw_basic_block_t &bb) {
+  if(bb->insts.len == 0) return {};
+  auto last = reinterpret_cast<koopa_raw_value_t>(bb->insts.buffer[bb->insts.len - 1]);
+  if(last->kind.tag == KOOPA_RVT_BRANCH)
+    return {last->kind.data.branch.true_bb, last->kind.data.branch.false_bb};
+  if(last->kind.tag == KOOPA_RVT_JUMP) return {last->kind.data.jump.target};
+  return {};
+}
+
+// 记一条后端的优化报告, 位置取基本块 bb 对应的源代码位置
+static void remark(Remark::Kind kind, const string &pass, const string &name, const koopa_raw_basic_block_t &bb,
+                   const string &message) {
+  if(!ctx->opts.remarks) return;
+  auto loc = ctx->opts.remarks->BlockLocation(ctx->func_name, bb->name+1);
+  ctx->remarks.push_back(Remark{kind, pass, name, ctx->func_name, loc.first, loc.second, message});
+}
+
+// 函数中的计数点: (计数器标号的后缀, 计数点的名字), 按基本块的顺序, 每个基本块之后是它的真分支
+// 真分支的计数器放在跳板 TO_目标块 上, 跳板只从这一条分支进入
+static vector<pair<string, string>> profile_points(const koopa_raw_function_t &func) {
+  vector<pair<string, string>> points;
+  for(size_t i = 0; i < func->bbs.len; i++) {
+    auto bb = reinterpret_cast<koopa_raw_basic_block_t>(func->bbs.buffer[i]);
+    points.emplace_back(bb->name+1, bb->name+1);
+    if(bb->insts.len == 0) continue;
+    auto last = reinterpret_cast<koopa_raw_value_t>(bb->insts.buffer[bb->insts.len - 1]);
+    if(last->kind.tag == KOOPA_RVT_BRANCH) {
+      string target = last->kind.data.branch.true_bb->name+1;
+      points.emplace_back("TO_" + target, profile_edge(bb->name+1, target));
+    }
+  }
+  return points;
+}
+
+// 把标号后缀为 label 的计数器加一, 计数器都在 .data 段, 由 Visit(program) 在所有函数之后给出
+static void count_point(const string &label) {
+  string addr = get_reg(), value = get_reg();
+  string symbol = ".Lprof." + ctx->func_name + "." + label;
+  ctx->out << "  lui " << addr << ", %hi(" << symbol << ")" << endl;
+  ctx->out << "  lw " << value << ", %lo(" << symbol << ")(" << addr << ")" << endl;
+  ctx->out << "  addi " << value << ", " << value << ", 1" << endl;
+  ctx->out << "  sw " << value << ", %lo(" << symbol << ")(" << addr << ")" << endl;
+  ctx->reg_used[addr] = 0;
+  ctx->reg_used[value] = 0;
+}
+
+// 函数 func 的计数; 没有计数, 或者计数点与函数对不上 (计数之后程序改过了) 时返回 nullptr
+static const FunctionProfile *function_profile(const koopa_raw_function_t &func) {
+  if(!ctx->opts.profile || func->bbs.len == 0) return nullptr;
+  auto profile = ctx->opts.profile->Function(func->name+1);
+  if(!profile) return nullptr;
+  auto points = profile_points(func);
+  bool match = points.size() == profile->counts.size();
+  for(auto &point : points) match = match && profile->counts.count(point.second);
+  if(match) return profile;
+  remark(Remark::Missed, "pgo", "ProfileMismatch", reinterpret_cast<koopa_raw_basic_block_t>(func->bbs.buffer[0]),
+         "profile of function " + ctx->func_name + " does not match its current code and is ignored");
+  return nullptr;
+}
+
+// 输出所有计数器和计数器表 .Lprof_table: 计数器个数 n, 然后是 n 对 (计数器的地址, 计数点的名字)
+// 名字为 "函数名 计数点", 运行时库的 __sysy_profile_dump 按表逐行输出
+static void emit_profile_table(const koopa_raw_program_t &program) {
+  vector<pair<string, string>> entries; // (计数器的标号, 名字)
+  for(size_t i = 0; i < program.funcs.len; i++) {
+    auto func = reinterpret_cast<koopa_raw_function_t>(program.funcs.buffer[i]);
+    if(func->bbs.len == 0) continue;
+    for(auto &point : profile_points(func))
+      entries.emplace_back(string(".Lprof.") + (func->name+1) + "." + point.first,
+                           string(func->name+1) + " " + point.second);
+  }
+  ctx->out << "  .data" << endl;
+  for(auto &entry : entries) ctx->out << entry.first << ":" << endl << "  .word 0" << endl;
+  ctx->out << ".Lprof_table:" << endl << "  .word " << entries.size() << endl;
+  for(size_t i = 0; i < entries.size(); i++)
+    ctx->out << "  .word " << entries[i].first << ", .Lprof_name." << i << endl;
+  for(size_t i = 0; i < entries.size(); i++)
+    ctx->out << ".Lprof_name." << i << ":" << endl << "  .asciz \"" << entries[i].second << "\"" << endl;
+  ctx->out << endl;
+}
+
+// 每个基本块所在循环的嵌套层数
+// 目标支配源的边是回边, 每条回边对应一个自然循环,
+// 一个基本块的层数就是包含它的自然循环的个数 (同一个循环头的多条回边算一个循环)
+// 从入口到不了的基本块 (如 return 之后的代码) 也要生成, 支配树从入口和没有前驱的基本块出发
+static unordered_map<koopa_raw_basic_block_t, int> loop_depths(const koopa_raw_function_t &func) {
+  size_t n = func->bbs.len;
+  vector<koopa_raw_basic_block_t> bbs(n);
+  unordered_map<koopa_raw_basic_block_t, size_t> index;
+  for(size_t i = 0; i < n; i++) {
+    bbs[i] = reinterpret_cast<koopa_raw_basic_block_t>(func->bbs.buffer[i]);
+    index[bbs[i]] = i;
+  }
+  vector<vector<uint32_t>> succ(n);
+  vector<vector<size_t>> pred(n);
+  for(size_t i = 0; i < n; i++)
+    for(auto &s : successors(bbs[i])) {
+      succ[i].push_back(index[s]);
+      pred[index[s]].push_back(i);
+    }
+  vector<uint32_t> roots;
+  for(size_t i = 0; i < n; i++)
+    if(!i || pred[i].empty()) roots.push_back(i);
+  DominatorTree dom(succ, roots);
+
+  unordered_map<koopa_raw_basic_block_t, int> depth;
+  for(size_t i = 0; i < n; i++) depth[bbs[i]] = 0;
+  unordered_map<size_t, unordered_set<size_t>> loops; // 循环头 -> 循环中的基本块
+  for(size_t i = 0; i < n; i++)
+    for(size_t h : succ[i]) {
+      if(!dom.Dominates(h, i)) continue;
+      auto &body = loops[h];
+      body.insert(h);
+      vector<size_t> work;
+      if(body.insert(i).second) work.push_back(i);
+      while(!work.empty()) {
+        size_t b = work.back();
+        work.pop_back();
+        for(size_t p : pred[b])
+          if(body.insert(p).second) work.push_back(p);
+      }
+    }
+
+  for(auto &loop : loops)
+    for(size_t b : loop.second) depth[bbs[b]]++;
+  return depth;
+}
+
+// 基本块的排列顺序, 让常走的边尽量成为顺序执行 (fallthrough), 不需要跳转
+// 边的权重: 有计数时为边的执行次数; 否则源块按 10^循环层数 估计执行次数, 条件跳转的两条边各占一半,
+// 但离开循环的边 (目标的循环层数更小) 只占 1/8
+// 按权重从大到小处理每条边 u->v, u 是所在链的末尾且 v 是另一条链的开头时把两条链接起来 (Pettis-Hansen);
+// 权重相同时先处理无条件跳转的边: 条件跳转的边没接上时另一条边还可以顺序执行, 无条件跳转的边没接上就一定要跳;
+// 再先处理回边 (IR 中循环头在循环体之前, 所以目标不在源之后的边就是回边), 使循环的判断紧接着循环体
+// 最后从入口所在的链开始, 每次接上与已排好的基本块之间边的权重最大的链, 都没有边相连时按 IR 中的顺序
+static vector<koopa_raw_basic_block_t> block_layout(const koopa_raw_function_t &func,
+                                                    const unordered_map<koopa_raw_basic_block_t, int> &depth) {
+  size_t n = func->bbs.len;
+  vector<koopa_raw_basic_block_t> bbs(n);
+  unordered_map<koopa_raw_basic_block_t, size_t> index;
+  for(size_t i = 0; i < n; i++) {
+    bbs[i] = reinterpret_cast<koopa_raw_basic_block_t>(func->bbs.buffer[i]);
+    index[bbs[i]] = i;
+  }
+
+  struct Edge {
+    size_t from, to;
+    double weight;
+    bool jump; // 源块以无条件跳转结束
+  };
+  vector<Edge> edges;
+  for(size_t i = 0; i < n; i++) {
+    auto succ = successors(bbs[i]);
+    if(succ.size() == 1) {
+      long long count = profile_count(ctx->profile, bbs[i]->name+1);
+      edges.push_back({i, index[succ[0]], count >= 0 ? double(count) : pow(10.0, depth.at(bbs[i])), true});
+    }
+    else if(succ.size() == 2) {
+      double weight[2];
+      long long total = profile_count(ctx->profile, bbs[i]->name+1);
+      long long taken = profile_count(ctx->profile, profile_edge(bbs[i]->name+1, succ[0]->name+1));
+      if(total >= 0 && taken >= 0) {
+        weight[0] = taken;
+        weight[1] = max(0LL, total - taken);
+      }
+      else {
+        double freq = pow(10.0, depth.at(bbs[i]));
+        bool exit0 = depth.at(succ[0]) < depth.at(bbs[i]), exit1 = depth.at(succ[1]) < depth.at(bbs[i]);
+        double p0 = exit0 == exit1 ? 0.5 : exit0 ? 0.125 : 0.875;
+        weight[0] = freq * p0;
+        weight[1] = freq * (1 - p0);
+      }
+      for(int k = 0; k < 2; k++) edges.push_back({i, index[succ[k]], weight[k], false});
+    }
+  }
+  stable_sort(edges.begin(), edges.end(), [](const Edge &a, const Edge &b) {
+    if(a.weight != b.weight) return a.weight > b.weight;
+    if(a.jump != b.jump) return a.jump;
+    return (a.to <= a.from) > (b.to <= b.from);
+  });
+
+  vector<size_t> chain_of(n);
+  vector<vector<size_t>> chains(n);
+  for(size_t i = 0; i < n; i++) {
+    chain_of[i] = i;
+    chains[i] = {i};
+  }
+  for(auto &e : edges) {
+    size_t cu = chain_of[e.from], cv = chain_of[e.to];
+    if(cu == cv || e.to == 0 || chains[cu].back() != e.from || chains[cv].front() != e.to) continue;
+    for(size_t b : chains[cv]) {
+      chains[cu].push_back(b);
+      chain_of[b] = cu;
+    }
+    chains[cv].clear();
+  }
+
+  vector<koopa_raw_basic_block_t> order;
+  vector<bool> placed(n, false);
+  for(size_t next = n ? chain_of[0] : 0; order.size() < n;) {
+    for(size_t b : chains[next]) {
+      order.push_back(bbs[b]);
+      placed[b] = true;
+    }
+    // 与已排好的基本块相连的权重最大的链, 权重相同时取 IR 中靠前的
+    vector<double> link(n, -1);
+    for(auto &e : edges)
+      if(placed[e.from] && !placed[e.to]) link[chain_of[e.to]] = max(link[chain_of[e.to]], e.weight);
+    next = n;
+    for(size_t c = 0; c < n; c++) {
+      if(chains[c].empty() || placed[chains[c].front()]) continue;
+      if(next == n || link[c] > link[next]) next = c;
+    }
+    if(next == n) break;
+  }
+  return order;
+}
+
+// 是否是 i32 的全局变量
+static bool scalar_global(const koopa_raw_value_t &value) {
+  return value->kind.tag == KOOPA_RVT_GLOBAL_ALLOC && value->ty->data.pointer.base->tag == KOOPA_RTT_INT32;
+}
+
+// 在调用图上求出每个函数读写的全局变量: 先收集各函数直接读写的, 再沿调用边传给调用者直到不再变化
+// whole_program 为假时 (按函数增量编译) 其余函数的函数体可能会变, 调用运行时库以外的函数都当作 unknown
+static unordered_map<koopa_raw_function_t, GlobalEffects> global_effects(const koopa_raw_program_t &program,
+                                                                         bool whole_program) {
+  unordered_map<koopa_raw_function_t, GlobalEffects> effects;
+  vector<pair<koopa_raw_function_t, koopa_raw_function_t>> calls; // (调用者, 被调用者)
+  for(size_t i = 0; i < program.funcs.len; i++) {
+    auto func = reinterpret_cast<koopa_raw_function_t>(program.funcs.buffer[i]);
+    auto &e = effects[func];
+    if(!runtime_funcs.count(func->name+1) && (!whole_program || !func->bbs.len)) {
+      e.unknown = true;
+      continue;
+    }
+    for(size_t j = 0; j < func->bbs.len; j++) {
+      auto bb = reinterpret_cast<koopa_raw_basic_block_t>(func->bbs.buffer[j]);
+      for(size_t k = 0; k < bb->insts.len; k++) {
+        auto inst = reinterpret_cast<koopa_raw_value_t>(bb->insts.buffer[k]);
+        if(inst->kind.tag == KOOPA_RVT_LOAD && scalar_global(inst->kind.data.load.src))
+          e.ref.insert(inst->kind.data.load.src);
+        else if(inst->kind.tag == KOOPA_RVT_STORE && scalar_global(inst->kind.data.store.dest))
+          e.mod.insert(inst->kind.data.store.dest);
+        else if(inst->kind.tag == KOOPA_RVT_CALL)
+          calls.emplace_back(func, inst->kind.data.call.callee);
+      }
+    }
+  }
+  for(bool changed = true; changed;) {
+    changed = false;
+    for(auto &call : calls) {
+      auto &caller = effects[call.first];
+      const auto &callee = effects[call.second];
+      size_t size = caller.ref.size() + caller.mod.size();
+      bool unknown = caller.unknown;
+      caller.unknown |= callee.unknown;
+      caller.ref.insert(callee.ref.begin(), callee.ref.end());
+      caller.mod.insert(callee.mod.begin(), callee.mod.end());
+      changed |= caller.unknown != unknown || caller.ref.size() + caller.mod.size() != size;
+    }
+  }
+  return effects;
+}
+
+// 优化报告中全局变量的名字: 前端给全局作用域中的名字加上了前缀 "Block_0_" (见 ast.hpp), 去掉它得到源程序中的名字
+static string source_name(const koopa_raw_value_t &global) {
+  string name = global->name+1;
+  const string prefix = "Block_0_";
+  return name.compare(0, prefix.size(), prefix) == 0 ? name.substr(prefix.size()) : name;
+}
+
+// 选出函数中提升到寄存器中的全局变量: 在入口处读到寄存器里, 函数中的读写都只用寄存器,
+// 可能读写它的调用之前写回、可能写它的调用之后重新读入, 函数写过它时返回前写回
+// 按 10 的循环层数次方加权, 读写的次数多于这些同步的次数时才提升; dirty 中是函数写过的全局变量
+static vector<koopa_raw_value_t> promoted_globals(const koopa_raw_function_t &func,
+                                                  const unordered_map<koopa_raw_basic_block_t, int> &depth,
+                                                  unordered_set<koopa_raw_value_t> &dirty) {
+  auto weight = [&depth](const koopa_raw_basic_block_t &bb) {
+    long long w = 1;
+    for(int d = min(depth.at(bb), 6); d > 0; d--) w *= 10;
+    return w;
+  };
+  vector<koopa_raw_value_t> globals; // 按第一次读写的顺序
+  unordered_map<koopa_raw_value_t, long long> benefit;
+  vector<pair<koopa_raw_function_t, long long>> calls;
+  long long exits = 0;
+  for(size_t i = 0; i < func->bbs.len; i++) {
+    auto bb = reinterpret_cast<koopa_raw_basic_block_t>(func->bbs.buffer[i]);
+    for(size_t j = 0; j < bb->insts.len; j++) {
+      auto inst = reinterpret_cast<koopa_raw_value_t>(bb->insts.buffer[j]);
+      koopa_raw_value_t global = nullptr;
+      if(inst->kind.tag == KOOPA_RVT_LOAD) global = inst->kind.data.load.src;
+      else if(inst->kind.tag == KOOPA_RVT_STORE) {
+        global = inst->kind.data.store.dest;
+        if(scalar_global(global)) dirty.insert(global);
+      }
+      else if(inst->kind.tag == KOOPA_RVT_CALL) calls.emplace_back(inst->kind.data.call.callee, weight(bb));
+      else if(inst->kind.tag == KOOPA_RVT_RETURN) exits += weight(bb);
+      if(!global || !scalar_global(global)) continue;
+      if(!benefit.count(global)) globals.push_back(global);
+      benefit[global] += weight(bb);
+    }
+  }
+  auto entry = reinterpret_cast<koopa_raw_basic_block_t>(func->bbs.buffer[0]);
+  vector<koopa_raw_value_t> promoted;
+  for(auto &global : globals) {
+    long long cost = 1 + (dirty.count(global) ? exits : 0), observed = 0;
+    for(auto &call : calls) {
+      const auto &e = ctx->effects->at(call.first);
+      bool mod = e.unknown || e.mod.count(global), ref = mod || e.ref.count(global);
+      if(ref && dirty.count(global)) cost += call.second;
+      if(mod) cost += call.second;
+      if(ref) observed++;
+    }
+    if(benefit[global] > cost) promoted.push_back(global);
+    else if(observed)
+      remark(Remark::Missed, "promote", "GlobalObservedByCall", entry,
+             "global variable " + source_name(global) + " is not kept in a register because " +
+             to_string(observed) + (observed == 1 ? " call may" : " calls may") + " read or write it");
+  }
+  for(auto it = dirty.begin(); it != dirty.end();)
+    it = find(promoted.begin(), promoted.end(), *it) == promoted.end() ? dirty.erase(it) : next(it);
+  return promoted;
+}
+
+// 地址最终指向的对象: 局部变量或数组 (alloc)、全局变量, 或者从参数得到的指针
+static koopa_raw_value_t address_root(koopa_raw_value_t ptr) {
+  while(ptr->kind.tag == KOOPA_RVT_GET_PTR || ptr->kind.tag == KOOPA_RVT_GET_ELEM_PTR) ptr = address_operands(ptr).first;
+  return ptr;
+}
+
+// 找出可以加记忆表的函数 (-fauto-memoize): 直接或间接调用自己、参数和返回值都是 i32 (参数不超过 8 个),
+// 并且是纯的: 只写局部变量和局部数组, 读的全局变量在整个程序中都没被写过 (也没传给其他函数),
+// 调用的函数也都是纯的 (运行时库的函数都有输入输出)
+// 返回每个这样的递归函数不是纯的原因, 可以加记忆表时为空串
+static unordered_map<koopa_raw_function_t, string> memoizable_functions(const koopa_raw_program_t &program) {
+  unordered_map<koopa_raw_function_t, vector<koopa_raw_function_t>> callees;
+  unordered_set<koopa_raw_value_t> written; // 可能被写的全局变量
+  for(size_t i = 0; i < program.funcs.len; i++) {
+    auto func = reinterpret_cast<koopa_raw_function_t>(program.funcs.buffer[i]);
+    for(size_t j = 0; j < func->bbs.len; j++) {
+      auto bb = reinterpret_cast<koopa_raw_basic_block_t>(func->bbs.buffer[j]);
+      for(size_t k = 0; k < bb->insts.len; k++) {
+        auto inst = reinterpret_cast<koopa_raw_value_t>(bb->insts.buffer[k]);
+        if(inst->kind.tag == KOOPA_RVT_STORE) written.insert(address_root(inst->kind.data.store.dest));
+        if(inst->kind.tag != KOOPA_RVT_CALL) continue;
+        callees[func].push_back(inst->kind.data.call.callee);
+        for(size_t a = 0; a < inst->kind.data.call.args.len; a++)
+          written.insert(address_root(reinterpret_cast<koopa_raw_value_t>(inst->kind.data.call.args.buffer[a])));
+      }
+    }
+  }
+  // 只看参数和返回值都是 i32 的函数
+  unordered_map<koopa_raw_function_t, string> reason;
+  for(size_t i = 0; i < program.funcs.len; i++) {
+    auto func = reinterpret_cast<koopa_raw_function_t>(program.funcs.buffer[i]);
+    auto ty = func->ty->data.function;
+    bool scalar = func->bbs.len && ty.ret->tag == KOOPA_RTT_INT32 && ty.params.len && ty.params.len <= param_regs.size();
+    for(size_t j = 0; scalar && j < ty.params.len; j++)
+      scalar = reinterpret_cast<koopa_raw_type_t>(ty.params.buffer[j])->tag == KOOPA_RTT_INT32;
+    if(!scalar) continue;
+    string &why = reason[func];
+    for(size_t j = 0; j < func->bbs.len && why.empty(); j++) {
+      auto bb = reinterpret_cast<koopa_raw_basic_block_t>(func->bbs.buffer[j]);
+      for(size_t k = 0; k < bb->insts.len && why.empty(); k++) {
+        auto inst = reinterpret_cast<koopa_raw_value_t>(bb->insts.buffer[k]);
+        koopa_raw_value_t root = nullptr;
+        if(inst->kind.tag == KOOPA_RVT_STORE) {
+          root = address_root(inst->kind.data.store.dest);
+          if(root->kind.tag != KOOPA_RVT_ALLOC) why = "writes global variable " + source_name(root);
+        }
+        else if(inst->kind.tag == KOOPA_RVT_LOAD) {
+          root = address_root(inst->kind.data.load.src);
+          if(root->kind.tag == KOOPA_RVT_GLOBAL_ALLOC && written.count(root))
+            why = "reads global variable " + source_name(root) + ", which is modified";
+        }
+      }
+    }
+  }
+  // 调用的函数不是纯的, 这个函数也不是; 直到不再变化
+  for(bool changed = true; changed;) {
+    changed = false;
+    for(auto &r : reason) {
+      if(!r.second.empty()) continue;
+      for(auto &callee : callees[r.first]) {
+        auto it = reason.find(callee);
+        if(it == reason.end() || !it->second.empty()) {
+          r.second = string("calls ") + (callee->name+1) + (it == reason.end() ? "" : ", which is not pure");
+          changed = true;
+          break;
+        }
+      }
+    }
+  }
+  // 只保留递归的函数
+  unordered_map<koopa_raw_function_t, string> recursive;
+  for(auto &r : reason) {
+    unordered_set<koopa_raw_function_t> seen;
+    vector<koopa_raw_function_t> stack(callees[r.first]);
+    bool found = false;
+    while(!stack.empty() && !found) {
+      auto func = stack.back();
+      stack.pop_back();
+      found = func == r.first;
+      if(!seen.insert(func).second) continue;
+      for(auto &callee : callees[func]) stack.push_back(callee);
+    }
+    if(found) recursive.insert(r);
+  }
+  return recursive;
+}
+
+// 给函数加上直接映射的记忆表, 在函数的标号处先查表, 函数体放在 .L函数名.memo_body 处
+// 表 .Lmemo.函数名 在 .bss 段中, 共 opts.memoize 项, 每项依次是有效位、各个参数和返回值, 项长取 2 的幂
+// 参数的散列值决定用哪一项, 参数都相同时直接返回记下的值; 否则调用函数体, 返回后把参数和返回值记到这一项中
+// 此时参数都还在 a 寄存器中, 只用 t0-t2
+static void emit_memo_table(const koopa_raw_function_t &func) {
+  int params = func->params.len, entries = ctx->opts.memoize, stride = 4;
+  while(stride < (params + 2) * 4) stride <<= 1;
+  string table = ".Lmemo." + ctx->func_name, miss = ".L" + ctx->func_name + ".memo_miss";
+  ctx->out << "  .bss" << endl << "  .align 2" << endl << table << ":" << endl
+           << "  .zero " << entries * stride << endl;
+  ctx->out << "  .text" << endl;
+  ctx->out << "  .globl " << ctx->func_name << endl;
+  ctx->out << ctx->func_name << ":" << endl;
+  // 散列值: 依次乘 31 加上各个参数, 再把高 16 位混到低位
+  ctx->out << "  mv t1, a0" << endl;
+  for(int i = 1; i < params; i++)
+    ctx->out << "  slli t2, t1, 5" << endl << "  sub t1, t2, t1" << endl << "  add t1, t1, a" << i << endl;
+  ctx->out << "  srli t2, t1, 16" << endl << "  xor t1, t1, t2" << endl;
+  if(entries - 1 < 2048) ctx->out << "  andi t1, t1, " << entries - 1 << endl;
+  else ctx->out << "  li t2, " << entries - 1 << endl << "  and t1, t1, t2" << endl;
+  ctx->out << "  slli t1, t1, " << __builtin_ctz(stride) << endl;
+  ctx->out << "  lui t0, %hi(" << table << ")" << endl << "  addi t0, t0, %lo(" << table << ")" << endl
+           << "  add t0, t0, t1" << endl;
+  ctx->out << "  lw t1, 0(t0)" << endl << "  beqz t1, " << miss << endl;
+  for(int i = 0; i < params; i++)
+    ctx->out << "  lw t1, " << (i + 1) * 4 << "(t0)" << endl << "  bne t1, a" << i << ", " << miss << endl;
+  ctx->out << "  lw a0, " << (params + 1) * 4 << "(t0)" << endl << "  ret" << endl;
+  // 没查到: 保存 ra、表项的地址和参数, 调用函数体
+  int frame = ((params + 2) * 4 + 15) & ~15;
+  ctx->out << miss << ":" << endl << "  addi sp, sp, -" << frame << endl;
+  ctx->out << "  sw ra, " << frame - 4 << "(sp)" << endl << "  sw t0, " << frame - 8 << "(sp)" << endl;
+  for(int i = 0; i < params; i++) ctx->out << "  sw a" << i << ", " << i * 4 << "(sp)" << endl;
+  ctx->out << "  call .L" << ctx->func_name << ".memo_body" << endl;
+  ctx->out << "  lw t0, " << frame - 8 << "(sp)" << endl;
+  for(int i = 0; i < params; i++)
+    ctx->out << "  lw t1, " << i * 4 << "(sp)" << endl << "  sw t1, " << (i + 1) * 4 << "(t0)" << endl;
+  ctx->out << "  sw a0, " << (params + 1) * 4 << "(t0)" << endl;
+  ctx->out << "  li t1, 1" << endl << "  sw t1, 0(t0)" << endl;
+  ctx->out << "  lw ra, " << frame - 4 << "(sp)" << endl << "  addi sp, sp, " << frame << endl << "  ret" << endl;
+  ctx->out << ".L" << ctx->func_name << ".memo_body:" << endl;
+}
+
+// 叶子函数 (不调用其他函数) 可以放值的寄存器: 没有用来传参的 a 寄存器, 以及 t4-t6
+// t0-t3 留作生成指令时的临时寄存器, 一条指令同时用到的临时寄存器不超过 4 个
+static vector<string> leaf_registers(const koopa_raw_function_t &func) {
+  vector<string> regs;
+  for(size_t i = func->params.len; i < param_regs.size(); i++) regs.push_back(param_regs[i]);
+  for(int i = 4; i < num_regs; i++) regs.push_back(tmp_regs[i]);
+  return regs;
+}
+
+// 用线性扫描把函数中有返回值的指令分配到寄存器里, 分配不到的留给调用者放在栈上
+// caller 是调用者保存的寄存器, callee 是被调用者保存的寄存器 (由函数的序言和尾声保存)
+// 局部变量 (alloc) 在整个函数中都活跃; 其余的值只在所在基本块中用到时, 活跃区间是从定义到最后一次使用,
+// 跨基本块用到的值保守地认为在整个函数中都活跃
+// 跨过调用的值优先放在 callee 中, 其余的值优先放在 caller 中; 都没有空闲的寄存器时让出结束得最晚的那个
+// 跨过调用、又放在 caller 中的值只在这些调用前后存到栈上再取回, 记在 call_saves 中 (call -> 寄存器)
+// 一条指令的操作数和结果可以共用寄存器: 操作数都取出之后才写结果
+// 读局部变量的 load 在结果用完之前变量都没被改写时, 直接用变量所在的寄存器
+// globals 是提升到寄存器中的全局变量, 和局部变量一样在整个函数中都活跃; 读它的 load 之后还不能有调用
+// leaf 为真时 (a 寄存器不会被调用改写), 只用来初始化一个局部变量的参数让这个变量留在传参的寄存器中
+static unordered_map<koopa_raw_value_t, string> assign_registers(
+    const koopa_raw_function_t &func, const vector<koopa_raw_value_t> &globals, const vector<string> &caller,
+    const vector<string> &callee, bool leaf, unordered_map<koopa_raw_value_t, vector<string>> &call_saves) {
+  unordered_map<koopa_raw_value_t, string> home;
+  for(size_t i = 0; leaf && i < func->params.len && i < param_regs.size(); i++) {
+    auto param = reinterpret_cast<koopa_raw_value_t>(func->params.buffer[i]);
+    if(param->used_by.len != 1) continue;
+    auto user = reinterpret_cast<koopa_raw_value_t>(param->used_by.buffer[0]);
+    if(user->kind.tag != KOOPA_RVT_STORE || user->kind.data.store.dest->kind.tag != KOOPA_RVT_ALLOC) continue;
+    auto var = user->kind.data.store.dest;
+    if(scalar_alloc(var) && !home.count(var)) home[var] = param_regs[i];
+  }
+  vector<pair<koopa_raw_value_t, koopa_raw_value_t>> aliases; // (load, 局部变量)
+  // 按 IR 中的顺序给指令编号
+  unordered_map<koopa_raw_value_t, pair<int, koopa_raw_basic_block_t>> index;
+  vector<pair<int, koopa_raw_value_t>> calls;
+  int count = 0;
+  for(size_t i = 0; i < func->bbs.len; i++) {
+    auto bb = reinterpret_cast<koopa_raw_basic_block_t>(func->bbs.buffer[i]);
+    for(size_t j = 0; j < bb->insts.len; j++) {
+      auto inst = reinterpret_cast<koopa_raw_value_t>(bb->insts.buffer[j]);
+      if(inst->kind.tag == KOOPA_RVT_CALL) calls.emplace_back(count, inst);
+      index[inst] = {count++, bb};
+    }
+  }
+  // 活跃区间 (开始, 结束, 值)
+  vector<tuple<int, int, koopa_raw_value_t>> intervals;
+  for(auto &global : globals) intervals.emplace_back(-1, count, global);
+  for(size_t i = 0; i < func->bbs.len; i++) {
+    auto bb = reinterpret_cast<koopa_raw_basic_block_t>(func->bbs.buffer[i]);
+    for(size_t j = 0; j < bb->insts.len; j++) {
+      auto inst = reinterpret_cast<koopa_raw_value_t>(bb->insts.buffer[j]);
+      if(inst->ty->tag == KOOPA_RTT_UNIT || fused_compare(inst, bb) || folded_address(inst) || home.count(inst))
+        continue;
+      int start = index[inst].first, end = start;
+      if(inst->kind.tag == KOOPA_RVT_ALLOC) {
+        // 数组放在栈上
+        if(!scalar_alloc(inst)) continue;
+        start = -1;
+        end = count;
+      }
+      // 合并掉的地址计算在读写内存处才用到基址
+      vector<koopa_raw_value_t> users;
+      for(size_t k = 0; k < inst->used_by.len; k++) users.push_back(reinterpret_cast<koopa_raw_value_t>(inst->used_by.buffer[k]));
+      for(size_t k = 0; k < users.size() && end < count; k++) {
+        auto user = users[k];
+        if(folded_address(user)) {
+          for(size_t u = 0; u < user->used_by.len; u++)
+            users.push_back(reinterpret_cast<koopa_raw_value_t>(user->used_by.buffer[u]));
+          continue;
+        }
+        auto it = index.find(user);
+        if(it == index.end() || it->second.second != bb) end = count;
+        // 合并到条件跳转中的比较在跳转处才取操作数
+        else if(fused_compare(user, bb)) end = max(end, int(bb->insts.len) - 1 + index[inst].first - int(j));
+        else end = max(end, it->second.first);
+      }
+      if(inst->kind.tag == KOOPA_RVT_LOAD && end < count &&
+         (inst->kind.data.load.src->kind.tag == KOOPA_RVT_ALLOC ||
+          find(globals.begin(), globals.end(), inst->kind.data.load.src) != globals.end())) {
+        auto var = inst->kind.data.load.src;
+        bool global = var->kind.tag == KOOPA_RVT_GLOBAL_ALLOC, stored = false;
+        for(int k = j + 1; k <= int(j) + end - start && !stored; k++) {
+          auto next = reinterpret_cast<koopa_raw_value_t>(bb->insts.buffer[k]);
+          stored = (next->kind.tag == KOOPA_RVT_STORE && next->kind.data.store.dest == var) ||
+                   (global && next->kind.tag == KOOPA_RVT_CALL);
+        }
+        if(!stored) {
+          aliases.emplace_back(inst, var);
+          continue;
+        }
+      }
+      intervals.emplace_back(start, end, inst);
+    }
+  }
+  sort(intervals.begin(), intervals.end(),
+       [](const tuple<int, int, koopa_raw_value_t> &a, const tuple<int, int, koopa_raw_value_t> &b) {
+         return get<0>(a) != get<0>(b) ? get<0>(a) < get<0>(b) : get<1>(a) > get<1>(b);
+       });
+  // 区间 (start, end) 中是否有调用; 调用的操作数在调用前取出, 结果在调用后写入, 都不算跨过调用
+  auto first_call_after = [&calls](int start) {
+    return upper_bound(calls.begin(), calls.end(), start,
+                       [](int i, const pair<int, koopa_raw_value_t> &call) { return i < call.first; });
+  };
+  unordered_set<string> callee_set(callee.begin(), callee.end());
+  vector<tuple<int, string, koopa_raw_value_t>> active; // (结束, 寄存器, 值)
+  vector<string> free_caller(caller.rbegin(), caller.rend()), free_callee(callee.rbegin(), callee.rend());
+  for(auto &interval : intervals) {
+    for(size_t k = 0; k < active.size();) {
+      if(get<0>(active[k]) <= get<0>(interval)) {
+        (callee_set.count(get<1>(active[k])) ? free_callee : free_caller).push_back(get<1>(active[k]));
+        active.erase(active.begin() + k);
+      }
+      else k++;
+    }
+    auto next_call = first_call_after(get<0>(interval));
+    bool across = next_call != calls.end() && next_call->first < get<1>(interval);
+    vector<string> *prefer = across ? &free_callee : &free_caller, *other = across ? &free_caller : &free_callee;
+    if(prefer->empty()) prefer = other;
+    if(prefer->empty()) {
+      auto last = max_element(active.begin(), active.end());
+      if(last == active.end() || get<0>(*last) <= get<1>(interval)) continue;
+      home.erase(get<2>(*last));
+      prefer->push_back(get<1>(*last));
+      active.erase(last);
+    }
+    home[get<2>(interval)] = prefer->back();
+    active.emplace_back(get<1>(interval), prefer->back(), get<2>(interval));
+    prefer->pop_back();
+  }
+  // 放在 caller 中的值在跨过的每个调用前后保存
+  for(auto &interval : intervals) {
+    auto it = home.find(get<2>(interval));
+    if(it == home.end() || callee_set.count(it->second)) continue;
+    for(auto call = first_call_after(get<0>(interval)); call != calls.end() && call->first < get<1>(interval); call++)
+      call_saves[call->second].push_back(it->second);
+  }
+  // 变量不在寄存器中时, 读出的值放在栈上
+  for(auto &alias : aliases)
+    if(home.count(alias.second)) home[alias.first] = home[alias.second];
+  return home;
+}
+
+// 一行汇编的字节数, 伪指令按展开后的长度计算, 标签和伪操作为 0
+static int instruction_bytes(const string &line) {
+  istringstream in(line);
+  string op, dst, src;
+  in >> op;
+  if(op.empty() || op[0] == '.' || op.back() == ':') return 0;
+  if(op == "li") {
+    in >> dst >> src;
+    long long value = strtoll(src.c_str(), nullptr, 0);
+    return value < -2048 || value >= 2048 ? 8 : 4;
+  }
+  if(op == "la" || op == "call" || op == "tail") return 8;
+  return 4;
+}
+
+// 检查函数的汇编 code 中的条件跳转是否都能跳到目标, 跳不到的所在基本块加入 ctx->far_branches
+// 返回是否有新加入的基本块, 有时需要重新生成这个函数
+static bool relax_branches(const string &code) {
+  unordered_map<string, long> label_addr;
+  unordered_map<long, long> line_addr; // 行在 code 中的位置 -> 地址
+  long addr = 0;
+  for(size_t pos = 0; pos < code.size();) {
+    size_t end = code.find('\n', pos);
+    if(end == string::npos) end = code.size();
+    string line = code.substr(pos, end - pos);
+    line_addr[pos] = addr;
+    if(!line.empty() && line[0] != ' ' && line.back() == ':') label_addr[line.substr(0, line.size() - 1)] = addr;
+    addr += instruction_bytes(line);
+    pos = end + 1;
+  }
+  bool changed = false;
+  for(auto &branch : ctx->cond_branches) {
+    long offset = label_addr.at(get<2>(branch)) - line_addr.at(get<1>(branch));
+    if(offset < -4096 || offset > 4094) changed |= ctx->far_branches.insert(get<0>(branch)).second;
+  }
+  return changed;
+}
+
+// 按各基本块的起始位置切分函数的汇编 code, 统计到 ctx->cost 中
+static void account_function(const string &code) {
+  auto &starts = ctx->block_starts;
+  for(size_t i = 0; i < starts.size(); i++) {
+    // 第一个基本块之前是函数序言, 算在入口块中
+    long begin = i ? starts[i].second : 0;
+    long end = i + 1 < starts.size() ? starts[i + 1].second : code.size();
+    BlockCost block;
+    block.label = starts[i].first->name+1;
+    block.loop_depth = ctx->loop_depth.at(starts[i].first);
+    block.count = profile_count(ctx->profile, block.label);
+    account_block(code.substr(begin, end - begin), block, *ctx->cost);
+    ctx->cost->blocks.push_back(block);
+  }
+}
+
+// 分别生成每个函数的汇编, 没有函数体的函数对应空串
+// 函数之间只通过事先求出的全局变量读写关系相互影响, 每个函数用全新的上下文生成到各自的缓冲区, 最后按源码顺序拼接,
+// 所以无论是否并行、用几个线程, 输出都完全相同; whole_program 为假时只生成了其中一部分函数, 见 global_effects
+// ctx->opts.costs 非空时把每个有函数体的函数的统计按顺序追加到其中
+static vector<string> generate_functions(const koopa_raw_program_t &program, bool whole_program) {
+  auto effects = global_effects(program, whole_program);
+  unordered_map<koopa_raw_function_t, string> memoizable;
+  if(ctx->opts.memoize) memoizable = memoizable_functions(program);
+  vector<string> funcs(program.funcs.len);
+  vector<FunctionCost> func_costs(ctx->opts.costs ? program.funcs.len : 0);
+  vector<vector<Remark>> func_remarks(program.funcs.len);
+  const BackendOptions &opts = ctx->opts;
+  auto generate = [&funcs, &program, &func_costs, &func_remarks, &opts, &effects, &memoizable](size_t i) {
+    BackendContext *saved = ctx;
+    auto func = reinterpret_cast<koopa_raw_function_t>(program.funcs.buffer[i]);
+    // 有条件跳转跳不到目标时, 让它改用跳板后重新生成整个函数; 跳板只会让代码变长, 所以最终会停下来
+    unordered_set<koopa_raw_basic_block_t> far_branches;
+    for(bool done = false; !done;) {
+      ostringstream buffer;
+      BackendContext backend(buffer);
+      backend.opts = opts;
+      backend.far_branches = far_branches;
+      backend.effects = &effects;
+      if(opts.memoize) backend.memoizable = &memoizable;
+      ctx = &backend;
+      for(int j=0; j<num_regs; j++) ctx->reg_used[tmp_regs[j]] = 0;
+      if(!func_costs.empty()) {
+        func_costs[i] = FunctionCost();
+        ctx->cost = &func_costs[i];
+      }
+      ctx->func_name = func->name+1;
+      ctx->profile = function_profile(func);
+      Visit(func);
+      // 调度只在不移动的行之间重排, 各行的位置不变, 所以在检查跳转距离和统计代价之前做
+      string code = buffer.str();
+      if(opts.schedule) ScheduleFunction(code, *opts.schedule);
+      done = !relax_branches(code);
+      far_branches = ctx->far_branches;
+      if(!done) continue;
+      func_remarks[i] = std::move(ctx->remarks);
+      funcs[i] = std::move(code);
+      if(ctx->cost && func->bbs.len) {
+        ctx->cost->name = func->name+1;
+        ctx->cost->frame_size = ctx->stack_frame_length;
+        account_function(funcs[i]);
+      }
+    }
+    ctx = saved;
+  };
+  if(ctx->opts.pool) ctx->opts.pool->ParallelFor(funcs.size(), generate);
+  else for(size_t i = 0; i < funcs.size(); i++) generate(i);
+  for(size_t i = 0; i < func_costs.size(); i++)
+    if(reinterpret_cast<koopa_raw_function_t>(program.funcs.buffer[i])->bbs.len)
+      ctx->opts.costs->push_back(std::move(func_costs[i]));
+  if(ctx->opts.remarks)
+    for(auto &remarks : func_remarks)
+      for(auto &r : remarks) ctx->opts.remarks->Emit(std::move(r));
+  return funcs;
+}
+
 /***********************************main************************************/
+// 为 raw program 生成 RISC-V 汇编，写到 out
+void GenerateRiscv(const koopa_raw_program_t &program, ostream &out, const BackendOptions &opts) {
+  BackendContext backend(out);
+  backend.opts = opts;
+  ctx = &backend;
+  Visit(program);
+  ctx = nullptr;
+}
+
+void GenerateRiscvFragments(const koopa_raw_program_t &program, string &globals,
+                            vector<pair<string, string>> &funcs, const BackendOptions &opts) {
+  assert(!opts.instrument && !opts.memoize);
+  ostringstream out;
+  BackendContext backend(out);
+  backend.opts = opts;
+  ctx = &backend;
+  for(int i=0; i<num_regs; i++) ctx->reg_used[tmp_regs[i]] = 0;
+  Visit(program.values);
+  globals = out.str();
+  vector<string> code = generate_functions(program, false);
+  for(size_t i = 0; i < code.size(); i++) {
+    auto func = reinterpret_cast<koopa_raw_function_t>(program.funcs.buffer[i]);
+    if(func->bbs.len) funcs.emplace_back(func->name+1, code[i]);
+  }
+  ctx = nullptr;
+}
+
 // 访问 raw program
 void Visit(const koopa_raw_program_t &program) {
   // 执行一些其他的必要操作
   // ...
-  for(int i=0; i<num_regs; i++) reg_used[tmp_regs[i]] = 0;
+  for(int i=0; i<num_regs; i++) ctx->reg_used[tmp_regs[i]] = 0;
   // 访问所有全局变量
   Visit(program.values);
   // 访问所有函数
-  Visit(program.funcs);
+  for(auto &func : generate_functions(program, true)) ctx->out << func;
+  if(ctx->opts.instrument) emit_profile_table(program);
 }
 
 // 访问 raw slice
@@ -178,15 +1123,26 @@ void Visit(const koopa_raw_function_t &func) {
   // 访问所有基本块
   if(func->bbs.len == 0) return;
 
-  cout << "  .text" << endl;
-  cout << "  .globl " << func->name+1 << endl;
-  cout << func->name+1 << ":" << endl;
+  ctx->func_name = func->name+1;
+  auto memo = ctx->memoizable ? ctx->memoizable->find(func) : unordered_map<koopa_raw_function_t, string>::const_iterator();
+  if(ctx->memoizable && memo != ctx->memoizable->end() && memo->second.empty()) {
+    remark(Remark::Passed, "memoize", "Memoized", reinterpret_cast<koopa_raw_basic_block_t>(func->bbs.buffer[0]),
+           "recursive function " + ctx->func_name + " is memoized in a table of " + to_string(ctx->opts.memoize) +
+           " entries");
+    emit_memo_table(func);
+  }
+  else {
+    if(ctx->memoizable && memo != ctx->memoizable->end())
+      remark(Remark::Missed, "memoize", "NotPure", reinterpret_cast<koopa_raw_basic_block_t>(func->bbs.buffer[0]),
+             "recursive function " + ctx->func_name + " is not memoized because it " + memo->second);
+    ctx->out << "  .text" << endl;
+    ctx->out << "  .globl " << func->name+1 << endl;
+    ctx->out << func->name+1 << ":" << endl;
+  }
   // 清空
-  stack_frame_length = 0;
-  stack_frame_used = 0;
+  ctx->stack_frame_length = 0;
+  ctx->stack_frame_used = 0;
 
-  // 局部变量个数
-  int local_var = 0;
   // 是否需要为 ra 分配栈空间
   int return_addr = 0;
   // 需要为传参预留几个变量的栈空间
@@ -196,11 +1152,9 @@ void Visit(const koopa_raw_function_t &func) {
   for (size_t i = 0; i < func->bbs.len; ++i)
   {
     const auto& insts = reinterpret_cast<koopa_raw_basic_block_t>(func->bbs.buffer[i])->insts;
-    local_var += insts.len;
     for (size_t j = 0; j < insts.len; ++j)
     {
       auto inst = reinterpret_cast<koopa_raw_value_t>(insts.buffer[j]);
-      if(inst->ty->tag == KOOPA_RTT_UNIT) local_var--;
       if(inst->kind.tag == KOOPA_RVT_CALL)
       {
         return_addr = 1;
@@ -208,26 +1162,116 @@ void Visit(const koopa_raw_function_t &func) {
       }
     }
   }
-  stack_frame_length = (local_var + return_addr + arg_var) << 2;
-  stack_frame_length = (stack_frame_length + 15) & (~15);
-  stack_frame_used = arg_var<<2;
+  // 插桩时 main 返回前要调用 __sysy_profile_dump
+  if(ctx->opts.instrument && ctx->func_name == "main") return_addr = 1;
 
-  if (stack_frame_length > 0 && stack_frame_length < 2048)
-    cout << "  addi sp, sp, -" << stack_frame_length << endl;
-  else if (stack_frame_length >= 2048)
-    cout << "  li t0, -" << stack_frame_length << endl
-              << "  add sp, sp, t0" << endl;
+  // 值尽量放在寄存器中: 叶子函数先用没传参的 a 寄存器和 t4-t6, 其余函数中跨过调用的值用 s0-s11
+  // 插桩的 main 在返回前还要调用 __sysy_profile_dump, 不用调用者保存的寄存器
+  // 叶子函数不用保存 ra, 全部放得下、又没用到 s 寄存器时不需要栈帧
+  ctx->home.clear();
+  ctx->home_regs.clear();
+  ctx->call_saves.clear();
+  ctx->save_slot.clear();
+  ctx->callee_saved.clear();
+  ctx->promoted_dirty.clear();
+  ctx->loop_depth = loop_depths(func);
+  ctx->promoted = promoted_globals(func, ctx->loop_depth, ctx->promoted_dirty);
+  vector<string> caller, callee(saved_regs.begin(), saved_regs.end());
+  if(!return_addr) caller = leaf_registers(func);
+  else if(!(ctx->opts.instrument && ctx->func_name == "main")) caller.assign(tmp_regs.begin() + 4, tmp_regs.end());
+  ctx->home = assign_registers(func, ctx->promoted, caller, callee, !return_addr, ctx->call_saves);
+  // 分不到寄存器的全局变量仍然每次读写内存
+  for(size_t i = 0; i < ctx->promoted.size();) {
+    auto global = ctx->promoted[i];
+    if(ctx->home.count(global)) {
+      remark(Remark::Passed, "promote", "GlobalPromoted", reinterpret_cast<koopa_raw_basic_block_t>(func->bbs.buffer[0]),
+             "global variable " + source_name(global) + " is kept in " + ctx->home[global] + " in this function");
+      i++;
+      continue;
+    }
+    ctx->promoted_dirty.erase(global);
+    ctx->promoted.erase(ctx->promoted.begin() + i);
+  }
+  for(auto &h : ctx->home) {
+    ctx->home_regs.insert(h.second);
+    ctx->reg_used[h.second] = 1;
+  }
+
+  // 按 IR 中的顺序预先给每条没放在寄存器中、有返回值的指令分配栈上的位置, 基本块按什么顺序生成都可以
+  ctx->stack_frame_used = arg_var<<2;
+  for (size_t i = 0; i < func->bbs.len; ++i)
+  {
+    auto bb = reinterpret_cast<koopa_raw_basic_block_t>(func->bbs.buffer[i]);
+    const auto& insts = bb->insts;
+    for (size_t j = 0; j < insts.len; ++j)
+    {
+      auto inst = reinterpret_cast<koopa_raw_value_t>(insts.buffer[j]);
+      if(inst->ty->tag == KOOPA_RTT_UNIT || fused_compare(inst, bb) || folded_address(inst) || ctx->home.count(inst))
+        continue;
+      ctx->loc[inst] = ctx->stack_frame_used;
+      // 局部数组按类型的大小分配
+      ctx->stack_frame_used += inst->kind.tag == KOOPA_RVT_ALLOC ? type_size(inst->ty->data.pointer.base) : 4;
+    }
+  }
+  // 局部变量个数
+  int local_var = (ctx->stack_frame_used>>2) - arg_var;
+  // 在调用前后保存的寄存器, 以及用到的 s 寄存器, 各占一个位置
+  for(auto &saves : ctx->call_saves)
+    for(auto &reg : saves.second)
+      if(!ctx->save_slot.count(reg)) ctx->save_slot[reg] = 0;
+  for(auto &reg : callee)
+    if(ctx->home_regs.count(reg)) {
+      ctx->callee_saved.push_back(reg);
+      ctx->save_slot[reg] = 0;
+    }
+  for(auto &reg : tmp_regs)
+    if(ctx->save_slot.count(reg)) {
+      ctx->save_slot[reg] = ctx->stack_frame_used;
+      ctx->stack_frame_used += 4;
+    }
+  for(auto &reg : ctx->callee_saved) {
+    ctx->save_slot[reg] = ctx->stack_frame_used;
+    ctx->stack_frame_used += 4;
+  }
+  ctx->stack_frame_length = ctx->stack_frame_used + (return_addr << 2);
+  ctx->stack_frame_length = (ctx->stack_frame_length + 15) & (~15);
 
-  if(return_addr&&stack_frame_length) {
-    std::cout << "  li t0, " << stack_frame_length - 4 << std::endl;
-    std::cout << "  add t0, t0, sp" << std::endl;
-    std::cout << "  sw ra, 0(t0)" << std::endl;
-    saved_ra = 1;
+  auto entry = reinterpret_cast<koopa_raw_basic_block_t>(func->bbs.buffer[0]);
+  if(!return_addr && ctx->stack_frame_length == 0)
+    remark(Remark::Passed, "leaf", "FrameEliminated", entry,
+           "leaf function keeps all " + to_string(ctx->home.size()) + " values in registers, no stack frame");
+  if(local_var)
+    remark(Remark::Missed, "regalloc", "Spill", entry,
+           to_string(local_var) + " of " + to_string(local_var + ctx->home.size()) +
+           " values do not fit in registers and are kept on the stack");
+  if(!ctx->call_saves.empty()) {
+    size_t saves = 0;
+    for(auto &call : ctx->call_saves) saves += call.second.size();
+    remark(Remark::Missed, "regalloc", "CallerSavedAcrossCall", entry,
+           to_string(saves) + " values live across calls are saved and restored around the calls "
+           "because the callee-saved registers are all in use");
   }
-  else saved_ra = 0;
 
+  if (ctx->stack_frame_length > 0 && ctx->stack_frame_length < 2048)
+    ctx->out << "  addi sp, sp, -" << ctx->stack_frame_length << endl;
+  else if (ctx->stack_frame_length >= 2048)
+    ctx->out << "  li t0, -" << ctx->stack_frame_length << endl
+              << "  add sp, sp, t0" << endl;
+
+  if(return_addr&&ctx->stack_frame_length) {
+    stack_access("sw", "ra", ctx->stack_frame_length - 4);
+    ctx->saved_ra = 1;
+  }
+  else ctx->saved_ra = 0;
+  for(auto &reg : ctx->callee_saved) stack_access("sw", reg, ctx->save_slot[reg]);
+  for(auto &global : ctx->promoted) global_access("lw", ctx->home[global], global);
 
-  Visit(func->bbs);
+  // 按排好的顺序生成各个基本块
+  auto order = block_layout(func, ctx->loop_depth);
+  for(size_t i = 0; i < order.size(); i++) {
+    ctx->next_bb = i + 1 < order.size() ? order[i + 1] : nullptr;
+    Visit(order[i]);
+  }
 }
 
 // 访问基本块
@@ -235,25 +1279,30 @@ void Visit(const koopa_raw_basic_block_t &bb) {
   // 执行一些其他的必要操作
   // ...
   // 访问所有指令
+  if(ctx->cost) ctx->block_starts.emplace_back(bb, ctx->out.tellp());
+  ctx->bb = bb;
   // 如果bb->name是entry，那么就不用输出标签
   if(strncmp(bb->name+1, "entry", 5))
-    std::cout << bb->name+1 << ":" << std::endl;
-  Visit(bb->insts);
+    ctx->out << bb_label(bb) << ":" << std::endl;
+  if(ctx->opts.instrument) count_point(bb->name+1);
+  for(size_t i = 0; i < bb->insts.len; i++) {
+    ctx->inst = reinterpret_cast<koopa_raw_value_t>(bb->insts.buffer[i]);
+    if(fused_compare(ctx->inst, bb)) continue; // 在条件跳转中生成
+    if(folded_address(ctx->inst)) continue; // 在读写内存的指令中生成
+    Visit(ctx->inst);
+  }
 }
 
 // 访问指令
 void Visit(const koopa_raw_value_t &value) {
   // 根据指令类型判断后续需要如何访问
-  if(loc.find(value) != loc.end())
+  // 作为操作数用到其他指令的结果时, 结果已经在栈上
+  if(value != ctx->inst && (ctx->loc.count(value) || ctx->home.count(value)))
   {
-    string target_reg = get_reg();
-    load_reg(value, target_reg); // 把变量的值放到寄存器里
-    nums.push_back(target_reg);
+    load_value(value);
     return;
   }
   const auto &kind = value->kind;
-  // cout<<"kind.tag="<<kind.tag<<": ";
-  // return ;
     switch (kind.tag) {
     case KOOPA_RVT_RETURN:
       // 访问 return 指令
@@ -268,9 +1317,7 @@ void Visit(const koopa_raw_value_t &value) {
       Visit(kind.data.binary, value);
       break;
     case KOOPA_RVT_ALLOC:
-      // 访问 alloc 指令
-      loc[value] = stack_frame_used;
-      stack_frame_used += 4;
+      // 访问 alloc 指令, 位置已经在 Visit(func) 中分配好了
       break;
     case KOOPA_RVT_LOAD:
       // 访问 load 指令
@@ -280,6 +1327,14 @@ void Visit(const koopa_raw_value_t &value) {
       // 访问 store 指令
       Visit(kind.data.store);
       break;
+    case KOOPA_RVT_GET_PTR:
+      // 访问 getptr 指令
+      Visit(kind.data.get_ptr, value);
+      break;
+    case KOOPA_RVT_GET_ELEM_PTR:
+      // 访问 getelemptr 指令
+      Visit(kind.data.get_elem_ptr, value);
+      break;
     case KOOPA_RVT_BRANCH:
       // 访问 branch 指令
       Visit(kind.data.branch);
@@ -299,52 +1354,52 @@ void Visit(const koopa_raw_value_t &value) {
     case KOOPA_RVT_FUNC_ARG_REF:
       // 访问 func arg ref 指令
       if(value->kind.data.func_arg_ref.index < 8)
-        nums.push_back(param_regs[value->kind.data.func_arg_ref.index]);
+        ctx->nums.push_back(param_regs[value->kind.data.func_arg_ref.index]);
       else
       {
         string tmp_reg = get_reg();
-        cout<<"  li "<<tmp_reg<<", "<<stack_frame_length + (value->kind.data.func_arg_ref.index - 8) * 4<<endl;
-        cout<<"  add "<<tmp_reg<<", "<<tmp_reg<<", sp"<<endl;
-        cout<<"  lw "<<tmp_reg<<", 0("<<tmp_reg<<")"<<endl;
-        nums.push_back(tmp_reg);
+        stack_access("lw", tmp_reg, ctx->stack_frame_length + (value->kind.data.func_arg_ref.index - 8) * 4);
+        ctx->nums.push_back(tmp_reg);
       }
       break;
     default:
-      // 其他类型暂时遇不到
-      cout<<"kind.tag="<<kind.tag<<endl;
-      assert(false);
+      // 其他类型暂时不支持, 只让这一次编译失败
+      throw("unsupported Koopa IR instruction, kind.tag=" + to_string(kind.tag));
   }
 }
 
 void Visit(const koopa_raw_return_t &ret) {
-  // 执行一些其他的必要操作
-  // ...
+  // 插桩时 main 返回前输出计数, 此时没有放在寄存器中的值
+  if(ctx->opts.instrument && ctx->func_name == "main") {
+    ctx->out<<"  lui a0, %hi(.Lprof_table)"<<endl;
+    ctx->out<<"  addi a0, a0, %lo(.Lprof_table)"<<endl;
+    ctx->out<<"  call __sysy_profile_dump"<<endl;
+  }
   
-  // 访问返回值
+  // 访问返回值; 提升到寄存器中的全局变量可能放在 a0 中, 在放入返回值之前写回
+  if(ret.value != nullptr) Visit(ret.value);
+  for(auto &global : ctx->promoted)
+    if(ctx->promoted_dirty.count(global)) global_access("sw", ctx->home[global], global);
   if(ret.value != nullptr)
   {
-    Visit(ret.value);
-    cout<<"  mv a0, "<<nums.back()<<endl;
+    if(ctx->nums.back() != "a0") ctx->out<<"  mv a0, "<<ctx->nums.back()<<endl;
     free_reg();
   }
 
-  // 恢复 ra
-  if (saved_ra) {
-    string tmp_reg = get_reg();
-    cout<<"  li "<<tmp_reg<<", "<<stack_frame_length - 4<<endl;
-    cout<<"  add "<<tmp_reg<<", "<<tmp_reg<<", sp"<<endl;
-    cout<<"  lw ra, 0("<<tmp_reg<<")"<<endl;
-    reg_used[tmp_reg] = 0;
-  }
+  // 恢复 s 寄存器和 ra
+  for(auto &reg : ctx->callee_saved) stack_access("lw", reg, ctx->save_slot[reg]);
+  if (ctx->saved_ra) stack_access("lw", "ra", ctx->stack_frame_length - 4);
 
   // 释放栈帧
-  string tmp_reg = get_reg();
-  if (stack_frame_length != 0) {
-    cout<<"  li "<<tmp_reg<<", "<<stack_frame_length<<endl;
-    cout<<"  add sp, sp, "<<tmp_reg<<endl;
+  if (ctx->stack_frame_length > 0 && ctx->stack_frame_length < 2048)
+    ctx->out<<"  addi sp, sp, "<<ctx->stack_frame_length<<endl;
+  else if (ctx->stack_frame_length >= 2048) {
+    string tmp_reg = get_reg();
+    ctx->out<<"  li "<<tmp_reg<<", "<<ctx->stack_frame_length<<endl;
+    ctx->out<<"  add sp, sp, "<<tmp_reg<<endl;
+    ctx->reg_used[tmp_reg] = 0;
   }
-  reg_used[tmp_reg] = 0;
-  cout<<"  ret\n";
+  ctx->out<<"  ret\n";
 }
 
 void Visit(const koopa_raw_integer_t &integer) {
@@ -353,12 +1408,12 @@ void Visit(const koopa_raw_integer_t &integer) {
   // 访问整数值
   if(integer.value == 0)
   {
-    nums.push_back("x0");
+    ctx->nums.push_back("x0");
     return;
   }
   string target_reg = get_reg();
-  cout<<"  li "<<target_reg<<", "<<integer.value<<endl;
-  nums.push_back(target_reg);
+  ctx->out<<"  li "<<target_reg<<", "<<integer.value<<endl;
+  ctx->nums.push_back(target_reg);
 }
 
 void Visit(const koopa_raw_binary_t &binary, const koopa_raw_value_t &value) {
@@ -369,22 +1424,22 @@ void Visit(const koopa_raw_binary_t &binary, const koopa_raw_value_t &value) {
   if(binary.op == KOOPA_RBO_NOT_EQ || binary.op == KOOPA_RBO_EQ)
   {
     binary_two_operands(binary.lhs, binary.rhs, "xor", value);
-    Visit(value);
-    cout<<"  "<<binary_op_map[binary.op]<<" "<<nums.back()<<", "<<nums.back()<<endl;
+    load_value(value);
+    ctx->out<<"  "<<binary_op_map.at(binary.op)<<" "<<ctx->nums.back()<<", "<<ctx->nums.back()<<endl;
   }
   else if(binary.op == KOOPA_RBO_LE || binary.op == KOOPA_RBO_GE)
   {
-    binary_two_operands(binary.lhs, binary.rhs, binary_op_map[binary.op], value);
-    Visit(value);
-    cout<<"  seqz "<<nums.back()<<", "<<nums.back()<<endl;
+    binary_two_operands(binary.lhs, binary.rhs, binary_op_map.at(binary.op), value);
+    load_value(value);
+    ctx->out<<"  seqz "<<ctx->nums.back()<<", "<<ctx->nums.back()<<endl;
   }
   else{
-    binary_two_operands(binary.lhs, binary.rhs, binary_op_map[binary.op], value);
-    Visit(value);
+    binary_two_operands(binary.lhs, binary.rhs, binary_op_map.at(binary.op), value);
+    load_value(value);
   }
   if(value->ty->tag != KOOPA_RTT_UNIT)
   {
-    save_reg(value, nums.back());
+    save_reg(value, ctx->nums.back());
     free_reg();
   }
 }
@@ -392,15 +1447,20 @@ void Visit(const koopa_raw_binary_t &binary, const koopa_raw_value_t &value) {
 void Visit(const koopa_raw_load_t &load, const koopa_raw_value_t &value) {
   // 执行一些其他的必要操作
   // ...
-  // 访问 load 指令
-  string target_reg = get_reg();
-  load_reg(load.src, target_reg);
-  nums.push_back(target_reg);
+  // 访问 load 指令, 结果放在寄存器中时直接取到那个寄存器里
+  string target_reg = ctx->home.count(value) ? ctx->home[value] : get_reg();
+  if(load.src->kind.tag == KOOPA_RVT_ALLOC || load.src->kind.tag == KOOPA_RVT_GLOBAL_ALLOC)
+    load_reg(load.src, target_reg);
+  else {
+    // 通过算出来的地址读
+    string tmp_reg, mem = memory_operand(load.src, tmp_reg);
+    ctx->out<<"  lw "<<target_reg<<", "<<mem<<endl;
+    if(!tmp_reg.empty()) ctx->reg_used[tmp_reg] = 0;
+  }
+  ctx->nums.push_back(target_reg);
 
   if(value->ty->tag != KOOPA_RTT_UNIT)
   {
-    loc[value] = stack_frame_used;
-    stack_frame_used += 4;
     save_reg(value, target_reg);
     free_reg();
   }
@@ -410,73 +1470,224 @@ void Visit(const koopa_raw_store_t &store) {
   // 执行一些其他的必要操作
   // ...
   // 访问 store 指令
+  if(store.value->kind.tag == KOOPA_RVT_INTEGER && ctx->home.count(store.dest) &&
+     (store.dest->kind.tag == KOOPA_RVT_ALLOC || store.dest->kind.tag == KOOPA_RVT_GLOBAL_ALLOC)) {
+    ctx->out<<"  li "<<ctx->home[store.dest]<<", "<<store.value->kind.data.integer.value<<endl;
+    return;
+  }
   Visit(store.value);
-  save_reg(store.dest, nums.back());
+  if(store.dest->kind.tag == KOOPA_RVT_ALLOC || store.dest->kind.tag == KOOPA_RVT_GLOBAL_ALLOC)
+    save_reg(store.dest, ctx->nums.back());
+  else {
+    // 通过算出来的地址写
+    string tmp_reg, mem = memory_operand(store.dest, tmp_reg);
+    ctx->out<<"  sw "<<ctx->nums.back()<<", "<<mem<<endl;
+    if(!tmp_reg.empty()) ctx->reg_used[tmp_reg] = 0;
+  }
+  free_reg();
+}
+
+// 算出 getelemptr/getptr 的地址: 基址加上下标乘以步长, 步长是 2 的幂时用移位
+static void address_arithmetic(const koopa_raw_value_t &value) {
+  auto index = address_operands(value).second;
+  int stride = index_stride(value);
+  // 先算下标, 结果可能和下标共用寄存器
+  string scaled;
+  int offset = 0;
+  if(index->kind.tag == KOOPA_RVT_INTEGER) offset = index->kind.data.integer.value * stride;
+  else {
+    Visit(index);
+    scaled = get_reg();
+    if((stride & (stride - 1)) == 0) {
+      int shift = 0;
+      while((1 << shift) < stride) shift++;
+      ctx->out<<"  slli "<<scaled<<", "<<ctx->nums.back()<<", "<<shift<<endl;
+    }
+    else {
+      ctx->out<<"  li "<<scaled<<", "<<stride<<endl;
+      ctx->out<<"  mul "<<scaled<<", "<<ctx->nums.back()<<", "<<scaled<<endl;
+    }
+    free_reg();
+  }
+  string target_reg = ctx->home.count(value) ? ctx->home[value] : get_reg();
+  int base_offset;
+  auto base = address_base(address_operands(value).first, base_offset);
+  offset += base_offset;
+  if(base->kind.tag == KOOPA_RVT_GLOBAL_ALLOC) {
+    ctx->out<<"  lui "<<target_reg<<", %hi("<<symbol_offset(base, offset)<<")"<<endl;
+    ctx->out<<"  addi "<<target_reg<<", "<<target_reg<<", %lo("<<symbol_offset(base, offset)<<")"<<endl;
+  }
+  else if(base->kind.tag == KOOPA_RVT_ALLOC) add_offset(target_reg, "sp", ctx->loc[base] + offset);
+  else {
+    load_value(base);
+    if(!scaled.empty() && offset == 0) {
+      // 没有常数偏移量时直接把基址和下标加起来
+      ctx->out<<"  add "<<target_reg<<", "<<ctx->nums.back()<<", "<<scaled<<endl;
+      ctx->reg_used[scaled] = 0;
+      scaled.clear();
+    }
+    else add_offset(target_reg, ctx->nums.back(), offset);
+    free_reg();
+  }
+  if(!scaled.empty()) {
+    ctx->out<<"  add "<<target_reg<<", "<<target_reg<<", "<<scaled<<endl;
+    ctx->reg_used[scaled] = 0;
+  }
+  ctx->nums.push_back(target_reg);
+  save_reg(value, target_reg);
   free_reg();
 }
 
+void Visit(const koopa_raw_get_ptr_t &get_ptr, const koopa_raw_value_t &value) {
+  // 访问 getptr 指令
+  address_arithmetic(value);
+}
+
+void Visit(const koopa_raw_get_elem_ptr_t &get_elem_ptr, const koopa_raw_value_t &value) {
+  // 访问 getelemptr 指令
+  address_arithmetic(value);
+}
+
 void Visit(const koopa_raw_branch_t &branch) {
   // 执行一些其他的必要操作
   // ...
   // 访问 branch 指令
-  Visit(branch.cond);
-  
-  // 此处不直接跳转至true_bb，因为bnez的跳转距离有限，但是j的跳转距离非常大
-  // 所以先跳转到TO_true_bb，这里有且仅有“j true_bb"，再跳转到true_bb
-  cout<<"  bnez "<<nums.back()<<", TO_"<<branch.true_bb->name+1<<endl;
-  free_reg();
-  cout<<"  j "<<branch.false_bb->name+1<<endl;
-  cout<<"TO_"<<branch.true_bb->name+1<<":"<<endl;
-  cout<<"  j "<<branch.true_bb->name+1<<endl;
+  // 条件成立和不成立时跳转的指令, 以及它们的操作数
+  string op = "bnez", inverse = "beqz", cond;
+  if(fused_compare(branch.cond, ctx->bb)) {
+    // 条件是只在这里用到的比较, 直接比较两个操作数
+    const auto &binary = branch.cond->kind.data.binary;
+    Visit(binary.lhs);
+    Visit(binary.rhs);
+    tie(op, inverse) = branch_op_map.at(binary.op);
+    cond = ctx->nums[ctx->nums.size()-2] + ", " + ctx->nums.back();
+    free_reg();
+    free_reg();
+  }
+  else {
+    Visit(branch.cond);
+    cond = ctx->nums.back();
+    free_reg();
+  }
+
+  if(ctx->opts.instrument || ctx->far_branches.count(ctx->bb)) {
+    // 条件跳转的距离有限 (±4KiB)，但是j的跳转距离非常大
+    // 所以先跳转到TO_true_bb，这里有且仅有“j true_bb"，再跳转到true_bb
+    // 插桩时真分支的计数器也放在这个跳板上
+    ctx->out<<"  "<<op<<" "<<cond<<", "<<bb_label(branch.true_bb, "TO_")<<endl;
+    ctx->out<<"  j "<<bb_label(branch.false_bb)<<endl;
+    ctx->out<<bb_label(branch.true_bb, "TO_")<<":"<<endl;
+    if(ctx->opts.instrument) count_point(string("TO_") + (branch.true_bb->name+1));
+    ctx->out<<"  j "<<bb_label(branch.true_bb)<<endl;
+    if(!ctx->opts.instrument)
+      remark(Remark::Missed, "branch-relax", "BranchOutOfRange", ctx->bb,
+             "conditional branch to " + string(branch.true_bb->name+1) + " or " + (branch.false_bb->name+1) +
+             " is out of range, using a trampoline");
+  }
+  else if(branch.true_bb == branch.false_bb) {
+    if(branch.true_bb != ctx->next_bb) ctx->out<<"  j "<<bb_label(branch.true_bb)<<endl;
+  }
+  else if(branch.true_bb == ctx->next_bb) {
+    // 真分支紧跟在后面, 条件取反跳到假分支
+    ctx->cond_branches.emplace_back(ctx->bb, ctx->out.tellp(), bb_label(branch.false_bb));
+    ctx->out<<"  "<<inverse<<" "<<cond<<", "<<bb_label(branch.false_bb)<<endl;
+  }
+  else {
+    ctx->cond_branches.emplace_back(ctx->bb, ctx->out.tellp(), bb_label(branch.true_bb));
+    ctx->out<<"  "<<op<<" "<<cond<<", "<<bb_label(branch.true_bb)<<endl;
+    if(branch.false_bb != ctx->next_bb) ctx->out<<"  j "<<bb_label(branch.false_bb)<<endl;
+  }
+
+  // 按计数报告分支的走向
+  long long total = profile_count(ctx->profile, ctx->bb->name+1);
+  long long taken = profile_count(ctx->profile, profile_edge(ctx->bb->name+1, branch.true_bb->name+1));
+  if(total > 0 && taken >= 0) {
+    ostringstream message;
+    message << "branch to " << branch.true_bb->name+1 << " taken " << taken << " of " << total << " times ("
+            << fixed << setprecision(1) << 100.0 * taken / total << "%)";
+    remark(Remark::Analysis, "pgo", "BranchProbability", branch.true_bb, message.str());
+  }
 }
 
 void Visit(const koopa_raw_jump_t &jump) {
   // 执行一些其他的必要操作
   // ...
-  // 访问 jump 指令
-  cout<<"  j "<<jump.target->name+1<<endl;
+  // 访问 jump 指令, 目标紧跟在后面时不用跳转
+  if(jump.target != ctx->next_bb) ctx->out<<"  j "<<bb_label(jump.target)<<endl;
 }
 
 void Visit(const koopa_raw_call_t &call, const koopa_raw_value_t &value) {
+  // 跨过这次调用、放在调用者保存的寄存器中的值
+  const vector<string> *saves = nullptr;
+  auto it = ctx->call_saves.find(value);
+  if(it != ctx->call_saves.end()) saves = &it->second;
+  for(size_t i = 0; saves && i < saves->size(); i++) {
+    if(ctx->cost) ctx->cost->spills++;
+    stack_access("sw", (*saves)[i], ctx->save_slot[(*saves)[i]]);
+  }
   // 处理参数
   for (size_t i = 0; i < call.args.len; ++i) {
     auto arg = reinterpret_cast<koopa_raw_value_t>(call.args.buffer[i]);
     Visit(arg);
     if (i < 8) {
-      cout<<"  mv a"<<i<<", "<<nums.back()<<endl;
+      ctx->out<<"  mv a"<<i<<", "<<ctx->nums.back()<<endl;
       free_reg();
     }
     else {
-      string src_reg = nums.back();
-      string tmp_reg = get_reg();
-      std::cout << "  li " << tmp_reg << ", " << (i - 8) * 4 << std::endl;
-      std::cout << "  add " << tmp_reg << ", " << tmp_reg << ", sp" << std::endl;
-      std::cout << "  sw " << src_reg << ", 0(" << tmp_reg << ")" << std::endl;
-      reg_used[tmp_reg] = 0;
+      stack_access("sw", ctx->nums.back(), (i - 8) * 4);
       free_reg();
     }
   }
-  std::cout << "  call " << call.callee->name+1 << std::endl;
+  // 被调用者可能读写的全局变量: 调用前写回, 调用后 (恢复寄存器之后) 重新读入
+  const auto &effects = ctx->effects->at(call.callee);
+  for(auto &global : ctx->promoted)
+    if(ctx->promoted_dirty.count(global) && (effects.unknown || effects.ref.count(global) || effects.mod.count(global)))
+      global_access("sw", ctx->home[global], global);
+  ctx->out << "  call " << call.callee->name+1 << std::endl;
+  for(size_t i = 0; saves && i < saves->size(); i++) {
+    if(ctx->cost) ctx->cost->reloads++;
+    stack_access("lw", (*saves)[i], ctx->save_slot[(*saves)[i]]);
+  }
+  for(auto &global : ctx->promoted)
+    if(effects.unknown || effects.mod.count(global)) global_access("lw", ctx->home[global], global);
 
-  // 若有返回值则将 a0 中的结果存入栈
+  // 若有返回值则将 a0 中的结果存入栈或者它所在的寄存器
   if(value->ty->tag != KOOPA_RTT_UNIT) {
-    loc[value] = stack_frame_used;
-    stack_frame_used += 4;
     save_reg(value, "a0");
   }
 }
 
+// 全局变量的初始值, 数组按元素依次给出, 连续的 0 合并成一个 .zero
+static void global_initializer(const koopa_raw_value_t &init) {
+  int zeros = 0;
+  auto flush = [&zeros]() {
+    if(zeros) ctx->out << "  .zero " << zeros << std::endl;
+    zeros = 0;
+  };
+  // 按深度优先的顺序访问所有元素
+  vector<koopa_raw_value_t> stack = {init};
+  while(!stack.empty()) {
+    auto v = stack.back();
+    stack.pop_back();
+    if(v->kind.tag == KOOPA_RVT_ZERO_INIT || (v->kind.tag == KOOPA_RVT_INTEGER && v->kind.data.integer.value == 0))
+      zeros += type_size(v->ty);
+    else if(v->kind.tag == KOOPA_RVT_INTEGER) {
+      flush();
+      ctx->out << "  .word " << v->kind.data.integer.value << std::endl;
+    }
+    else if(v->kind.tag == KOOPA_RVT_AGGREGATE) {
+      const auto &elems = v->kind.data.aggregate.elems;
+      for(size_t i = elems.len; i > 0; i--) stack.push_back(reinterpret_cast<koopa_raw_value_t>(elems.buffer[i - 1]));
+    }
+    else throw("unsupported global initializer, kind.tag=" + to_string(v->kind.tag));
+  }
+  flush();
+}
+
 void Visit(const koopa_raw_global_alloc_t &global_alloc, const koopa_raw_value_t &value) {
-  std::cout << "  .data" << std::endl;
-  std::cout << "  .globl " << value->name+1 << std::endl;
-  std::cout << value->name+1 << ":" << std::endl;
-  if (global_alloc.init->kind.tag == KOOPA_RVT_ZERO_INIT) {
-    // 初始化为 0
-    std::cout << "  .zero 4" << std::endl;
-  }
-  else if (global_alloc.init->kind.tag == KOOPA_RVT_INTEGER) {
-    // 初始化为 int
-    std::cout << "  .word " << global_alloc.init->kind.data.integer.value << std::endl;
-  }
-  std::cout << std::endl;
+  ctx->out << "  .data" << std::endl;
+  ctx->out << "  .globl " << value->name+1 << std::endl;
+  ctx->out << value->name+1 << ":" << std::endl;
+  global_initializer(global_alloc.init);
+  ctx->out << std::endl;
 }
\ No newline at end of file
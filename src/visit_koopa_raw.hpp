@@ -1,6 +1,41 @@
 #pragma once
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
 #include "koopa.h"
 
+class ThreadPool;
+class Profile;
+class Remarks;
+struct FunctionCost;
+struct MachineModel;
+
+// 生成代码的选项
+struct BackendOptions {
+  ThreadPool *pool = nullptr; // 非空时各个函数在其中并行生成，输出与串行生成完全相同
+  std::vector<FunctionCost> *costs = nullptr; // 非空时按顺序追加每个有函数体的函数的代码质量统计 (--report=codegen)
+  bool instrument = false; // 在每个基本块和每个真分支上插入计数器, main 返回前输出计数 (-fprofile-generate)
+  const Profile *profile = nullptr; // 非空时按其中的计数决定代码的布局和代价 (-fprofile-use)
+  Remarks *remarks = nullptr; // 非空时把后端的优化报告记到其中
+  int memoize = 0; // 非 0 时给纯的递归函数加上这么多项 (2 的幂) 的记忆表 (-fauto-memoize)
+  const MachineModel *schedule = nullptr; // 非空时按该机器模型在每个基本块内调度指令 (-fschedule-insns)
+};
+
+// 为 raw program 生成 RISC-V 汇编，写到 out
+// 状态保存在每次调用各自的上下文中，可以在多个线程中同时调用
+void GenerateRiscv(const koopa_raw_program_t &program, std::ostream &out,
+                   const BackendOptions &opts = BackendOptions());
+
+// 与 GenerateRiscv 相同, 但分开给出全局变量部分和每个函数的汇编, 供增量编译拼接
+// funcs 中是每个有函数体的函数的 (函数名, 汇编), 按程序中的顺序
+// 依次输出 globals 和 funcs 中的汇编就得到 GenerateRiscv 的输出
+// 插桩的计数器表在所有函数之后, 不能这样拼接, 所以不支持 opts.instrument;
+// 记忆表要看整个程序中的函数是不是纯的, 也不支持 opts.memoize
+void GenerateRiscvFragments(const koopa_raw_program_t &program, std::string &globals,
+                            std::vector<std::pair<std::string, std::string>> &funcs,
+                            const BackendOptions &opts = BackendOptions());
+
 // 访问 raw program
 void Visit(const koopa_raw_program_t &program);
 
@@ -31,6 +66,12 @@ void Visit(const koopa_raw_load_t &load, const koopa_raw_value_t &value);
 // 访问 store 指令
 void Visit(const koopa_raw_store_t &store);
 
+// 访问 getptr 指令
+void Visit(const koopa_raw_get_ptr_t &get_ptr, const koopa_raw_value_t &value);
+
+// 访问 getelemptr 指令
+void Visit(const koopa_raw_get_elem_ptr_t &get_elem_ptr, const koopa_raw_value_t &value);
+
 // 访问 branch 指令
 void Visit(const koopa_raw_branch_t &branch);
 